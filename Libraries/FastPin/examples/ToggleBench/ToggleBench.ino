@@ -0,0 +1,96 @@
+//Prints how many CPU cycles a pin change takes with digitalWrite() and with FastPin, over Serial at 115200 baud. Each way is
+//timed over REPETITIONS pairs of changes with interrupts off and an empty loop of as many turns is taken off.
+//What to expect on an Uno: digitalWrite() about 60 cycles, OutputPin High() and Low() 2 (an sbi/cbi), Toggle() 1-2 (an out to
+//PINx), OutputPins::Write() about 4 (in, eor, andi, out). On an ESP32 digitalWrite() goes through the GPIO driver and FastPin is
+//a single store to out_w1ts/out_w1tc.
+#include <FastPin.h>
+
+#define REPETITIONS 100
+
+#if defined(ARDUINO_ARCH_AVR)
+#define BENCH_PIN 13  //PORTB, the LED
+#define OTHER_PIN 12  //PORTB too
+typedef uint16_t CycleWord;
+
+//Timer1 counting every cycle. The sketch has it to itself, nothing here uses the Servo library.
+static void StartCycleCounter()
+{
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+}
+
+static CycleWord CycleCount()
+{
+    return TCNT1;
+}
+#else
+#define BENCH_PIN 2   //The LED on most ESP32 boards
+#define OTHER_PIN 4
+typedef uint32_t CycleWord;
+
+static void StartCycleCounter()
+{
+}
+
+static CycleWord CycleCount()
+{
+    return ESP.getCycleCount();
+}
+#endif
+
+typedef OutputPin<BENCH_PIN> BenchPin;
+typedef OutputPins<BENCH_PIN, OTHER_PIN> BenchPins;
+
+//Cycles of REPETITIONS runs of statement. The empty asm keeps the compiler from dropping or merging the loop.
+#define MEASURE(cycles, statement)                                  \
+    do                                                              \
+    {                                                               \
+        noInterrupts();                                             \
+        CycleWord start = CycleCount();                             \
+        for(int i = 0; i < REPETITIONS; i++)                        \
+        {                                                           \
+            statement;                                              \
+            asm volatile("" ::: "memory");                          \
+        }                                                           \
+        cycles = (CycleWord)(CycleCount() - start);                 \
+        interrupts();                                               \
+    } while(0)
+
+static CycleWord emptyLoop;
+
+static void Report(const char *name, CycleWord cycles)
+{
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print((float)(cycles - emptyLoop) / (2 * REPETITIONS), 1);
+    Serial.println(" cycles a change");
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    BenchPins::Begin();
+    StartCycleCounter();
+}
+
+void loop()
+{
+    CycleWord cycles;
+
+    MEASURE(emptyLoop, (void)0);
+
+    MEASURE(cycles, (digitalWrite(BENCH_PIN, HIGH), digitalWrite(BENCH_PIN, LOW)));
+    Report("digitalWrite()", cycles);
+
+    MEASURE(cycles, (BenchPin::High(), BenchPin::Low()));
+    Report("OutputPin High() and Low()", cycles);
+
+    MEASURE(cycles, (BenchPin::Toggle(), BenchPin::Toggle()));
+    Report("OutputPin Toggle()", cycles);
+
+    MEASURE(cycles, (BenchPins::Write(PinBit<BENCH_PIN>()), BenchPins::Write(PinBit<OTHER_PIN>())));
+    Report("OutputPins Write() of 2 pins", cycles);
+
+    Serial.println();
+    delay(2000);
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <Arduino.h>
+
+//Pins as types. OutputPin<13>::High() compiles to a single store to the pin's port register, because the port and the bit are
+//worked out by the compiler instead of looked up in tables by digitalWrite() every call. OutputPins<...> and InputPins<...> change
+//or read several pins of one port in a single register access.
+//  AVR      Arduino Uno pin numbers, PORTB/C/D. High() and Low() are an sbi/cbi, Toggle() and OutputPins::Write() one write to
+//           PINx, which toggles the bits written as 1. Unlike digitalWrite() nothing turns off analogWrite() PWM on the pin.
+//  ESP32    The GPIO set and clear registers, a store each and never a read-modify-write. OutputPins::Write() sets the pins that
+//           go high first and clears the ones that go low right after, the two stores are a few ns apart.
+//  Else     digitalWrite() and digitalRead(), also on the AVR and the ESP32 when FASTPIN_PORTABLE is defined before including this.
+//A port is PORTB, PORTC or PORTD on the AVR and pins 0-31 or 32-39 on the ESP32. PinBit<pin>() is the bit of a pin in the word of
+//its port, to build the levels for OutputPins::Write() and to pick pins out of what InputPins::Read() returns.
+//Only the pins a call names change, even when an interrupt changes other pins of the same port halfway through it.
+//Begin() does pinMode() for the pins, as the setup() code that isnt in a hurry would.
+//To use it in a sketch, copy or link Libraries/FastPin into the libraries folder of the Arduino IDE. Needs nothing past C++11.
+
+#if !defined(FASTPIN_PORTABLE) && !defined(ARDUINO_ARCH_AVR) && !defined(ARDUINO_ARCH_ESP32)
+#define FASTPIN_PORTABLE
+#endif
+
+#if !defined(FASTPIN_PORTABLE) && defined(ARDUINO_ARCH_ESP32)
+#include "soc/gpio_struct.h"
+#endif
+
+#define FASTPIN_INLINE inline __attribute__((always_inline))
+
+namespace FastPinDetail
+{
+#if !defined(FASTPIN_PORTABLE) && defined(ARDUINO_ARCH_AVR)
+typedef uint8_t PortWord;
+
+//Uno: pins 0-7 are PORTD, 8-13 PORTB and 14-19 (A0-A5) PORTC.
+constexpr uint8_t PortOf(uint8_t pin) { return pin < 8 ? 'D' : (pin < 14 ? 'B' : 'C'); }
+constexpr PortWord BitOf(uint8_t pin) { return 1 << (pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14)); }
+constexpr bool IsOutput(uint8_t pin) { return pin < 20; }
+constexpr bool IsInput(uint8_t pin) { return pin < 20; }
+
+template<uint8_t Port> struct Registers;
+
+template<> struct Registers<'B'>
+{
+    static FASTPIN_INLINE auto Out() -> decltype((PORTB)) { return PORTB; }
+    static FASTPIN_INLINE auto In() -> decltype((PINB)) { return PINB; }
+};
+
+template<> struct Registers<'C'>
+{
+    static FASTPIN_INLINE auto Out() -> decltype((PORTC)) { return PORTC; }
+    static FASTPIN_INLINE auto In() -> decltype((PINC)) { return PINC; }
+};
+
+template<> struct Registers<'D'>
+{
+    static FASTPIN_INLINE auto Out() -> decltype((PORTD)) { return PORTD; }
+    static FASTPIN_INLINE auto In() -> decltype((PIND)) { return PIND; }
+};
+
+//A single bit is an sbi/cbi, which cant be torn. Several bits go through PINx: read what the port drives, write a 1 for every
+//bit that has to change. An interrupt changing another pin of the port in between doesnt get undone.
+template<uint8_t Port> struct PortOps
+{
+    typedef Registers<Port> R;
+
+    static FASTPIN_INLINE void Set(PortWord mask)
+    {
+        if((mask & (mask - 1)) == 0) R::Out() |= mask;
+        else R::In() = ~R::Out() & mask;
+    }
+
+    static FASTPIN_INLINE void Clear(PortWord mask)
+    {
+        if((mask & (mask - 1)) == 0) R::Out() &= (PortWord)~mask;
+        else R::In() = R::Out() & mask;
+    }
+
+    static FASTPIN_INLINE void Toggle(PortWord mask) { R::In() = mask; }
+    static FASTPIN_INLINE void Write(PortWord mask, PortWord levels) { R::In() = (R::Out() ^ levels) & mask; }
+    static FASTPIN_INLINE PortWord Read(PortWord mask) { return R::In() & mask; }
+};
+#else
+typedef uint32_t PortWord;
+
+constexpr uint8_t PortOf(uint8_t pin) { return pin / 32; }
+constexpr PortWord BitOf(uint8_t pin) { return (PortWord)1 << (pin % 32); }
+
+#if !defined(FASTPIN_PORTABLE)
+constexpr bool IsOutput(uint8_t pin) { return pin < 34; } //34-39 are inputs only
+constexpr bool IsInput(uint8_t pin) { return pin < 40; }
+
+template<uint8_t Port> struct Registers;
+
+template<> struct Registers<0>
+{
+    static FASTPIN_INLINE void Set(PortWord mask) { GPIO.out_w1ts = mask; }
+    static FASTPIN_INLINE void Clear(PortWord mask) { GPIO.out_w1tc = mask; }
+    static FASTPIN_INLINE PortWord Outputs(PortWord mask) { return GPIO.out & mask; }
+    static FASTPIN_INLINE PortWord Read(PortWord mask) { return GPIO.in & mask; }
+};
+
+template<> struct Registers<1>
+{
+    static FASTPIN_INLINE void Set(PortWord mask) { GPIO.out1_w1ts.val = mask; }
+    static FASTPIN_INLINE void Clear(PortWord mask) { GPIO.out1_w1tc.val = mask; }
+    static FASTPIN_INLINE PortWord Outputs(PortWord mask) { return GPIO.out1.data & mask; }
+    static FASTPIN_INLINE PortWord Read(PortWord mask) { return GPIO.in1.data & mask; }
+};
+#else
+constexpr bool IsOutput(uint8_t) { return true; }
+constexpr bool IsInput(uint8_t) { return true; }
+
+//One digitalWrite() or digitalRead() per pin of the mask.
+template<uint8_t Port> struct Registers
+{
+    static void Set(PortWord mask)
+    {
+        for(; mask != 0; mask &= mask - 1) digitalWrite(Port * 32 + __builtin_ctzl(mask), HIGH);
+    }
+
+    static void Clear(PortWord mask)
+    {
+        for(; mask != 0; mask &= mask - 1) digitalWrite(Port * 32 + __builtin_ctzl(mask), LOW);
+    }
+
+    static PortWord Read(PortWord mask)
+    {
+        PortWord levels = 0;
+        for(PortWord left = mask; left != 0; left &= left - 1)
+        {
+            if(digitalRead(Port * 32 + __builtin_ctzl(left))) levels |= left & -left;
+        }
+        return levels;
+    }
+
+    static PortWord Outputs(PortWord mask) { return Read(mask); }
+};
+#endif
+
+template<uint8_t Port> struct PortOps
+{
+    typedef Registers<Port> R;
+
+    static FASTPIN_INLINE void Set(PortWord mask) { R::Set(mask); }
+    static FASTPIN_INLINE void Clear(PortWord mask) { R::Clear(mask); }
+
+    static FASTPIN_INLINE void Toggle(PortWord mask)
+    {
+        PortWord high = R::Outputs(mask);
+        if(high != 0) R::Clear(high);
+        if(high != mask) R::Set(mask & ~high);
+    }
+
+    static FASTPIN_INLINE void Write(PortWord mask, PortWord levels)
+    {
+        if((levels & mask) != 0) R::Set(levels & mask);
+        if((~levels & mask) != 0) R::Clear(~levels & mask);
+    }
+
+    static FASTPIN_INLINE PortWord Read(PortWord mask) { return R::Read(mask); }
+};
+#endif
+
+//Port and bits of a list of pins.
+template<uint8_t First, uint8_t... Rest> struct PinList
+{
+    static constexpr uint8_t Port() { return PortOf(First); }
+    static constexpr PortWord Mask() { return BitOf(First) | PinList<Rest...>::Mask(); }
+    static constexpr bool OnePort() { return PortOf(First) == PinList<Rest...>::Port() && PinList<Rest...>::OnePort(); }
+    static constexpr bool Outputs() { return IsOutput(First) && PinList<Rest...>::Outputs(); }
+    static constexpr bool Inputs() { return IsInput(First) && PinList<Rest...>::Inputs(); }
+};
+
+template<uint8_t Pin> struct PinList<Pin>
+{
+    static constexpr uint8_t Port() { return PortOf(Pin); }
+    static constexpr PortWord Mask() { return BitOf(Pin); }
+    static constexpr bool OnePort() { return true; }
+    static constexpr bool Outputs() { return IsOutput(Pin); }
+    static constexpr bool Inputs() { return IsInput(Pin); }
+};
+
+template<uint8_t... Pins> FASTPIN_INLINE void SetModes(uint8_t mode)
+{
+    int modes[] = {(pinMode(Pins, mode), 0)...};
+    (void)modes;
+}
+}
+
+typedef FastPinDetail::PortWord PortWord;
+
+template<uint8_t Pin> constexpr PortWord PinBit()
+{
+    return FastPinDetail::BitOf(Pin);
+}
+
+template<uint8_t Pin> struct OutputPin
+{
+    static_assert(FastPinDetail::IsOutput(Pin), "not an output pin on this board");
+    typedef FastPinDetail::PortOps<FastPinDetail::PortOf(Pin)> Ops;
+
+    static void Begin() { pinMode(Pin, OUTPUT); }
+    static FASTPIN_INLINE void High() { Ops::Set(PinBit<Pin>()); }
+    static FASTPIN_INLINE void Low() { Ops::Clear(PinBit<Pin>()); }
+    static FASTPIN_INLINE void Write(bool high) { if(high) High(); else Low(); }
+    static FASTPIN_INLINE void Toggle() { Ops::Toggle(PinBit<Pin>()); }
+};
+
+template<uint8_t Pin> struct InputPin
+{
+    static_assert(FastPinDetail::IsInput(Pin), "not an input pin on this board");
+    typedef FastPinDetail::PortOps<FastPinDetail::PortOf(Pin)> Ops;
+
+    static void Begin(uint8_t mode = INPUT) { pinMode(Pin, mode); }
+    static FASTPIN_INLINE bool Read() { return Ops::Read(PinBit<Pin>()) != 0; }
+};
+
+//Pins of one port changed together. Write() takes a word with PinBit() set for every pin that goes high.
+template<uint8_t... Pins> struct OutputPins
+{
+    typedef FastPinDetail::PinList<Pins...> List;
+    static_assert(List::OnePort(), "the pins arent all on one port");
+    static_assert(List::Outputs(), "not an output pin on this board");
+    typedef FastPinDetail::PortOps<List::Port()> Ops;
+
+    static void Begin() { FastPinDetail::SetModes<Pins...>(OUTPUT); }
+    static FASTPIN_INLINE void High() { Ops::Set(List::Mask()); }
+    static FASTPIN_INLINE void Low() { Ops::Clear(List::Mask()); }
+    static FASTPIN_INLINE void Write(PortWord levels) { Ops::Write(List::Mask(), levels); }
+};
+
+//Pins of one port read together. Read() returns PinBit() set for every pin that is high.
+template<uint8_t... Pins> struct InputPins
+{
+    typedef FastPinDetail::PinList<Pins...> List;
+    static_assert(List::OnePort(), "the pins arent all on one port");
+    static_assert(List::Inputs(), "not an input pin on this board");
+    typedef FastPinDetail::PortOps<List::Port()> Ops;
+
+    static void Begin(uint8_t mode = INPUT) { FastPinDetail::SetModes<Pins...>(mode); }
+    static FASTPIN_INLINE PortWord Read() { return Ops::Read(List::Mask()); }
+};
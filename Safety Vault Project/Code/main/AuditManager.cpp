@@ -0,0 +1,328 @@
+#include "Arduino.h"
+#include "esp_partition.h"
+#include "rom/crc.h"
+#include "AuditManager.h"
+
+#define AUDIT_MAX_SECTORS 64
+#define AUDIT_ERASED_CHECK_SIZE 64
+
+//Starts every sector in use. The CRC is written last, so a sector with a valid one has a complete header, and the garbage an
+//erase the power went during leaves behind doesnt pass for one.
+struct AuditSectorHeader
+{
+  uint32_t sequence;    //Goes up by one for every new sector, the highest valid one is the current sector
+  uint32_t firstRecord; //Index of the sector's first record
+  uint32_t time;        //millis() when the sector was started, the first record's time is relative to it
+  uint16_t boot;
+  uint16_t unused;
+  uint32_t crc;
+};
+
+struct AuditSector
+{
+  bool valid;
+  AuditSectorHeader header;
+};
+
+const esp_partition_t *auditPartition = NULL;
+int auditSectorAmount = 0;
+AuditSector auditSectors[AUDIT_MAX_SECTORS];
+int auditCurrent = -1;                  //-1 until the first sector is started
+int auditNext = 0;                      //The sector started once the current one is full
+bool auditEraseNeeded = false;          //Whether auditNext still has to be erased
+int auditOffset = AUDIT_SECTOR_SIZE;    //Where the next record goes in the current sector
+uint32_t auditSequence = 0;
+uint32_t auditNextIndex = 0;
+uint16_t auditBoot = 0;
+uint32_t auditLastTime = 0;
+
+//The first byte is the event with its complement in the high nibble, always four bits set. Programming it from 0xFF clears the
+//other four, so one the power went during has more than four set and isnt taken for a record.
+int EncodeAuditRecord(uint8_t *out, AuditEvent event, uint32_t delta, uint16_t argument)
+{
+    int argumentBytes = argument == 0 ? 0 : argument <= 0xFF ? 1 : 2;
+    int length = 0;
+    out[length++] = (~event & 0x0F) << 4 | event;
+
+    //The delta and how many argument bytes follow, seven bits a byte, the high bit says another byte follows.
+    uint64_t value = (uint64_t)delta << 2 | argumentBytes;
+    do
+    {
+        out[length++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        value >>= 7;
+    } while(value != 0);
+
+    for(int i = 0; i < argumentBytes; i++) out[length++] = argument >> (8 * i);
+    return length;
+}
+
+int DecodeAuditRecord(const uint8_t *in, int length, AuditEvent *event, uint32_t *delta, uint16_t *argument)
+{
+    if(length < 2 || (in[0] >> 4 ^ 0x0F) != (in[0] & 0x0F) || (in[0] & 0x0F) >= AUDIT_EVENT_AMOUNT) return 0;
+    *event = (AuditEvent)(in[0] & 0x0F);
+
+    int position = 1;
+    uint64_t value = 0;
+    for(int shift = 0; ; shift += 7)
+    {
+        if(position >= length || shift > 28) return 0;
+        uint8_t data = in[position++];
+        value |= (uint64_t)(data & 0x7F) << shift;
+        if(!(data & 0x80)) break;
+    }
+    int argumentBytes = value & 0x03;
+    *delta = value >> 2;
+
+    if(argumentBytes > 2 || position + argumentBytes > length) return 0;
+    *argument = 0;
+    for(int i = 0; i < argumentBytes; i++) *argument |= in[position++] << (8 * i);
+    return position;
+}
+
+uint32_t AuditHeaderCrc(AuditSectorHeader *header)
+{
+    return crc32_le(0, (const uint8_t *)header, offsetof(AuditSectorHeader, crc));
+}
+
+uint32_t SectorAddress(int sector)
+{
+    return sector * AUDIT_SECTOR_SIZE;
+}
+
+bool IsErased(int sector, int offset)
+{
+    uint8_t data[AUDIT_ERASED_CHECK_SIZE];
+    for(; offset < AUDIT_SECTOR_SIZE; offset += sizeof(data))
+    {
+        int length = AUDIT_SECTOR_SIZE - offset < (int)sizeof(data) ? AUDIT_SECTOR_SIZE - offset : sizeof(data);
+        esp_partition_read(auditPartition, SectorAddress(sector) + offset, data, length);
+        for(int i = 0; i < length; i++)
+        {
+            if(data[i] != 0xFF) return false;
+        }
+    }
+    return true;
+}
+
+void StartReader(AuditReader *reader, int sector)
+{
+    AuditSectorHeader *header = &auditSectors[sector].header;
+    reader->index = header->firstRecord;
+    reader->sector = sector;
+    reader->sequence = header->sequence;
+    reader->offset = sizeof(AuditSectorHeader);
+    reader->boot = header->boot;
+    reader->time = header->time;
+}
+
+//Read the next record and move past it. False at the end of the log, or if the reader's sector was erased meanwhile.
+bool ReadAuditRecord(AuditReader *reader, AuditRecord *record)
+{
+    for(;;)
+    {
+        if(reader->sector < 0) return false;
+        AuditSector *sector = &auditSectors[reader->sector];
+        if(!sector->valid || sector->header.sequence != reader->sequence) return false;
+
+        //The current sector only up to the last record written, it may be written to while we read.
+        int end = reader->sector == auditCurrent ? auditOffset : AUDIT_SECTOR_SIZE;
+        int length = end - reader->offset < AUDIT_RECORD_MAX_SIZE ? end - reader->offset : AUDIT_RECORD_MAX_SIZE;
+        uint8_t data[AUDIT_RECORD_MAX_SIZE];
+        uint32_t delta;
+        int used = 0;
+        if(length > 0)
+        {
+            esp_partition_read(auditPartition, SectorAddress(reader->sector) + reader->offset, data, length);
+            used = DecodeAuditRecord(data, length, &record->event, &delta, &record->argument);
+        }
+
+        if(used > 0)
+        {
+            reader->offset += used;
+            reader->time = record->event == AuditBoot ? delta : reader->time + delta;
+            if(record->event == AuditBoot) reader->boot = record->argument;
+            record->index = reader->index++;
+            record->boot = reader->boot;
+            record->time = reader->time;
+            return true;
+        }
+
+        //End of the sector, go on with the one started after it if there is one.
+        if(reader->sector == auditCurrent) return false;
+        int next = (reader->sector + 1) % auditSectorAmount;
+        if(!auditSectors[next].valid || auditSectors[next].header.sequence != reader->sequence + 1) return false;
+        StartReader(reader, next);
+    }
+}
+
+//Count the records of the current sector to find where the next one goes, and the boot and time it is relative to.
+void ScanCurrentSector()
+{
+    AuditReader reader;
+    AuditRecord record;
+    StartReader(&reader, auditCurrent);
+    auditOffset = AUDIT_SECTOR_SIZE; //So ReadAuditRecord() reads up to the end of the sector
+    while(ReadAuditRecord(&reader, &record));
+
+    auditOffset = reader.offset;
+    auditNextIndex = reader.index;
+    auditBoot = reader.boot;
+    auditLastTime = reader.time;
+
+    //Bytes after the last record mean the power went halfway through writing one. Start clean in a new sector.
+    if(!IsErased(auditCurrent, auditOffset)) auditOffset = AUDIT_SECTOR_SIZE;
+}
+
+bool SetupAudit()
+{
+    auditPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, AUDIT_PARTITION_LABEL);
+    if(auditPartition == NULL)
+    {
+        Serial.println("Audit partition not found");
+        return false;
+    }
+    auditSectorAmount = auditPartition->size / AUDIT_SECTOR_SIZE;
+    if(auditSectorAmount > AUDIT_MAX_SECTORS) auditSectorAmount = AUDIT_MAX_SECTORS;
+
+    //The newest valid sector is the current one.
+    auditCurrent = -1;
+    for(int sector = 0; sector < auditSectorAmount; sector++)
+    {
+        AuditSector *entry = &auditSectors[sector];
+        esp_partition_read(auditPartition, SectorAddress(sector), &entry->header, sizeof(AuditSectorHeader));
+        entry->valid = entry->header.crc == AuditHeaderCrc(&entry->header);
+        if(entry->valid && (auditCurrent < 0 || entry->header.sequence > auditSequence))
+        {
+            auditCurrent = sector;
+            auditSequence = entry->header.sequence;
+        }
+    }
+
+    if(auditCurrent >= 0) ScanCurrentSector();
+    auditNext = auditCurrent < 0 ? 0 : (auditCurrent + 1) % auditSectorAmount;
+    auditEraseNeeded = !IsErased(auditNext, 0);
+
+    auditBoot++;
+    LogAuditEvent(AuditBoot, auditBoot);
+    return true;
+}
+
+//Move on to the next sector. It is erased already unless HandleAuditLog() didnt get to it yet.
+void StartAuditSector(uint32_t now)
+{
+    if(auditEraseNeeded) HandleAuditLog();
+
+    AuditSector *sector = &auditSectors[auditNext];
+    sector->header.sequence = ++auditSequence;
+    sector->header.firstRecord = auditNextIndex;
+    sector->header.time = now;
+    sector->header.boot = auditBoot;
+    sector->header.unused = 0xFFFF;
+    sector->header.crc = AuditHeaderCrc(&sector->header);
+    esp_partition_write(auditPartition, SectorAddress(auditNext), &sector->header, offsetof(AuditSectorHeader, crc));
+    esp_partition_write(auditPartition, SectorAddress(auditNext) + offsetof(AuditSectorHeader, crc), &sector->header.crc, sizeof(sector->header.crc));
+    sector->valid = true;
+
+    auditCurrent = auditNext;
+    auditNext = (auditCurrent + 1) % auditSectorAmount;
+    auditEraseNeeded = true;
+    auditOffset = sizeof(AuditSectorHeader);
+    auditLastTime = now;
+}
+
+void LogAuditEvent(AuditEvent event, uint16_t argument)
+{
+    if(auditPartition == NULL) return;
+
+    uint32_t now = millis();
+    if(auditCurrent < 0 || auditOffset + AUDIT_RECORD_MAX_SIZE > AUDIT_SECTOR_SIZE) StartAuditSector(now);
+
+    uint8_t record[AUDIT_RECORD_MAX_SIZE];
+    int length = EncodeAuditRecord(record, event, event == AuditBoot ? now : now - auditLastTime, argument);
+
+    //The first byte last, until it is written the record isnt there.
+    uint32_t address = SectorAddress(auditCurrent) + auditOffset;
+    esp_partition_write(auditPartition, address + 1, record + 1, length - 1);
+    esp_partition_write(auditPartition, address, record, 1);
+
+    auditOffset += length;
+    auditLastTime = now;
+    auditNextIndex++;
+}
+
+void HandleAuditLog()
+{
+    if(!auditEraseNeeded) return;
+
+    //The oldest records go now. Until the log has gone round once the sector is still erased from the factory, reading it
+    //takes 0.1ms where erasing takes 45.
+    auditSectors[auditNext].valid = false;
+    if(!IsErased(auditNext, 0)) esp_partition_erase_range(auditPartition, SectorAddress(auditNext), AUDIT_SECTOR_SIZE);
+    auditEraseNeeded = false;
+}
+
+uint32_t FirstAuditRecord()
+{
+    for(int i = 1; i <= auditSectorAmount; i++)
+    {
+        AuditSector *sector = &auditSectors[(auditCurrent + i) % auditSectorAmount];
+        if(sector->valid) return sector->header.firstRecord;
+    }
+    return auditNextIndex;
+}
+
+uint32_t AuditRecordAmount()
+{
+    return auditNextIndex;
+}
+
+void OpenAuditReader(AuditReader *reader, uint32_t first)
+{
+    reader->sector = -1;
+    if(auditCurrent < 0) return;
+
+    //The last sector, oldest to newest, that starts at or before the record we want.
+    for(int i = 1; i <= auditSectorAmount; i++)
+    {
+        int sector = (auditCurrent + i) % auditSectorAmount;
+        if(auditSectors[sector].valid && (reader->sector < 0 || auditSectors[sector].header.firstRecord <= first)) StartReader(reader, sector);
+    }
+
+    AuditRecord record;
+    while(reader->index < first && ReadAuditRecord(reader, &record));
+}
+
+int ReadAuditChunk(AuditReader *reader, uint8_t *chunk, int size, int maxRecords, int *records)
+{
+    *records = 0;
+    int length = AUDIT_CHUNK_HEADER_SIZE;
+    uint32_t lastTime = 0;
+
+    for(;;)
+    {
+        AuditReader before = *reader;
+        AuditRecord record;
+        if(*records >= maxRecords || !ReadAuditRecord(reader, &record)) break;
+
+        if(*records == 0)
+        {
+            for(int i = 0; i < 4; i++) chunk[i] = record.index >> (8 * i);
+            for(int i = 0; i < 2; i++) chunk[4 + i] = record.boot >> (8 * i);
+            for(int i = 0; i < 4; i++) chunk[6 + i] = record.time >> (8 * i);
+            lastTime = record.time;
+        }
+
+        uint8_t encoded[AUDIT_RECORD_MAX_SIZE];
+        int encodedLength = EncodeAuditRecord(encoded, record.event, record.event == AuditBoot ? record.time : record.time - lastTime, record.argument);
+        if(length + encodedLength > size)
+        {
+            *reader = before; //Goes in the next chunk
+            break;
+        }
+        memcpy(chunk + length, encoded, encodedLength);
+        length += encodedLength;
+        lastTime = record.time;
+        (*records)++;
+    }
+    return *records > 0 ? length : 0;
+}
@@ -0,0 +1,62 @@
+//Append-only log of what happened to the vault, in the "audit" flash partition (see partitions.csv). Every sector starts with a
+//header holding the index, boot and time of its first record, and a record after that is only a packed event code, the
+//milliseconds since the record before it and an argument of 0-2 bytes: 2 to 8 bytes, usually 4. A record is written payload
+//first and its first byte last, so one the power went during never shows up. Logging an event programs at most
+//AUDIT_RECORD_MAX_SIZE bytes. The sector after the current one is kept erased, by HandleAuditLog() outside of the event, and the
+//oldest records go when it is.
+//There is no clock that survives a reboot, so times are milliseconds since the boot the record was logged in, and every boot
+//logs an AuditBoot record with its number.
+#define AUDIT_PARTITION_LABEL "audit"
+#define AUDIT_SECTOR_SIZE 4096
+#define AUDIT_RECORD_MAX_SIZE 8   //Event, up to 5 bytes of time delta and 2 of argument
+#define AUDIT_CHUNK_HEADER_SIZE 10
+
+enum AuditEvent
+{
+  AuditBoot,              //Argument: number of the boot
+  AuditUnlocked,          //User whose code opened the vault, ADMIN_USER or ONE_TIME_USER
+  AuditWrongCode,         //Wrong tries in a row
+  AuditLockdown,          //Seconds
+  AuditLockdownEnded,
+  AuditLocked,
+  AuditDoorOpened,
+  AuditDoorClosed,
+  AuditAdminCodeChanged,
+  AuditUserCodeSet,       //User
+  AuditUserCodeRemoved,   //User
+  AuditOneTimeCodeAdded,  //Minutes it is valid for
+  AUDIT_EVENT_AMOUNT
+};
+
+struct AuditRecord
+{
+  uint32_t index;         //Counts up from the first record ever logged
+  uint16_t boot;
+  uint32_t time;          //millis() of that boot
+  AuditEvent event;
+  uint16_t argument;
+};
+
+//Where an export is in the log.
+struct AuditReader
+{
+  uint32_t index;         //Next record to read
+  int sector;
+  uint32_t sequence;      //Of the sector, to notice it was erased
+  int offset;
+  uint16_t boot;
+  uint32_t time;
+};
+
+bool SetupAudit(); //Call after SetupStorage(). Returns false if the partition cant be found.
+void LogAuditEvent(AuditEvent event, uint16_t argument); //From loop() only
+void HandleAuditLog(); //Erases the next sector when it has to be, call it from loop() after handling everything else.
+uint32_t FirstAuditRecord(); //Index of the oldest record still in the log
+uint32_t AuditRecordAmount(); //Index the next record will get
+
+//Exports read the log as chunks: the index, boot and time of the first record, each 4, 2 and 4 bytes little endian, then the
+//records packed like in flash, every time relative to the record before, an AuditBoot's to the start of its boot.
+void OpenAuditReader(AuditReader *reader, uint32_t first); //Starts at the oldest record if first is older.
+int ReadAuditChunk(AuditReader *reader, uint8_t *chunk, int size, int maxRecords, int *records); //Returns the bytes used, 0 at the end.
+int EncodeAuditRecord(uint8_t *out, AuditEvent event, uint32_t delta, uint16_t argument); //Returns the length.
+int DecodeAuditRecord(const uint8_t *in, int length, AuditEvent *event, uint32_t *delta, uint16_t *argument); //0 if there is no record.
@@ -1,97 +1,315 @@
-#include "BluetoothSerial.h"
-#include "DisplayDrivers.h"
-#include "PasswordManager.h"
-#include "BluetoothHandler.h"
-#include "Time.h"
-
-BluetoothSerial ESP_BT;
-bool (*ReceiveInputCallback)(int code[DIGIT_AMOUNT]);
-void (*ReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]);
-bool bluetoothInitialized = false;
-
-void InitializeBluetooth(bool (*OnReceiveInputCallback)(int code[DIGIT_AMOUNT]), void (*OnReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]))
-{
-    //Assign callback methods to their corresponding variables.
-    ReceiveInputCallback = OnReceiveInputCallback;
-    ReceiveNewPasswordCallback = OnReceiveNewPasswordCallback;
-
-    //Setup bluetooth so the user's device can pair with it.
-    if(!ESP_BT.begin("UnicornVault"))
-    {
-        Serial.println("An error occurred initializing Bluetooth"); //Setting up bluetooth failed, show in serial monitor for debugging purposes
-    }
-    else
-    {
-        bluetoothInitialized = true; //Setting up bluetooth went fine. Set a flag to true so we know we can safely execute our bluetooth scanning methods.
-        Serial.println("Bluetooth initialized");
-    }
-}
-
-//Credit to Stackoverflow, I'd have done it myself but I was pressed for time and this is a beautiful solution.
-//A method for splitting a string into two or more strings based on the deliminator
-String SplitString(String input, char delim, int index)
-{
-    int found = 0;
-    int strIndex[] = { 0, -1 };
-    int maxIndex = input.length() - 1;
-
-    for (int i = 0; i <= maxIndex && found <= index; i++) {
-        if (input.charAt(i) == delim || i == maxIndex) {
-            found++;
-            strIndex[0] = strIndex[1] + 1;
-            strIndex[1] = (i == maxIndex) ? i+1 : i;
-        }
-    }
-    return found > index ? input.substring(strIndex[0], strIndex[1]) : "";
-}
-
-void HandleBluetooth()
-{
-    if(!bluetoothInitialized) return; //Break out of handling bluetooth if we havent been able to initialize.
-  
-    if (ESP_BT.available()) //Check if we receive anything from Bluetooth
-    { 
-        //Read the received data as a string (The app only sends string data)
-        String incomingMessage = ESP_BT.readString();
-        Serial.print("Received:");
-        Serial.println(incomingMessage);
-
-        //Check if the first letter of the string is an E. This signifies we want to "Enter" a value to open the vault.
-        if (incomingMessage[0] == 'E')
-        {
-            Serial.println("Entering Code");
-
-            //Split the string on the | deliminator to get the digits by themselves.
-            String codeValueString = SplitString(incomingMessage, '|', 1);
-            int codeValue = codeValueString.toInt(); //Convert the string into an int.
-
-            //Seperate the digits and write them into a temporary array.
-            int code[DIGIT_AMOUNT];
-            code[0] = codeValue / 1000 % 10;
-            code[1] = codeValue / 100 % 10;
-            code[2] = codeValue / 10 % 10;
-            code[3] = codeValue  % 10;
-
-            //Send back a 1 or 0 depending on if the code was correct.
-            ESP_BT.println(ReceiveInputCallback(code));
-        } 
-        if (incomingMessage[0] == 'C') //The C stands for "Changing"
-        {
-            Serial.println("Changing Code");
-            
-            //Split the string on the | deliminator to get the digits by themselves.
-            String codeValueString = SplitString(incomingMessage, '|', 1);
-            int codeValue = codeValueString.toInt(); //Convert the string into an int.
-
-            //Seperate the digits and write them into a temporary array.
-            int code[DIGIT_AMOUNT];
-            code[0] = codeValue / 1000 % 10;
-            code[1] = codeValue / 100 % 10;
-            code[2] = codeValue / 10 % 10;
-            code[3] = codeValue  % 10;
-
-            //Change the currently stored password to the one we just received.
-            ReceiveNewPasswordCallback(code);
-        } 
-    }
-}
+#include "BluetoothSerial.h"
+#include "DisplayDrivers.h"
+#include "PasswordManager.h"
+#include "CredentialManager.h"
+#include "AuditManager.h"
+#include "BluetoothHandler.h"
+#include "TraceManager.h"
+#include "Time.h"
+
+BluetoothSerial ESP_BT;
+bool (*ReceiveInputCallback)(int code[DIGIT_AMOUNT]);
+bool (*ReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]);
+bool (*AdminCodeCallback)(int code[DIGIT_AMOUNT]);
+void (*StatusRequestCallback)(VaultStatus *status);
+void (*DataReceivedCallback)();
+bool bluetoothInitialized = false;
+
+//The message we are receiving. Bytes are added as they come in until the end of the line.
+char frame[BLUETOOTH_FRAME_SIZE];
+int frameLength = 0;
+bool frameOverflowed = false;
+
+//The audit log export going on, see the L command.
+bool exporting = false;
+AuditReader exportReader;
+int exportRecordsLeft = 0;
+int exportNextChunk = 0;
+int exportAcknowledged = -1;
+
+//Runs in the Bluetooth stack's task for everything that happens on the link.
+void BluetoothEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
+    if(event == ESP_SPP_DATA_IND_EVT && DataReceivedCallback != NULL) DataReceivedCallback();
+}
+
+void InitializeBluetooth(bool (*OnReceiveInputCallback)(int code[DIGIT_AMOUNT]), bool (*OnReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]), bool (*OnAdminCodeCallback)(int code[DIGIT_AMOUNT]), void (*OnStatusRequestCallback)(VaultStatus *status), void (*OnDataReceivedCallback)())
+{
+    //Assign callback methods to their corresponding variables.
+    ReceiveInputCallback = OnReceiveInputCallback;
+    ReceiveNewPasswordCallback = OnReceiveNewPasswordCallback;
+    AdminCodeCallback = OnAdminCodeCallback;
+    StatusRequestCallback = OnStatusRequestCallback;
+    DataReceivedCallback = OnDataReceivedCallback;
+    ESP_BT.register_callback(BluetoothEvent);
+
+    //Setup bluetooth so the user's device can pair with it.
+    if(!ESP_BT.begin("UnicornVault"))
+    {
+        Serial.println("An error occurred initializing Bluetooth"); //Setting up bluetooth failed, show in serial monitor for debugging purposes
+    }
+    else
+    {
+        bluetoothInitialized = true; //Setting up bluetooth went fine. Set a flag to true so we know we can safely execute our bluetooth scanning methods.
+        Serial.println("Bluetooth initialized");
+    }
+}
+
+byte Checksum(const char *text, int length)
+{
+    byte checksum = 0;
+    for(int i = 0; i < length; i++) checksum ^= text[i];
+    return checksum;
+}
+
+int HexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+//Send a message with its checksum and line ending in one write.
+void SendFrame(const char *text)
+{
+    const char hexDigits[] = "0123456789ABCDEF";
+    char message[BLUETOOTH_SEND_SIZE + 4];
+    int length = 0;
+
+    while(*text && length < BLUETOOTH_SEND_SIZE) message[length++] = *text++;
+    byte checksum = Checksum(message, length);
+    message[length++] = '*';
+    message[length++] = hexDigits[checksum >> 4];
+    message[length++] = hexDigits[checksum & 0x0F];
+    message[length++] = '\n';
+
+    ESP_BT.write((const uint8_t *)message, length);
+}
+
+//Read a '|' and the number after it, minDigits to maxDigits long, into value and move *text past it.
+bool ParseNumber(const char **text, const char *end, int minDigits, int maxDigits, int *value)
+{
+    const char *c = *text;
+    if(c >= end || *c++ != '|') return false;
+
+    int digits = 0;
+    *value = 0;
+    for(; c < end && *c >= '0' && *c <= '9' && digits < maxDigits; c++, digits++) *value = *value * 10 + *c - '0';
+    if(digits < minDigits) return false;
+
+    *text = c;
+    return true;
+}
+
+//Read a "|dddd" field into a code and move *text past it.
+bool ParseCodeField(const char **text, const char *end, int code[DIGIT_AMOUNT])
+{
+    const char *c = *text;
+    if(end - c < 1 + DIGIT_AMOUNT || *c++ != '|') return false;
+
+    for(int i = 0; i < DIGIT_AMOUNT; i++, c++)
+    {
+        if(*c < '0' || *c > '9') return false;
+        code[i] = *c - '0';
+    }
+    *text = c;
+    return true;
+}
+
+//Read the "|dddd" part of an E or C message into a code. The message has to end right after the last digit.
+bool ParseCode(const char *text, int length, int code[DIGIT_AMOUNT])
+{
+    const char *end = text + length;
+    return ParseCodeField(&text, end, code) && text == end;
+}
+
+//Carry out a C, U, O or D message, the text after the command letter. Returns false if it isnt understood, otherwise done tells
+//whether it was carried out.
+bool HandleCredentialCommand(char command, const char *text, int length, bool *done)
+{
+    const char *end = text + length;
+    int adminCode[DIGIT_AMOUNT];
+    int code[DIGIT_AMOUNT];
+    int user = 0;
+    int minutes = 0;
+
+    if(!ParseCodeField(&text, end, adminCode)) return false;
+    if(command == 'C' && !ParseCodeField(&text, end, code)) return false;
+    if(command == 'U' && !(ParseNumber(&text, end, 1, 3, &user) && ParseCodeField(&text, end, code))) return false;
+    if(command == 'O' && !(ParseCodeField(&text, end, code) && ParseNumber(&text, end, 1, 4, &minutes))) return false;
+    if(command == 'D' && !ParseNumber(&text, end, 1, 3, &user)) return false;
+    if(text != end) return false;
+
+    if(!AdminCodeCallback(adminCode)) *done = false;
+    else if(command == 'C') *done = ReceiveNewPasswordCallback(code);
+    else if(command == 'U') *done = AddCredential(code, CredentialUser, user, 0);
+    else if(command == 'O') *done = AddCredential(code, CredentialOneTime, ONE_TIME_USER, minutes);
+    else *done = RemoveCredentials(CredentialUser, user) > 0;
+
+    if(*done && command == 'U') LogAuditEvent(AuditUserCodeSet, user);
+    if(*done && command == 'O') LogAuditEvent(AuditOneTimeCodeAdded, minutes);
+    if(*done && command == 'D') LogAuditEvent(AuditUserCodeRemoved, user);
+    return true;
+}
+
+//Start exporting the records asked for by an L message.
+void StartExport(int first, int amount)
+{
+    OpenAuditReader(&exportReader, first);
+    int available = AuditRecordAmount() - exportReader.index;
+    exportRecordsLeft = amount < available ? amount : available;
+    exportNextChunk = 0;
+    exportAcknowledged = -1;
+    exporting = true;
+
+    char reply[BLUETOOTH_FRAME_SIZE];
+    snprintf(reply, sizeof(reply), "L|%lu|%d", (unsigned long)exportReader.index, exportRecordsLeft);
+    SendFrame(reply);
+}
+
+void EncodeBase64(const uint8_t *data, int length, char *out)
+{
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for(int i = 0; i < length; i += 3)
+    {
+        uint32_t group = data[i] << 16 | (i + 1 < length ? data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+        *out++ = alphabet[group >> 18 & 0x3F];
+        *out++ = alphabet[group >> 12 & 0x3F];
+        *out++ = i + 1 < length ? alphabet[group >> 6 & 0x3F] : '=';
+        *out++ = i + 2 < length ? alphabet[group & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+bool ExportWindowOpen()
+{
+    return exporting && exportNextChunk - exportAcknowledged <= BLUETOOTH_EXPORT_WINDOW;
+}
+
+//Send export chunks until the window is full. Each one is a single write, so a chunk never waits on the flash halfway.
+void SendExportChunks()
+{
+    while(ExportWindowOpen())
+    {
+        uint8_t chunk[BLUETOOTH_CHUNK_SIZE];
+        int records = 0;
+        int length = exportRecordsLeft > 0 ? ReadAuditChunk(&exportReader, chunk, sizeof(chunk), exportRecordsLeft, &records) : 0;
+
+        char message[BLUETOOTH_SEND_SIZE];
+        int prefix = snprintf(message, sizeof(message), "B|%d|", exportNextChunk);
+        EncodeBase64(chunk, length, message + prefix);
+        SendFrame(message);
+
+        exportNextChunk++;
+        exportRecordsLeft -= records;
+        if(length == 0) exporting = false; //That was the empty chunk at the end
+    }
+}
+
+//Check a complete message and carry it out.
+void HandleFrame()
+{
+    //Split off the "*hh" checksum at the end and make sure it matches.
+    if(frameLength < 4 || frame[frameLength - 3] != '*')
+    {
+        SendFrame("?");
+        return;
+    }
+    int high = HexValue(frame[frameLength - 2]);
+    int low = HexValue(frame[frameLength - 1]);
+    int length = frameLength - 3;
+    if(high < 0 || low < 0 || Checksum(frame, length) != (high << 4 | low))
+    {
+        SendFrame("?");
+        return;
+    }
+
+    int code[DIGIT_AMOUNT];
+    bool done;
+    int first, amount;
+    const char *text = frame + 1;
+    const char *end = frame + length;
+    char command = frame[0];
+    if(command == 'E' && ParseCode(frame + 1, length - 1, code)) //E stands for "Enter", trying a code to open the vault.
+    {
+        SendFrame(ReceiveInputCallback(code) ? "E|1" : "E|0");
+    }
+    else if(command == 'C' && !HasAdminCode() && ParseCode(frame + 1, length - 1, code)) //C stands for "Changing" the stored code.
+    {
+        //Without an admin code yet there is none to ask for, so this sets the first one. Not during a lockdown though.
+        VaultStatus status;
+        StatusRequestCallback(&status);
+        SendFrame(!status.inputLocked && ReceiveNewPasswordCallback(code) ? "C|1" : "C|0");
+    }
+    else if((command == 'C' || command == 'U' || command == 'O' || command == 'D') && HandleCredentialCommand(command, frame + 1, length - 1, &done))
+    {
+        char reply[] = {command, '|', done ? '1' : '0', '\0'};
+        SendFrame(reply);
+    }
+    else if(command == 'L' && ParseNumber(&text, end, 1, 9, &first) && ParseNumber(&text, end, 1, 5, &amount) && text == end)
+    {
+        StartExport(first, amount);
+    }
+    else if(command == 'A' && ParseNumber(&text, end, 1, 5, &amount) && text == end)
+    {
+        if(exporting && amount > exportAcknowledged && amount < exportNextChunk) exportAcknowledged = amount;
+    }
+    else if(command == 'S' && length == 1)
+    {
+        VaultStatus status;
+        StatusRequestCallback(&status);
+
+        char reply[BLUETOOTH_FRAME_SIZE];
+        snprintf(reply, sizeof(reply), "S|%d|%d|%d", status.doorUnlocked, status.inputLocked, status.incorrectTries);
+        SendFrame(reply);
+    }
+    else
+    {
+        SendFrame("?");
+    }
+}
+
+//Take in whatever has arrived without waiting for more, and carry out every message that is complete.
+void HandleBluetooth()
+{
+    if(!bluetoothInitialized) return; //Break out of handling bluetooth if we havent been able to initialize.
+
+    int available = ESP_BT.available();
+    if(available > BLUETOOTH_BYTES_PER_UPDATE) available = BLUETOOTH_BYTES_PER_UPDATE; //The rest waits for the next loop.
+
+    for(int i = 0; i < available; i++)
+    {
+        char c = ESP_BT.read();
+        if(c == '\r') continue;
+
+        if(c == '\n') //End of a message
+        {
+            if(frameOverflowed) SendFrame("?");
+            else if(frameLength > 0)
+            {
+                TRACE_BEGIN(TraceBluetoothFrame, frame[0]);
+                HandleFrame();
+                TRACE_END(TraceBluetoothFrame, frame[0]);
+            }
+
+            frameLength = 0;
+            frameOverflowed = false;
+        }
+        else if(frameLength < BLUETOOTH_FRAME_SIZE)
+        {
+            frame[frameLength++] = c;
+        }
+        else
+        {
+            frameOverflowed = true; //Too long to be anything we know, skip to the end of the line.
+        }
+    }
+
+    SendExportChunks();
+}
+
+bool BluetoothDataWaiting()
+{
+    return bluetoothInitialized && (ESP_BT.available() > 0 || ExportWindowOpen());
+}
@@ -1,3 +1,35 @@
-void InitializeBluetooth(bool (*OnReceiveInputCallback)(int code[DIGIT_AMOUNT]), void (*OnReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]));
-void HandleBluetooth();
-bool ProcessIncomingSerial(String *buf);
+//Messages are lines: a command letter, its fields after a '|', then '*' and a two digit hex checksum, the XOR of every byte before
+//the '*'. For example "E|1234*59". Any number of messages can be sent in one go and each one is answered the same way, in order.
+//  E|dddd            Try a code. Answered with E|1 or E|0.
+//  S                 Vault status. Answered with S|<door unlocked 0/1>|<input locked 0/1>|<incorrect tries>.
+//The commands that manage the codes start with the admin code aaaa. A wrong one counts as a wrong try, like E, and during a
+//lockdown they are all refused.
+//  C|aaaa|dddd       Change the admin code. Answered with C|1, or C|0 if a user already has that code. While the vault has no
+//                    admin code yet, C|dddd sets the first one.
+//  U|aaaa|nnn|dddd   Give user nnn (1-999) the code dddd in place of theirs. Answered with U|1 or U|0.
+//  O|aaaa|dddd|mmmm  Add a code that opens the vault once, within mmmm minutes (1-1440). Answered with O|1 or O|0.
+//  D|aaaa|nnn        Remove the code of user nnn. Answered with D|1, or D|0 if they had none.
+//The audit log (see AuditManager.h) is exported in chunks, at most BLUETOOTH_EXPORT_WINDOW of them waiting for an acknowledgement.
+//  L|iii|nnn         Export up to nnn records from index iii on. Answered with L|<first index>|<records>, then the chunks
+//                    B|<chunk number from 0>|<chunk in base64>, and an empty chunk after the last one. It ends early if
+//                    the records are overwritten meanwhile. Another L starts over.
+//  A|ccc             Every chunk up to ccc came in. Not answered.
+//Anything too long, with a bad checksum or that isnt understood is answered with ?.
+#define BLUETOOTH_FRAME_SIZE 32         //Longest message we accept, including the checksum
+#define BLUETOOTH_SEND_SIZE 160         //Longest message we send, without the checksum
+#define BLUETOOTH_CHUNK_SIZE 96         //Audit log bytes in an export chunk, 128 in base64
+#define BLUETOOTH_EXPORT_WINDOW 16      //Export chunks sent ahead of the acknowledgements, about 2KB
+#define BLUETOOTH_BYTES_PER_UPDATE 64   //Most bytes a single HandleBluetooth() takes in, so a flood cant stall loop()
+
+struct VaultStatus
+{
+  bool doorUnlocked;
+  bool inputLocked;
+  int incorrectTries;
+};
+
+//OnAdminCodeCallback checks the admin code of C, U, O and D. OnDataReceivedCallback runs in the Bluetooth stack's task whenever data
+//comes in, NULL for none.
+void InitializeBluetooth(bool (*OnReceiveInputCallback)(int code[DIGIT_AMOUNT]), bool (*OnReceiveNewPasswordCallback)(int code[DIGIT_AMOUNT]), bool (*OnAdminCodeCallback)(int code[DIGIT_AMOUNT]), void (*OnStatusRequestCallback)(VaultStatus *status), void (*OnDataReceivedCallback)());
+void HandleBluetooth();
+bool BluetoothDataWaiting(); //True when there is more for HandleBluetooth() than it takes in one go, or export chunks it can send
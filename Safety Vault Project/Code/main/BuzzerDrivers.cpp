@@ -0,0 +1,55 @@
+#include "Arduino.h"
+#include "BuzzerDrivers.h"
+
+QueueHandle_t toneQueue;
+volatile bool tonePlaying = false;
+
+//Plays the queued tone sequences one after another. Only this task touches the buzzer's LEDC channel.
+void BuzzerTask(void *parameter)
+{
+    ToneType tone;
+    for(;;)
+    {
+        xQueueReceive(toneQueue, &tone, portMAX_DELAY);
+        tonePlaying = true;
+
+        //Time every step from the start of the sequence so the steps dont drift.
+        TickType_t wakeTime = xTaskGetTickCount();
+        for(const ToneStep *step = TONES[tone]; step->duration > 0; step++)
+        {
+            ledcWriteTone(BUZZER_CHANNEL, step->frequency);
+            vTaskDelayUntil(&wakeTime, step->duration / portTICK_PERIOD_MS);
+        }
+        ledcWriteTone(BUZZER_CHANNEL, 0);
+        tonePlaying = false;
+    }
+}
+
+void SetupBuzzer()
+{
+    //Drive the buzzer from an LEDC channel so the tone keeps going without the CPU.
+    ledcSetup(BUZZER_CHANNEL, 1000, BUZZER_RESOLUTION);
+    ledcAttachPin(PIN_BUZZER, BUZZER_CHANNEL);
+    ledcWriteTone(BUZZER_CHANNEL, 0);
+
+    toneQueue = xQueueCreate(TONE_QUEUE_LENGTH, sizeof(ToneType));
+    xTaskCreate(
+      BuzzerTask,             // Function that should be called
+      "Buzzer",               // Name of the task (for debugging)
+      2048,                   // Stack size (bytes)
+      NULL,                   // Parameter to pass
+      2,                      // Task priority (0 - 24) 0 = lowest, 24 = highest
+      NULL                    // Task handle
+    );
+}
+
+void PlayTone(ToneType tone)
+{
+    xQueueSend(toneQueue, &tone, 0); //If the queue is full the buzzer has enough to say already.
+}
+
+//True when no tone is playing or waiting to.
+bool BuzzerIdle()
+{
+    return !tonePlaying && uxQueueMessagesWaiting(toneQueue) == 0;
+}
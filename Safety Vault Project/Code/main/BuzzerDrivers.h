@@ -0,0 +1,30 @@
+#define PIN_BUZZER 15 //13 on pcb
+#define BUZZER_CHANNEL 15         //LEDC channel for the buzzer. ESP32Servo hands out channels from 0 up, so take the last one.
+#define BUZZER_RESOLUTION 8       //Bits of duty cycle, the tone plays at 50%
+#define TONE_QUEUE_LENGTH 4       //Sequences that can wait while another one plays
+
+//One step of a tone sequence. A sequence ends with a step of duration 0.
+struct ToneStep
+{
+  unsigned short frequency;  //Hz, 0 is silence
+  unsigned short duration;   //ms
+};
+
+enum ToneType
+{
+  ToneError,
+  ToneLockdown,
+  ToneUnlock,
+  ToneDoorOpen,
+  TONE_TYPE_AMOUNT
+};
+
+const ToneStep ERROR_TONE[] = {{880, 250}, {0, 50}, {440, 700}, {0, 0}};
+const ToneStep LOCKDOWN_TONE[] = {{330, 400}, {0, 150}, {330, 400}, {0, 150}, {220, 1000}, {0, 0}};
+const ToneStep UNLOCK_TONE[] = {{1760, 60}, {2637, 90}, {0, 0}};
+const ToneStep DOOR_OPEN_TONE[] = {{2000, 150}, {0, 100}, {2000, 150}, {0, 100}, {2000, 150}, {0, 0}};
+const ToneStep *const TONES[TONE_TYPE_AMOUNT] = {ERROR_TONE, LOCKDOWN_TONE, UNLOCK_TONE, DOOR_OPEN_TONE};
+
+void SetupBuzzer();
+void PlayTone(ToneType tone); //Returns straight away. The tone plays after any that are still playing or waiting.
+bool BuzzerIdle();
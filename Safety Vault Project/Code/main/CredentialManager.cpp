@@ -0,0 +1,522 @@
+#include "Arduino.h"
+#include "esp_partition.h"
+#include "DisplayDrivers.h"
+#include "StorageManager.h"
+#include "CredentialManager.h"
+
+//Flags are cleared as things happen to a slot, an erased slot has none of them.
+#define SLOT_WRITTEN 0x01   //Cleared by the last byte of the slot's write, so a slot the power went during never counts
+#define SLOT_REMOVED 0x02
+#define SLOT_USED 0x04      //A one-time code that opened the vault or ran out of time
+#define SLOT_REPLACING 0x08 //Written with this cleared when it replaces the code of its admin or user
+#define SLOT_REPLACED 0x10  //and this one cleared once the old code is removed. A boot finishes what the power cut short.
+#define SIPHASH_KEY_HIGH 0x5661756C74437264ULL //Second half of the SipHash key, the salt is the first
+
+struct CredentialSlot
+{
+  uint64_t key;       //SipHash of the code. Never all ones, so it cant be mistaken for an erased slot.
+  uint32_t attempts;  //Unary, one more bit cleared for every attempt
+  uint16_t user;
+  uint8_t type;
+  uint8_t flags;      //Last, so it is written last
+};
+
+struct OneTimeCode
+{
+  int slot;           //-1 when free
+  unsigned long expires;
+};
+
+const esp_partition_t *credentialPartition = NULL;
+uint64_t credentialSalt = 0;
+int credentialTable = 0;
+bool adminCodeStored = false;
+uint8_t usersWithCode[(MAX_USER + 8) / 8]; //So replacing a code only goes through the table if there is one to remove
+OneTimeCode oneTimeCodes[ONE_TIME_CODE_AMOUNT];
+CredentialStats credentialStats;
+
+#define ROTATE_LEFT(x, bits) (((x) << (bits)) | ((x) >> (64 - (bits))))
+
+void SipRound(uint64_t v[4])
+{
+    v[0] += v[1]; v[1] = ROTATE_LEFT(v[1], 13); v[1] ^= v[0]; v[0] = ROTATE_LEFT(v[0], 32);
+    v[2] += v[3]; v[3] = ROTATE_LEFT(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = ROTATE_LEFT(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = ROTATE_LEFT(v[1], 17); v[1] ^= v[2]; v[2] = ROTATE_LEFT(v[2], 32);
+}
+
+//SipHash-2-4 of a message shorter than 8 bytes.
+uint64_t SipHash(uint64_t k0, uint64_t k1, const uint8_t *message, int length)
+{
+    uint64_t v[4] = {k0 ^ 0x736f6d6570736575ULL, k1 ^ 0x646f72616e646f6dULL, k0 ^ 0x6c7967656e657261ULL, k1 ^ 0x7465646279746573ULL};
+    uint64_t last = (uint64_t)length << 56;
+    for(int i = 0; i < length; i++) last |= (uint64_t)message[i] << (8 * i);
+
+    v[3] ^= last;
+    SipRound(v);
+    SipRound(v);
+    v[0] ^= last;
+
+    v[2] ^= 0xFF;
+    for(int i = 0; i < 4; i++) SipRound(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+//Hash the code as packed BCD, two digits a byte.
+uint64_t CodeKey(const int code[DIGIT_AMOUNT])
+{
+    uint8_t packed[(DIGIT_AMOUNT + 1) / 2] = {};
+    for(int i = 0; i < DIGIT_AMOUNT; i++) packed[i / 2] |= (code[i] & 0x0F) << (i % 2 ? 0 : 4);
+
+    uint64_t key = SipHash(credentialSalt, SIPHASH_KEY_HIGH, packed, sizeof(packed));
+    return key == UINT64_MAX ? key - 1 : key;
+}
+
+int FirstBucket(uint64_t key)
+{
+    return key % CREDENTIAL_BUCKETS;
+}
+
+int SecondBucket(uint64_t key)
+{
+    int bucket = (key >> 32) % CREDENTIAL_BUCKETS;
+    return bucket == FirstBucket(key) ? (bucket + 1) % CREDENTIAL_BUCKETS : bucket;
+}
+
+uint32_t SlotOffset(int table, int slot)
+{
+    return table * CREDENTIAL_TABLE_SIZE + slot * CREDENTIAL_SLOT_SIZE;
+}
+
+void ReadBucket(int bucket, CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS])
+{
+    esp_partition_read(credentialPartition, SlotOffset(credentialTable, bucket * CREDENTIAL_BUCKET_SLOTS), slots, CREDENTIAL_BUCKET_SLOTS * CREDENTIAL_SLOT_SIZE);
+}
+
+//Clear the given flag of a slot. Programming the byte can only clear bits, so a power cut cant touch any other flag.
+void ClearSlotFlag(int slot, uint8_t flags, uint8_t flag)
+{
+    uint8_t value = flags & ~flag;
+    esp_partition_write(credentialPartition, SlotOffset(credentialTable, slot) + offsetof(CredentialSlot, flags), &value, 1);
+}
+
+bool IsErasedSlot(const CredentialSlot *slot)
+{
+    const uint8_t *data = (const uint8_t *)slot;
+    for(int i = 0; i < CREDENTIAL_SLOT_SIZE; i++)
+    {
+        if(data[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+bool IsLiveSlot(const CredentialSlot *slot)
+{
+    return (slot->flags & (SLOT_WRITTEN | SLOT_REMOVED | SLOT_USED)) == (SLOT_REMOVED | SLOT_USED);
+}
+
+int Attempts(uint32_t bits)
+{
+    int attempts = 0;
+    for(; bits != UINT32_MAX; bits |= bits + 1) attempts++; //Counts the cleared bits from the bottom
+    return attempts;
+}
+
+//1 if the value is 0 and 0 otherwise, without a branch the compiler could turn into a different timing.
+uint32_t IsZero(uint64_t value)
+{
+    uint32_t folded = (uint32_t)(value | (value >> 32));
+    return 1 ^ ((folded | (0U - folded)) >> 31);
+}
+
+//Find the slot holding a code that can still be answered for, live ones first. Every slot of both buckets gets exactly the same
+//work whether it matches or not. Returns the slot, or -1 if the code isnt there.
+int FindCredential(uint64_t key, CredentialSlot *found)
+{
+    CredentialSlot slots[2 * CREDENTIAL_BUCKET_SLOTS];
+    int buckets[2] = {FirstBucket(key), SecondBucket(key)};
+    ReadBucket(buckets[0], slots);
+    ReadBucket(buckets[1], slots + CREDENTIAL_BUCKET_SLOTS);
+
+    uint32_t liveFound = 0, liveIndex = 0, usedFound = 0, usedIndex = 0;
+    for(uint32_t i = 0; i < 2 * CREDENTIAL_BUCKET_SLOTS; i++)
+    {
+        uint32_t flags = slots[i].flags;
+        uint32_t matches = IsZero(slots[i].key ^ key) & IsZero(flags & SLOT_WRITTEN) & (1 ^ IsZero(flags & SLOT_REMOVED));
+        uint32_t used = IsZero(flags & SLOT_USED);
+
+        uint32_t takeLive = matches & (used ^ 1) & (liveFound ^ 1);
+        uint32_t takeUsed = matches & used & (usedFound ^ 1);
+        liveIndex |= (0U - takeLive) & i;
+        liveFound |= takeLive;
+        usedIndex |= (0U - takeUsed) & i;
+        usedFound |= takeUsed;
+    }
+
+    if(!liveFound && !usedFound) return -1;
+    int index = liveFound ? liveIndex : usedIndex;
+    *found = slots[index];
+    return buckets[index / CREDENTIAL_BUCKET_SLOTS] * CREDENTIAL_BUCKET_SLOTS + index % CREDENTIAL_BUCKET_SLOTS;
+}
+
+//An erased slot in the emptier of the code's two buckets, or -1 if both are full. reclaimable tells whether a compaction would
+//free a slot in them.
+int FreeSlot(uint64_t key, bool *reclaimable)
+{
+    *reclaimable = false;
+    int best = -1;
+    int bestFree = 0;
+    int buckets[2] = {FirstBucket(key), SecondBucket(key)};
+
+    for(int b = 0; b < 2; b++)
+    {
+        CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS];
+        ReadBucket(buckets[b], slots);
+
+        int free = 0;
+        int first = -1;
+        for(int i = 0; i < CREDENTIAL_BUCKET_SLOTS; i++)
+        {
+            if(!IsErasedSlot(&slots[i]))
+            {
+                *reclaimable |= !IsLiveSlot(&slots[i]);
+                continue;
+            }
+            if(first < 0) first = i;
+            free++;
+        }
+        if(free > bestFree)
+        {
+            best = buckets[b] * CREDENTIAL_BUCKET_SLOTS + first;
+            bestFree = free;
+        }
+    }
+    return best;
+}
+
+bool UserHasCode(int user)
+{
+    return user >= 0 && user <= MAX_USER && usersWithCode[user / 8] & (1 << user % 8);
+}
+
+void SetUserHasCode(int user, bool hasCode)
+{
+    if(user < 0 || user > MAX_USER) return;
+    if(hasCode) usersWithCode[user / 8] |= 1 << user % 8;
+    else usersWithCode[user / 8] &= ~(1 << user % 8);
+}
+
+int FindOneTimeCode(int slot)
+{
+    for(int i = 0; i < ONE_TIME_CODE_AMOUNT; i++)
+    {
+        if(oneTimeCodes[i].slot == slot) return i;
+    }
+    return -1;
+}
+
+int RemoveCredentialsExcept(CredentialType type, int user, int keep);
+
+bool IsReplacingSlot(const CredentialSlot *slot)
+{
+    return IsLiveSlot(slot) && (slot->flags & (SLOT_REPLACING | SLOT_REPLACED)) == SLOT_REPLACED;
+}
+
+//Read every slot once: count them, and void the one-time codes of the last boot since we cant tell how long ago that was.
+//A code that was still replacing an older one when the power went was written whole, so it wins and the older one goes now.
+void ScanCredentials()
+{
+    credentialStats.live = 0;
+    credentialStats.dead = 0;
+    adminCodeStored = false;
+    memset(usersWithCode, 0, sizeof(usersWithCode));
+
+    for(int bucket = 0; bucket < CREDENTIAL_BUCKETS; bucket++)
+    {
+        CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS];
+        ReadBucket(bucket, slots);
+
+        for(int i = 0; i < CREDENTIAL_BUCKET_SLOTS; i++)
+        {
+            CredentialSlot *slot = &slots[i];
+            if(IsErasedSlot(slot)) continue;
+
+            if(IsLiveSlot(slot) && slot->type == CredentialOneTime && FindOneTimeCode(bucket * CREDENTIAL_BUCKET_SLOTS + i) < 0)
+            {
+                ClearSlotFlag(bucket * CREDENTIAL_BUCKET_SLOTS + i, slot->flags, SLOT_USED);
+                slot->flags &= ~SLOT_USED;
+            }
+
+            if(!IsLiveSlot(slot))
+            {
+                credentialStats.dead++;
+                continue;
+            }
+            credentialStats.live++;
+            if(slot->type == CredentialAdmin) adminCodeStored = true;
+            if(slot->type == CredentialUser) SetUserHasCode(slot->user, true);
+        }
+    }
+
+    for(int bucket = 0; bucket < CREDENTIAL_BUCKETS; bucket++)
+    {
+        CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS];
+        ReadBucket(bucket, slots);
+
+        for(int i = 0; i < CREDENTIAL_BUCKET_SLOTS; i++)
+        {
+            if(!IsReplacingSlot(&slots[i])) continue;
+
+            int index = bucket * CREDENTIAL_BUCKET_SLOTS + i;
+            RemoveCredentialsExcept((CredentialType)slots[i].type, slots[i].user, index);
+            ClearSlotFlag(index, slots[i].flags, SLOT_REPLACED);
+        }
+    }
+}
+
+bool SetupCredentials()
+{
+    credentialPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CREDENTIAL_PARTITION_LABEL);
+    if(credentialPartition == NULL)
+    {
+        Serial.println("Credential partition not found");
+        return false;
+    }
+    for(int i = 0; i < ONE_TIME_CODE_AMOUNT; i++) oneTimeCodes[i].slot = -1;
+
+    //The salt is made once, the first time the vault boots, and never changes.
+    if(!ReadStorage(StoredCredentialSalt, &credentialSalt, sizeof(credentialSalt)))
+    {
+        credentialSalt = (uint64_t)esp_random() << 32 | esp_random();
+        WriteStorage(StoredCredentialSalt, &credentialSalt, sizeof(credentialSalt));
+        CommitStorage();
+    }
+    credentialTable = 0;
+    ReadStorage(StoredCredentialTable, &credentialTable, sizeof(credentialTable));
+    ScanCredentials();
+
+    //Vaults from before the credential table kept their code as plain digits. Move it over and forget the digits. Only a whole
+    //code is taken, anything else left under the key is just removed.
+    if(IsStored(StoredPasscode))
+    {
+        byte storedCode[DIGIT_AMOUNT] = {};
+        bool valid = !adminCodeStored && StoredLength(StoredPasscode) == sizeof(storedCode) && ReadStorage(StoredPasscode, storedCode, sizeof(storedCode));
+        int code[DIGIT_AMOUNT];
+        for(int i = 0; i < DIGIT_AMOUNT; i++)
+        {
+            code[i] = storedCode[i];
+            valid &= storedCode[i] <= 9;
+        }
+        if(valid) AddCredential(code, CredentialAdmin, ADMIN_USER, 0);
+        RemoveStorage(StoredPasscode);
+        CommitStorage();
+    }
+    return true;
+}
+
+bool HasAdminCode()
+{
+    return adminCodeStored;
+}
+
+//Check an entered code. A match costs one flash byte write for its attempt counter, and a one-time code is used up by it.
+CredentialMatch VerifyCredential(const int code[DIGIT_AMOUNT])
+{
+    CredentialMatch match = {CredentialUnknown, CredentialUser, 0, 0};
+    if(credentialPartition == NULL) return match;
+
+    CredentialSlot slot;
+    int index = FindCredential(CodeKey(code), &slot);
+    if(index < 0) return match;
+
+    match.type = (CredentialType)slot.type;
+    match.user = slot.user;
+    if(slot.attempts != 0)
+    {
+        //Clear the lowest bit still set, writing only the byte it is in.
+        int byteIndex = __builtin_ctz(slot.attempts) / 8;
+        slot.attempts &= slot.attempts - 1;
+        esp_partition_write(credentialPartition, SlotOffset(credentialTable, index) + offsetof(CredentialSlot, attempts) + byteIndex,
+                            (uint8_t *)&slot.attempts + byteIndex, 1);
+    }
+    match.attempts = Attempts(slot.attempts);
+
+    if(!IsLiveSlot(&slot))
+    {
+        match.result = CredentialUsedUp;
+        return match;
+    }
+    if(slot.type != CredentialOneTime)
+    {
+        match.result = CredentialAccepted;
+        return match;
+    }
+
+    //A one-time code goes either way, so it is used up now.
+    int oneTime = FindOneTimeCode(index);
+    match.result = oneTime >= 0 && (long)(oneTimeCodes[oneTime].expires - millis()) > 0 ? CredentialAccepted : CredentialExpired;
+    if(oneTime >= 0) oneTimeCodes[oneTime].slot = -1;
+    ClearSlotFlag(index, slot.flags, SLOT_USED);
+    credentialStats.live--;
+    credentialStats.dead++;
+    return match;
+}
+
+//A free entry for a new one-time code. Entries of codes that ran out of time unused are taken back.
+int FreeOneTimeCode()
+{
+    for(int i = 0; i < ONE_TIME_CODE_AMOUNT; i++)
+    {
+        if(oneTimeCodes[i].slot < 0) return i;
+    }
+    for(int i = 0; i < ONE_TIME_CODE_AMOUNT; i++)
+    {
+        if((long)(oneTimeCodes[i].expires - millis()) > 0) continue;
+
+        CredentialSlot slot;
+        esp_partition_read(credentialPartition, SlotOffset(credentialTable, oneTimeCodes[i].slot), &slot, sizeof(slot));
+        ClearSlotFlag(oneTimeCodes[i].slot, slot.flags, SLOT_USED);
+        credentialStats.live--;
+        credentialStats.dead++;
+        oneTimeCodes[i].slot = -1;
+        return i;
+    }
+    return -1;
+}
+
+//Add a code. The admin and every user have one code each, so a new one replaces theirs. validMinutes is for one-time codes only.
+bool AddCredential(const int code[DIGIT_AMOUNT], CredentialType type, int user, int validMinutes)
+{
+    if(credentialPartition == NULL) return false;
+    if(type == CredentialAdmin) user = ADMIN_USER;
+    if(type == CredentialUser && (user < 1 || user > MAX_USER)) return false;
+    if(type == CredentialOneTime && (validMinutes < 1 || validMinutes > ONE_TIME_CODE_MAX_MINUTES)) return false;
+    if(type == CredentialOneTime) user = ONE_TIME_USER;
+
+    //A code can only belong to one of them, or nobody could tell who opened the vault.
+    uint64_t key = CodeKey(code);
+    CredentialSlot slot;
+    if(FindCredential(key, &slot) >= 0 && IsLiveSlot(&slot)) return type != CredentialOneTime && slot.type == type && slot.user == user;
+
+    int oneTime = -1;
+    if(type == CredentialOneTime && (oneTime = FreeOneTimeCode()) < 0) return false;
+
+    bool reclaimable;
+    int index = FreeSlot(key, &reclaimable);
+    if(index < 0 && reclaimable)
+    {
+        CompactCredentials();
+        index = FreeSlot(key, &reclaimable);
+    }
+    if(index < 0) return false; //Both of its buckets are full of live codes
+
+    //The new code goes in before the old one is removed, so a power cut in between never leaves the admin without a code. A
+    //replacing code is marked first and only counts once SLOT_WRITTEN is cleared on its own after, a half programmed flags
+    //byte cant make it count without the mark.
+    slot.key = key;
+    slot.attempts = UINT32_MAX;
+    slot.user = user;
+    slot.type = type;
+    if(type == CredentialOneTime)
+    {
+        slot.flags = 0xFF & ~SLOT_WRITTEN;
+        esp_partition_write(credentialPartition, SlotOffset(credentialTable, index), &slot, sizeof(slot));
+    }
+    else
+    {
+        slot.flags = 0xFF & ~SLOT_REPLACING;
+        esp_partition_write(credentialPartition, SlotOffset(credentialTable, index), &slot, sizeof(slot));
+        ClearSlotFlag(index, slot.flags, SLOT_WRITTEN);
+        slot.flags &= ~SLOT_WRITTEN;
+    }
+
+    credentialStats.live++;
+    if(type != CredentialOneTime)
+    {
+        RemoveCredentialsExcept(type, user, index);
+        ClearSlotFlag(index, slot.flags, SLOT_REPLACED);
+    }
+    if(type == CredentialAdmin) adminCodeStored = true;
+    if(type == CredentialUser) SetUserHasCode(user, true);
+    if(oneTime >= 0)
+    {
+        oneTimeCodes[oneTime].slot = index;
+        oneTimeCodes[oneTime].expires = millis() + validMinutes * 60000UL;
+    }
+    return true;
+}
+
+//Goes through the whole table if there is anything to remove, it is only for changing codes.
+int RemoveCredentials(CredentialType type, int user)
+{
+    return RemoveCredentialsExcept(type, user, -1);
+}
+
+//Removes the codes of the admin or a user but the one in slot keep.
+int RemoveCredentialsExcept(CredentialType type, int user, int keep)
+{
+    if(credentialPartition == NULL) return 0;
+    if(type == CredentialAdmin && !adminCodeStored) return 0;
+    if(type == CredentialUser && !UserHasCode(user)) return 0;
+
+    int removed = 0;
+    for(int bucket = 0; bucket < CREDENTIAL_BUCKETS; bucket++)
+    {
+        CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS];
+        ReadBucket(bucket, slots);
+
+        for(int i = 0; i < CREDENTIAL_BUCKET_SLOTS; i++)
+        {
+            int index = bucket * CREDENTIAL_BUCKET_SLOTS + i;
+            if(!IsLiveSlot(&slots[i]) || slots[i].type != type || slots[i].user != user || index == keep) continue;
+
+            ClearSlotFlag(index, slots[i].flags, SLOT_REMOVED);
+            int oneTime = FindOneTimeCode(index);
+            if(oneTime >= 0) oneTimeCodes[oneTime].slot = -1;
+            removed++;
+        }
+    }
+
+    credentialStats.live -= removed;
+    credentialStats.dead += removed;
+    if(keep < 0 && type == CredentialAdmin) adminCodeStored = false;
+    if(keep < 0 && type == CredentialUser) SetUserHasCode(user, false);
+    return removed;
+}
+
+//Copy the live codes to the same slots of the other table, leaving out the dead ones, and switch over to it. Slots keep their
+//place, so nothing can end up in a full bucket and the one-time codes waiting in RAM still point at the right slots.
+void CompactCredentials()
+{
+    if(credentialPartition == NULL) return;
+
+    int target = 1 - credentialTable;
+    esp_partition_erase_range(credentialPartition, SlotOffset(target, 0), CREDENTIAL_TABLE_SIZE);
+
+    for(int bucket = 0; bucket < CREDENTIAL_BUCKETS; bucket++)
+    {
+        CredentialSlot slots[CREDENTIAL_BUCKET_SLOTS];
+        ReadBucket(bucket, slots);
+
+        for(int i = 0; i < CREDENTIAL_BUCKET_SLOTS; i++)
+        {
+            if(!IsLiveSlot(&slots[i])) continue;
+            esp_partition_write(credentialPartition, SlotOffset(target, bucket * CREDENTIAL_BUCKET_SLOTS + i), &slots[i], sizeof(CredentialSlot));
+        }
+    }
+
+    //The new table only counts once this commit is in flash.
+    WriteStorage(StoredCredentialTable, &target, sizeof(target));
+    CommitStorage();
+
+    credentialTable = target;
+    credentialStats.dead = 0;
+    credentialStats.compactions++;
+}
+
+CredentialStats GetCredentialStats()
+{
+    CredentialStats stats = credentialStats;
+    stats.table = credentialTable;
+    return stats;
+}
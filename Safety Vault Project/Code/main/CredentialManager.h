@@ -0,0 +1,60 @@
+//Every code that opens the vault: the admin code, a code per user and one-time codes, kept in a hash table in the "creds" flash
+//partition (see partitions.csv). A code is stored as the SipHash of its packed BCD digits under a salt made on first boot, never
+//as the digits themselves. The hash picks two buckets of CREDENTIAL_BUCKET_SLOTS slots and a code lives in one of them, so
+//checking a code always reads the same two buckets and compares every slot in them, however many codes there are and however
+//close the code was. With 4 digits an offline search of a flash dump still only takes 10000 tries, the salt just keeps the
+//table from being a list of codes.
+//Slots only ever have bits cleared, one flag at a time, so nothing but CompactCredentials() erases flash. It copies the codes
+//still in use to the partition's other table and switches over with a single CommitStorage(), so a power cut leaves either table.
+#define CREDENTIAL_PARTITION_LABEL "creds"
+#define CREDENTIAL_TABLE_SIZE 16384     //One table, the partition holds two
+#define CREDENTIAL_SLOT_SIZE 16
+#define CREDENTIAL_BUCKET_SLOTS 8
+#define CREDENTIAL_SLOTS (CREDENTIAL_TABLE_SIZE / CREDENTIAL_SLOT_SIZE)
+#define CREDENTIAL_BUCKETS (CREDENTIAL_SLOTS / CREDENTIAL_BUCKET_SLOTS)
+#define CREDENTIAL_MAX_ATTEMPTS 32      //Attempt counters are unary in flash and stop counting here
+#define ONE_TIME_CODE_AMOUNT 16         //One-time codes that can be waiting at once
+#define ONE_TIME_CODE_MAX_MINUTES 1440
+#define ADMIN_USER 0
+#define ONE_TIME_USER 0xFFFF
+#define MAX_USER 999
+
+enum CredentialType
+{
+  CredentialAdmin,
+  CredentialUser,
+  CredentialOneTime   //Opens once, within its time. There is no clock that survives a reboot, so a reboot voids them.
+};
+
+enum CredentialResult
+{
+  CredentialUnknown,  //No such code
+  CredentialAccepted,
+  CredentialExpired,
+  CredentialUsedUp
+};
+
+//What a code turned out to be. type, user and attempts only mean something if the code is known.
+struct CredentialMatch
+{
+  CredentialResult result;
+  CredentialType type;
+  int user;
+  int attempts;       //Times the code was entered, this time included, up to CREDENTIAL_MAX_ATTEMPTS
+};
+
+struct CredentialStats
+{
+  int live;           //Codes that can still open the vault
+  int dead;           //Removed, used up or expired codes whose slots are waiting for a compaction
+  int table;          //Which of the two tables is in use
+  unsigned long compactions;
+};
+
+bool SetupCredentials(); //Call after SetupStorage(). Returns false if the partition cant be found.
+bool HasAdminCode();
+CredentialMatch VerifyCredential(const int code[DIGIT_AMOUNT]);
+bool AddCredential(const int code[DIGIT_AMOUNT], CredentialType type, int user, int validMinutes); //False if another user has the code or the table is full.
+int RemoveCredentials(CredentialType type, int user); //Returns how many were removed.
+void CompactCredentials();
+CredentialStats GetCredentialStats();
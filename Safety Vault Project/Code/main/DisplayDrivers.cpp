@@ -1,148 +1,437 @@
-#include "Arduino.h"
-#include "DisplayDrivers.h"
-
-SemaphoreHandle_t displaySemaphore;
-
-//This is an asynchronous task running on either one of the two cores of the ESP32
-void RefreshDisplayTask(void * perameter)
-{
-    //Decode the input perameter to the correct value type.
-    DisplayData *_data = (DisplayData*) perameter;
-    byte code; //Reserve a variable to code our data into
-    
-    for(;;) //Start an infinite loop. As we are running this on other threads this isnt a problem and even desireable (Creating a second update loop)
-    {
-        //Check if we actually have access to the display data right now. This is done by a flag indicating if the display is flashing right now and if we can access the Semaphore for the data.
-        if(!_data->displayIsFlashing && xSemaphoreTake(displaySemaphore, (TickType_t)10) == pdTRUE) 
-        {
-            //Loop through each digit
-            for(int i = 0; i < DIGIT_AMOUNT; i++)
-            {     
-                //Set the dot LED to off
-                digitalWrite(PIN_DOT_ON, HIGH);  
-                //Check if we want to turn on the dot LED and if we are currently on the right display. If so turn on the dot LED
-                if(_data->dot && i == _data->dotPosition) digitalWrite(PIN_DOT_ON, LOW);  
-  
-                //Write the copy pin to low, indicating to the 595 that we dont want it to read from the input register right now.
-                digitalWrite(PIN_COPY, LOW);
-  
-                //Encode our data to an 8-bit value. (BCD[0000] + Display[0000])
-                code = (15-_data->digits[i])<<4;
-                code += ((0001<<i));
-  
-                //Shift the data out to the 595 starting at the most significant bit.
-                shiftOut(PIN_WRITE_BUS, PIN_DISPLAY_CLOCK, MSBFIRST, ~code);
-  
-                //Write the copy pin to high, indicating to the 595 we want it to read from the input register.
-                digitalWrite(PIN_COPY, HIGH);
-  
-                //Delay this loop for 1 millisecond. While this helps us humans seeing the digit it also stops this thread from crashing
-                vTaskDelay(1 / portTICK_PERIOD_MS);
-            }
-            
-            xSemaphoreGive(displaySemaphore); //Release our usage of the semaphore so a potential display flash can use it.
-        }
-        else //We cant use the semaphore anymore since the thread responsible for flashing the display wants to use it (or is already using it)
-        {
-            xSemaphoreGive(displaySemaphore); //Give the semaphore back in case we are using it
-            vTaskDelay(1 / portTICK_PERIOD_MS); //Delay the task as we dont want it to crash. (watchdog will kill this thread when it detects the infinite loop (I think))
-        }
-        
-    }
-}
-
-void SetupDisplayTask(DisplayData *_data)
-{
-  //Setup the pins we need to use to write data to the display
-  pinMode(PIN_WRITE_BUS, OUTPUT);
-  pinMode(PIN_DISPLAY_CLOCK, OUTPUT);
-  pinMode(PIN_COPY, OUTPUT);
-  pinMode(PIN_DOT_ON, OUTPUT);
-
-  //Create a semaphore we can use during the running of our program
-  displaySemaphore = xSemaphoreCreateBinary();
-
-  //Start the display task.
-  xTaskCreate(
-    RefreshDisplayTask,          // Function that should be called
-    "Display Refreshing",   // Name of the task (for debugging)
-    1000,                 // Stack size (bytes)
-    (_data),              // Parameter to pass
-    3,                    // Task priority (0 - 24) 0 = lowest, 24 = highest
-    NULL                  // Task handle
-  );
-}
-
-void FlashDisplayTask(void *perameter)
-{
-    //Decode the input perameter to the correct value type.
-    DisplayData *_data = (DisplayData*) perameter;
-    
-    for(;;) //Start an infinite loop. We dont need this for flashing our display but in case we are starting this during an update cycle of the display we need to retry. Infinite loop might not be necessary but it ensures we get a chance to flash the display
-    {
-        if(xSemaphoreTake(displaySemaphore, (TickType_t)10) == pdTRUE) //Check if we can take the Semaphore.
-        {
-            _data->displayIsFlashing = true; //Set the flashing display flag to true.
-            byte code; //Reserve a byte of memory to write our display data into
-            digitalWrite(PIN_DOT_ON, LOW); //turn on each dot 
-            
-            for(int flash = 0; flash < FLASH_AMOUNT; flash++) //Loop through each flash we need to do.
-            {
-                digitalWrite(PIN_COPY, LOW); //Write the copy pin to low, indicating to the 595 that we dont want it to read from the input register right now.
-
-                //Write in the BCD value of 8 and turn each display on
-                code = (15-8)<<4;
-                code += 15; //1111
-
-                //Shift the data out to the 595 starting at the most significant bit.
-                shiftOut(PIN_WRITE_BUS, PIN_DISPLAY_CLOCK, MSBFIRST, ~code);
-
-                //Write the copy pin to high, indicating to the 595 we want it to read from the input register.
-                digitalWrite(PIN_COPY, HIGH);
-
-                //Delay for half the amount of time this flash should take
-                vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
-      
-                digitalWrite(PIN_COPY, LOW); //Write the copy pin to low, indicating to the 595 that we dont want it to read from the input register right now.
-                
-                code = 0; //Set the code to 0. This means absolutely no displays will be turned on.
-                
-                //Shift the data out to the 595 starting at the most significant bit.
-                shiftOut(PIN_WRITE_BUS, PIN_DISPLAY_CLOCK, MSBFIRST, ~code);
-
-                //Write the copy pin to high, indicating to the 595 we want it to read from the input register.
-                digitalWrite(PIN_COPY, HIGH);
-
-                //Delay for the other half the amount of time this flash should take
-                vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
-            }
-
-            //As we have finished flashing, give the Semaphore back so the display can start refreshing itself again.
-            xSemaphoreGive(displaySemaphore);
-
-            //break out of the infinite loop.
-            break;
-        }
-        else //If we cant delay the task by 1ms and then try to take the semaphore again.
-        {
-            vTaskDelay(1 / portTICK_PERIOD_MS); //Delay the task by 1ms so the watchdog doesnt stop it.
-        }
-    }
-
-    //Turn of the flag indicating we are flashing
-    _data->displayIsFlashing = false;
-    vTaskDelete(NULL); //Delete this task.
-}
-
-void FlashDisplay(DisplayData *_data)
-{
-    //Create the task that will flash the display.
-    xTaskCreate(
-        FlashDisplayTask,     // Function that should be called
-        "Flash Display",      // Name of the task (for debugging)
-        1000,                 // Stack size (bytes)
-        (_data),              // Parameter to pass
-        4,                    // Task priority
-        NULL                  // Task handle
-    );
-}
+#include <string.h>
+#include "Arduino.h"
+#include <FastPin.h>
+#include "DisplayDrivers.h"
+#include "TraceManager.h"
+
+#define BLANK_CODE 0xFF //Inverted 0, no display turned on
+
+typedef OutputPin<PIN_WRITE_BUS> WriteBusPin;
+typedef OutputPin<PIN_DISPLAY_CLOCK> DisplayClockPin;
+typedef OutputPin<PIN_COPY> CopyPin;
+typedef OutputPins<PIN_DOT_ON, PIN_COPY> DotAndCopyPins;
+
+//Shift a byte into the 595 starting at the most significant bit and copy it to the outputs. The dot LED is set up for this digit first.
+void IRAM_ATTR WriteDisplayByte(byte code, bool dotOn)
+{
+    //Dot LED is active low. Set it and pull the copy pin low together so the 595 doesnt read from the input register while we shift.
+    DotAndCopyPins::Write(dotOn ? 0 : PinBit<PIN_DOT_ON>());
+
+    for(int bit = 7; bit >= 0; bit--)
+    {
+        WriteBusPin::Write(code & (1 << bit));
+
+        //The 595 samples the bus on the rising edge of the clock.
+        DisplayClockPin::High();
+        DisplayClockPin::Low();
+    }
+
+    CopyPin::High();
+}
+
+//Publishing the display data works like a seqlock: the sequence is odd while the main loop changes the data and the reader
+//checks it did not change while it was copying. Both sides are O(1) and neither ever blocks the other.
+void BeginDisplayUpdate(DisplayData *_data)
+{
+    _data->sequence.store(_data->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void EndDisplayUpdate(DisplayData *_data)
+{
+    _data->sequence.store(_data->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void IRAM_ATTR EncodeFrame(DisplayData *_data, DisplayFrame *frame)
+{
+    for(int i = 0; i < DIGIT_AMOUNT; i++)
+    {
+        //Encode our data to an 8-bit value. (BCD[0000] + Display[0000]), stored inverted the way we shift it out.
+        byte code = (15-_data->digits[i])<<4;
+        code += ((0001<<i));
+
+        frame->codes[i] = ~code;
+    }
+
+    frame->dotPosition = _data->dot ? _data->dotPosition : -1;
+}
+
+//Encode the display data again if the main loop published a change since the frame was made. Returns false and leaves the
+//frame alone when nothing changed or when the data is being changed right now, in which case we just try again next slot.
+bool IRAM_ATTR UpdateFrame(DisplayData *_data, DisplayFrame *frame)
+{
+    unsigned int sequence = _data->sequence.load(std::memory_order_acquire);
+    if(sequence & 1) return false;
+    if(frame->encoded && frame->sequence == sequence) return false;
+
+    DisplayFrame next;
+    EncodeFrame(_data, &next);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(_data->sequence.load(std::memory_order_relaxed) != sequence) return false; //Torn, the main loop changed the data while we encoded it.
+
+    next.sequence = sequence;
+    next.encoded = true;
+    *frame = next;
+    return true;
+}
+
+//Show a single digit of the display. The frame is only encoded again if the display data changed since the last time.
+void IRAM_ATTR ShowDigit(DisplayData *_data, DisplayFrame *frame, int digit)
+{
+    UpdateFrame(_data, frame);
+
+    //Check if we want to turn on the dot LED and if we are currently on the right display.
+    WriteDisplayByte(frame->codes[digit], digit == frame->dotPosition);
+}
+
+hw_timer_t *refreshTimer = NULL;
+DisplayData *refreshData;
+DisplayFrame refreshFrame; //The encoded bytes we keep shifting out until the display data changes
+DisplayRefreshStats refreshStats;
+
+volatile unsigned long slotTimeUs = 1000000 / (DISPLAY_REFRESH_RATE * DIGIT_AMOUNT);
+volatile byte digitBrightness[DIGIT_AMOUNT] = {255,255,255,255};
+
+//What the countdown and scroll effects show instead of the main loop's data. Only the effects task writes it.
+DisplayData effectData;
+DisplayFrame effectFrame;
+volatile bool effectShowing = false;      //Refresh from effectData instead of the main loop's data
+volatile bool flashOwnsDisplay = false;   //The flash effect drives the 595 directly, the refresh interrupt keeps its hands off
+volatile bool effectPlaying = false;
+volatile bool refreshSleeping = false;    //The display is dark and the refresh timer stopped until WakeDisplay()
+
+QueueHandle_t effectQueue;
+DisplayEffect lastQueuedEffect[EFFECT_TYPE_AMOUNT];
+std::atomic<int> effectsWaiting[EFFECT_TYPE_AMOUNT];
+
+int currentDigit = 0;
+bool digitOn = false;     //True while the current digit is lit and waiting for its on-time to end
+uint64_t slotStart = 0;   //Timer count at which the current slot should start
+
+//Set the timer to go off at the given count. If we are already past it, go off as soon as possible. The late slot is counted when it runs.
+void IRAM_ATTR ArmRefreshTimer(uint64_t alarm, uint64_t now)
+{
+    if(alarm < now + 2) alarm = now + 2;
+    timerAlarmWrite(refreshTimer, alarm, false);
+    timerAlarmEnable(refreshTimer);
+}
+
+//Runs on every slot start, and at the end of a digit's on-time when it isnt at full brightness.
+//The timer counts in microseconds.
+void IRAM_ATTR RefreshDisplayISR()
+{
+    if(refreshSleeping) return; //Went off right as the display went to sleep. Dont arm the timer again.
+
+    TRACE_BEGIN(TraceDisplaySlot, currentDigit);
+    uint64_t now = timerRead(refreshTimer);
+
+    if(digitOn) //The on-time of the digit is over. Keep the display dark until the next slot.
+    {
+        if(!flashOwnsDisplay) WriteDisplayByte(BLANK_CODE, false);
+        digitOn = false;
+        slotStart += slotTimeUs;
+        ArmRefreshTimer(slotStart, now);
+        TRACE_END(TraceDisplaySlot, currentDigit);
+        return;
+    }
+
+    //Check how late we are. If we missed whole slots, skip their digits so the others keep their timing.
+    uint64_t lateness = now - slotStart;
+    if(lateness >= slotTimeUs)
+    {
+        uint64_t missed = lateness / slotTimeUs;
+        refreshStats.missedSlots += missed;
+        slotStart += missed * slotTimeUs;
+        currentDigit = (currentDigit + missed) % DIGIT_AMOUNT;
+        lateness -= missed * slotTimeUs;
+    }
+    if(lateness > DISPLAY_LATE_THRESHOLD_US) refreshStats.lateSlots++;
+    if(lateness > refreshStats.maxLatenessUs) refreshStats.maxLatenessUs = lateness;
+    refreshStats.slots++;
+
+    //The flash effect owns the display while it is flashing.
+    unsigned long onTime = slotTimeUs * digitBrightness[currentDigit] / 255;
+    if(!flashOwnsDisplay)
+    {
+        if(onTime == 0) WriteDisplayByte(BLANK_CODE, false);
+        else if(effectShowing) ShowDigit(&effectData, &effectFrame, currentDigit);
+        else ShowDigit(refreshData, &refreshFrame, currentDigit);
+    }
+    currentDigit = (currentDigit + 1) % DIGIT_AMOUNT;
+
+    if(onTime > 0 && onTime < slotTimeUs)
+    {
+        digitOn = true;
+        ArmRefreshTimer(slotStart + onTime, now);
+    }
+    else
+    {
+        slotStart += slotTimeUs;
+        ArmRefreshTimer(slotStart, now);
+    }
+    TRACE_END(TraceDisplaySlot, currentDigit);
+}
+
+//Attaches the refresh interrupt. Interrupts are allocated on the core that attaches them, so this runs as a short task pinned to DISPLAY_REFRESH_CORE.
+void StartRefreshTimerTask(void *perameter)
+{
+    refreshTimer = timerBegin(DISPLAY_TIMER, 80, true); //80MHz APB clock / 80 = a count every microsecond
+    timerAttachInterrupt(refreshTimer, &RefreshDisplayISR, true);
+
+    uint64_t now = timerRead(refreshTimer);
+    slotStart = now + slotTimeUs;
+    ArmRefreshTimer(slotStart, now);
+
+    vTaskDelete(NULL);
+}
+
+void PlayFlash(int flashes)
+{
+    //We run on the same core as the refresh interrupt, so it cant be halfway through shifting out a digit when we take over.
+    refreshData->displayIsFlashing = true;
+    flashOwnsDisplay = true;
+    byte code; //Reserve a byte of memory to write our display data into
+    
+    for(int flash = 0; flash < flashes; flash++) //Loop through each flash we need to do.
+    {
+        //Write in the BCD value of 8 and turn each display and each dot on
+        code = (15-8)<<4;
+        code += 15; //1111
+        WriteDisplayByte(~code, true);
+
+        //Delay for half the amount of time this flash should take
+        vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
+      
+        code = 0; //Set the code to 0. This means absolutely no displays will be turned on.
+        WriteDisplayByte(~code, true);
+
+        //Delay for the other half the amount of time this flash should take
+        vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
+    }
+
+    //Hand the display back to the refresh interrupt.
+    flashOwnsDisplay = false;
+    refreshData->displayIsFlashing = false;
+}
+
+//Blink one digit by turning its brightness off and back on. The rest of the display and the input keep working.
+void PlayBlink(int digit, int blinks)
+{
+    if(digit < 0 || digit >= DIGIT_AMOUNT) return;
+    byte brightness = digitBrightness[digit];
+
+    for(int blink = 0; blink < blinks; blink++)
+    {
+        digitBrightness[digit] = 0;
+        vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
+        digitBrightness[digit] = brightness;
+        vTaskDelay((FLASH_TIME / 2) / portTICK_PERIOD_MS);
+    }
+}
+
+//Count down minutes and seconds the same way the lockdown timer shows them.
+void PlayCountdown(int seconds)
+{
+    refreshData->displayIsFlashing = true;
+    effectShowing = true;
+    TickType_t wakeTime = xTaskGetTickCount();
+
+    for(int i = seconds; i > 0; i--)
+    {
+        BeginDisplayUpdate(&effectData);
+        effectData.digits[0] = 0;
+        effectData.digits[1] = i / 60 % 10;
+        effectData.digits[2] = i % 60 / 10;
+        effectData.digits[3] = i % 10;
+        effectData.dot = true;
+        effectData.dotPosition = 1;
+        EndDisplayUpdate(&effectData);
+
+        vTaskDelayUntil(&wakeTime, 1000 / portTICK_PERIOD_MS);
+    }
+
+    effectShowing = false;
+    refreshData->displayIsFlashing = false;
+}
+
+//Scroll the text in from the right until it has left on the left.
+void PlayScroll(const char *text)
+{
+    refreshData->displayIsFlashing = true;
+    effectShowing = true;
+    int length = strlen(text);
+
+    for(int step = 1; step < length + DIGIT_AMOUNT; step++)
+    {
+        BeginDisplayUpdate(&effectData);
+        for(int i = 0; i < DIGIT_AMOUNT; i++)
+        {
+            int position = step - DIGIT_AMOUNT + i;
+            char c = position >= 0 && position < length ? text[position] : ' ';
+            effectData.digits[i] = c >= '0' && c <= '9' ? c - '0' : BLANK_DIGIT;
+        }
+        effectData.dot = false;
+        EndDisplayUpdate(&effectData);
+
+        vTaskDelay(SCROLL_STEP_TIME / portTICK_PERIOD_MS);
+    }
+
+    effectShowing = false;
+    refreshData->displayIsFlashing = false;
+}
+
+//Lives as long as the program does and plays the effects queued for it one after the other.
+void DisplayEffectsTask(void *perameter)
+{
+    DisplayEffect effect;
+
+    for(;;)
+    {
+        xQueueReceive(effectQueue, &effect, portMAX_DELAY);
+        effectsWaiting[effect.type]--;
+        effectPlaying = true;
+
+        switch(effect.type)
+        {
+            case EffectFlash: PlayFlash(effect.amount); break;
+            case EffectBlinkDigit: PlayBlink(effect.digit, effect.amount); break;
+            case EffectCountdown: PlayCountdown(effect.amount); break;
+            case EffectScroll: PlayScroll(effect.text); break;
+            default: break;
+        }
+        effectPlaying = false;
+    }
+}
+
+void SetupDisplayTask(DisplayData *_data)
+{
+  //Setup the pins we need to use to write data to the display
+  pinMode(PIN_WRITE_BUS, OUTPUT);
+  pinMode(PIN_DISPLAY_CLOCK, OUTPUT);
+  pinMode(PIN_COPY, OUTPUT);
+  pinMode(PIN_DOT_ON, OUTPUT);
+
+  //Start refreshing the display from a hardware timer.
+  refreshData = _data;
+  effectData.dot = false;
+  xTaskCreatePinnedToCore(
+    StartRefreshTimerTask,  // Function that should be called
+    "Display Timer Setup",  // Name of the task (for debugging)
+    2048,                   // Stack size (bytes)
+    NULL,                   // Parameter to pass
+    3,                      // Task priority (0 - 24) 0 = lowest, 24 = highest
+    NULL,                   // Task handle
+    DISPLAY_REFRESH_CORE    // Core to run on
+  );
+
+  //Start the task that plays flashes and other effects. It sits on the refresh interrupt's core so they never run at the same time.
+  effectQueue = xQueueCreate(EFFECT_QUEUE_LENGTH, sizeof(DisplayEffect));
+  xTaskCreatePinnedToCore(
+    DisplayEffectsTask,     // Function that should be called
+    "Display Effects",      // Name of the task (for debugging)
+    2048,                   // Stack size (bytes)
+    NULL,                   // Parameter to pass
+    4,                      // Task priority (0 - 24) 0 = lowest, 24 = highest
+    NULL,                   // Task handle
+    DISPLAY_REFRESH_CORE    // Core to run on
+  );
+}
+
+//Turn the display off and stop refreshing it, so the chip can light sleep. Call from the main loop only.
+void SleepDisplay()
+{
+    refreshSleeping = true;
+    timerAlarmDisable(refreshTimer);
+    WriteDisplayByte(BLANK_CODE, false);
+}
+
+//Start refreshing the display again from the next slot.
+void WakeDisplay()
+{
+    if(!refreshSleeping) return;
+
+    refreshSleeping = false;
+    digitOn = false;
+    uint64_t now = timerRead(refreshTimer);
+    slotStart = now + slotTimeUs;
+    ArmRefreshTimer(slotStart, now);
+}
+
+//True when no effect is playing or waiting to.
+bool DisplayEffectsIdle()
+{
+    return !effectPlaying && uxQueueMessagesWaiting(effectQueue) == 0;
+}
+
+//Change how many times per second each digit is shown. Takes effect from the next slot.
+void SetDisplayRefreshRate(int hertz)
+{
+    if(hertz > 0) slotTimeUs = 1000000 / (hertz * DIGIT_AMOUNT);
+}
+
+//Set how long a digit stays lit within its slot, 0 (off) to 255 (the whole slot).
+void SetDigitBrightness(int digit, int brightness)
+{
+    if(digit < 0 || digit >= DIGIT_AMOUNT) return;
+    digitBrightness[digit] = constrain(brightness, 0, 255);
+}
+
+DisplayRefreshStats GetDisplayRefreshStats()
+{
+    return refreshStats;
+}
+
+//Queue an effect without waiting for the display. Returns false if the queue is full and the effect was dropped.
+//Call this from the main loop only.
+bool QueueDisplayEffect(DisplayEffect *effect)
+{
+    //Coalesce: the same request is already waiting, no need to play it twice.
+    if(effectsWaiting[effect->type] > 0 && memcmp(&lastQueuedEffect[effect->type], effect, sizeof(DisplayEffect)) == 0) return true;
+
+    effectsWaiting[effect->type]++;
+    if(xQueueSend(effectQueue, effect, 0) != pdTRUE)
+    {
+        effectsWaiting[effect->type]--;
+        return false;
+    }
+
+    memcpy(&lastQueuedEffect[effect->type], effect, sizeof(DisplayEffect));
+    return true;
+}
+
+//Effects are compared byte for byte when coalescing, so clear the padding too.
+DisplayEffect MakeEffect(DisplayEffectType type, int amount)
+{
+    DisplayEffect effect;
+    memset(&effect, 0, sizeof(effect));
+    effect.type = type;
+    effect.amount = amount;
+    return effect;
+}
+
+void FlashDisplay(DisplayData *_data)
+{
+    DisplayEffect effect = MakeEffect(EffectFlash, FLASH_AMOUNT);
+    QueueDisplayEffect(&effect);
+}
+
+void BlinkDigit(int digit, int times)
+{
+    DisplayEffect effect = MakeEffect(EffectBlinkDigit, times);
+    effect.digit = digit;
+    QueueDisplayEffect(&effect);
+}
+
+void ShowCountdown(int seconds)
+{
+    DisplayEffect effect = MakeEffect(EffectCountdown, seconds);
+    QueueDisplayEffect(&effect);
+}
+
+void ScrollDigits(const char *text)
+{
+    DisplayEffect effect = MakeEffect(EffectScroll, 0);
+    strncpy(effect.text, text, SCROLL_MAX_LENGTH);
+    QueueDisplayEffect(&effect);
+}
@@ -1,22 +1,90 @@
-#define DIGIT_AMOUNT 4
-#define FLASH_AMOUNT 3
-#define FLASH_TIME 900
-
-#define PIN_WRITE_BUS 16
-#define PIN_DISPLAY_CLOCK 17
-#define PIN_COPY 18
-#define PIN_DOT_ON 19
-
-//This struct holds all the data we need for our threads to display the values we want
-struct DisplayData
-{
-  int digits[DIGIT_AMOUNT] = {0,0,0,0};
-  
-  bool dot = true;
-  int dotPosition;
-
-  bool displayIsFlashing = false;
-};
-
-void SetupDisplayTask(DisplayData *_data);
-void FlashDisplay(DisplayData *_data);
+#include <atomic>
+
+#define DIGIT_AMOUNT 4
+#define FLASH_AMOUNT 3
+#define FLASH_TIME 900
+
+#define PIN_WRITE_BUS 16
+#define PIN_DISPLAY_CLOCK 17
+#define PIN_COPY 18
+#define PIN_DOT_ON 19
+
+#define DISPLAY_REFRESH_RATE 250    //How many times per second each digit is shown
+#define DISPLAY_REFRESH_CORE 1      //Core the refresh timer interrupt is pinned to
+#define DISPLAY_TIMER 0             //Hardware timer used to multiplex the digits
+#define DISPLAY_LATE_THRESHOLD_US 50 //A digit shown later than this after its slot started counts as late
+
+#define EFFECT_QUEUE_LENGTH 8       //Effects that can wait for the display at once
+#define SCROLL_MAX_LENGTH 16
+#define SCROLL_STEP_TIME 300
+#define BLANK_DIGIT 15              //BCD values above 9 show nothing on the decoder
+
+//This struct holds all the data we need for our threads to display the values we want.
+//Only the main loop writes digits, dot and dotPosition, and it has to wrap every change in BeginDisplayUpdate/EndDisplayUpdate.
+//The refresh interrupt never waits for it: when it catches a change halfway it keeps showing the previous frame.
+struct DisplayData
+{
+  int digits[DIGIT_AMOUNT] = {0,0,0,0};
+  
+  bool dot = true;
+  int dotPosition = 0;
+
+  std::atomic<bool> displayIsFlashing {false}; //True while an effect that takes over the whole display plays. Input is ignored meanwhile.
+
+  //Bumped at the start and the end of every update, so it is odd while the data is being changed.
+  std::atomic<unsigned int> sequence {0};
+};
+
+//The display data encoded into the bytes we shift into the 595, one per digit. Only rebuilt when the DisplayData it was made from changes.
+struct DisplayFrame
+{
+  unsigned char codes[DIGIT_AMOUNT] = {0xFF,0xFF,0xFF,0xFF}; //All displays off until the first frame is encoded
+  int dotPosition = -1;     //-1 when the dot is off
+
+  unsigned int sequence;    //DisplayData sequence the codes were encoded from
+  bool encoded = false;
+};
+
+enum DisplayEffectType
+{
+  EffectFlash,
+  EffectBlinkDigit,
+  EffectCountdown,
+  EffectScroll,
+  EFFECT_TYPE_AMOUNT
+};
+
+//A command for the display effects task. A request identical to one still waiting in the queue is dropped.
+struct DisplayEffect
+{
+  DisplayEffectType type;
+  int amount;                         //Flashes, blinks or seconds to count down
+  int digit;                          //Digit to blink
+  char text[SCROLL_MAX_LENGTH + 1];   //Digits to scroll past, a space is a blank digit
+};
+
+//Counters kept by the refresh interrupt so we can see refresh jitter.
+struct DisplayRefreshStats
+{
+  unsigned long slots = 0;        //Digits shown
+  unsigned long lateSlots = 0;    //Digits shown more than DISPLAY_LATE_THRESHOLD_US after their slot started
+  unsigned long missedSlots = 0;  //Digits skipped because the interrupt came a whole slot or more too late
+  unsigned long maxLatenessUs = 0;
+};
+
+void SetupDisplayTask(DisplayData *_data);
+void SleepDisplay();
+void WakeDisplay();
+bool DisplayEffectsIdle();
+void SetDisplayRefreshRate(int hertz);
+void SetDigitBrightness(int digit, int brightness);
+DisplayRefreshStats GetDisplayRefreshStats();
+void FlashDisplay(DisplayData *_data);
+void BlinkDigit(int digit, int times);
+void ShowCountdown(int seconds);
+void ScrollDigits(const char *text);
+bool QueueDisplayEffect(DisplayEffect *effect);
+void BeginDisplayUpdate(DisplayData *_data);
+void EndDisplayUpdate(DisplayData *_data);
+bool UpdateFrame(DisplayData *_data, DisplayFrame *frame);
+void ShowDigit(DisplayData *_data, DisplayFrame *frame, int digit);
@@ -0,0 +1,137 @@
+#include "Arduino.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include "EventManager.h"
+#include "DoorDrivers.h"
+#include "RotaryDrivers.h"
+#include "TraceManager.h"
+
+//A pin that wakes the chip from light sleep, at the level it goes to when someone does something.
+struct WakePin
+{
+  gpio_num_t pin;
+  gpio_int_type_t level;
+  VaultEventType type;
+};
+
+const WakePin WAKE_PINS[] =
+{
+  {(gpio_num_t)PIN_CLOCKWISE, GPIO_INTR_LOW_LEVEL, EventInput},
+  {(gpio_num_t)PIN_COUNTERCLOCKWISE, GPIO_INTR_LOW_LEVEL, EventInput},
+  {(gpio_num_t)PIN_BUTTON_PRESS, GPIO_INTR_HIGH_LEVEL, EventInput},
+  {(gpio_num_t)PIN_DOORSTATE, GPIO_INTR_LOW_LEVEL, EventDoor}
+};
+const int WAKE_PIN_AMOUNT = sizeof(WAKE_PINS) / sizeof(WAKE_PINS[0]);
+
+QueueHandle_t eventQueue;
+VaultEventStats eventStats;
+
+void SetupEvents()
+{
+    eventQueue = xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(VaultEvent));
+}
+
+void IRAM_ATTR PostEventFromISR(VaultEventType type)
+{
+    TRACE_INSTANT(TraceEventPosted, type);
+    VaultEvent event = {type, micros()};
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    xQueueSendFromISR(eventQueue, &event, &higherPriorityTaskWoken);
+    if(higherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
+
+void IRAM_ATTR PostInputEvent()
+{
+    PostEventFromISR(EventInput);
+}
+
+void IRAM_ATTR PostDoorEvent()
+{
+    PostEventFromISR(EventDoor);
+}
+
+void IRAM_ATTR PostResetButtonEvent()
+{
+    PostEventFromISR(EventResetButton);
+}
+
+void PostEvent(VaultEventType type)
+{
+    TRACE_INSTANT(TraceEventPosted, type);
+    VaultEvent event = {type, micros()};
+    xQueueSend(eventQueue, &event, 0);
+}
+
+void PostBluetoothEvent()
+{
+    PostEvent(EventBluetooth);
+}
+
+//Block until an event comes in or the timeout (ms, -1 for none) runs out, in which case it is a deadline event.
+//The CPU idles in the meantime.
+void WaitForEvent(VaultEvent *event, long timeout)
+{
+    unsigned long deadline = (millis() + timeout) * 1000UL;
+    if(xQueueReceive(eventQueue, event, timeout < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) == pdTRUE) return;
+
+    event->type = EventDeadline;
+    event->time = deadline;
+}
+
+//Same as WaitForEvent, but light sleeps the whole chip until one of the wake pins or the timeout wakes it. Timers, tasks and
+//the display stop meanwhile, so the caller has to make sure nothing else is going on.
+void LightSleepForEvent(VaultEvent *event, long timeout)
+{
+    //Anything that came in while we were deciding to sleep comes first.
+    if(xQueueReceive(eventQueue, event, 0) == pdTRUE) return;
+
+    unsigned long deadline = (millis() + timeout) * 1000UL;
+    for(int i = 0; i < WAKE_PIN_AMOUNT; i++) gpio_wakeup_enable(WAKE_PINS[i].pin, WAKE_PINS[i].level);
+    esp_sleep_enable_gpio_wakeup();
+    long sleepTime = (long)(deadline - micros());
+    if(timeout >= 0) esp_sleep_enable_timer_wakeup(sleepTime > 0 ? sleepTime : 1);
+    else esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+
+    TRACE_BEGIN(TraceLightSleep, 0);
+    esp_light_sleep_start();
+    TRACE_END(TraceLightSleep, esp_sleep_get_wakeup_cause());
+    eventStats.lightSleeps++;
+
+    //Waking up on a level left the pins with level interrupts. Give them their edge interrupts back.
+    for(int i = 0; i < WAKE_PIN_AMOUNT; i++)
+    {
+        gpio_wakeup_disable(WAKE_PINS[i].pin);
+        gpio_set_intr_type(WAKE_PINS[i].pin, GPIO_INTR_ANYEDGE);
+    }
+
+    if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER)
+    {
+        event->type = EventDeadline;
+        event->time = deadline;
+        return;
+    }
+
+    //Woken by a pin. Whatever its interrupt posts gets handled on the next round anyway.
+    event->type = EventInput;
+    event->time = micros();
+    for(int i = 0; i < WAKE_PIN_AMOUNT; i++)
+    {
+        if(digitalRead(WAKE_PINS[i].pin) == (WAKE_PINS[i].level == GPIO_INTR_HIGH_LEVEL ? HIGH : LOW)) event->type = WAKE_PINS[i].type;
+    }
+}
+
+//Called by loop() once it has handled an event.
+void EventHandled(VaultEvent *event)
+{
+    long latency = (long)(micros() - event->time);
+    if(latency < 0) latency = 0; //The tick woke us a little before the millisecond the timer was due on
+
+    eventStats.handled[event->type]++;
+    eventStats.totalLatencyUs[event->type] += latency;
+    if((unsigned long)latency > eventStats.maxLatencyUs[event->type]) eventStats.maxLatencyUs[event->type] = latency;
+}
+
+VaultEventStats GetEventStats()
+{
+    return eventStats;
+}
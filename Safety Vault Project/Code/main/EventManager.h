@@ -0,0 +1,41 @@
+#define EVENT_QUEUE_LENGTH 16     //Wake-ups that can wait for loop(). A full queue means loop() is awake already, so dropping one loses nothing.
+#define LIGHT_SLEEP_ENABLED true  //Let the chip light sleep when the vault has been left alone
+#define LIGHT_SLEEP_DELAY 30000   //How long nobody has to touch the vault before the display goes dark and the chip light sleeps
+#define LIGHT_SLEEP_RETRY 1000    //How much later to try again when an effect or a tone was still playing
+
+//Why loop() woke up.
+enum VaultEventType
+{
+  EventInput,         //The rotary encoder turned or its button was pressed
+  EventDoor,          //The door sensor changed
+  EventResetButton,
+  EventBluetooth,     //Bluetooth data came in
+  EventDeadline,      //One of loop()'s timers ran out
+  VAULT_EVENT_TYPE_AMOUNT
+};
+
+struct VaultEvent
+{
+  VaultEventType type;
+  unsigned long time;   //micros() when it happened, or when the timer was due
+};
+
+//Counters kept by loop() so we can see how long it takes to get round to things.
+struct VaultEventStats
+{
+  unsigned long handled[VAULT_EVENT_TYPE_AMOUNT] = {};
+  unsigned long long totalLatencyUs[VAULT_EVENT_TYPE_AMOUNT] = {};  //From the event to loop() having handled it
+  unsigned long maxLatencyUs[VAULT_EVENT_TYPE_AMOUNT] = {};
+  unsigned long lightSleeps = 0;
+};
+
+void SetupEvents();
+void PostInputEvent();        //Interrupt callbacks
+void PostDoorEvent();
+void PostResetButtonEvent();
+void PostBluetoothEvent();    //Called from the Bluetooth stack's task
+void PostEvent(VaultEventType type); //From a task
+void WaitForEvent(VaultEvent *event, long timeout);
+void LightSleepForEvent(VaultEvent *event, long timeout);
+void EventHandled(VaultEvent *event);
+VaultEventStats GetEventStats();
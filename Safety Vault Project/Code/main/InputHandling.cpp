@@ -1,71 +1,81 @@
-#include "Arduino.h"
-#include "DisplayDrivers.h"
-#include "InputHandling.h"
-#include "RotaryDrivers.h"
-
-int currentRotValue = 0;
-DisplayData *_dataPointer;
-void (*completedInputCallback)();
-
-#define READ_INPUT_DELAY 50
-unsigned long timeSinceRead = 0;
-
-void SubmitDigit()
-{
-    //Check if we are currently flasing the display, if so we dont need to update our dot position.
-    if(_dataPointer->displayIsFlashing) return;
-
-    //Reset values
-    currentRotValue = 0;
-    ResetRotaryCounter();
-    _dataPointer->dotPosition++;
-
-    //Check if we've entered 4 digits, if so we have a full code.
-    if(_dataPointer->dotPosition > 3) 
-    {
-        completedInputCallback();
-        _dataPointer->dotPosition = 0;
-    }
-}
-
-void SetupInputHandler(DisplayData *_data, void (*onCompletedInputCallback)())
-{
-    //Store pointer for later use and setup callback & rotary encoder
-    _dataPointer = _data;
-    completedInputCallback = onCompletedInputCallback;
-    SetupRotaryEncoder();
-}
-
-void HandleInput()
-{
-    //Update the rotary encoder
-    UpdateRotaryEncoder(&currentRotValue, &SubmitDigit);
-
-    //Check if we aren't flashing the display
-    if(!_dataPointer->displayIsFlashing)
-    {
-        //If we arent, wait 50ms to read the current value (to circumvent double reading due to the callbacks)
-        if(millis() - timeSinceRead > READ_INPUT_DELAY)
-        {
-          timeSinceRead = millis();
-          _dataPointer->digits[_dataPointer->dotPosition] = currentRotValue;
-        }
-    }
-    else //If we are, just constantly reset the input. (We dont want the user to be able to input anything while the display is flashing.
-    {
-        ResetInput();
-    }
-}
-
-void ResetInput()
-{
-  //Reset digit values to 0.
-  _dataPointer->digits[0] = 0;
-  _dataPointer->digits[1] = 0;
-  _dataPointer->digits[2] = 0;
-  _dataPointer->digits[3] = 0;
-
-  //Reset the dot position and the rotary encoder's position.
-  _dataPointer->dotPosition = 0;
-  ResetRotaryCounter();
-}
+#include "Arduino.h"
+#include "DisplayDrivers.h"
+#include "InputHandling.h"
+#include "RotaryDrivers.h"
+
+int currentRotValue = 0;
+DisplayData *_dataPointer;
+void (*completedInputCallback)();
+
+void SubmitDigit()
+{
+    //Check if we are currently flasing the display, if so we dont need to update our dot position.
+    if(_dataPointer->displayIsFlashing) return;
+
+    //Reset values
+    currentRotValue = 0;
+    BeginDisplayUpdate(_dataPointer);
+    _dataPointer->dotPosition++;
+    EndDisplayUpdate(_dataPointer);
+
+    //Check if we've entered 4 digits, if so we have a full code.
+    if(_dataPointer->dotPosition > 3) 
+    {
+        completedInputCallback();
+        BeginDisplayUpdate(_dataPointer);
+        _dataPointer->dotPosition = 0;
+        EndDisplayUpdate(_dataPointer);
+    }
+}
+
+//Turn the digit we are entering by the given amount of steps, wrapping around within the range.
+void MoveDigit(int steps)
+{
+    //We dont want the user to be able to input anything while the display is flashing.
+    if(_dataPointer->displayIsFlashing) return;
+
+    const int range = RANGE_MAXIMUM_VALUE - RANGE_MINIMUM_VALUE + 1;
+    currentRotValue = RANGE_MINIMUM_VALUE + ((currentRotValue - RANGE_MINIMUM_VALUE + steps) % range + range) % range;
+
+    BeginDisplayUpdate(_dataPointer);
+    _dataPointer->digits[_dataPointer->dotPosition] = currentRotValue;
+    EndDisplayUpdate(_dataPointer);
+}
+
+void SetupInputHandler(DisplayData *_data, void (*onCompletedInputCallback)(), void (*onRotaryEventCallback)())
+{
+    //Store pointer for later use and setup callback & rotary encoder
+    _dataPointer = _data;
+    completedInputCallback = onCompletedInputCallback;
+    SetupRotaryEncoder(onRotaryEventCallback);
+}
+
+void HandleInput()
+{
+    //Handle everything the rotary encoder did since the last time, in the order it happened.
+    RotaryEvent event;
+    while(ReadRotaryEvent(&event))
+    {
+        if(event.type == RotaryButton) SubmitDigit();
+        else MoveDigit(RotaryStepSize(&event));
+    }
+
+    //While the display is flashing, just constantly reset the input. (We dont want the user to be able to input anything while the display is flashing.
+    if(_dataPointer->displayIsFlashing) ResetInput();
+}
+
+void ResetInput()
+{
+  //Reset digit values to 0.
+  BeginDisplayUpdate(_dataPointer);
+  _dataPointer->digits[0] = 0;
+  _dataPointer->digits[1] = 0;
+  _dataPointer->digits[2] = 0;
+  _dataPointer->digits[3] = 0;
+
+  //Reset the dot position and forget whatever the rotary encoder did that we havent handled yet.
+  _dataPointer->dotPosition = 0;
+  EndDisplayUpdate(_dataPointer);
+  currentRotValue = 0;
+  ClearRotaryEvents();
+}
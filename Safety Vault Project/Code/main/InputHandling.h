@@ -1,4 +1,4 @@
-void SetupInputHandler(DisplayData *_dataPointer, void (*onCompletedInputCallback)());
-void HandleInput();
-
-void ResetInput();
+void SetupInputHandler(DisplayData *_dataPointer, void (*onCompletedInputCallback)(), void (*onRotaryEventCallback)());
+void HandleInput();
+
+void ResetInput();
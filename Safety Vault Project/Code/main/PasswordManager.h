@@ -1,17 +1,16 @@
-#define PIN_RESET_PASSWORD_BUTTON 2 //23 on pcb
-#define PIN_BUZZER 15 //13 on pcb
-
-#define STORED_PASSCODE_ADDRESS 1
-#define INCORRECT_TRIES_ADDRESS 1 + sizeof(int[4]) //Calculate size of the memory block we use to store our code.
-
-#define MAX_INCORRECT_TRIES 3
-#define LOCK_TIME_SECONDS 180
-#define BUZZER_SOUND_TIME 1000
-
-void SetupPasswordManager(bool alreadyInitialized);
-bool ResetPasswordButtonPressed();
-
-bool IsPasswordCorrect(int code[4]);
-int AmountOfCorrectTries();
-void SetPasscode(int code[4]);
-void SoundBuzzer();
+#define PIN_RESET_PASSWORD_BUTTON 2 //23 on pcb
+
+
+#define MAX_INCORRECT_TRIES 3
+#define LOCK_TIME_SECONDS 180
+#define LOCKDOWN_SAVE_INTERVAL 10 //Seconds between saving the remaining lockdown time
+
+void SetupPasswordManager(bool alreadyInitialized, void (*onResetButtonCallback)()); //The callback is attached as the reset button's interrupt, NULL for none.
+bool ResetPasswordButtonPressed();
+
+bool IsPasswordCorrect(int code[4]); //Any code that may open the vault now: the admin's, a user's or a one-time code.
+bool IsAdminCodeCorrect(int code[4]);
+struct CredentialMatch LastCredentialMatch(); //What the last code checked turned out to be, see CredentialManager.h.
+int AmountOfCorrectTries();
+int GetIncorrectTries(); //Same as AmountOfCorrectTries() without printing, for status requests.
+bool SetPasscode(int code[4]); //Replaces the admin code. False if a user already has this code.
@@ -1,96 +1,145 @@
-#include "Arduino.h"
-#include "RotaryDrivers.h"
-
-unsigned long lastButtonPress = 0;
-volatile int counter;
-volatile bool flagA;
-volatile bool flagB;
-
-//Read the current state of both rotary encoder pins and map them into a single byte value.
-byte ReadInputs()
-{
-    byte retVal = 0;
-
-    retVal |= digitalRead(PIN_CLOCKWISE);
-    retVal = retVal << 1;
-    retVal |= digitalRead(PIN_COUNTERCLOCKWISE);
-
-    return retVal;
-}
-
-//interrupt to be attached to pin A of the rotary encoder
-void IRAM_ATTR PinA()
-{
-    byte val = ReadInputs(); //Get both states of the rotary encoder's pins
-
-    //Check if we have already encountered flag B and if both pins are high.
-    if(flagB && val == 3) //If we have this means we are rotating counter clockwise.
-    {
-      counter--; //decrement the counter. Also clamp the counter within its minimum and maximum range. (between 0 - 9)
-      if(counter > RANGE_MAXIMUM_VALUE) counter = RANGE_MINIMUM_VALUE;
-      if(counter < RANGE_MINIMUM_VALUE) counter = RANGE_MAXIMUM_VALUE;
-      flagB = false;
-      flagA = false;
-    }
-    else if(val == 2) //If we havent encountered flag B yet or not all pins are high, but the value corresponding with pin A is high, set flag A to true.
-    {
-      flagA = true;
-    }
-}
-
-//interrupt to be attached to pin B of the rotary encoder
-void IRAM_ATTR PinB()
-{
-    byte val = ReadInputs(); //Get both states of the rotary encoder's pins
-
-    //Check if we have already encountered flag A and if both pins are high.
-    if(flagA && val == 3) //If we have this means we are rotating counter clockwise.
-    {
-      counter++; //increment the counter. Also clamp the counter within its minimum and maximum range. (between 0 - 9)
-      if(counter > RANGE_MAXIMUM_VALUE) counter = RANGE_MINIMUM_VALUE;
-      if(counter < RANGE_MINIMUM_VALUE) counter = RANGE_MAXIMUM_VALUE;
-      flagB = false;
-      flagA = false;
-    }
-    else if(val == 1) //If we havent encountered flag A yet or not all pins are high, but the value corresponding with pin B is high, set flag B to true.
-    {
-      flagB = true;
-    }
-}
-
-void SetupRotaryEncoder()
-{
-    //Setup the pins we need to use for the rotary encoder
-    pinMode(PIN_BUTTON_PRESS, INPUT);
-    pinMode(PIN_CLOCKWISE, INPUT);
-    pinMode(PIN_COUNTERCLOCKWISE, INPUT);
-    
-    attachInterrupt(PIN_CLOCKWISE,PinA,FALLING); // set an interrupt on PinA, looking for a falling edge signal and executing the "PinA" Interrupt Service Routine (above)
-    attachInterrupt(PIN_COUNTERCLOCKWISE,PinB,FALLING); // set an interrupt on PinB, looking for a falling edge signal and executing the "PinB" Interrupt Service Routine (above)
-}
-
-void UpdateRotaryEncoder(int *value, void (*onButtonPressCallback)())
-{
-    //Update the value reference we are receiving.
-    *value = counter;
-  
-    //Check if the encoder's button is being pressed.
-    if (digitalRead(PIN_BUTTON_PRESS)) 
-    {
-        //if 50ms have passed since last LOW pulse, it means that the
-        //button has been pressed, released and pressed again
-        if (millis() - lastButtonPress > 50) 
-        {    
-          onButtonPressCallback();
-        }
-    
-        // Remember last button press event
-        lastButtonPress = millis();
-    }
-}
-
-//A small method called by ResetInput() to make sure the rotary encoder starts at 0 on a new digit or after entering a full code.
-void ResetRotaryCounter()
-{
-  counter = 0;
-}
+#include "Arduino.h"
+#include <FastPin.h>
+#include "RotaryDrivers.h"
+#include "TraceManager.h"
+
+#define CLOCKWISE_BIT PinBit<PIN_CLOCKWISE>()
+#define COUNTERCLOCKWISE_BIT PinBit<PIN_COUNTERCLOCKWISE>()
+#define BUTTON_BIT PinBit<PIN_BUTTON_PRESS>()
+#define REST_STATE 3 //Both contacts open, where the encoder sits between detents
+
+//Quarter steps for every (previous state << 2 | new state), where a state is clockwise pin << 1 | counterclockwise pin.
+//Turning clockwise goes 3 -> 1 -> 0 -> 2 -> 3. Impossible jumps (both pins changed) count as nothing.
+const signed char QUADRATURE_TABLE[16] =
+{
+     0, -1,  1,  0,
+     1,  0,  0, -1,
+    -1,  0,  0,  1,
+     0,  1, -1,  0
+};
+
+//Single producer/single consumer ring. The GPIO interrupts share one handler on the core that attached them, so they
+//never run at the same time and together are the only producer. HandleInput is the only consumer.
+RotaryEvent rotaryEvents[ROTARY_EVENT_BUFFER_SIZE];
+std::atomic<unsigned int> rotaryEventHead {0};
+std::atomic<unsigned int> rotaryEventTail {0};
+volatile unsigned long droppedRotaryEvents = 0;
+void (*rotaryEventCallback)() = NULL;
+
+byte quadratureState = REST_STATE;
+int quarterSteps = 0;
+unsigned long lastButtonEdge = 0;
+
+unsigned long lastStepTime = 0;
+signed char lastStepDirection = 0;
+
+typedef InputPins<PIN_BUTTON_PRESS, PIN_CLOCKWISE, PIN_COUNTERCLOCKWISE> RotaryPins;
+
+//Read the current state of both rotary encoder pins and the button in a single read of their port.
+uint32_t IRAM_ATTR ReadInputs()
+{
+    return RotaryPins::Read();
+}
+
+byte IRAM_ATTR QuadratureState(uint32_t levels)
+{
+    return ((levels & CLOCKWISE_BIT) ? 2 : 0) | ((levels & COUNTERCLOCKWISE_BIT) ? 1 : 0);
+}
+
+void IRAM_ATTR PushRotaryEvent(RotaryEventType type, signed char direction, unsigned long time)
+{
+    unsigned int head = rotaryEventHead.load(std::memory_order_relaxed);
+    if(head - rotaryEventTail.load(std::memory_order_acquire) >= ROTARY_EVENT_BUFFER_SIZE)
+    {
+        droppedRotaryEvents++; //HandleInput hasnt kept up, the oldest events are worth more than this one.
+        return;
+    }
+
+    RotaryEvent *event = &rotaryEvents[head % ROTARY_EVENT_BUFFER_SIZE];
+    event->time = time;
+    event->type = type;
+    event->direction = direction;
+    rotaryEventHead.store(head + 1, std::memory_order_release);
+
+    if(rotaryEventCallback != NULL) rotaryEventCallback();
+}
+
+//Attached to both encoder pins on every edge. A step is counted once the encoder is back at rest between detents, as long as
+//it got there by turning at least half way in one direction, so a lost edge or contact bounce doesnt lose or add a step.
+void IRAM_ATTR RotaryISR()
+{
+    TRACE_BEGIN(TraceRotaryISR, 0);
+    byte state = QuadratureState(ReadInputs());
+
+    quarterSteps += QUADRATURE_TABLE[(quadratureState << 2) | state];
+    quadratureState = state;
+
+    if(state == REST_STATE)
+    {
+        if(quarterSteps >= 2) PushRotaryEvent(RotaryStep, 1, micros());
+        else if(quarterSteps <= -2) PushRotaryEvent(RotaryStep, -1, micros());
+        quarterSteps = 0;
+    }
+    TRACE_END(TraceRotaryISR, 0);
+}
+
+void IRAM_ATTR ButtonISR()
+{
+    TRACE_BEGIN(TraceButtonISR, 0);
+    unsigned long now = micros();
+
+    //Only a press after the button was quiet for a while counts, so bouncing on either edge doesnt give extra presses.
+    if((ReadInputs() & BUTTON_BIT) && now - lastButtonEdge > BUTTON_DEBOUNCE_US) PushRotaryEvent(RotaryButton, 0, now);
+    lastButtonEdge = now;
+    TRACE_END(TraceButtonISR, 0);
+}
+
+void SetupRotaryEncoder(void (*onEventCallback)())
+{
+    rotaryEventCallback = onEventCallback;
+
+    //Setup the pins we need to use for the rotary encoder
+    pinMode(PIN_BUTTON_PRESS, INPUT);
+    pinMode(PIN_CLOCKWISE, INPUT);
+    pinMode(PIN_COUNTERCLOCKWISE, INPUT);
+
+    quadratureState = QuadratureState(ReadInputs());
+    
+    attachInterrupt(PIN_CLOCKWISE, RotaryISR, CHANGE);
+    attachInterrupt(PIN_COUNTERCLOCKWISE, RotaryISR, CHANGE);
+    attachInterrupt(PIN_BUTTON_PRESS, ButtonISR, CHANGE);
+}
+
+//Take the oldest event out of the ring. Returns false when there is nothing left.
+bool ReadRotaryEvent(RotaryEvent *event)
+{
+    unsigned int tail = rotaryEventTail.load(std::memory_order_relaxed);
+    if(tail == rotaryEventHead.load(std::memory_order_acquire)) return false;
+
+    *event = rotaryEvents[tail % ROTARY_EVENT_BUFFER_SIZE];
+    rotaryEventTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+//Forget everything that hasnt been handled yet. Called by ResetInput() so turns and presses made while input was ignored dont count later.
+void ClearRotaryEvents()
+{
+    rotaryEventTail.store(rotaryEventHead.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+//How far a step event should move the value. The faster the encoder turns in one direction, the further each step goes.
+int RotaryStepSize(RotaryEvent *event)
+{
+    unsigned long interval = event->time - lastStepTime;
+    bool sameDirection = event->direction == lastStepDirection;
+    lastStepTime = event->time;
+    lastStepDirection = event->direction;
+
+    if(!sameDirection || interval >= ROTARY_ACCELERATION_US) return event->direction;
+    return event->direction * (1 + ((ROTARY_MAXIMUM_STEP - 1) * (ROTARY_ACCELERATION_US - interval) + ROTARY_ACCELERATION_US / 2) / ROTARY_ACCELERATION_US);
+}
+
+unsigned long GetDroppedRotaryEvents()
+{
+    return droppedRotaryEvents;
+}
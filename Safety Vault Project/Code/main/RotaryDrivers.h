@@ -1,10 +1,33 @@
-#define PIN_BUTTON_PRESS 32
-#define PIN_CLOCKWISE 34
-#define PIN_COUNTERCLOCKWISE 35
-
-#define RANGE_MINIMUM_VALUE 0
-#define RANGE_MAXIMUM_VALUE 9
-
-void SetupRotaryEncoder();
-void ResetRotaryCounter();
-void UpdateRotaryEncoder(int *value, void (*onButtonPressCallback)());
+#include <atomic>
+
+#define PIN_BUTTON_PRESS 32
+#define PIN_CLOCKWISE 34
+#define PIN_COUNTERCLOCKWISE 35
+
+#define RANGE_MINIMUM_VALUE 0
+#define RANGE_MAXIMUM_VALUE 9
+
+#define ROTARY_EVENT_BUFFER_SIZE 32     //Events the interrupts can queue before HandleInput picks them up. Must be a power of 2.
+#define BUTTON_DEBOUNCE_US 50000        //A press only counts if the button was quiet this long before
+#define ROTARY_ACCELERATION_US 15000    //Steps closer together than this move the value further
+#define ROTARY_MAXIMUM_STEP 2           //How far a single step can move the value when spinning as fast as possible
+
+enum RotaryEventType
+{
+  RotaryStep,
+  RotaryButton
+};
+
+//Something the rotary encoder did, timestamped by the interrupt that saw it.
+struct RotaryEvent
+{
+  unsigned long time;       //micros()
+  RotaryEventType type;
+  signed char direction;    //1 clockwise, -1 counterclockwise
+};
+
+void SetupRotaryEncoder(void (*onEventCallback)()); //The callback runs in the interrupt after every event it queues, NULL for none.
+bool ReadRotaryEvent(RotaryEvent *event);
+void ClearRotaryEvents();
+int RotaryStepSize(RotaryEvent *event);
+unsigned long GetDroppedRotaryEvents();
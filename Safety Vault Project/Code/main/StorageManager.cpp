@@ -0,0 +1,316 @@
+#include "Arduino.h"
+#include "esp_partition.h"
+#include <EEPROM.h>
+#include "rom/crc.h"
+#include "StorageManager.h"
+#include "TraceManager.h"
+
+#define STORAGE_MAGIC 0x5641554C  //"VAUL"
+#define SLOT_SIZE 16
+#define SLOTS_PER_PAGE (STORAGE_PAGE_SIZE / SLOT_SIZE)
+#define RECORD_FIRST 0x80         //Key flag: first record of a commit
+#define RECORD_LAST 0x40          //Key flag: last record of a commit, the commit counts once this one is in flash
+#define RECORD_KEY_MASK 0x3F
+#define RECORD_REMOVED 0xFF       //Length of a record that removes its key
+
+//Where the firmware before this store kept its values in EEPROM. Its EEPROM lived in the nvs partition, which is still there.
+#define EEPROM_SIZE 512
+#define EEPROM_INIT_FLAG_ADDRESS 0
+#define EEPROM_PASSCODE_ADDRESS 1       //One byte per digit, the room of an int[4] was kept for it
+#define EEPROM_DIGIT_AMOUNT 4
+#define EEPROM_INCORRECT_TRIES_ADDRESS 1 + sizeof(int[4])
+#define EEPROM_VAULT_STATE_ADDRESS EEPROM_INCORRECT_TRIES_ADDRESS + 1
+
+//Starts every page that is in use. It is written after the values copied into the page, so a page with a valid header is
+//always complete.
+struct StoragePageHeader
+{
+  uint32_t magic;
+  uint32_t sequence;  //Goes up by one for every new page, the highest valid one is the current page
+  uint32_t unused;
+  uint32_t crc;
+};
+
+struct StorageRecord
+{
+  uint8_t key;        //StorageKey | RECORD_FIRST | RECORD_LAST. Never 0xFF, so an erased slot cant be mistaken for a record.
+  uint8_t length;     //RECORD_REMOVED if the key was removed
+  uint8_t value[STORAGE_VALUE_SIZE];
+  uint32_t crc;
+};
+
+struct StoredValue
+{
+  uint8_t value[STORAGE_VALUE_SIZE];
+  uint8_t length;
+  bool present;
+};
+
+const esp_partition_t *storagePartition = NULL;
+int storagePageAmount = 0;
+int currentPage = 0;
+uint32_t currentSequence = 0;
+int nextSlot = SLOTS_PER_PAGE; //Where the next record goes in the current page
+
+StoredValue committedValues[STORAGE_KEY_AMOUNT]; //What is in flash
+StoredValue pendingValues[STORAGE_KEY_AMOUNT];   //What will be in flash after the next commit
+
+uint32_t HeaderCrc(StoragePageHeader *header)
+{
+  return crc32_le(0, (const uint8_t *)header, offsetof(StoragePageHeader, crc));
+}
+
+uint32_t RecordCrc(StorageRecord *record)
+{
+  return crc32_le(0, (const uint8_t *)record, offsetof(StorageRecord, crc));
+}
+
+bool ReadPageHeader(int page, StoragePageHeader *header)
+{
+  esp_partition_read(storagePartition, page * STORAGE_PAGE_SIZE, header, sizeof(StoragePageHeader));
+  return header->magic == STORAGE_MAGIC && header->crc == HeaderCrc(header);
+}
+
+bool IsErased(const uint8_t *data, int length)
+{
+  for(int i = 0; i < length; i++)
+  {
+    if(data[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+//Read the records of the current page. A commit is only applied once its last record has been read, records of a commit that
+//was cut short are thrown away.
+void ReplayPage()
+{
+  static StorageRecord records[SLOTS_PER_PAGE];
+  esp_partition_read(storagePartition, currentPage * STORAGE_PAGE_SIZE, records, sizeof(records));
+
+  StoredValue batch[STORAGE_KEY_AMOUNT];
+  memset(batch, 0, sizeof(batch));
+  memset(committedValues, 0, sizeof(committedValues));
+  nextSlot = 1;
+
+  for(int slot = 1; slot < SLOTS_PER_PAGE; slot++)
+  {
+    StorageRecord *record = &records[slot];
+    if(IsErased((const uint8_t *)record, SLOT_SIZE)) continue;
+    nextSlot = slot + 1; //Never write over anything, not even a half written record.
+
+    int key = record->key & RECORD_KEY_MASK;
+    if(record->crc != RecordCrc(record) || key >= STORAGE_KEY_AMOUNT || (record->length > STORAGE_VALUE_SIZE && record->length != RECORD_REMOVED))
+    {
+      memset(batch, 0, sizeof(batch));
+      continue;
+    }
+
+    if(record->key & RECORD_FIRST) memset(batch, 0, sizeof(batch));
+    memcpy(batch[key].value, record->value, STORAGE_VALUE_SIZE);
+    batch[key].length = record->length;
+    batch[key].present = true;
+
+    if(record->key & RECORD_LAST)
+    {
+      for(int i = 0; i < STORAGE_KEY_AMOUNT; i++)
+      {
+        if(batch[i].present) committedValues[i] = batch[i];
+        if(batch[i].length == RECORD_REMOVED) memset(&committedValues[i], 0, sizeof(StoredValue));
+      }
+      memset(batch, 0, sizeof(batch));
+    }
+  }
+}
+
+//Vaults updated from the EEPROM firmware boot with an empty store. Take their code, incorrect tries and vault state over so
+//they dont come up as never set up, with whoever comes next picking the admin code, and dont forget a lockdown.
+void ImportEeprom()
+{
+  if(!EEPROM.begin(EEPROM_SIZE)) return;
+
+  if(EEPROM.read(EEPROM_INIT_FLAG_ADDRESS) == 1)
+  {
+    uint8_t passcode[EEPROM_DIGIT_AMOUNT];
+    for(int i = 0; i < EEPROM_DIGIT_AMOUNT; i++) passcode[i] = EEPROM.read(EEPROM_PASSCODE_ADDRESS + i);
+    int incorrectTries = EEPROM.read(EEPROM_INCORRECT_TRIES_ADDRESS);
+    int vaultState = EEPROM.read(EEPROM_VAULT_STATE_ADDRESS);
+
+    //SetupCredentials() moves the code into the credential table.
+    WriteStorage(StoredPasscode, passcode, sizeof(passcode));
+    WriteStorage(StoredIncorrectTries, &incorrectTries, sizeof(incorrectTries));
+    WriteStorage(StoredVaultState, &vaultState, sizeof(vaultState));
+    if(CommitStorage())
+    {
+      //Once the store has them, forget the old values. The digits shouldnt stay readable in flash, and a store that is found
+      //empty later on must not bring back a code from years ago.
+      EEPROM.write(EEPROM_INIT_FLAG_ADDRESS, 0xFF);
+      for(int i = 0; i < EEPROM_DIGIT_AMOUNT; i++) EEPROM.write(EEPROM_PASSCODE_ADDRESS + i, 0xFF);
+      EEPROM.commit();
+      Serial.println("Imported the EEPROM values");
+    }
+  }
+  EEPROM.end();
+}
+
+bool SetupStorage()
+{
+  storagePartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, STORAGE_PARTITION_LABEL);
+  if(storagePartition == NULL)
+  {
+    Serial.println("Storage partition not found");
+    return false;
+  }
+  storagePageAmount = storagePartition->size / STORAGE_PAGE_SIZE;
+
+  //Find the page with the highest sequence. If there is none the vault has never saved anything.
+  currentPage = -1;
+  currentSequence = 0;
+  for(int page = 0; page < storagePageAmount; page++)
+  {
+    StoragePageHeader header;
+    if(ReadPageHeader(page, &header) && (currentPage < 0 || header.sequence > currentSequence))
+    {
+      currentPage = page;
+      currentSequence = header.sequence;
+    }
+  }
+
+  bool empty = currentPage < 0;
+  if(!empty)
+  {
+    ReplayPage();
+  }
+  else
+  {
+    memset(committedValues, 0, sizeof(committedValues));
+    currentPage = storagePageAmount - 1; //So the first commit starts on page 0
+    nextSlot = SLOTS_PER_PAGE;
+  }
+
+  memcpy(pendingValues, committedValues, sizeof(pendingValues));
+  if(empty) ImportEeprom();
+  return true;
+}
+
+bool IsStored(StorageKey key)
+{
+  return pendingValues[key].present;
+}
+
+int StoredLength(StorageKey key)
+{
+  return pendingValues[key].present ? pendingValues[key].length : 0;
+}
+
+bool ReadStorage(StorageKey key, void *value, int length)
+{
+  if(!pendingValues[key].present) return false;
+
+  if(length > pendingValues[key].length) length = pendingValues[key].length;
+  memcpy(value, pendingValues[key].value, length);
+  return true;
+}
+
+void WriteStorage(StorageKey key, const void *value, int length)
+{
+  if(length > STORAGE_VALUE_SIZE) length = STORAGE_VALUE_SIZE;
+
+  memset(pendingValues[key].value, 0, STORAGE_VALUE_SIZE);
+  memcpy(pendingValues[key].value, value, length);
+  pendingValues[key].length = length;
+  pendingValues[key].present = true;
+}
+
+void RemoveStorage(StorageKey key)
+{
+  memset(&pendingValues[key], 0, sizeof(StoredValue));
+}
+
+//A removed key is changed too while it is still in flash.
+bool IsChanged(int key)
+{
+  return memcmp(&pendingValues[key], &committedValues[key], sizeof(StoredValue)) != 0;
+}
+
+//Write the given keys as one commit starting at the given slot.
+bool WriteRecords(int page, int slot, const bool keys[STORAGE_KEY_AMOUNT], int amount)
+{
+  StorageRecord records[STORAGE_KEY_AMOUNT];
+  int written = 0;
+
+  for(int key = 0; key < STORAGE_KEY_AMOUNT; key++)
+  {
+    if(!keys[key]) continue;
+
+    StorageRecord *record = &records[written];
+    record->key = key;
+    if(written == 0) record->key |= RECORD_FIRST;
+    if(written == amount - 1) record->key |= RECORD_LAST;
+    record->length = pendingValues[key].present ? pendingValues[key].length : RECORD_REMOVED;
+    memcpy(record->value, pendingValues[key].value, STORAGE_VALUE_SIZE);
+    record->crc = RecordCrc(record);
+    written++;
+  }
+
+  return esp_partition_write(storagePartition, page * STORAGE_PAGE_SIZE + slot * SLOT_SIZE, records, amount * SLOT_SIZE) == ESP_OK;
+}
+
+//Start the next page with a copy of every value, then make it the current page by writing its header.
+bool MoveToNextPage()
+{
+  int page = (currentPage + 1) % storagePageAmount;
+  if(esp_partition_erase_range(storagePartition, page * STORAGE_PAGE_SIZE, STORAGE_PAGE_SIZE) != ESP_OK) return false;
+
+  bool keys[STORAGE_KEY_AMOUNT];
+  int amount = 0;
+  for(int key = 0; key < STORAGE_KEY_AMOUNT; key++)
+  {
+    keys[key] = pendingValues[key].present;
+    if(keys[key]) amount++;
+  }
+  if(!WriteRecords(page, 1, keys, amount)) return false;
+
+  StoragePageHeader header;
+  header.magic = STORAGE_MAGIC;
+  header.sequence = currentSequence + 1;
+  header.unused = 0xFFFFFFFF;
+  header.crc = HeaderCrc(&header);
+  if(esp_partition_write(storagePartition, page * STORAGE_PAGE_SIZE, &header, sizeof(header)) != ESP_OK) return false;
+
+  currentPage = page;
+  currentSequence = header.sequence;
+  nextSlot = 1 + amount;
+  return true;
+}
+
+bool CommitStorage()
+{
+  if(storagePartition == NULL) return false;
+
+  bool keys[STORAGE_KEY_AMOUNT];
+  int amount = 0;
+  for(int key = 0; key < STORAGE_KEY_AMOUNT; key++)
+  {
+    keys[key] = IsChanged(key);
+    if(keys[key]) amount++;
+  }
+  if(amount == 0) return true; //Nothing changed, dont touch the flash at all.
+
+  TRACE_BEGIN(TraceStorageCommit, amount);
+
+  bool written;
+  if(nextSlot + amount > SLOTS_PER_PAGE)
+  {
+    written = MoveToNextPage(); //The copy in the new page already has the changed values in it.
+  }
+  else
+  {
+    written = WriteRecords(currentPage, nextSlot, keys, amount);
+    nextSlot += amount;
+  }
+
+  //What didnt make it stays changed, so the next commit writes it again.
+  if(written) memcpy(committedValues, pendingValues, sizeof(committedValues));
+  TRACE_END(TraceStorageCommit, amount);
+  return written;
+}
@@ -0,0 +1,28 @@
+//Small journaled key/value store in the "vault" flash partition (see partitions.csv), used instead of EEPROM so saving a value
+//doesnt erase a flash sector every time. Records are appended to the current page, and only when it is full are the latest
+//values copied over to the next page round robin, so erases are rare and spread over every page. Every record has a CRC and
+//the records of one CommitStorage() only count once all of them made it to flash, so a power cut loses either the whole commit
+//or nothing. A vault updated from the firmware that used EEPROM takes its values over on the first boot and clears them from
+//EEPROM, see ImportEeprom().
+#define STORAGE_PARTITION_LABEL "vault"
+#define STORAGE_PAGE_SIZE 4096    //One flash sector, the smallest part that can be erased
+#define STORAGE_VALUE_SIZE 10     //Largest value a single key can hold
+
+enum StorageKey
+{
+  StoredPasscode,
+  StoredIncorrectTries,
+  StoredVaultState,
+  StoredLockdownSeconds,
+  StoredCredentialSalt,   //See CredentialManager.h
+  StoredCredentialTable,
+  STORAGE_KEY_AMOUNT
+};
+
+bool SetupStorage(); //Returns false if the partition cant be found. Imports the old EEPROM values when nothing was stored yet.
+bool IsStored(StorageKey key);
+int StoredLength(StorageKey key); //0 if the key isnt stored.
+bool ReadStorage(StorageKey key, void *value, int length); //Returns false if the key was never stored.
+void WriteStorage(StorageKey key, const void *value, int length); //Only changes the value in RAM. Writing the same value again is free.
+void RemoveStorage(StorageKey key); //Only in RAM as well, the key counts as never stored after the next commit.
+bool CommitStorage(); //Saves every value that changed since the last commit in one go. Returns false if the flash couldnt be written.
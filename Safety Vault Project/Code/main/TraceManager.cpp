@@ -0,0 +1,164 @@
+#include <atomic>
+#include "Arduino.h"
+#include "TraceManager.h"
+
+#if TRACE_ENABLED
+
+struct TraceSlot
+{
+  TraceRecord record;
+  std::atomic<uint32_t> sequence {0}; //Index + 1 of the record once it is written
+};
+
+//Multiple producer/single consumer ring. Interrupts and tasks on the same core can preempt each other halfway through
+//recording, so a slot is claimed with a compare and swap on the head and only counts as written once its sequence is set.
+//The core's drain task is the only consumer. It stops at a slot that is claimed but not written yet and picks it up next time.
+struct TraceRing
+{
+  TraceSlot slots[TRACE_BUFFER_SIZE];
+  std::atomic<uint32_t> head {0};
+  std::atomic<uint32_t> tail {0};
+  std::atomic<unsigned long> dropped {0};
+  unsigned long droppedSent = 0;      //Drain task only
+};
+
+TraceRing traceRings[TRACE_CORE_AMOUNT];
+TraceStats traceStats;
+
+//Never blocks and never allocates, so it can be called from anywhere, interrupts included.
+void IRAM_ATTR TraceRecordEvent(TraceEventType type, TracePhase phase, uint16_t argument)
+{
+    uint32_t cycles = ESP.getCycleCount();
+    int core = xPortGetCoreID();
+    TraceRing *ring = &traceRings[core];
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t waiting;
+    do
+    {
+        waiting = head - ring->tail.load(std::memory_order_acquire);
+        if(waiting >= TRACE_BUFFER_SIZE)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed); //The drain task is behind. The oldest records show how we got here, keep those.
+            return;
+        }
+    } while(!ring->head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed));
+
+    TraceSlot *slot = &ring->slots[head % TRACE_BUFFER_SIZE];
+    slot->record.cycles = cycles;
+    slot->record.type = type;
+    slot->record.phase = phase;
+    slot->record.argument = argument;
+    slot->sequence.store(head + 1, std::memory_order_release);
+
+    if(waiting + 1 > traceStats.mostWaiting[core]) traceStats.mostWaiting[core] = waiting + 1;
+}
+
+void PutLittleEndian(uint8_t *out, uint32_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++) out[i] = value >> (8 * i);
+}
+
+//Send up to a frame of the records written so far. Returns how many were sent.
+int SendTraceFrame(int core)
+{
+    TraceRing *ring = &traceRings[core];
+    uint8_t frame[TRACE_FRAME_SIZE(TRACE_FRAME_RECORDS)];
+    uint8_t *out = frame + TRACE_FRAME_HEADER_SIZE;
+
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    int amount = 0;
+    while(amount < TRACE_FRAME_RECORDS)
+    {
+        TraceSlot *slot = &ring->slots[(tail + amount) % TRACE_BUFFER_SIZE];
+        if(slot->sequence.load(std::memory_order_acquire) != tail + amount + 1) break; //Claimed by a writer we preempted, or empty
+
+        PutLittleEndian(out, slot->record.cycles, 4);
+        out[4] = slot->record.type;
+        out[5] = slot->record.phase;
+        PutLittleEndian(out + 6, slot->record.argument, 2);
+        out += TRACE_RECORD_SIZE;
+        amount++;
+    }
+    ring->tail.store(tail + amount, std::memory_order_release);
+
+    unsigned long dropped = ring->dropped.load(std::memory_order_relaxed);
+    unsigned long newlyDropped = dropped - ring->droppedSent;
+    if(amount == 0 && newlyDropped == 0) return 0;
+    ring->droppedSent = dropped;
+
+    frame[0] = TRACE_FRAME_MAGIC_1;
+    frame[1] = TRACE_FRAME_MAGIC_2;
+    frame[2] = core;
+    frame[3] = amount;
+    PutLittleEndian(frame + 4, newlyDropped > 0xFFFF ? 0xFFFF : newlyDropped, 2);
+
+    uint8_t checksum = 0;
+    for(uint8_t *data = frame + 2; data < out; data++) checksum ^= *data;
+    *out++ = checksum;
+
+    //The Arduino core holds the UART lock for a whole write, so frames from both cores and println()s dont get mixed up.
+    Serial.write(frame, out - frame);
+
+    traceStats.records[core] += amount;
+    traceStats.dropped[core] = dropped;
+    traceStats.frames[core]++;
+    traceStats.bytes[core] += out - frame;
+    return amount;
+}
+
+//One per core, pinned to it, so every core records a drain span at least every TRACE_DRAIN_INTERVAL. That keeps the gaps
+//between the records of a core short enough for the decoder to count the wraps of its 32 bit cycle counter.
+void TraceDrainTask(void *parameter)
+{
+    int core = (int)(intptr_t)parameter;
+
+    for(;;)
+    {
+        vTaskDelay(TRACE_DRAIN_INTERVAL / portTICK_PERIOD_MS);
+
+        TRACE_BEGIN(TraceDrain, 0);
+        int sent = 0;
+        int amount;
+        do
+        {
+            amount = SendTraceFrame(core);
+            sent += amount;
+        } while(amount == TRACE_FRAME_RECORDS);
+        TRACE_END(TraceDrain, sent);
+    }
+}
+
+void SetupTrace()
+{
+    for(int core = 0; core < TRACE_CORE_AMOUNT; core++)
+    {
+        xTaskCreatePinnedToCore(
+          TraceDrainTask,         // Function that should be called
+          "Trace Drain",          // Name of the task (for debugging)
+          2048,                   // Stack size (bytes)
+          (void *)(intptr_t)core, // Parameter to pass
+          TRACE_DRAIN_PRIORITY,   // Task priority (0 - 24) 0 = lowest, 24 = highest
+          NULL,                   // Task handle
+          core                    // Core to run on
+        );
+    }
+}
+
+TraceStats GetTraceStats()
+{
+    return traceStats;
+}
+
+#else
+
+void SetupTrace()
+{
+}
+
+TraceStats GetTraceStats()
+{
+    return TraceStats();
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdint.h>
+
+//Hot path tracing. Interrupts and tasks record small fixed size events, timestamped with the CPU cycle counter, into a ring
+//per core without ever blocking. A low priority task per core drains its ring to Serial as binary frames, which the host tool
+//in sim/tools turns into latency histograms and a Chrome trace. Build with -DTRACE_ENABLED=true to turn it on, every TRACE_
+//macro compiles to nothing otherwise.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED false
+#endif
+
+#define TRACE_CORE_AMOUNT 2
+#define TRACE_BUFFER_SIZE 256       //Records each core can hold until its drain task gets to them. Must be a power of 2.
+#define TRACE_FRAME_RECORDS 32      //Most records sent in one frame
+#define TRACE_DRAIN_INTERVAL 20     //ms between drains. Each drain also records a span, so the timestamps of a quiet core cant wrap unnoticed.
+#define TRACE_DRAIN_PRIORITY 0      //Below loop(), so the drain only gets the CPU when nothing else wants it
+#define TRACE_BAUD_RATE 921600      //The display alone traces 2000 records a second, more than 115200 baud can carry
+
+//A frame is TRACE_FRAME_MAGIC, the core, the amount of records, the records dropped on that core since the last frame
+//(2 bytes, little endian, saturating), the records and the XOR of every byte after the magic.
+#define TRACE_FRAME_MAGIC_1 0xA5
+#define TRACE_FRAME_MAGIC_2 0x5A
+#define TRACE_FRAME_HEADER_SIZE 6
+#define TRACE_FRAME_SIZE(records) (TRACE_FRAME_HEADER_SIZE + (records) * TRACE_RECORD_SIZE + 1)
+
+enum TraceEventType
+{
+  TraceLoop,            //One round of loop(), argument is the VaultEventType it handled
+  TraceRotaryISR,
+  TraceButtonISR,
+  TraceDisplaySlot,     //Display refresh interrupt, argument is the digit
+  TraceEventPosted,     //An interrupt or the Bluetooth stack woke loop(), argument is the VaultEventType
+  TraceStorageCommit,   //Argument is the amount of values saved
+  TraceBluetoothFrame,  //Carrying out a Bluetooth message, argument is the command
+  TraceLightSleep,
+  TraceVaultState,      //The state changed, argument is the new state
+  TraceDoorState,
+  TraceInputTask,
+  TraceDrain,           //A drain task sending its core's records, argument is how many
+  TRACE_EVENT_TYPE_AMOUNT
+};
+
+const char *const TRACE_EVENT_NAMES[TRACE_EVENT_TYPE_AMOUNT] =
+{
+  "loop", "rotary isr", "button isr", "display slot", "event posted", "storage commit", "bluetooth frame", "light sleep",
+  "vault state", "door state", "input task", "trace drain"
+};
+
+enum TracePhase
+{
+  TraceBegin,
+  TraceEnd,
+  TraceInstant
+};
+
+//Sent as is, little endian like the ESP32.
+struct TraceRecord
+{
+  uint32_t cycles;      //CPU cycle counter of the core that recorded it. Wraps every 17.9s at 240MHz.
+  uint8_t type;
+  uint8_t phase;
+  uint16_t argument;
+};
+#define TRACE_RECORD_SIZE 8
+
+//Per core.
+struct TraceStats
+{
+  unsigned long records[TRACE_CORE_AMOUNT] = {};      //Sent
+  unsigned long dropped[TRACE_CORE_AMOUNT] = {};      //Lost because the ring was full
+  unsigned long mostWaiting[TRACE_CORE_AMOUNT] = {};  //Fullest the ring has been
+  unsigned long frames[TRACE_CORE_AMOUNT] = {};
+  unsigned long bytes[TRACE_CORE_AMOUNT] = {};
+};
+
+void SetupTrace(); //Call after Serial.begin().
+void TraceRecordEvent(TraceEventType type, TracePhase phase, uint16_t argument);
+TraceStats GetTraceStats();
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(type, argument) TraceRecordEvent(type, TraceBegin, argument)
+#define TRACE_END(type, argument) TraceRecordEvent(type, TraceEnd, argument)
+#define TRACE_INSTANT(type, argument) TraceRecordEvent(type, TraceInstant, argument)
+#else
+#define TRACE_BEGIN(type, argument)
+#define TRACE_END(type, argument)
+#define TRACE_INSTANT(type, argument)
+#endif
@@ -1,302 +1,516 @@
-#include "DisplayDrivers.h"
-#include "InputHandling.h"
-#include "DoorDrivers.h"
-#include "PasswordManager.h"
-#include "BluetoothHandler.h"
-#include <EEPROM.h>
-
-#define EEPROM_SIZE 512
-#define INIT_FLAG_ADDRESS 0
-#define VAULT_STATE_ADDRESS INCORRECT_TRIES_ADDRESS + 1
-
-#define BLUETOOTH_ENABLED false
-
-DisplayData _data; //This variable is shared between all methods that need to use the display. The display drivers then use this data to display the correct digits etc.
-unsigned long timeWhenDoorUnlocked = 0; 
-unsigned long timeWhenDoorLocked = 0;
-unsigned long timeWhenDoorPhysicallyClosed = 0;
-int previousPhysicalDoorState;
-bool doorWasClosed = false;
-
-bool buzzerIsSounding = false;
-unsigned long buzzerStartedTime;
-
-enum VaultState
-{
-  AcceptingInput = 0,
-  InputLocked = 1
-};
-VaultState currentVaultState;
-
-enum InputHandlerTask
-{
-    EnteringCode,
-    ChangingPassword
-};
-InputHandlerTask currentInputTask;
-
-enum DoorState
-{
-    Locked,
-    Unlocked
-};
-DoorState currentDoorState;
-
-void setup() 
-{
-    //Initialize FLASH memory & Serial communication
-    EEPROM.begin(EEPROM_SIZE);
-    Serial.begin(115200);
-
-    //Initialize the Input, Display & Door drivers.
-    SetupInputHandler(&_data, &ReceivedInput);
-    SetupDisplayTask(&_data);
-    SetupDoorDrivers();
-
-    bool initialized = false;
-
-    //Check if our program has been initialized before (will always be true unless the chip was just reprogrammed)
-    if(EEPROM.read(INIT_FLAG_ADDRESS) == 1) //The program has already been initialized once. This means that the ESP32 lost power and has rebooted. No need to change password.
-    {       
-        initialized = true; //Set initialized to true. Used later to setup the password manager
-        
-        Serial.println("Already Initialized");
-
-        //Set states to their stored or default states.
-        currentInputTask = EnteringCode;
-        currentVaultState = (VaultState)EEPROM.read(VAULT_STATE_ADDRESS);
-
-        Serial.println("Vault already initialized, now accepting input.");
-    } 
-    else //The program has not been started before. This means we wont have a password so we need to ask for one.
-    {
-        Serial.println("Initializing");
-
-        //Write to memory that we have now initialized our program. We dont need to do this again on the next restart.
-        EEPROM.write(INIT_FLAG_ADDRESS, 1); 
-
-        //Set states to the default startup states. 
-        currentInputTask = ChangingPassword; //We currently dont have a password stored so we need to create one.
-        currentVaultState = AcceptingInput;
-
-        //Write to memory the current state of the vault.
-        EEPROM.write(VAULT_STATE_ADDRESS, currentVaultState);
-        EEPROM.commit();
-
-        Serial.println("Initializing Vault, Now using input to set new password.");
-    } 
-  
-    //Check whether or not the door is currently open or closed
-    if(IsDoorOpen())//Door is open
-    {
-        //Store when the door was opened
-        timeWhenDoorUnlocked = millis();
-
-        //Unlock the door and change the door state accordingly
-        currentDoorState = Unlocked;
-        Unlock();
-        Serial.println("Unlocking Vault.");
-    }
-    else //Door is closed
-    {
-        //Lock the door and change the door state accordingly
-        currentDoorState = Locked;
-        Lock();
-        timeWhenDoorLocked = millis();
-        ResetInput();
-        Serial.println("Locking Vault.");
-    }
-
-    //Initialize the Password & Bluetooth managers
-    SetupPasswordManager(initialized);
-    
-    if(BLUETOOTH_ENABLED) InitializeBluetooth(&CheckInput, &SetNewPassword);
-}
-
-void loop() 
-{
-    //Check if the user has not been locked out as of yet.
-    if(currentVaultState == AcceptingInput) //Vault has not locked the user out
-    {
-        //Update the Input & Bluetooth managers as they need an update loop.
-        HandleInput();
-        if(BLUETOOTH_ENABLED) HandleBluetooth();
-
-        //Check if the door is currently unlocked
-        if(currentDoorState == Unlocked)
-        {
-            //Check the current state of the physical door
-            int currentPhysicalDoorState = IsDoorOpen();
-
-            //Check if the physical door state changed
-            if(currentPhysicalDoorState != previousPhysicalDoorState)
-            {
-                //Check if the door transitioned from open to closed
-                if(!currentPhysicalDoorState) //Door was just closed
-                {
-                    //Save the time the door was closed on and set a flag indicating the door was closed to true
-                    timeWhenDoorPhysicallyClosed = millis();
-                    doorWasClosed = true;
-                }
-                else
-                {
-                    //door transitioned back to open before the door locked. Set this flag back to false.
-                    doorWasClosed = false;
-                }
-
-                //Save the current state so we only trigger this once.
-                previousPhysicalDoorState = currentPhysicalDoorState;
-            }
-
-            //Check if the door is closed but hasnt been opened yet. Then lock the door again after a preindicated delay.
-            if(!IsDoorOpen() && (millis() - timeWhenDoorUnlocked > UNLOCK_LOCK_DELAY) && !doorWasClosed)
-            {
-                //Lock the door and update state & flag accordingly
-                currentDoorState = Locked;
-                Lock();        
-                doorWasClosed = false;
-                timeWhenDoorLocked = millis();
-                ResetInput();
-                Serial.println("Locking vault.");
-            }
-            else if(!IsDoorOpen() && millis() - timeWhenDoorPhysicallyClosed > LOCK_DELAY && doorWasClosed) //Check if the door was recently closed and then wait a predetermined time to lock the gate
-            {
-                //Lock the door and update state & flag accordingly
-                currentDoorState = Locked;
-                Lock();     
-                doorWasClosed = false;
-                timeWhenDoorLocked = millis();
-                ResetInput();   
-                Serial.println("Locking vault.");
-            }
-    
-            //Scan if reset password was pressed, if so change input task to ChangingPassword 
-            if(ResetPasswordButtonPressed())
-            {
-                //Change our input task to changing the password.
-                currentInputTask = ChangingPassword;
-                Serial.println("Now changing stored password with next input.");
-            }
-        }
-        else if(IsDoorOpen() && millis() - timeWhenDoorLocked < RESET_LOCK_DELAY) //Door is open while it should be closed. User probably opened the door really quickly while the lock was engaging, causing the lock to fail.
-        {
-            //Record the time we unlocked the door
-            timeWhenDoorUnlocked = millis();
-
-            //Unlock the door again (If we dont we wont be abe to close the door again) and update state.
-            currentDoorState = Unlocked;
-            Unlock();
-            Serial.println("Unlocked door as it was already open");
-        }
-    }
-    else //Vault is currently locked down because of too many incorrect attempts to open the vault.
-    {
-        Serial.println("Started Lockdown timer.");
-
-        //Set the dot to the position of the minute digit.
-        _data.dotPosition = 1;
-
-        //Loop for LOCK_TIME_SECONDS
-        for(int i = LOCK_TIME_SECONDS; i > 0; i--)
-        {
-            //Calculate the amount of minutes/seconds remaining.
-            int seconds = i % 60;
-            int minutes = (i - seconds) / 60; 
-
-            //Update the display
-            _data.digits[0] = 0;
-            _data.digits[1] = minutes;
-            _data.digits[2] = seconds / 10 % 10;
-            _data.digits[3] = seconds % 10;
-            
-            delay(1000);
-        }
-
-        //Reset our input (change display values back to 0, set dot position to the first digit and reset the rotary encoder's counter.
-        ResetInput();
-        //Flash the display to indicate the counter has finished.
-        FlashDisplay(&_data);
-
-        //Set the vault state back to accepting input and write this change to memory.
-        currentVaultState = AcceptingInput;
-        EEPROM.write(VAULT_STATE_ADDRESS, currentVaultState);
-        EEPROM.commit();
-    }
-}
-
-void ReceivedInput()
-{ 
-    //print the entered code. Just for debugging purposes.
-    Serial.print("Entered Digits: ");
-    for(int i = 0; i < DIGIT_AMOUNT; i++)
-    {
-        Serial.print(_data.digits[i]);
-    }
-    
-    Serial.println();
-  
-    if(currentInputTask == EnteringCode) //The current input is to be handled as an attempt at opening the vault
-    {
-        if(currentDoorState != Unlocked) //Check if the door isnt currently unlocked
-        {    
-            CheckInput(_data.digits); //Handle the given input. Put into external method so bluetooth can access easily.
-        }
-    }
-    else if (currentInputTask == ChangingPassword) //The current input is to be handled as a new password, resetting the old.
-    {
-        SetNewPassword(_data.digits); //Handle the given input. Put into external method so bluetooth can access easily.
-    }
-
-    ResetInput();
-}
-
-bool CheckInput(int code[DIGIT_AMOUNT])
-{
-    if(IsPasswordCorrect(code)) //Check if the password entered by the user is correct.
-    {
-        //Store when we unlocked the door. This is used for later locking the door if we dont open it.
-        timeWhenDoorUnlocked = millis();
-  
-        //Change states of the vault and unlock the door.
-        currentDoorState = Unlocked;
-        Unlock();
-        Serial.println("Unlocked Door");
-  
-        ResetInput();
-        return true;
-    }
-    else
-    {
-        Serial.println("Wrong Input");
-  
-        //Flash the display & sound buzzer to indicate the code entered was wrong
-        FlashDisplay(&_data);
-        
-        //Check if the user has failed to enter the correct password before. If so lock them out of putting in a code for a predefined amount of time.
-        if(AmountOfCorrectTries() >= MAX_INCORRECT_TRIES)
-        {
-          currentVaultState = InputLocked;
-          //TODO: Send bluetooth or wifi signal.
-  
-          //Write the current locked state to memory in case the user tries to circumvent this by unplugging power.
-          EEPROM.write(VAULT_STATE_ADDRESS, currentVaultState);
-          EEPROM.commit();
-  
-          Serial.println("Locked Input.");
-        }
-        SoundBuzzer();
-  
-        ResetInput();
-        return false;
-    }
-}
-
-void SetNewPassword(int code[DIGIT_AMOUNT])
-{
-    //Change the password we have in memory to the newly entered password.
-    SetPasscode(code);
-  
-    //Finished changing password, change input task accordingly
-    currentInputTask = EnteringCode;
-    Serial.println("Set Password, now accepting codes");
-}
+#include "DisplayDrivers.h"
+#include "InputHandling.h"
+#include "DoorDrivers.h"
+#include "PasswordManager.h"
+#include "BluetoothHandler.h"
+#include "StorageManager.h"
+#include "CredentialManager.h"
+#include "AuditManager.h"
+#include "BuzzerDrivers.h"
+#include "EventManager.h"
+#include "TraceManager.h"
+
+#ifndef BLUETOOTH_ENABLED
+#define BLUETOOTH_ENABLED false
+#endif
+
+DisplayData _data; //This variable is shared between all methods that need to use the display. The display drivers then use this data to display the correct digits etc.
+unsigned long timeWhenDoorUnlocked = 0; 
+unsigned long timeWhenDoorLocked = 0;
+unsigned long timeWhenDoorPhysicallyClosed = 0;
+int previousPhysicalDoorState;
+bool doorWasClosed = false;
+unsigned long timeWhenDoorOpened = 0;
+unsigned long timeWhenDoorAlarmSounded = 0;
+unsigned long timeWhenLastActive = 0; //Last time someone did something, for the light sleep delay
+
+enum VaultState
+{
+  AcceptingInput = 0,
+  InputLocked = 1
+};
+VaultState currentVaultState;
+
+enum InputHandlerTask
+{
+    EnteringCode,
+    ChangingPassword
+};
+InputHandlerTask currentInputTask;
+
+enum DoorState
+{
+    Locked,
+    Unlocked
+};
+DoorState currentDoorState;
+
+unsigned long timeWhenLockdownStarted = 0;
+int lockdownSeconds = 0;        //Length of the running lockdown, counted from timeWhenLockdownStarted
+int lockdownSavedSeconds = 0;   //Remaining time as last saved to memory
+int lockdownShownSeconds = -1;
+
+void setup() 
+{
+    //Initialize Serial communication, tracing & FLASH memory
+    Serial.begin(TRACE_ENABLED ? TRACE_BAUD_RATE : 115200);
+    SetupTrace();
+    SetupStorage();
+    SetupCredentials();
+    SetupAudit();
+
+    //Initialize the events loop() waits on, then the Input, Display, Door & Buzzer drivers that post them.
+    SetupEvents();
+    SetupInputHandler(&_data, &ReceivedInput, &PostInputEvent);
+    SetupDisplayTask(&_data);
+    SetupDoorDrivers(&PostDoorEvent);
+    SetupBuzzer();
+
+    bool initialized = false;
+
+    //Check if our program has been initialized before, which is the case once an admin code has been stored (will always be true unless the chip was just reprogrammed)
+    if(HasAdminCode()) //The program has already been initialized once. This means that the ESP32 lost power and has rebooted. No need to change password.
+    {       
+        initialized = true; //Set initialized to true. Used later to setup the password manager
+        
+        Serial.println("Already Initialized");
+
+        //Set states to their stored or default states.
+        currentInputTask = EnteringCode;
+        currentVaultState = AcceptingInput;
+        ReadStorage(StoredVaultState, &currentVaultState, sizeof(currentVaultState));
+
+        //Continue a lockdown that was going on when the power went.
+        if(currentVaultState == InputLocked)
+        {
+            int seconds = LOCK_TIME_SECONDS;
+            ReadStorage(StoredLockdownSeconds, &seconds, sizeof(seconds));
+            if(seconds <= 0 || seconds > LOCK_TIME_SECONDS) seconds = LOCK_TIME_SECONDS;
+            StartLockdown(seconds);
+        }
+
+        Serial.println("Vault already initialized, now accepting input.");
+    } 
+    else //The program has not been started before. This means we wont have a password so we need to ask for one.
+    {
+        Serial.println("Initializing");
+
+        //Set states to the default startup states. 
+        currentInputTask = ChangingPassword; //We currently dont have a password stored so we need to create one.
+        currentVaultState = AcceptingInput;
+
+        //Write to memory the current state of the vault.
+        WriteStorage(StoredVaultState, &currentVaultState, sizeof(currentVaultState));
+        CommitStorage();
+
+        Serial.println("Initializing Vault, Now using input to set new password.");
+    } 
+  
+    //Check whether or not the door is currently open or closed
+    if(IsDoorOpen())//Door is open
+    {
+        //Store when the door was opened
+        timeWhenDoorUnlocked = millis();
+
+        //Unlock the door and change the door state accordingly
+        currentDoorState = Unlocked;
+        Unlock();
+        Serial.println("Unlocking Vault.");
+    }
+    else //Door is closed
+    {
+        //Lock the door and change the door state accordingly
+        currentDoorState = Locked;
+        Lock();
+        timeWhenDoorLocked = millis();
+        ResetInput();
+        Serial.println("Locking Vault.");
+    }
+
+    //Initialize the Password & Bluetooth managers
+    SetupPasswordManager(initialized, &PostResetButtonEvent);
+    
+    if(BLUETOOTH_ENABLED) InitializeBluetooth(&CheckInput, &SetNewPassword, &CheckAdminCode, &GetVaultStatus, &PostBluetoothEvent);
+
+    TRACE_INSTANT(TraceVaultState, currentVaultState);
+    TRACE_INSTANT(TraceDoorState, currentDoorState);
+    TRACE_INSTANT(TraceInputTask, currentInputTask);
+    timeWhenLastActive = millis();
+    PostEvent(EventDeadline); //Let loop() go round once for whatever setup() left it to do.
+}
+
+void loop() 
+{
+    //Wait until something happens or one of our timers runs out. The CPU idles meanwhile, or light sleeps if nobody is around.
+    VaultEvent event;
+    long timeout = TimeUntilNextDeadline();
+    if(CanLightSleep())
+    {
+        ResetInput(); //Whoever left a half entered code isnt coming back for it.
+        SleepDisplay();
+        LightSleepForEvent(&event, timeout);
+        WakeDisplay();
+    }
+    else
+    {
+        WaitForEvent(&event, timeout);
+    }
+    if(event.type != EventDeadline) timeWhenLastActive = millis();
+    TRACE_BEGIN(TraceLoop, event.type);
+
+    //Check if the user has not been locked out as of yet.
+    if(currentVaultState == AcceptingInput) //Vault has not locked the user out
+    {
+        //Update the Input manager as it needs an update loop.
+        HandleInput();
+    }
+    else //Vault is currently locked down because of too many incorrect attempts to open the vault.
+    {
+        HandleLockdown();
+    }
+
+    //Bluetooth and the door keep being handled during a lockdown. CheckInput refuses codes until it is over.
+    if(BLUETOOTH_ENABLED) HandleBluetooth();
+    HandleDoor();
+
+    //Last, so the flash erase it may do doesnt hold up anything above.
+    HandleAuditLog();
+
+    EventHandled(&event);
+    TRACE_END(TraceLoop, event.type);
+}
+
+//Milliseconds until more than the given delay has passed since the given time, 0 if it already has.
+long TimeLeft(unsigned long since, unsigned long delay)
+{
+    unsigned long elapsed = millis() - since;
+    return elapsed > delay ? 0 : delay + 1 - elapsed;
+}
+
+void EarliestDeadline(long *timeout, long timeLeft)
+{
+    if(*timeout < 0 || timeLeft < *timeout) *timeout = timeLeft;
+}
+
+//Milliseconds until loop() has to run again even if nothing happens, -1 if nothing is waiting on time. Everything else comes in
+//as an event. RESET_LOCK_DELAY only matters when the door sensor changes, so the door interrupt takes care of it.
+long TimeUntilNextDeadline()
+{
+    long timeout = -1;
+
+    //Bluetooth data HandleBluetooth() didnt get to yet.
+    if(BLUETOOTH_ENABLED && BluetoothDataWaiting()) return 0;
+
+    if(currentDoorState == Unlocked)
+    {
+        if(IsDoorOpen())
+        {
+            //The next door alarm.
+            long alarm = TimeLeft(timeWhenDoorOpened, DOOR_OPEN_ALARM_DELAY);
+            long repeat = TimeLeft(timeWhenDoorAlarmSounded, DOOR_OPEN_ALARM_REPEAT);
+            EarliestDeadline(&timeout, alarm > repeat ? alarm : repeat);
+        }
+        else if(doorWasClosed) EarliestDeadline(&timeout, TimeLeft(timeWhenDoorPhysicallyClosed, LOCK_DELAY));
+        else EarliestDeadline(&timeout, TimeLeft(timeWhenDoorUnlocked, UNLOCK_LOCK_DELAY));
+    }
+
+    //The lockdown display changes every second.
+    if(currentVaultState == InputLocked)
+    {
+        unsigned long elapsed = millis() - timeWhenLockdownStarted;
+        unsigned long duration = lockdownSeconds * 1000UL;
+        EarliestDeadline(&timeout, elapsed >= duration ? 0 : (duration - elapsed - 1) % 1000 + 1);
+    }
+
+    //Come back when it is time to light sleep, or a bit later if an effect or a tone is still playing by then.
+    if(LightSleepAllowed())
+    {
+        long idle = millis() - timeWhenLastActive;
+        if(idle < LIGHT_SLEEP_DELAY) EarliestDeadline(&timeout, LIGHT_SLEEP_DELAY - idle);
+        else if(!DisplayEffectsIdle() || !BuzzerIdle()) EarliestDeadline(&timeout, LIGHT_SLEEP_RETRY);
+    }
+
+    return timeout;
+}
+
+//Light sleep stops the display, the buzzer and the radio, so only when the vault is locked, closed and waiting for a code.
+//The servo gets no pulses while the chip sleeps and holds the lock by its gearing.
+bool LightSleepAllowed()
+{
+    return LIGHT_SLEEP_ENABLED && !BLUETOOTH_ENABLED && currentVaultState == AcceptingInput && currentDoorState == Locked && !IsDoorOpen();
+}
+
+bool CanLightSleep()
+{
+    return LightSleepAllowed() && millis() - timeWhenLastActive >= LIGHT_SLEEP_DELAY && DisplayEffectsIdle() && BuzzerIdle();
+}
+
+void HandleDoor()
+{
+    //Check if the door is currently unlocked
+    if(currentDoorState == Unlocked)
+    {
+        //Check the current state of the physical door
+        int currentPhysicalDoorState = IsDoorOpen();
+
+        //Check if the physical door state changed
+        if(currentPhysicalDoorState != previousPhysicalDoorState)
+        {
+            //Check if the door transitioned from open to closed
+            if(!currentPhysicalDoorState) //Door was just closed
+            {
+                //Save the time the door was closed on and set a flag indicating the door was closed to true
+                timeWhenDoorPhysicallyClosed = millis();
+                doorWasClosed = true;
+                LogAuditEvent(AuditDoorClosed, 0);
+            }
+            else
+            {
+                //door transitioned back to open before the door locked. Set this flag back to false.
+                doorWasClosed = false;
+                timeWhenDoorOpened = millis();
+                LogAuditEvent(AuditDoorOpened, 0);
+            }
+
+            //Save the current state so we only trigger this once.
+            previousPhysicalDoorState = currentPhysicalDoorState;
+        }
+
+        //Sound the alarm every so often if the door has been left open.
+        if(currentPhysicalDoorState && millis() - timeWhenDoorOpened > DOOR_OPEN_ALARM_DELAY && millis() - timeWhenDoorAlarmSounded > DOOR_OPEN_ALARM_REPEAT)
+        {
+            timeWhenDoorAlarmSounded = millis();
+            PlayTone(ToneDoorOpen);
+        }
+
+        //Check if the door is closed but hasnt been opened yet. Then lock the door again after a preindicated delay.
+        if(!IsDoorOpen() && (millis() - timeWhenDoorUnlocked > UNLOCK_LOCK_DELAY) && !doorWasClosed)
+        {
+            //Lock the door and update state & flag accordingly
+            currentDoorState = Locked;
+            TRACE_INSTANT(TraceDoorState, currentDoorState);
+            Lock();        
+            LogAuditEvent(AuditLocked, 0);
+            doorWasClosed = false;
+            timeWhenDoorLocked = millis();
+            if(currentVaultState == AcceptingInput) ResetInput(); //During a lockdown the display shows the countdown.
+            Serial.println("Locking vault.");
+        }
+        else if(!IsDoorOpen() && millis() - timeWhenDoorPhysicallyClosed > LOCK_DELAY && doorWasClosed) //Check if the door was recently closed and then wait a predetermined time to lock the gate
+        {
+            //Lock the door and update state & flag accordingly
+            currentDoorState = Locked;
+            TRACE_INSTANT(TraceDoorState, currentDoorState);
+            Lock();     
+            LogAuditEvent(AuditLocked, 0);
+            doorWasClosed = false;
+            timeWhenDoorLocked = millis();
+            if(currentVaultState == AcceptingInput) ResetInput();
+            Serial.println("Locking vault.");
+        }
+
+        //Scan if reset password was pressed, if so change input task to ChangingPassword 
+        if(ResetPasswordButtonPressed())
+        {
+            //Change our input task to changing the password.
+            currentInputTask = ChangingPassword;
+            TRACE_INSTANT(TraceInputTask, currentInputTask);
+            Serial.println("Now changing stored password with next input.");
+        }
+    }
+    else if(IsDoorOpen() && millis() - timeWhenDoorLocked < RESET_LOCK_DELAY) //Door is open while it should be closed. User probably opened the door really quickly while the lock was engaging, causing the lock to fail.
+    {
+        //Record the time we unlocked the door
+        timeWhenDoorUnlocked = millis();
+
+        //Unlock the door again (If we dont we wont be abe to close the door again) and update state.
+        currentDoorState = Unlocked;
+        TRACE_INSTANT(TraceDoorState, currentDoorState);
+        Unlock();
+        Serial.println("Unlocked door as it was already open");
+    }
+}
+
+//Lock out any input for the given amount of seconds. The remaining time is saved so a reboot continues the lockdown.
+void StartLockdown(int seconds)
+{
+    Serial.println("Started Lockdown timer.");
+
+    currentVaultState = InputLocked;
+    TRACE_INSTANT(TraceVaultState, currentVaultState);
+    lockdownSeconds = seconds;
+    lockdownSavedSeconds = seconds;
+    timeWhenLockdownStarted = millis();
+    lockdownShownSeconds = -1;
+    LogAuditEvent(AuditLockdown, seconds);
+
+    //Write the current locked state to memory in case the user tries to circumvent this by unplugging power.
+    WriteStorage(StoredVaultState, &currentVaultState, sizeof(currentVaultState));
+    WriteStorage(StoredLockdownSeconds, &lockdownSavedSeconds, sizeof(lockdownSavedSeconds));
+    CommitStorage();
+}
+
+void HandleLockdown()
+{
+    //Calculate the amount of seconds remaining, rounded up so the display reaches 0:00 right as the lockdown ends.
+    unsigned long elapsed = millis() - timeWhenLockdownStarted;
+    unsigned long duration = lockdownSeconds * 1000UL;
+    int secondsLeft = elapsed >= duration ? 0 : (duration - elapsed + 999) / 1000;
+
+    if(secondsLeft == 0)
+    {
+        //Reset our input (change display values back to 0, set dot position to the first digit and forget any rotary encoder input we havent handled.
+        ResetInput();
+        //Flash the display to indicate the counter has finished.
+        FlashDisplay(&_data);
+
+        //Set the vault state back to accepting input and write this change to memory.
+        currentVaultState = AcceptingInput;
+        TRACE_INSTANT(TraceVaultState, currentVaultState);
+        LogAuditEvent(AuditLockdownEnded, 0);
+        lockdownSavedSeconds = 0;
+        WriteStorage(StoredVaultState, &currentVaultState, sizeof(currentVaultState));
+        WriteStorage(StoredLockdownSeconds, &lockdownSavedSeconds, sizeof(lockdownSavedSeconds));
+        CommitStorage();
+        return;
+    }
+
+    //Only touch the display when the shown time changes.
+    if(secondsLeft != lockdownShownSeconds)
+    {
+        int seconds = secondsLeft % 60;
+        int minutes = secondsLeft / 60;
+
+        //Update the display, with the dot on the minute digit.
+        BeginDisplayUpdate(&_data);
+        _data.digits[0] = 0;
+        _data.digits[1] = minutes;
+        _data.digits[2] = seconds / 10 % 10;
+        _data.digits[3] = seconds % 10;
+        _data.dotPosition = 1;
+        EndDisplayUpdate(&_data);
+
+        lockdownShownSeconds = secondsLeft;
+    }
+
+    //Save the remaining time every few seconds. After a reboot the lockdown goes on from the last save, never shorter.
+    if(lockdownSavedSeconds - secondsLeft >= LOCKDOWN_SAVE_INTERVAL)
+    {
+        lockdownSavedSeconds = secondsLeft;
+        WriteStorage(StoredLockdownSeconds, &lockdownSavedSeconds, sizeof(lockdownSavedSeconds));
+        CommitStorage();
+    }
+}
+
+void ReceivedInput()
+{ 
+    //print the entered code. Just for debugging purposes.
+    Serial.print("Entered Digits: ");
+    for(int i = 0; i < DIGIT_AMOUNT; i++)
+    {
+        Serial.print(_data.digits[i]);
+    }
+    
+    Serial.println();
+  
+    if(currentInputTask == EnteringCode) //The current input is to be handled as an attempt at opening the vault
+    {
+        if(currentDoorState != Unlocked) //Check if the door isnt currently unlocked
+        {    
+            CheckInput(_data.digits); //Handle the given input. Put into external method so bluetooth can access easily.
+        }
+    }
+    else if (currentInputTask == ChangingPassword) //The current input is to be handled as a new password, resetting the old.
+    {
+        SetNewPassword(_data.digits); //Handle the given input. Put into external method so bluetooth can access easily.
+    }
+
+    ResetInput();
+}
+
+bool CheckInput(int code[DIGIT_AMOUNT])
+{
+    //No codes at all during a lockdown, not even over bluetooth.
+    if(currentVaultState == InputLocked) return false;
+
+    if(IsPasswordCorrect(code)) //Check if the password entered by the user is correct.
+    {
+        //Store when we unlocked the door. This is used for later locking the door if we dont open it.
+        timeWhenDoorUnlocked = millis();
+  
+        //Change states of the vault and unlock the door.
+        currentDoorState = Unlocked;
+        TRACE_INSTANT(TraceDoorState, currentDoorState);
+        Unlock();
+        PlayTone(ToneUnlock);
+        LogAuditEvent(AuditUnlocked, LastCredentialMatch().user);
+        Serial.println("Unlocked Door");
+  
+        ResetInput();
+        return true;
+    }
+    else
+    {
+        WrongCode();
+        return false;
+    }
+}
+
+//The admin code that comes with a bluetooth command changing the other codes. A wrong one counts like any wrong code.
+bool CheckAdminCode(int code[DIGIT_AMOUNT])
+{
+    if(currentVaultState == InputLocked) return false;
+
+    if(IsAdminCodeCorrect(code)) return true;
+    WrongCode();
+    return false;
+}
+
+void WrongCode()
+{
+    Serial.println("Wrong Input");
+
+    //Flash the display & sound buzzer to indicate the code entered was wrong
+    FlashDisplay(&_data);
+    PlayTone(ToneError);
+    LogAuditEvent(AuditWrongCode, GetIncorrectTries());
+    
+    //Check if the user has failed to enter the correct password before. If so lock them out of putting in a code for a predefined amount of time.
+    if(AmountOfCorrectTries() >= MAX_INCORRECT_TRIES)
+    {
+      //TODO: Send bluetooth or wifi signal.
+      StartLockdown(LOCK_TIME_SECONDS);
+      PlayTone(ToneLockdown);
+      Serial.println("Locked Input.");
+    }
+
+    ResetInput();
+}
+
+bool SetNewPassword(int code[DIGIT_AMOUNT])
+{
+    //Change the admin code to the newly entered one. It cant be a code a user already has.
+    if(!SetPasscode(code))
+    {
+        Serial.println("Code already in use, enter another one");
+        FlashDisplay(&_data);
+        PlayTone(ToneError);
+        return false;
+    }
+  
+    LogAuditEvent(AuditAdminCodeChanged, 0);
+
+    //Finished changing password, change input task accordingly
+    currentInputTask = EnteringCode;
+    TRACE_INSTANT(TraceInputTask, currentInputTask);
+    Serial.println("Set Password, now accepting codes");
+    return true;
+}
+
+void GetVaultStatus(VaultStatus *status)
+{
+    //Fill in the current state of the vault for a bluetooth status request.
+    status->doorUnlocked = currentDoorState == Unlocked;
+    status->inputLocked = currentVaultState == InputLocked;
+    status->incorrectTries = GetIncorrectTries();
+}
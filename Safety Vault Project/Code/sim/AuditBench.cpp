@@ -0,0 +1,238 @@
+//Logs a few months of made up vault events into the audit log, long enough for it to go round, and measures what logging one
+//costs and how many bytes it takes. Then boots the vault with Bluetooth on and has a phone export the whole log over a link of
+//LINK_BYTES_PER_SECOND with a few round trip times, acknowledging every chunk as it comes in, and checks every record it gets.
+//A line of text per record, the way a println() per record would send it, is the baseline.
+//Usage: AuditBench [events]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "esp_partition.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/AuditManager.h"
+#include "../main/PasswordManager.h"
+#include "../main/StorageManager.h"
+#include "VaultStimulus.h"
+
+#define LINK_BYTES_PER_SECOND 60000   //Classic Bluetooth SPP to a phone, what it gets in practice
+#define FIXED_RECORD_SIZE 16          //Index, boot, time, event and argument, unpacked and with a CRC
+#define TEXT_LINE_SIZE 26             //"R|12345|2|123456789|3|7*hh\n"
+
+struct Expected
+{
+    AuditEvent event;
+    uint16_t argument;
+};
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static const uint64_t roundTrips[] = {10 * MS, 40 * MS, 100 * MS};
+static std::vector<Expected> expected;
+static bool passed = true;
+
+//Roughly what a vault goes through: mostly opening and closing, now and then a wrong code or a code change.
+static Expected RandomEvent()
+{
+    uint32_t random = NextRandom() % 100;
+    if(random < 25) return {AuditUnlocked, (uint16_t)(NextRandom() % 4 == 0 ? 0 : 1 + NextRandom() % 40)};
+    if(random < 50) return {AuditDoorOpened, 0};
+    if(random < 75) return {AuditDoorClosed, 0};
+    if(random < 92) return {AuditLocked, 0};
+    if(random < 97) return {AuditWrongCode, (uint16_t)(1 + NextRandom() % 2)};
+    if(random < 98) return {AuditUserCodeSet, (uint16_t)(1 + NextRandom() % 40)};
+    if(random < 99) return {AuditOneTimeCodeAdded, (uint16_t)(1 + NextRandom() % 1440)};
+    return {AuditLockdown, LOCK_TIME_SECONDS};
+}
+
+static int DecodeBase64(const char *text, uint8_t *out)
+{
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int length = 0;
+    uint32_t group = 0;
+    int bits = 0;
+    for(; *text && *text != '='; text++)
+    {
+        const char *found = strchr(alphabet, *text);
+        if(found == NULL) return -1;
+        group = group << 6 | (found - alphabet);
+        bits += 6;
+        if(bits >= 8)
+        {
+            bits -= 8;
+            out[length++] = group >> bits;
+        }
+    }
+    return length;
+}
+
+struct Export
+{
+    unsigned long records = 0;
+    unsigned long wireBytes = 0;
+    unsigned long bad = 0;
+    uint32_t nextIndex = 0;
+    uint64_t start = 0;
+    uint64_t lastArrival = 0;
+    bool finished = false;
+};
+
+//Check the records of a chunk against what was logged.
+static void CheckChunk(Export *result, const uint8_t *chunk, int length)
+{
+    uint32_t index = 0;
+    for(int i = 3; i >= 0; i--) index = index << 8 | chunk[i];
+    if(index != result->nextIndex) result->bad++;
+
+    int position = AUDIT_CHUNK_HEADER_SIZE;
+    while(position < length)
+    {
+        AuditEvent event;
+        uint32_t delta;
+        uint16_t argument;
+        int used = DecodeAuditRecord(chunk + position, length - position, &event, &delta, &argument);
+        if(used == 0)
+        {
+            result->bad++;
+            return;
+        }
+        if(index < expected.size() && (expected[index].event != event || expected[index].argument != argument)) result->bad++;
+        position += used;
+        index++;
+        result->records++;
+    }
+    result->nextIndex = index;
+}
+
+//The phone: asks for everything, takes the messages in as the link would deliver them and acknowledges each chunk.
+static Export RunExport(uint64_t roundTrip)
+{
+    Export result;
+    std::deque<std::pair<uint64_t, int>> acknowledgements;
+    size_t taken = 0;
+    uint64_t linkFree = SimNow();
+
+    SimBluetoothClearSent();
+    result.start = SimNow();
+    SendBluetooth("L|0|99999");
+
+    while(!result.finished && SimNow() - result.start < 120000 * MS)
+    {
+        Wait(100 * US);
+
+        //Every complete line the vault wrote, arriving one after the other at the link speed and half a round trip later.
+        std::string sent = SimBluetoothSent();
+        size_t end;
+        while((end = sent.find('\n', taken)) != std::string::npos)
+        {
+            std::string line = sent.substr(taken, end - taken);
+            taken = end + 1;
+            linkFree = std::max(linkFree, SimNow()) + (line.size() + 1) * 1000000000ULL / LINK_BYTES_PER_SECOND;
+            uint64_t arrival = linkFree + roundTrip / 2;
+            result.wireBytes += line.size() + 1;
+            line = line.substr(0, line.rfind('*'));
+
+            if(line.compare(0, 2, "L|") == 0)
+            {
+                unsigned long first;
+                sscanf(line.c_str(), "L|%lu", &first);
+                result.nextIndex = first;
+            }
+            else if(line.compare(0, 2, "B|") == 0)
+            {
+                int chunkNumber = atoi(line.c_str() + 2);
+                const char *data = strchr(line.c_str() + 2, '|') + 1;
+                uint8_t chunk[BLUETOOTH_CHUNK_SIZE + 3];
+                int length = DecodeBase64(data, chunk);
+                if(length == 0)
+                {
+                    result.finished = true;
+                    result.lastArrival = arrival;
+                }
+                else if(length < AUDIT_CHUNK_HEADER_SIZE) result.bad++;
+                else CheckChunk(&result, chunk, length);
+                acknowledgements.push_back({arrival + roundTrip / 2, chunkNumber});
+            }
+        }
+
+        while(!acknowledgements.empty() && acknowledgements.front().first <= SimNow())
+        {
+            char message[16];
+            snprintf(message, sizeof(message), "A|%d", acknowledgements.front().second);
+            SendBluetooth(message);
+            acknowledgements.pop_front();
+        }
+    }
+    return result;
+}
+
+static void Phone(void *parameter)
+{
+    Wait(500 * MS);
+
+    printf("%-12s %10s %12s %12s %14s %14s\n", "round trip", "records", "wire B/rec", "time", "records/s", "text lines/s");
+    for(uint64_t roundTrip : roundTrips)
+    {
+        Export result = RunExport(roundTrip);
+        double seconds = (result.lastArrival - result.start) / 1e9;
+        printf("%9.0f ms %10lu %12.1f %10.2f s %14.0f %14.0f\n", roundTrip / 1e6, result.records, (double)result.wireBytes / result.records,
+               seconds, result.records / seconds, (double)LINK_BYTES_PER_SECOND / TEXT_LINE_SIZE);
+
+        bool complete = result.finished && result.bad == 0 && result.nextIndex == AuditRecordAmount();
+        if(!complete) printf("  export incomplete or wrong: %lu bad, ended at %lu of %lu\n", result.bad, (unsigned long)result.nextIndex, (unsigned long)AuditRecordAmount());
+        passed &= complete;
+        Wait(1000 * MS);
+    }
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    int events = argc > 1 ? atoi(argv[1]) : 30000;
+
+    SetupStorage();
+    SetupAudit();
+    expected.push_back({AuditBoot, 1});
+
+    //Minutes to hours between events, like a vault in use.
+    SimHistogram logTime;
+    uint64_t maintenanceTime = 0;
+    uint64_t bytesBefore = simStats.flashBytesWritten;
+    uint64_t erasesBefore = simStats.flashErases;
+    for(int i = 0; i < events; i++)
+    {
+        Wait((60 + NextRandom() % 600) * 1000 * MS);
+        Expected event = RandomEvent();
+        expected.push_back(event);
+
+        uint64_t start = SimNow();
+        LogAuditEvent(event.event, event.argument);
+        logTime.Record(SimNow() - start);
+
+        start = SimNow();
+        HandleAuditLog();
+        maintenanceTime += SimNow() - start;
+    }
+
+    uint32_t kept = AuditRecordAmount() - FirstAuditRecord();
+    double bytesPerRecord = (double)(simStats.flashBytesWritten - bytesBefore) / events;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, AUDIT_PARTITION_LABEL);
+    printf("%d events over %.0f days: %.2f flash bytes each (%d unpacked), %u kept in the %u KB log, %llu sector erases\n", events,
+           SimNow() / 86400e9, bytesPerRecord, FIXED_RECORD_SIZE, kept, partition->size / 1024,
+           (unsigned long long)(simStats.flashErases - erasesBefore));
+    printf("logging an event: p50 %.1f us, max %.1f us; HandleAuditLog() %.1f ms in all, an EEPROM.commit() would be 45 ms each\n",
+           logTime.Percentile(50) / 1e3, logTime.Max() / 1e3, maintenanceTime / 1e6);
+
+    //The vault boots on the same flash and a phone exports the log.
+    PreloadInitializedVault(storedCode);
+    vaultBluetoothEnabled = true;
+    SimStartArduino();
+    SimCreateExternalTask(Phone, NULL, "phone");
+    SimRun(UINT64_MAX);
+
+    printf("%s\n", passed ? "every record exported intact" : "EXPORT FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+//Logs random events into the audit log and cuts the power at a random byte write or sector erase, then boots the log again
+//from whatever made it to flash. What comes back must be exactly the events logged before, with the one the power went during
+//either there or not, followed by the new boot's AuditBoot. Only whole sectors of the oldest records may be missing.
+//Usage: AuditPowerCutTest [powerCuts]
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/AuditManager.h"
+#include "VaultStimulus.h"
+
+#define MAXIMUM_OPERATIONS_PER_CUT 3000 //Byte writes and erases before the power goes
+
+struct Logged
+{
+    AuditEvent event;
+    uint16_t argument;
+};
+
+//Every record still in the log, by index from the first one kept.
+static std::vector<Logged> ReadBack(uint32_t *first)
+{
+    std::vector<Logged> records;
+    AuditReader reader;
+    OpenAuditReader(&reader, 0);
+    *first = reader.index;
+
+    uint8_t chunk[128];
+    int amount;
+    int length;
+    while((length = ReadAuditChunk(&reader, chunk, sizeof(chunk), 1000, &amount)) > 0)
+    {
+        for(int position = AUDIT_CHUNK_HEADER_SIZE; position < length;)
+        {
+            Logged logged;
+            uint32_t delta;
+            position += DecodeAuditRecord(chunk + position, length - position, &logged.event, &delta, &logged.argument);
+            records.push_back(logged);
+        }
+    }
+    return records;
+}
+
+int main(int argc, char **argv)
+{
+    int powerCuts = argc > 1 ? atoi(argv[1]) : 1000;
+
+    std::vector<Logged> logged; //By index, everything ever logged
+    uint16_t boot = 1;
+    int failures = 0;
+    int keptInterrupted = 0;
+    unsigned long events = 0;
+
+    SetupAudit();
+    logged.push_back({AuditBoot, boot});
+
+    for(int cut = 0; cut < powerCuts; cut++)
+    {
+        bool inLog = false;
+        SimFlashCutPowerAfter(NextRandom() % MAXIMUM_OPERATIONS_PER_CUT, NextRandom());
+        while(!SimFlashPowerLost())
+        {
+            Wait((1 + NextRandom() % 100000) * MS);
+            Logged event = {(AuditEvent)(1 + NextRandom() % (AUDIT_EVENT_AMOUNT - 1)), (uint16_t)(NextRandom() % 3 == 0 ? NextRandom() : 0)};
+            LogAuditEvent(event.event, event.argument);
+            logged.push_back(event);
+            inLog = SimFlashPowerLost();
+            if(!inLog) events++;
+            if(!inLog && NextRandom() % 4 == 0) HandleAuditLog();
+        }
+
+        //Reboot.
+        SimFlashRestorePower();
+        SetupAudit();
+        boot++;
+
+        uint32_t first;
+        std::vector<Logged> recovered = ReadBack(&first);
+        uint32_t next = first + recovered.size(); //Index after the new AuditBoot
+        bool good = !recovered.empty() && recovered.back().event == AuditBoot && recovered.back().argument == boot;
+        good &= next == logged.size() + 1 || (inLog && next == logged.size());
+        for(size_t i = 0; good && i + 1 < recovered.size(); i++)
+        {
+            good &= first + i < logged.size() && recovered[i].event == logged[first + i].event && recovered[i].argument == logged[first + i].argument;
+        }
+        if(inLog && next == logged.size() + 1) keptInterrupted++;
+
+        if(!good)
+        {
+            if(failures++ < 10) printf("power cut %d: the log doesnt match what was logged before it\n", cut);
+            break;
+        }
+
+        //Go on from what is in flash now.
+        logged.resize(next - 1);
+        logged.push_back({AuditBoot, boot});
+    }
+
+    printf("%d power cuts (%d kept the record they cut into), %d bad recoveries\n", powerCuts, keptInterrupted, failures);
+    printf("%lu events logged, %u records kept, %llu flash bytes written, %llu erases\n", events, (unsigned)(AuditRecordAmount() - FirstAuditRecord()),
+           (unsigned long long)simStats.flashBytesWritten, (unsigned long long)simStats.flashErases);
+
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
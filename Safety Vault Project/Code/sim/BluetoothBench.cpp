@@ -0,0 +1,210 @@
+//Compares the old HandleBluetooth(), which blocks in readString() until the link has been quiet for a second and splits Strings,
+//against the streaming parser. Reports how many commands per second get answered and how long a single HandleBluetooth() call
+//holds up loop(), for commands sent one at a time and for pipelined batches.
+//Usage: BluetoothBench [commands] [batchSize]
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "BluetoothSerial.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "VaultStimulus.h"
+
+extern BluetoothSerial ESP_BT;
+
+struct BenchSettings
+{
+    int commands;
+    int batchSize;
+};
+
+struct PhaseResult
+{
+    const char *name;
+    int sent;
+    int answered;
+    int rejected;
+    double seconds;
+    SimHistogram stall;
+};
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+
+static void (*handler)() = NULL;
+static PhaseResult *currentPhase = NULL;
+static PhaseResult phases[4];
+
+static bool BenchCheckInput(int code[DIGIT_AMOUNT])
+{
+    return memcmp(code, storedCode, sizeof(storedCode)) == 0;
+}
+
+static bool BenchSetNewPassword(int code[DIGIT_AMOUNT])
+{
+    return true;
+}
+
+static void BenchGetVaultStatus(VaultStatus *status)
+{
+    status->doorUnlocked = false;
+    status->inputLocked = false;
+    status->incorrectTries = 0;
+}
+
+//Same as the old handler, kept here as the baseline. The Serial prints went along with every command so they stay in.
+static String LegacySplitString(String input, char delim, int index)
+{
+    int found = 0;
+    int strIndex[] = { 0, -1 };
+    int maxIndex = input.length() - 1;
+
+    for (int i = 0; i <= maxIndex && found <= index; i++) {
+        if (input.charAt(i) == delim || i == maxIndex) {
+            found++;
+            strIndex[0] = strIndex[1] + 1;
+            strIndex[1] = (i == maxIndex) ? i+1 : i;
+        }
+    }
+    return found > index ? input.substring(strIndex[0], strIndex[1]) : "";
+}
+
+static void LegacyHandleBluetooth()
+{
+    if (ESP_BT.available())
+    {
+        String incomingMessage = ESP_BT.readString();
+        Serial.print("Received:");
+        Serial.println(incomingMessage);
+
+        if (incomingMessage[0] == 'E')
+        {
+            Serial.println("Entering Code");
+
+            String codeValueString = LegacySplitString(incomingMessage, '|', 1);
+            int codeValue = codeValueString.toInt();
+
+            int code[DIGIT_AMOUNT];
+            code[0] = codeValue / 1000 % 10;
+            code[1] = codeValue / 100 % 10;
+            code[2] = codeValue / 10 % 10;
+            code[3] = codeValue  % 10;
+
+            ESP_BT.println(BenchCheckInput(code));
+        }
+    }
+}
+
+//Stands in for loop(): calls the handler under test over and over and times every call.
+static void Harness(void *parameter)
+{
+    InitializeBluetooth(&BenchCheckInput, &BenchSetNewPassword, &BenchCheckInput, &BenchGetVaultStatus, NULL);
+
+    for(;;)
+    {
+        if(handler)
+        {
+            uint64_t start = SimNow();
+            handler();
+            currentPhase->stall.Record(SimNow() - start);
+        }
+        delayMicroseconds(1);
+    }
+}
+
+static int RepliesSent()
+{
+    int replies = 0;
+    for(const char *c = SimBluetoothSent(); *c; c++) replies += *c == '\n';
+    return replies;
+}
+
+static int RepliesRejected()
+{
+    const char *sent = SimBluetoothSent();
+    int rejected = *sent == '?';
+    for(const char *c = sent; *c; c++) rejected += c[0] == '\n' && c[1] == '?';
+    return rejected;
+}
+
+//Waits until the given amount of replies came back, or until nothing has come back for a few seconds.
+static void WaitForReplies(int expected)
+{
+    int replies = RepliesSent();
+    uint64_t lastReplyTime = SimNow();
+    while(replies < expected && SimNow() - lastReplyTime < 3000 * MS)
+    {
+        Wait(100 * US);
+        int now = RepliesSent();
+        if(now != replies) lastReplyTime = SimNow();
+        replies = now;
+    }
+}
+
+static void RunPhase(PhaseResult *phase, const char *name, void (*phaseHandler)(), bool framed, int commands, int batchSize)
+{
+    static const char *const mixedCommands[] = {"E|1234", "E|0000", "C|1234|1234", "S"};
+
+    phase->name = name;
+    phase->sent = 0;
+    SimBluetoothClearSent();
+    currentPhase = phase;
+    handler = phaseHandler;
+
+    uint64_t start = SimNow();
+    while(phase->sent < commands)
+    {
+        int amount = batchSize < commands - phase->sent ? batchSize : commands - phase->sent;
+        int expected = RepliesSent() + amount;
+        for(int i = 0; i < amount; i++)
+        {
+            if(framed) SendBluetooth(batchSize > 1 ? mixedCommands[i % 4] : "E|1234");
+            else SimBluetoothReceive("E|1234\n");
+        }
+        phase->sent += amount;
+        WaitForReplies(expected);
+    }
+
+    phase->answered = RepliesSent();
+    phase->rejected = RepliesRejected();
+    phase->seconds = (SimNow() - start) / 1e9;
+    handler = NULL;
+    Wait(10 * MS);
+}
+
+static void Scenario(void *parameter)
+{
+    BenchSettings *settings = (BenchSettings *)parameter;
+    Wait(10 * MS);
+
+    RunPhase(&phases[0], "readString, one at a time", LegacyHandleBluetooth, false, settings->commands, 1);
+    RunPhase(&phases[1], "readString, pipelined", LegacyHandleBluetooth, false, settings->commands, settings->batchSize);
+    RunPhase(&phases[2], "streaming, one at a time", HandleBluetooth, true, settings->commands, 1);
+    RunPhase(&phases[3], "streaming, pipelined", HandleBluetooth, true, settings->commands, settings->batchSize);
+
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    BenchSettings settings;
+    settings.commands = argc > 1 ? atoi(argv[1]) : 40;
+    settings.batchSize = argc > 2 ? atoi(argv[2]) : 20;
+
+    xTaskCreate(Harness, "harness", 8192, NULL, 1, NULL);
+    SimCreateExternalTask(Scenario, &settings, "scenario");
+    SimRun(UINT64_MAX);
+
+    printf("Bluetooth commands (%d per run, pipelined in batches of %d)\n", settings.commands, settings.batchSize);
+    printf("%-28s %8s %8s %12s %14s %14s\n", "", "sent", "answered", "commands/s", "stall p50", "stall max");
+    for(int i = 0; i < 4; i++)
+    {
+        PhaseResult *phase = &phases[i];
+        printf("%-28s %8d %8d %12.1f %11.1f us %11.1f us\n", phase->name, phase->sent, phase->answered, phase->answered / phase->seconds,
+               phase->stall.Percentile(50) / 1e3, phase->stall.Max() / 1e3);
+    }
+
+    bool streamingLostNothing = true;
+    for(int i = 2; i < 4; i++) streamingLostNothing &= phases[i].answered == phases[i].sent && phases[i].rejected == 0;
+    return streamingLostNothing ? 0 : 1;
+}
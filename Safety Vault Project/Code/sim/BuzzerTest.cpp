@@ -0,0 +1,137 @@
+//Listens to the buzzer pin while the vault gets a wrong code, the right code, a door left open and a lockdown, and checks every
+//tone sequence plays step by step as defined in BuzzerDrivers.h, queued ones right after each other. Also checks that a wrong
+//code gets its answer without waiting for the buzzer.
+//Usage: BuzzerTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/BuzzerDrivers.h"
+#include "../main/DoorDrivers.h"
+#include "../main/PasswordManager.h"
+#include "VaultStimulus.h"
+
+#define TONE_TOLERANCE (2 * MS) //A tick of scheduling either way
+
+struct ToneChange
+{
+    uint64_t time;
+    double frequency;
+};
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static std::vector<ToneChange> played;
+static bool passed = true;
+
+static void OnTone(uint8_t pin, double frequency)
+{
+    if(pin == PIN_BUZZER) played.push_back({SimNow(), frequency});
+}
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+//Checks that what the buzzer did from the given change on is exactly the given sequences played back to back.
+static bool PlayedInOrder(size_t first, std::vector<ToneType> tones)
+{
+    std::vector<ToneChange> expected;
+    uint64_t time = 0;
+    for(ToneType tone : tones)
+    {
+        for(const ToneStep *step = TONES[tone]; step->duration > 0; step++)
+        {
+            expected.push_back({time, (double)step->frequency});
+            time += step->duration * MS;
+        }
+        expected.push_back({time, 0});
+    }
+
+    if(played.size() - first != expected.size()) return false;
+
+    uint64_t start = played[first].time;
+    for(size_t i = 0; i < expected.size(); i++)
+    {
+        const ToneChange &change = played[first + i];
+        if(change.frequency != expected[i].frequency) return false;
+        if(llabs((long long)(change.time - start) - (long long)expected[i].time) > (long long)TONE_TOLERANCE) return false;
+    }
+    return true;
+}
+
+//Sends a message and returns how long the vault took to answer it.
+static uint64_t Ask(const char *message)
+{
+    SimBluetoothClearSent();
+    uint64_t start = SimNow();
+    SendBluetooth(message);
+    while(strchr(SimBluetoothSent(), '\n') == NULL && SimNow() - start < 3000 * MS) Wait(10 * US);
+    return SimNow() - start;
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(500 * MS);
+
+    printf("one wrong code\n");
+    size_t first = played.size();
+    uint64_t answerTime = Ask("E|0000");
+    printf("  answered after %.1f us\n", answerTime / 1e3);
+    Check(answerTime < 1 * MS, "answered without waiting for the buzzer");
+    Wait(3000 * MS);
+    Check(PlayedInOrder(first, {ToneError}), "error tone");
+
+    printf("right code\n");
+    first = played.size();
+    Ask("E|1234");
+    Wait(1000 * MS);
+    Check(PlayedInOrder(first, {ToneUnlock}), "unlock chirp");
+
+    printf("door left open for %d s\n", (DOOR_OPEN_ALARM_DELAY + DOOR_OPEN_ALARM_REPEAT + 5000) / 1000);
+    first = played.size();
+    SimSetPin(PIN_DOORSTATE, LOW);
+    Wait((DOOR_OPEN_ALARM_DELAY - 1000) * MS);
+    Check(played.size() == first, "quiet before the alarm delay");
+    Wait((DOOR_OPEN_ALARM_REPEAT + 6000) * MS);
+    size_t second = first;
+    while(second < played.size() && played[second].time - played[first].time < DOOR_OPEN_ALARM_REPEAT * MS / 2) second++;
+    Check(second < played.size() && played[second].time - played[first].time >= DOOR_OPEN_ALARM_REPEAT * MS, "alarm repeats");
+    bool secondAlarm = PlayedInOrder(second, {ToneDoorOpen});
+    played.resize(second);
+    Check(PlayedInOrder(first, {ToneDoorOpen}) && secondAlarm, "door alarm tone both times");
+    SimSetPin(PIN_DOORSTATE, HIGH);
+    Wait((LOCK_DELAY + 500) * MS);
+
+    printf("%d wrong codes right after each other\n", MAX_INCORRECT_TRIES);
+    first = played.size();
+    for(int i = 0; i < MAX_INCORRECT_TRIES; i++) Ask("E|0000");
+    Wait(8000 * MS);
+    std::vector<ToneType> lockdownTones(MAX_INCORRECT_TRIES, ToneError);
+    lockdownTones.push_back(ToneLockdown);
+    Check(PlayedInOrder(first, lockdownTones), "error tones & lockdown tone back to back");
+
+    printf("  loop() max %.1f us\n", simStats.loopDuration.Max() / 1e3);
+    Check(simStats.loopDuration.Max() < 1 * MS, "loop() never waited for the buzzer");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    PreloadInitializedVault(storedCode);
+    vaultBluetoothEnabled = true;
+    SimSetToneHook(OnTone);
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+//Fills the credential table with more and more user codes and measures, at every size, how long checking a stored code and a
+//code that isnt stored takes, how long adding one takes and how much of the flash is used. Next to it is what reading a packed
+//list of the same codes front to back would cost. Then checks that a wrong code takes the same time however many of its leading
+//digits are right, and removes and adds codes until the table has to be compacted.
+//Arithmetic is free in the simulator, so the times are the flash reads and writes. SipHash itself is about 1us on the chip.
+//Usage: CredentialBench [checksPerSize]
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "esp_partition.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/StorageManager.h"
+#include "../main/CredentialManager.h"
+#include "VaultStimulus.h"
+
+static const int adminCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static const int sizes[] = {1, 10, 50, 100, 250, 500, 750, 850, 900};
+
+static void ToCode(int number, int code[DIGIT_AMOUNT])
+{
+    for(int i = DIGIT_AMOUNT - 1; i >= 0; i--, number /= 10) code[i] = number % 10;
+}
+
+static uint64_t TimeVerify(int number, CredentialResult *result)
+{
+    int code[DIGIT_AMOUNT];
+    ToCode(number, code);
+    uint64_t start = SimNow();
+    *result = VerifyCredential(code).result;
+    return SimNow() - start;
+}
+
+//Reading a packed list of entry slots in one go, the least a table without an index has to do to be sure a code isnt there.
+static uint64_t TimeLinearScan(int entries)
+{
+    static uint8_t buffer[CREDENTIAL_TABLE_SIZE];
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CREDENTIAL_PARTITION_LABEL);
+    uint64_t start = SimNow();
+    esp_partition_read(partition, 0, buffer, entries * CREDENTIAL_SLOT_SIZE);
+    return SimNow() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int checks = argc > 1 ? atoi(argv[1]) : 200;
+
+    SetupStorage();
+    SetupCredentials();
+    AddCredential(adminCode, CredentialAdmin, ADMIN_USER, 0);
+
+    //Every code but the admin's, in random order. The first ones go in as users, the rest are never stored.
+    std::vector<int> numbers;
+    for(int number = 0; number < 10000; number++)
+    {
+        if(number != 1234) numbers.push_back(number);
+    }
+    for(size_t i = numbers.size() - 1; i > 0; i--) std::swap(numbers[i], numbers[NextRandom() % (i + 1)]);
+
+    printf("%-6s %6s %12s %12s %12s %12s %12s %12s\n", "codes", "load", "hit", "miss", "miss max", "add", "flash/code", "linear scan");
+    int users = 0;
+    int failed = 0;
+    for(int size : sizes)
+    {
+        uint64_t addTime = 0;
+        int added = 0;
+        for(; users < size; users++)
+        {
+            int code[DIGIT_AMOUNT];
+            ToCode(numbers[users], code);
+            uint64_t start = SimNow();
+            if(!AddCredential(code, CredentialUser, users + 1, 0)) break;
+            addTime += SimNow() - start;
+            added++;
+        }
+        if(users < size)
+        {
+            printf("%-6d full at %d codes, both buckets of the next one were\n", size, users);
+            break;
+        }
+
+        SimHistogram hits, misses;
+        CredentialResult result;
+        for(int i = 0; i < checks; i++)
+        {
+            hits.Record(TimeVerify(numbers[NextRandom() % users], &result));
+            if(result != CredentialAccepted) failed++;
+            misses.Record(TimeVerify(numbers[users + NextRandom() % (numbers.size() - users)], &result));
+            if(result != CredentialUnknown) failed++;
+        }
+
+        CredentialStats stats = GetCredentialStats();
+        printf("%-6d %5.1f%% %9.1f us %9.1f us %9.1f us %9.1f us %10.0f B %9.1f us\n", size, 100.0 * stats.live / CREDENTIAL_SLOTS,
+               hits.Percentile(50) / 1e3, misses.Percentile(50) / 1e3, misses.Max() / 1e3, added ? addTime / 1e3 / added : 0.0,
+               2.0 * CREDENTIAL_TABLE_SIZE / stats.live, TimeLinearScan(stats.live) / 1e3);
+    }
+    printf("hit includes writing the attempt counter, %d B flash for the two tables at any size\n", 2 * CREDENTIAL_TABLE_SIZE);
+
+    //A wrong code that shares more and more leading digits with a stored one.
+    std::vector<bool> stored(10000, false);
+    for(int i = 0; i < users; i++) stored[numbers[i]] = true;
+    int variants[DIGIT_AMOUNT];
+    bool found = false;
+    for(int i = 0; !found; i++)
+    {
+        found = true;
+        for(int right = 0; right < DIGIT_AMOUNT; right++)
+        {
+            int number = 0;
+            for(int digit = DIGIT_AMOUNT - 1, scale = 1; digit >= 0; digit--, scale *= 10)
+            {
+                int value = numbers[i] / scale % 10;
+                number += (digit < right ? value : (value + 1) % 10) * scale;
+            }
+            variants[right] = number;
+            found &= !stored[number] && number != 1234;
+        }
+    }
+
+    printf("right leading digits:");
+    uint64_t fastest = UINT64_MAX, slowest = 0;
+    for(int right = 0; right < DIGIT_AMOUNT; right++)
+    {
+        CredentialResult result;
+        uint64_t time = TimeVerify(variants[right], &result);
+        if(result != CredentialUnknown) failed++;
+        printf("  %d: %.2f us", right, time / 1e3);
+        fastest = std::min(fastest, time);
+        slowest = std::max(slowest, time);
+    }
+    printf("\n");
+
+    //Take a third of the users out and add as many new ones, until the dead slots have to be compacted away.
+    unsigned long compactions = GetCredentialStats().compactions;
+    uint64_t erases = simStats.flashErases;
+    uint64_t start = SimNow();
+    int replaced = 0;
+    int refused = 0;
+    for(int round = 0; round < 3 && GetCredentialStats().compactions == compactions; round++)
+    {
+        for(int i = 0; i < users / 3; i++)
+        {
+            int user = 1 + NextRandom() % users;
+            int code[DIGIT_AMOUNT];
+            ToCode(numbers[users + replaced], code);
+            if(RemoveCredentials(CredentialUser, user) > 0) replaced++;
+            if(!AddCredential(code, CredentialUser, user, 0)) refused++;
+        }
+    }
+    CredentialStats stats = GetCredentialStats();
+    printf("%d codes replaced in %.1f ms, %d refused with both buckets full: %lu compaction(s), %llu sector erases, %d live and %d dead\n",
+           replaced, (SimNow() - start) / 1e6, refused, stats.compactions - compactions, (unsigned long long)(simStats.flashErases - erases),
+           stats.live, stats.dead);
+
+    printf("%d wrong results\n", failed);
+    return failed == 0 && fastest == slowest ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+//Changes the admin code and a user's code over and over and cuts the power at a random byte write or sector erase, then boots
+//the credentials again from whatever made it to flash. After every boot the vault must still have an admin code, and exactly
+//one code of the admin and of the user must open it: the last one set, or the one the power went during. A vault left without
+//an admin code would boot as never set up and let whoever comes next pick one.
+//Usage: CredentialPowerCutTest [powerCuts]
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/StorageManager.h"
+#include "../main/CredentialManager.h"
+#include "VaultStimulus.h"
+
+#define MAXIMUM_OPERATIONS_PER_CUT 400 //Byte writes and erases before the power goes
+#define USER 7
+
+//Admin codes start with 0-4 and the user's with 5-9, so the two never take each other's code.
+static void RandomCode(int code[DIGIT_AMOUNT], bool admin)
+{
+    code[0] = NextRandom() % 5 + (admin ? 0 : 5);
+    for(int i = 1; i < DIGIT_AMOUNT; i++) code[i] = NextRandom() % 10;
+}
+
+static bool SameCode(const int a[DIGIT_AMOUNT], const int b[DIGIT_AMOUNT])
+{
+    for(int i = 0; i < DIGIT_AMOUNT; i++)
+    {
+        if(a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+static bool Opens(const int code[DIGIT_AMOUNT], CredentialType type)
+{
+    CredentialMatch match = VerifyCredential(code);
+    return match.result == CredentialAccepted && match.type == type;
+}
+
+int main(int argc, char **argv)
+{
+    int powerCuts = argc > 1 ? atoi(argv[1]) : 1000;
+
+    int codes[2][DIGIT_AMOUNT]; //Admin, user
+    int failures = 0;
+    int keptInterrupted = 0;
+    long changes = 0;
+
+    //An empty passcode key, as an older move of the plain digits left it, must be dropped and not become an admin code.
+    SetupStorage();
+    WriteStorage(StoredPasscode, codes, 0);
+    CommitStorage();
+    SetupCredentials();
+    if(HasAdminCode() || IsStored(StoredPasscode))
+    {
+        printf("an empty passcode key was taken for an admin code or kept\n");
+        failures++;
+    }
+
+    for(int admin = 0; admin < 2; admin++)
+    {
+        RandomCode(codes[admin], admin == 0);
+        AddCredential(codes[admin], admin == 0 ? CredentialAdmin : CredentialUser, USER, 0);
+    }
+
+    for(int cut = 0; cut < powerCuts; cut++)
+    {
+        int interrupted = -1;
+        int inFlight[DIGIT_AMOUNT];
+
+        SimFlashCutPowerAfter(NextRandom() % MAXIMUM_OPERATIONS_PER_CUT, NextRandom());
+        while(!SimFlashPowerLost())
+        {
+            int which = NextRandom() % 2;
+            int code[DIGIT_AMOUNT];
+            RandomCode(code, which == 0);
+            if(SameCode(code, codes[which])) continue;
+
+            AddCredential(code, which == 0 ? CredentialAdmin : CredentialUser, USER, 0);
+            if(SimFlashPowerLost())
+            {
+                interrupted = which;
+                memcpy(inFlight, code, sizeof(inFlight));
+            }
+            else
+            {
+                memcpy(codes[which], code, sizeof(code));
+                changes++;
+            }
+        }
+
+        //Reboot.
+        SimFlashRestorePower();
+        SetupStorage();
+        SetupCredentials();
+
+        bool good = HasAdminCode();
+        for(int which = 0; which < 2; which++)
+        {
+            CredentialType type = which == 0 ? CredentialAdmin : CredentialUser;
+            bool oldOpens = Opens(codes[which], type);
+            bool newOpens = interrupted == which && Opens(inFlight, type);
+            good &= oldOpens != newOpens;
+            if(newOpens)
+            {
+                memcpy(codes[which], inFlight, sizeof(inFlight));
+                keptInterrupted++;
+            }
+        }
+        good &= GetCredentialStats().live == 2;
+
+        if(!good)
+        {
+            if(failures++ < 10) printf("power cut %d: the codes that open the vault arent the last ones set\n", cut);
+            break;
+        }
+    }
+
+    CredentialStats stats = GetCredentialStats();
+    printf("%d power cuts (%d kept the code they cut into), %d bad recoveries\n", powerCuts, keptInterrupted, failures);
+    printf("%ld code changes, %lu compactions, %llu flash bytes written, %llu erases\n", changes, stats.compactions,
+           (unsigned long long)simStats.flashBytesWritten, (unsigned long long)simStats.flashErases);
+
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+//Manages codes over Bluetooth the way the admin would: gives a user a code and replaces it, adds one-time codes and removes the
+//user again. Checks that every code opens the vault exactly when it should, that a wrong admin code is refused and counted as a
+//wrong try, that the admin code cant be changed without it and that a code can only belong to one user.
+//Usage: CredentialTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/CredentialManager.h"
+#include "VaultStimulus.h"
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+//Sends a message and returns the vault's reply without its checksum.
+static const char *Ask(const char *message)
+{
+    static char reply[BLUETOOTH_FRAME_SIZE];
+    SimBluetoothClearSent();
+    SendBluetooth(message);
+
+    uint64_t start = SimNow();
+    while(strchr(SimBluetoothSent(), '\n') == NULL && SimNow() - start < 3000 * MS) Wait(1 * MS);
+
+    strncpy(reply, SimBluetoothSent(), sizeof(reply) - 1);
+    char *end = strchr(reply, '*');
+    if(end) *end = '\0';
+    return reply;
+}
+
+static bool Replies(const char *message, const char *reply)
+{
+    return strcmp(Ask(message), reply) == 0;
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(500 * MS);
+
+    printf("user codes\n");
+    Check(Replies("U|1234|7|5555", "U|1"), "user 7 gets a code");
+    Check(Replies("E|5555", "E|1"), "it opens the vault");
+    Check(Replies("U|1234|7|6666", "U|1"), "user 7 gets another code");
+    Check(Replies("E|5555", "E|0"), "the old one doesnt open it anymore");
+    Check(Replies("E|6666", "E|1"), "the new one does");
+    Check(Replies("U|0000|8|7777", "U|0"), "a wrong admin code is refused");
+    Check(Replies("S", "S|1|0|1"), "and counted as a wrong try");
+    Check(Replies("U|1234|8|6666", "U|0"), "user 8 cant have the code of user 7");
+    Check(Replies("C|1234|6666", "C|0"), "neither can the admin");
+    Check(Replies("C|9999", "?"), "the admin code cant be changed without giving it");
+    Check(Replies("C|0000|9999", "C|0"), "nor with a wrong one");
+    Check(Replies("S", "S|1|0|1"), "which is counted as a wrong try");
+    Check(Replies("U|1234|7", "?"), "a message missing a field isnt understood");
+
+    printf("one-time codes\n");
+    Check(Replies("O|1234|4321|5", "O|1"), "one-time code added");
+    Check(Replies("E|4321", "E|1"), "it opens the vault");
+    Check(Replies("E|4321", "E|0"), "but only once");
+    Check(Replies("O|1234|9876|1", "O|1"), "one-time code for a minute added");
+    Wait(61000 * MS);
+    Check(Replies("E|9876", "E|0"), "it doesnt open the vault after that minute");
+
+    printf("removing\n");
+    Check(Replies("D|1234|7", "D|1"), "user 7 removed");
+    Check(Replies("E|6666", "E|0"), "their code doesnt open the vault anymore");
+    Check(Replies("D|1234|7", "D|0"), "removing them again does nothing");
+    Check(Replies("E|1234", "E|1"), "the admin code still opens the vault");
+
+    CredentialStats stats = GetCredentialStats();
+    printf("  %d live and %d dead slots\n", stats.live, stats.dead);
+    Check(stats.live == 1, "only the admin code is left");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    PreloadInitializedVault(storedCode);
+    vaultBluetoothEnabled = true;
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+//Stress test for publishing DisplayData to the refresh interrupt without a lock. One host thread plays the main loop and keeps
+//publishing frames while others play the refresh interrupt and pull them into a DisplayFrame. Every published frame is
+//self-consistent (all digits equal, dot position derived from the digit), so a reader that ever ends up with a mixed frame
+//saw a torn update. The same readers also copy the data without checking the sequence, to show the test does catch tearing.
+//Usage: DisplayPublishTest [publishes] [readers]
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Arduino.h"
+#include "../main/DisplayDrivers.h"
+
+struct ReaderResult
+{
+    unsigned long reads = 0;
+    unsigned long updates = 0;
+    unsigned long tornFrames = 0;
+    unsigned long backwards = 0;
+    unsigned long uncheckedReads = 0;
+    unsigned long uncheckedTorn = 0;
+};
+
+static int DotPositionFor(int value)
+{
+    return value % 3 != 0 ? value % DIGIT_AMOUNT : -1;
+}
+
+static bool FrameIsConsistent(const DisplayFrame &frame)
+{
+    int value = 15 - (((unsigned char)~frame.codes[0]) >> 4);
+    for(int i = 0; i < DIGIT_AMOUNT; i++)
+    {
+        unsigned char code = ~frame.codes[i];
+        if(15 - (code >> 4) != value || (code & 0x0F) != (1 << i)) return false;
+    }
+    return frame.dotPosition == DotPositionFor(value);
+}
+
+//The writer gives up the CPU after every update, and every so often halfway through one, so readers get to see both
+//finished and half written data even on a single core.
+static void Publish(DisplayData *data, int value, bool yieldHalfway)
+{
+    BeginDisplayUpdate(data);
+    for(int i = 0; i < DIGIT_AMOUNT; i++)
+    {
+        data->digits[i] = value;
+        if(yieldHalfway && i == DIGIT_AMOUNT / 2) std::this_thread::yield();
+    }
+    data->dot = value % 3 != 0;
+    data->dotPosition = value % DIGIT_AMOUNT;
+    EndDisplayUpdate(data);
+    std::this_thread::yield();
+}
+
+static void Reader(DisplayData *data, std::atomic<bool> *done, ReaderResult *result)
+{
+    DisplayFrame frame;
+    unsigned int lastSequence = 0;
+
+    while(!done->load(std::memory_order_relaxed))
+    {
+        result->reads++;
+        if(UpdateFrame(data, &frame))
+        {
+            result->updates++;
+            if(!FrameIsConsistent(frame)) result->tornFrames++;
+            if(frame.sequence < lastSequence) result->backwards++;
+            lastSequence = frame.sequence;
+        }
+        else
+        {
+            std::this_thread::yield(); //Nothing new or the writer is halfway, let it get on with it.
+        }
+
+        //What the refresh interrupt would see if it read the data straight away, like it did before the sequence number.
+        volatile int *digits = data->digits;
+        int value = digits[0];
+        bool mixed = false;
+        for(int i = 1; i < DIGIT_AMOUNT; i++) mixed |= digits[i] != value;
+        result->uncheckedReads++;
+        if(mixed) result->uncheckedTorn++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long publishes = argc > 1 ? atol(argv[1]) : 200000;
+    int readers = argc > 2 ? atoi(argv[2]) : 3;
+
+    DisplayData data;
+    Publish(&data, 0, false);
+
+    std::atomic<bool> done {false};
+    std::vector<ReaderResult> results(readers);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < readers; i++) threads.emplace_back(Reader, &data, &done, &results[i]);
+
+    for(long i = 1; i <= publishes; i++) Publish(&data, i % 10, i % 16 == 0);
+    done = true;
+    for(std::thread &thread : threads) thread.join();
+
+    ReaderResult total;
+    for(const ReaderResult &result : results)
+    {
+        total.reads += result.reads;
+        total.updates += result.updates;
+        total.tornFrames += result.tornFrames;
+        total.backwards += result.backwards;
+        total.uncheckedReads += result.uncheckedReads;
+        total.uncheckedTorn += result.uncheckedTorn;
+    }
+
+    printf("%ld publishes, %d reader threads, %u hardware threads\n", publishes, readers, std::thread::hardware_concurrency());
+    printf("  UpdateFrame   %10lu reads %10lu new frames %6lu torn %6lu out of order\n", total.reads, total.updates, total.tornFrames, total.backwards);
+    printf("  unchecked     %10lu reads %10lu torn\n", total.uncheckedReads, total.uncheckedTorn);
+
+    bool passed = total.tornFrames == 0 && total.backwards == 0 && total.updates > 0;
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
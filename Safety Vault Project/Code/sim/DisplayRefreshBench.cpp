@@ -0,0 +1,65 @@
+//Runs the sketch with the display refreshed from the hardware timer and reports refresh jitter, first idle and then while
+//wrong codes make the vault flash the display, sound the buzzer and save to flash.
+//Usage: DisplayRefreshBench
+#include <stdio.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "VaultStimulus.h"
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static const int wrongCode[DIGIT_AMOUNT] = {4, 3, 2, 1};
+
+static DisplayRefreshStats phaseStart;
+static uint64_t phaseStartTime;
+
+static void StartPhase()
+{
+    phaseStart = GetDisplayRefreshStats();
+    phaseStartTime = SimNow();
+}
+
+static void EndPhase(const char *name)
+{
+    DisplayRefreshStats stats = GetDisplayRefreshStats();
+    double seconds = (SimNow() - phaseStartTime) / 1e9;
+
+    printf("%-44s %8.1f Hz %8lu %8lu %8lu %8lu us\n", name, (stats.slots - phaseStart.slots) / seconds / DIGIT_AMOUNT,
+           stats.slots - phaseStart.slots, stats.lateSlots - phaseStart.lateSlots, stats.missedSlots - phaseStart.missedSlots, stats.maxLatenessUs);
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(500 * MS);
+    printf("%-44s %11s %8s %8s %8s %11s\n", "", "refresh", "slots", "late", "missed", "max so far");
+
+    StartPhase();
+    Wait(5000 * MS);
+    EndPhase("idle");
+
+    StartPhase();
+    for(int i = 0; i < 2; i++)
+    {
+        EnterCode(wrongCode);
+        Wait(3000 * MS);
+    }
+    EndPhase("2 wrong codes (display flash, buzzer, save)");
+
+    SetDigitBrightness(2, 64);
+    SetDigitBrightness(3, 128);
+    StartPhase();
+    Wait(5000 * MS);
+    EndPhase("idle, digits 3 & 4 dimmed");
+
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    PreloadInitializedVault(storedCode);
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+    return 0;
+}
@@ -0,0 +1,100 @@
+//Boots a vault that was locked down by the firmware before StorageManager, which kept its values in EEPROM, for the first time
+//with the store. The vault must come up with its old code, still locked down with its wrong tries counted, and not ask for a new
+//admin code as if it was never set up. The old values must be gone from EEPROM after, so a store that is found empty on a later
+//boot doesnt bring the old code back.
+//Usage: EepromUpgradeTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "esp_partition.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/DoorDrivers.h"
+#include "../main/PasswordManager.h"
+#include "../main/RotaryDrivers.h"
+#include "../main/StorageManager.h"
+#include "../main/CredentialManager.h"
+#include "VaultStimulus.h"
+
+//The EEPROM layout of the old firmware
+#define INIT_FLAG_ADDRESS 0
+#define STORED_PASSCODE_ADDRESS 1
+#define INCORRECT_TRIES_ADDRESS 1 + sizeof(int[4])
+#define VAULT_STATE_ADDRESS INCORRECT_TRIES_ADDRESS + 1
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+//Sends a message and returns the vault's reply without its checksum.
+static const char *Ask(const char *message)
+{
+    static char reply[BLUETOOTH_FRAME_SIZE];
+    SimBluetoothClearSent();
+    SendBluetooth(message);
+
+    uint64_t start = SimNow();
+    while(strchr(SimBluetoothSent(), '\n') == NULL && SimNow() - start < 3000 * MS) Wait(1 * MS);
+
+    strncpy(reply, SimBluetoothSent(), sizeof(reply) - 1);
+    char *end = strchr(reply, '*');
+    if(end) *end = '\0';
+    return reply;
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(500 * MS);
+
+    printf("booted from the old EEPROM values\n");
+    Check(HasAdminCode(), "the old code is the admin code");
+    byte digits[DIGIT_AMOUNT];
+    memset(digits, 0xFF, sizeof(digits));
+    ReadStorage(StoredPasscode, digits, sizeof(digits));
+    Check(digits[0] == 0xFF, "plain digits of the old code are gone");
+    Check(strcmp(Ask("S"), "S|0|1|3") == 0, "status shows the lockdown and the wrong tries");
+    Check(strcmp(Ask("E|1234"), "E|0") == 0, "the old code is refused during the lockdown");
+
+    Wait(LOCK_TIME_SECONDS * 1000 * MS);
+    Check(strncmp(Ask("S"), "S|0|0|", 6) == 0, "lockdown ends");
+    Check(strcmp(Ask("E|1234"), "E|1") == 0, "the old code opens the vault");
+
+    printf("rebooted with the store and the credentials erased\n");
+    const esp_partition_t *storage = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, STORAGE_PARTITION_LABEL);
+    const esp_partition_t *credentials = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CREDENTIAL_PARTITION_LABEL);
+    esp_partition_erase_range(storage, 0, storage->size);
+    esp_partition_erase_range(credentials, 0, credentials->size);
+    SetupStorage();
+    SetupCredentials();
+    Check(!IsStored(StoredPasscode) && !IsStored(StoredVaultState), "nothing was imported again");
+    Check(!HasAdminCode() && VerifyCredential(storedCode).result == CredentialUnknown, "the old code didnt come back");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    SimEepromPreload(INIT_FLAG_ADDRESS, 1);
+    for(int i = 0; i < DIGIT_AMOUNT; i++) SimEepromPreload(STORED_PASSCODE_ADDRESS + i, storedCode[i]);
+    SimEepromPreload(INCORRECT_TRIES_ADDRESS, MAX_INCORRECT_TRIES);
+    SimEepromPreload(VAULT_STATE_ADDRESS, 1); //InputLocked
+
+    SimSetPin(PIN_DOORSTATE, HIGH);
+    SimSetPin(PIN_CLOCKWISE, HIGH);
+    SimSetPin(PIN_COUNTERCLOCKWISE, HIGH);
+    vaultBluetoothEnabled = true;
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+
+    return passed ? 0 : 1;
+}
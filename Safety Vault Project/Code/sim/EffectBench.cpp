@@ -0,0 +1,110 @@
+//Measures how FlashDisplay() behaves: how long it takes from the call until the display actually flashes, and how much heap
+//the display effects take, both for single wrong codes and for a brute-force burst of them (someone hammering the E| command).
+//A flash is recognised on the modelled 74HC595 by the all-digits-lit byte it latches.
+//Usage: EffectBench [singleFlashes] [burstLength]
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+
+#define MS 1000000ULL
+#define FLASH_ON_CODE 0x80 //Inverted (15-8)<<4 + 0b1111: an 8 on every digit
+
+struct BenchSettings
+{
+    int singleFlashes;
+    int burstLength;
+};
+
+static DisplayData data;
+static uint8_t shiftRegister = 0;
+static uint64_t flashOnCount = 0;
+static uint64_t lastFlashOnTime = 0;
+
+static SimHistogram startLatency;
+static uint32_t heapUsedAtStart = 0;
+static uint32_t singleHeapPeak = 0;
+static uint32_t burstHeapPeak = 0;
+static uint64_t burstFirstLatency = 0;
+static uint64_t burstFlashes = 0;
+static uint64_t burstBusyTime = 0;
+
+static void OnPinChange(uint8_t pin, int level)
+{
+    if(pin == PIN_DISPLAY_CLOCK && level == HIGH) shiftRegister = (shiftRegister << 1) | SimGetPin(PIN_WRITE_BUS);
+    if(pin == PIN_COPY && level == HIGH && shiftRegister == FLASH_ON_CODE)
+    {
+        flashOnCount++;
+        lastFlashOnTime = SimNow();
+    }
+}
+
+//Stands in for the sketch's loop: it only sets up the display and asks for flashes.
+static void Driver(void *parameter)
+{
+    BenchSettings *settings = (BenchSettings *)parameter;
+
+    SetupDisplayTask(&data);
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    heapUsedAtStart = SIM_HEAP_SIZE - xPortGetFreeHeapSize();
+
+    //One wrong code at a time, the display idle in between.
+    for(int i = 0; i < settings->singleFlashes; i++)
+    {
+        uint64_t requestTime = SimNow();
+        uint64_t flashesBefore = flashOnCount;
+        FlashDisplay(&data);
+
+        while(flashOnCount == flashesBefore) vTaskDelay(1);
+        startLatency.Record(lastFlashOnTime - requestTime);
+
+        vTaskDelay((FLASH_AMOUNT * FLASH_TIME + 500) / portTICK_PERIOD_MS);
+    }
+    singleHeapPeak = SIM_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize();
+
+    //A burst of wrong codes 20ms apart, then wait for the display to calm down.
+    uint64_t burstStart = SimNow();
+    uint64_t flashesBefore = flashOnCount;
+    for(int i = 0; i < settings->burstLength; i++)
+    {
+        FlashDisplay(&data);
+        if(i == 0)
+        {
+            while(flashOnCount == flashesBefore) vTaskDelay(1);
+            burstFirstLatency = lastFlashOnTime - burstStart;
+        }
+        vTaskDelay(20 / portTICK_PERIOD_MS);
+    }
+    while(SimNow() - lastFlashOnTime < 5000 * MS) vTaskDelay(100 / portTICK_PERIOD_MS);
+
+    burstHeapPeak = SIM_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize();
+    burstFlashes = (flashOnCount - flashesBefore) / FLASH_AMOUNT;
+    burstBusyTime = lastFlashOnTime + FLASH_TIME / 2 * MS - burstStart;
+
+    SimStop();
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    BenchSettings settings;
+    settings.singleFlashes = argc > 1 ? atoi(argv[1]) : 20;
+    settings.burstLength = argc > 2 ? atoi(argv[2]) : 10;
+
+    SimSetPinHook(OnPinChange);
+    xTaskCreate(Driver, "driver", 8192, &settings, 1, NULL);
+    SimRun(UINT64_MAX);
+
+    printf("Display effects, heap used before the first effect %u bytes\n", heapUsedAtStart);
+    printf("single flashes (%llu)\n", (unsigned long long)startLatency.Count());
+    printf("  start latency p50 %8.1f us, max %8.1f us\n", startLatency.Percentile(50) / 1e3, startLatency.Max() / 1e3);
+    printf("  heap high-water %6u bytes\n", singleHeapPeak);
+    printf("burst of %d flash requests 20ms apart\n", settings.burstLength);
+    printf("  start latency     %8.1f us\n", burstFirstLatency / 1e3);
+    printf("  flashes shown     %8llu\n", (unsigned long long)burstFlashes);
+    printf("  display busy for  %8.1f s\n", burstBusyTime / 1e9);
+    printf("  heap high-water %6u bytes\n", burstHeapPeak);
+
+    return startLatency.Count() == (uint64_t)settings.singleFlashes && burstFlashes > 0 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+//Compiles the sketch for the host. The Arduino IDE includes Arduino.h and generates prototypes for every function in the .ino
+//before compiling it; this file does the same by hand.
+#include "Arduino.h"
+
+void ReceivedInput();
+bool CheckInput(int *code);
+bool CheckAdminCode(int *code);
+void WrongCode();
+bool SetNewPassword(int *code);
+struct VaultStatus;
+void GetVaultStatus(VaultStatus *status);
+void HandleDoor();
+void StartLockdown(int seconds);
+void HandleLockdown();
+long TimeLeft(unsigned long since, unsigned long delay);
+void EarliestDeadline(long *timeout, long timeLeft);
+long TimeUntilNextDeadline();
+bool LightSleepAllowed();
+bool CanLightSleep();
+
+//Bluetooth is off in the sketch; the benchmarks that need it switch it on before starting the firmware.
+bool vaultBluetoothEnabled = false;
+#define BLUETOOTH_ENABLED vaultBluetoothEnabled
+
+#include "../main/main.ino"
@@ -0,0 +1,208 @@
+//Runs the event driven vault through the ways it spends its day: on with nobody around, light sleeping, someone opening it and
+//changing the code, and idling with Bluetooth on. Reports how much of the time the CPU was busy, idle or asleep, the current that
+//works out to and how long loop() took to handle each kind of event after it happened, including waking up from light sleep.
+//Usage: IdlePowerBench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/DoorDrivers.h"
+#include "../main/EventManager.h"
+#include "../main/PasswordManager.h"
+#include "../main/RotaryDrivers.h"
+#include "VaultStimulus.h"
+
+//Rough ESP32 figures for the chip alone, radio off. The display, servo and buzzer come on top.
+#define ACTIVE_MILLIAMPS 50.0       //Running code at 240MHz (datasheet modem sleep: 30-68mA)
+#define IDLE_MILLIAMPS 20.0         //Both cores in waiti with the clocks still running
+#define LIGHT_SLEEP_MILLIAMPS 0.8   //Datasheet light sleep
+#define WAKE_TRIALS 5
+
+struct Snapshot
+{
+    uint64_t time;
+    uint64_t idle;
+    uint64_t sleep;
+};
+
+extern DisplayData _data;
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static const int wrongCode[DIGIT_AMOUNT] = {4, 3, 2, 1};
+static uint64_t firstLatch = 0; //First time the 595 latched something since it was set to 0
+static SimHistogram pressLatency;
+static SimHistogram turnLatency;
+
+static void OnPinChange(uint8_t pin, int level)
+{
+    if(pin == PIN_COPY && level == HIGH && firstLatch == 0) firstLatch = SimNow();
+}
+
+static Snapshot TakeSnapshot()
+{
+    return {SimNow(), simStats.idleTime, simStats.lightSleepTime};
+}
+
+static void PrintPhase(const char *name, Snapshot start)
+{
+    Snapshot end = TakeSnapshot();
+    double total = end.time - start.time;
+    double idle = (end.idle - start.idle) / total;
+    double sleep = (end.sleep - start.sleep) / total;
+    double busy = 1 - idle - sleep;
+    double current = busy * ACTIVE_MILLIAMPS + idle * IDLE_MILLIAMPS + sleep * LIGHT_SLEEP_MILLIAMPS;
+    printf("%-44s %6.1f s %8.3f%% %8.2f%% %8.2f%% %8.2f mA\n", name, total / 1e9, busy * 100, idle * 100, sleep * 100, current);
+}
+
+static void PrintEventStats()
+{
+    static const char *const names[VAULT_EVENT_TYPE_AMOUNT] = {"rotary encoder", "door", "reset button", "bluetooth", "deadline"};
+    VaultEventStats stats = GetEventStats();
+
+    printf("%-44s %8s %12s %12s\n", "event -> handled by loop()", "events", "mean", "max");
+    for(int type = 0; type < VAULT_EVENT_TYPE_AMOUNT; type++)
+    {
+        if(stats.handled[type] == 0) continue;
+        printf("%-44s %8lu %9.1f us %9lu us\n", names[type], stats.handled[type], (double)stats.totalLatencyUs[type] / stats.handled[type],
+               stats.maxLatencyUs[type]);
+    }
+}
+
+//Waits until the given condition holds and returns how long that took, or 0 if it didnt within a second.
+template <typename Condition>
+static uint64_t TimeUntil(Condition condition)
+{
+    uint64_t start = SimNow();
+    while(!condition())
+    {
+        if(SimNow() - start > 1000 * MS) return 0;
+        Wait(10 * US);
+    }
+    return SimNow() - start;
+}
+
+static void PressResetButton()
+{
+    SimSetPin(PIN_RESET_PASSWORD_BUTTON, HIGH);
+    Wait(100 * MS);
+    SimSetPin(PIN_RESET_PASSWORD_BUTTON, LOW);
+}
+
+static void WakeTrials()
+{
+    for(int trial = 0; trial < WAKE_TRIALS; trial++)
+    {
+        Wait((LIGHT_SLEEP_DELAY + 2000) * MS);
+        uint64_t sleeps = simStats.lightSleeps;
+        SimSetPin(PIN_BUTTON_PRESS, HIGH);
+        pressLatency.Record(TimeUntil([]() { return _data.dotPosition == 1; }));
+        SimSetPin(PIN_BUTTON_PRESS, LOW);
+        if(simStats.lightSleeps == sleeps) printf("  (trial %d: the vault wasnt asleep)\n", trial);
+
+        Wait((LIGHT_SLEEP_DELAY + 2000) * MS);
+        uint64_t start = SimNow();
+        firstLatch = 0;
+        RotateOneDetent();
+        turnLatency.Record(firstLatch - start);
+    }
+}
+
+static void PrintWakeLatency()
+{
+    printf("%-44s %8d %9.1f us %9.1f us\n", "from light sleep: press -> digit submitted", WAKE_TRIALS, pressLatency.Percentile(50) / 1e3,
+           pressLatency.Max() / 1e3);
+    printf("%-44s %8d %9.1f us %9.1f us\n", "from light sleep: turn -> display back on", WAKE_TRIALS, turnLatency.Percentile(50) / 1e3,
+           turnLatency.Max() / 1e3);
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(1000 * MS);
+    Snapshot start = TakeSnapshot();
+    Wait((LIGHT_SLEEP_DELAY - 5000) * MS);
+    PrintPhase("display on, nobody around", start);
+
+    Wait(10000 * MS);
+    start = TakeSnapshot();
+    Wait(60000 * MS);
+    PrintPhase("display off, light sleeping", start);
+
+    //Open it, change the code with the door open, close it again and get a code wrong.
+    start = TakeSnapshot();
+    EnterCode(storedCode);
+    Wait(1000 * MS);
+    SimSetPin(PIN_DOORSTATE, LOW);
+    Wait(2000 * MS);
+    PressResetButton();
+    Wait(500 * MS);
+    EnterCode(storedCode);
+    Wait(2000 * MS);
+    SimSetPin(PIN_DOORSTATE, HIGH);
+    Wait((LOCK_DELAY + 1000) * MS);
+    EnterCode(wrongCode);
+    Wait(5000 * MS);
+    PrintPhase("opening it & changing the code", start);
+
+    WakeTrials();
+    SimStop();
+}
+
+static void BluetoothScenario(void *parameter)
+{
+    Wait(1000 * MS);
+    Snapshot start = TakeSnapshot();
+    Wait(60000 * MS);
+    PrintPhase("Bluetooth on, nobody around", start);
+
+    for(int i = 0; i < 20; i++)
+    {
+        SendBluetooth("S");
+        Wait(100 * MS);
+    }
+    SimStop();
+}
+
+static void PrintHeader()
+{
+    printf("Chip current at %.0f mA running, %.0f mA idle, %.1f mA light sleeping (radio and peripherals not included)\n", ACTIVE_MILLIAMPS,
+           IDLE_MILLIAMPS, LIGHT_SLEEP_MILLIAMPS);
+    printf("%-44s %8s %9s %9s %9s %11s\n", "", "time", "busy", "idle", "asleep", "current");
+    printf("%-44s %8s %8.3f%% %8.2f%% %8.2f%% %8.2f mA\n", "polling loop() before this", "", 100.0, 0.0, 0.0, ACTIVE_MILLIAMPS);
+}
+
+int main(int argc, char **argv)
+{
+    //The firmware and the simulator are global, so each run gets a process of its own.
+    PrintHeader();
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0)
+    {
+        PreloadInitializedVault(storedCode);
+        SimSetPinHook(OnPinChange);
+        SimStartArduino();
+        SimCreateExternalTask(Scenario, NULL, "scenario");
+        SimRun(UINT64_MAX);
+        PrintEventStats();
+        PrintWakeLatency();
+        exit(0);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 1;
+
+    printf("\n");
+    PreloadInitializedVault(storedCode);
+    vaultBluetoothEnabled = true;
+    SimStartArduino();
+    SimCreateExternalTask(BluetoothScenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+    PrintEventStats();
+    return 0;
+}
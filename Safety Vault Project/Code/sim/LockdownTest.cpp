@@ -0,0 +1,109 @@
+//Boots the vault with part of a lockdown left, as if the power went during one, and checks that the lockdown goes on from where
+//it was saved and no further. Then locks it down again with wrong codes over Bluetooth and checks that codes and admin commands
+//are refused, the status shows the lockdown, loop() wakes up every second to count down and the remaining time is saved as it does.
+//Usage: LockdownTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/BluetoothHandler.h"
+#include "../main/DoorDrivers.h"
+#include "../main/PasswordManager.h"
+#include "../main/StorageManager.h"
+#include "VaultStimulus.h"
+
+#define RESUMED_SECONDS 42
+#define LOCKED_FOR_SECONDS 25
+
+extern DisplayData _data;
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+static int ShownSeconds()
+{
+    return _data.digits[1] * 60 + _data.digits[2] * 10 + _data.digits[3];
+}
+
+//Sends a message and returns the vault's reply without its checksum.
+static const char *Ask(const char *message)
+{
+    static char reply[BLUETOOTH_FRAME_SIZE];
+    SimBluetoothClearSent();
+    SendBluetooth(message);
+
+    uint64_t start = SimNow();
+    while(strchr(SimBluetoothSent(), '\n') == NULL && SimNow() - start < 3000 * MS) Wait(1 * MS);
+
+    strncpy(reply, SimBluetoothSent(), sizeof(reply) - 1);
+    char *end = strchr(reply, '*');
+    if(end) *end = '\0';
+    return reply;
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(500 * MS);
+
+    printf("booted with %d seconds of lockdown left\n", RESUMED_SECONDS);
+    Check(ShownSeconds() == RESUMED_SECONDS, "display shows the saved time");
+    Check(strcmp(Ask("S"), "S|0|1|3") == 0, "status shows the lockdown");
+
+    //Keep trying the right code once a second until it opens.
+    uint64_t openedAfter = 0;
+    while(openedAfter == 0 && SimNow() - simStats.setupFinishedTime < 2 * RESUMED_SECONDS * 1000 * MS)
+    {
+        if(strcmp(Ask("E|1234"), "E|1") == 0) openedAfter = SimNow() - simStats.setupFinishedTime;
+        else Wait(1000 * MS);
+    }
+    printf("  opened %.1f s after boot\n", openedAfter / 1e9);
+    Check(openedAfter >= RESUMED_SECONDS * 1000 * MS && openedAfter < (RESUMED_SECONDS + 2) * 1000 * MS, "lockdown ends when the saved time runs out");
+
+    //Let it lock again, then get locked out.
+    Wait(UNLOCK_LOCK_DELAY * MS + 500 * MS);
+    printf("%d wrong codes\n", MAX_INCORRECT_TRIES);
+    for(int i = 0; i < MAX_INCORRECT_TRIES; i++) Ask("E|0000");
+    uint64_t lockedTime = SimNow();
+    Check(strcmp(Ask("S"), "S|0|1|3") == 0, "status shows the lockdown");
+    Check(strcmp(Ask("E|1234"), "E|0") == 0, "the right code is refused");
+    Check(strcmp(Ask("S"), "S|0|1|3") == 0, "refused code didnt count as a wrong try");
+    Check(strcmp(Ask("C|1234|5555"), "C|0") == 0, "so is changing the admin code");
+
+    uint64_t iterationsBefore = simStats.loopIterations;
+    uint64_t erasesBefore = simStats.flashErases;
+    Wait(LOCKED_FOR_SECONDS * 1000 * MS - (SimNow() - lockedTime));
+    double iterationsPerSecond = (simStats.loopIterations - iterationsBefore) / ((SimNow() - lockedTime) / 1e9);
+
+    int savedSeconds = 0;
+    ReadStorage(StoredLockdownSeconds, &savedSeconds, sizeof(savedSeconds));
+    int shownSeconds = ShownSeconds();
+    printf("  after %d s: loop() %.0f iterations/s, display %d s left, saved %d s left\n", LOCKED_FOR_SECONDS, iterationsPerSecond,
+           shownSeconds, savedSeconds);
+    Check(iterationsPerSecond >= 1 && iterationsPerSecond < 2, "loop() only woke up to count down");
+    Check(shownSeconds > 0 && shownSeconds < LOCK_TIME_SECONDS - LOCKED_FOR_SECONDS + 2, "display counts down");
+    Check(savedSeconds >= shownSeconds && savedSeconds <= shownSeconds + LOCKDOWN_SAVE_INTERVAL, "remaining time saved every few seconds");
+    Check(simStats.flashErases == erasesBefore, "saving it erased no flash");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    PreloadLockedVault(storedCode, RESUMED_SECONDS);
+    vaultBluetoothEnabled = true;
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+//Replays synthetic quadrature traces into the rotary encoder pins at rising speeds, with contact bounce on every release, while
+//the display refresh interrupt runs too. Counts the step events that come out of the ring and reports the steps that went
+//missing or came out the wrong way. Anything up to a very fast hand spin has to come through without losing a step.
+//Usage: RotaryTraceTest [detentsPerSpeed]
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/RotaryDrivers.h"
+
+#define MS 1000000ULL
+#define REQUIRED_SPEED 1000 //Detents per second that must not lose a single step
+
+static const int speeds[] = {10, 100, 1000, 5000, 20000, 50000, 100000, 200000, 400000, 800000};
+static const int SPEED_AMOUNT = sizeof(speeds) / sizeof(speeds[0]);
+
+static DisplayData data;
+static int detentsPerSpeed;
+static volatile bool replayDone = false;
+static long clockwiseSteps = 0;
+static long counterclockwiseSteps = 0;
+
+static void Wait(uint64_t ns)
+{
+    SimSleepUntil(SimNow() + ns);
+}
+
+static void ReleaseContact(uint8_t pin)
+{
+    SimSetPin(pin, HIGH);
+    Wait(100);
+    SimSetPin(pin, LOW);
+    Wait(200);
+    SimSetPin(pin, HIGH);
+}
+
+//One detent: the leading contact closes, then the trailing one, then they open again in the same order.
+static void Detent(uint8_t leading, uint8_t trailing, uint64_t quarter)
+{
+    SimSetPin(leading, LOW);
+    Wait(quarter);
+    SimSetPin(trailing, LOW);
+    Wait(quarter);
+    ReleaseContact(leading);
+    Wait(quarter - 300);
+    ReleaseContact(trailing);
+    Wait(quarter - 300);
+}
+
+//Stands in for loop(): polls the ring about every microsecond.
+static void Consumer(void *parameter)
+{
+    SetupDisplayTask(&data);
+    SetupRotaryEncoder(NULL);
+
+    RotaryEvent event;
+    for(;;)
+    {
+        while(ReadRotaryEvent(&event))
+        {
+            if(event.type != RotaryStep) continue;
+            if(event.direction > 0) clockwiseSteps++;
+            else counterclockwiseSteps++;
+        }
+        delayMicroseconds(1);
+    }
+}
+
+static void Replay(void *parameter)
+{
+    bool passed = true;
+    Wait(100 * MS);
+
+    printf("%10s %10s %10s %10s %8s %8s %8s\n", "detents/s", "edge gap", "expected", "decoded", "missed", "reversed", "dropped");
+    for(int i = 0; i < SPEED_AMOUNT; i++)
+    {
+        uint64_t quarter = 1000000000ULL / speeds[i] / 4;
+        long clockwiseBefore = clockwiseSteps;
+        long counterclockwiseBefore = counterclockwiseSteps;
+        unsigned long droppedBefore = GetDroppedRotaryEvents();
+
+        for(int detent = 0; detent < detentsPerSpeed; detent++) Detent(PIN_CLOCKWISE, PIN_COUNTERCLOCKWISE, quarter);
+        Wait(50 * MS);
+        long clockwise = clockwiseSteps - clockwiseBefore;
+        long reversed = counterclockwiseSteps - counterclockwiseBefore;
+
+        for(int detent = 0; detent < detentsPerSpeed; detent++) Detent(PIN_COUNTERCLOCKWISE, PIN_CLOCKWISE, quarter);
+        Wait(50 * MS);
+        long counterclockwise = counterclockwiseSteps - counterclockwiseBefore - reversed;
+        reversed += clockwiseSteps - clockwiseBefore - clockwise;
+
+        long expected = 2 * detentsPerSpeed;
+        long decoded = clockwise + counterclockwise;
+        long missed = expected - decoded;
+        unsigned long dropped = GetDroppedRotaryEvents() - droppedBefore;
+        printf("%10d %8.1fus %10ld %10ld %8ld %8ld %8lu\n", speeds[i], quarter / 1e3, expected, decoded, missed, reversed, dropped);
+
+        if(speeds[i] <= REQUIRED_SPEED && (missed != 0 || reversed != 0)) passed = false;
+    }
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    replayDone = passed;
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    detentsPerSpeed = argc > 1 ? atoi(argv[1]) : 200;
+
+    SimSetPin(PIN_CLOCKWISE, HIGH);
+    SimSetPin(PIN_COUNTERCLOCKWISE, HIGH);
+    xTaskCreate(Consumer, "consumer", 8192, NULL, 1, NULL);
+    SimCreateExternalTask(Replay, NULL, "replay");
+    SimRun(UINT64_MAX);
+
+    return replayDone ? 0 : 1;
+}
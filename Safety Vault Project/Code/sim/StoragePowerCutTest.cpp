@@ -0,0 +1,116 @@
+//Saves and removes random values through StorageManager and cuts the power at a random byte write or sector erase, then boots
+//the store again from whatever made it to flash. The values that come back must be exactly those of the last finished commit,
+//or those of the commit the power went during, never a mix of the two and never anything older. Also shows how the erases
+//spread over the pages.
+//Usage: StoragePowerCutTest [powerCuts]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "esp_partition.h"
+#include "../main/StorageManager.h"
+#include "VaultStimulus.h"
+
+#define MAXIMUM_OPERATIONS_PER_CUT 3000 //Byte writes and erases before the power goes
+
+struct Values
+{
+    bool present[STORAGE_KEY_AMOUNT];
+    uint8_t value[STORAGE_KEY_AMOUNT][STORAGE_VALUE_SIZE];
+
+    bool operator==(const Values &other) const { return memcmp(this, &other, sizeof(Values)) == 0; }
+};
+
+static Values ReadBack()
+{
+    Values values;
+    memset(&values, 0, sizeof(values));
+    for(int key = 0; key < STORAGE_KEY_AMOUNT; key++) values.present[key] = ReadStorage((StorageKey)key, values.value[key], STORAGE_VALUE_SIZE);
+    return values;
+}
+
+int main(int argc, char **argv)
+{
+    int powerCuts = argc > 1 ? atoi(argv[1]) : 2000;
+
+    Values committed;
+    memset(&committed, 0, sizeof(committed));
+    Values pending = committed;
+
+    long commits = 0;
+    int recoveredNewer = 0;
+    int failures = 0;
+
+    SetupStorage();
+    for(int cut = 0; cut < powerCuts; cut++)
+    {
+        bool inCommit = false;
+        Values inFlight;
+
+        SimFlashCutPowerAfter(NextRandom() % MAXIMUM_OPERATIONS_PER_CUT, NextRandom());
+        while(!SimFlashPowerLost())
+        {
+            if(NextRandom() % 16 == 0)
+            {
+                int key = NextRandom() % STORAGE_KEY_AMOUNT;
+                RemoveStorage((StorageKey)key);
+                pending.present[key] = false;
+                memset(pending.value[key], 0, STORAGE_VALUE_SIZE);
+            }
+            else if(NextRandom() % 4 != 0)
+            {
+                //Few different values, so some writes change nothing and have to be coalesced away.
+                int key = NextRandom() % STORAGE_KEY_AMOUNT;
+                int length = 1 + NextRandom() % STORAGE_VALUE_SIZE;
+                uint8_t value[STORAGE_VALUE_SIZE] = {};
+                for(int i = 0; i < length; i++) value[i] = NextRandom() % 3;
+
+                WriteStorage((StorageKey)key, value, length);
+                pending.present[key] = true;
+                memcpy(pending.value[key], value, STORAGE_VALUE_SIZE);
+            }
+            else
+            {
+                CommitStorage();
+                if(SimFlashPowerLost())
+                {
+                    inCommit = true;
+                    inFlight = pending;
+                }
+                else
+                {
+                    committed = pending;
+                    commits++;
+                }
+            }
+        }
+
+        //Reboot.
+        SimFlashRestorePower();
+        SetupStorage();
+        Values recovered = ReadBack();
+
+        if(inCommit && recovered == inFlight && !(recovered == committed)) recoveredNewer++;
+        if(!(recovered == committed) && !(inCommit && recovered == inFlight))
+        {
+            if(failures++ < 10) printf("power cut %d: recovered values match neither the last nor the interrupted commit\n", cut);
+        }
+
+        committed = recovered;
+        pending = recovered;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, STORAGE_PARTITION_LABEL);
+    int pages = partition->size / STORAGE_PAGE_SIZE;
+
+    printf("%d power cuts (%d kept the commit they cut into), %d bad recoveries\n", powerCuts, recoveredNewer, failures);
+    printf("%ld finished commits, %llu flash bytes written, %llu erases (an EEPROM commit erases every time)\n", commits,
+           (unsigned long long)simStats.flashBytesWritten, (unsigned long long)simStats.flashErases);
+    printf("erases per page:");
+    for(int page = 0; page < pages; page++) printf(" %u", SimFlashEraseCount(page));
+    printf("\n");
+
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+//Runs the vault built with tracing on through someone opening it, changing the code, getting a code wrong and walking away
+//until it light sleeps, and captures everything it writes to Serial. Reports how much the trace sent per core, how full the
+//rings got and whether any records were dropped, and saves the capture for tools/TraceDecode (make bench runs it next). The
+//capture goes next to the benchmark as TraceBench.trace unless another file is given.
+//Usage: TraceBench [capture]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/DoorDrivers.h"
+#include "../main/EventManager.h"
+#include "../main/PasswordManager.h"
+#include "../main/TraceManager.h"
+#include "VaultStimulus.h"
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+static const int newCode[DIGIT_AMOUNT] = {5, 6, 7, 8};
+static const int wrongCode[DIGIT_AMOUNT] = {4, 3, 2, 1};
+static std::vector<uint8_t> captured;
+
+static void OnSerial(uint8_t c)
+{
+    captured.push_back(c);
+}
+
+static void Scenario(void *parameter)
+{
+    Wait(1000 * MS);
+    EnterCode(storedCode);
+    Wait(1000 * MS);
+    SimSetPin(PIN_DOORSTATE, LOW);
+    Wait(2000 * MS);
+    SimSetPin(PIN_RESET_PASSWORD_BUTTON, HIGH);
+    Wait(100 * MS);
+    SimSetPin(PIN_RESET_PASSWORD_BUTTON, LOW);
+    Wait(500 * MS);
+    EnterCode(newCode);
+    Wait(2000 * MS);
+    SimSetPin(PIN_DOORSTATE, HIGH);
+    Wait((LOCK_DELAY + 1000) * MS);
+    EnterCode(wrongCode);
+
+    //Walk away until it light sleeps, then wake it with a turn.
+    Wait((LIGHT_SLEEP_DELAY + 5000) * MS);
+    RotateOneDetent();
+    Wait(1000 * MS);
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    std::string defaultPath = std::string(argv[0]) + ".trace";
+    const char *path = argc > 1 ? argv[1] : defaultPath.c_str();
+
+    PreloadInitializedVault(storedCode);
+    SimSetSerialHook(OnSerial);
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, NULL, "scenario");
+    SimRun(UINT64_MAX);
+
+    TraceStats stats = GetTraceStats();
+    double seconds = SimNow() / 1e9;
+    unsigned long dropped = 0;
+    printf("%.1f s traced, %d baud carries %d bytes/s\n", seconds, TRACE_BAUD_RATE, TRACE_BAUD_RATE / 10);
+    printf("%-8s %10s %10s %10s %12s %12s %10s\n", "", "records", "frames", "bytes", "bytes/s", "ring peak", "dropped");
+    for(int core = 0; core < TRACE_CORE_AMOUNT; core++)
+    {
+        printf("core %-3d %10lu %10lu %10lu %12.0f %6lu/%-5d %10lu\n", core, stats.records[core], stats.frames[core], stats.bytes[core],
+               stats.bytes[core] / seconds, stats.mostWaiting[core], TRACE_BUFFER_SIZE, stats.dropped[core]);
+        dropped += stats.dropped[core];
+    }
+    printf("light sleeps: %lu\n", GetEventStats().lightSleeps);
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL || fwrite(captured.data(), 1, captured.size(), file) != captured.size())
+    {
+        printf("Cant write %s\n", path);
+        return 1;
+    }
+    fclose(file);
+    printf("Serial capture (%zu bytes) saved to %s\n", captured.size(), path);
+    return dropped == 0 ? 0 : 1;
+}
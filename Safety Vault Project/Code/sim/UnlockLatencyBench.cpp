@@ -0,0 +1,85 @@
+//Enters the stored code on the rotary encoder over and over and measures how long it takes from pressing the button on the
+//last digit until Unlock() drives the servo. Also reports how fast and how evenly loop() spins while doing so.
+//Usage: UnlockLatencyBench [trials]
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/DoorDrivers.h"
+#include "VaultStimulus.h"
+
+static const int storedCode[DIGIT_AMOUNT] = {1, 2, 3, 4};
+
+static uint64_t lastUnlockTime = 0;
+static uint64_t lastLockTime = 0;
+
+static SimHistogram unlockLatency;
+static int failedTrials = 0;
+
+static void OnServoWrite(int pin, int angle)
+{
+    if(angle == UNLOCKED) lastUnlockTime = SimNow();
+    if(angle == LOCKED) lastLockTime = SimNow();
+}
+
+static void Scenario(void *parameter)
+{
+    int trials = *(int *)parameter;
+
+    Wait(500 * MS); //Let setup() finish and the display settle.
+
+    for(int trial = 0; trial < trials; trial++)
+    {
+        uint64_t pressTime = EnterCode(storedCode);
+
+        if(lastUnlockTime >= pressTime)
+        {
+            unlockLatency.Record(lastUnlockTime - pressTime);
+        }
+        else
+        {
+            failedTrials++;
+            continue;
+        }
+
+        //Open the door, take something out and close it again. The vault locks LOCK_DELAY after closing.
+        SimSetPin(PIN_DOORSTATE, LOW);
+        Wait(300 * MS);
+        SimSetPin(PIN_DOORSTATE, HIGH);
+
+        uint64_t closeTime = SimNow();
+        while(lastLockTime < closeTime && SimNow() - closeTime < 10000 * MS) Wait(10 * MS);
+        Wait(200 * MS);
+    }
+
+    SimStop();
+}
+
+int main(int argc, char **argv)
+{
+    int trials = argc > 1 ? atoi(argv[1]) : 50;
+
+    PreloadInitializedVault(storedCode);
+    SimSetServoHook(OnServoWrite);
+
+    SimStartArduino();
+    SimCreateExternalTask(Scenario, &trials, "scenario");
+    SimRun(UINT64_MAX);
+
+    double simulatedSeconds = (SimNow() - simStats.setupFinishedTime) / 1e9;
+
+    printf("Unlock latency, last button press -> Unlock() servo write (%llu trials, %d failed)\n", (unsigned long long)unlockLatency.Count(), failedTrials);
+    printf("  p50 %10.1f us\n", unlockLatency.Percentile(50) / 1e3);
+    printf("  p99 %10.1f us\n", unlockLatency.Percentile(99) / 1e3);
+    printf("  max %10.1f us\n", unlockLatency.Max() / 1e3);
+    printf("loop(), %.1f simulated seconds\n", simulatedSeconds);
+    printf("  %.0f iterations per simulated second\n", simStats.loopIterations / simulatedSeconds);
+    printf("  duration p50 %.2f us, p99 %.2f us, max %.2f us\n", simStats.loopDuration.Percentile(50) / 1e3,
+           simStats.loopDuration.Percentile(99) / 1e3, simStats.loopDuration.Max() / 1e3);
+    printf("  %llu interrupts, %llu context switches, %llu flash erases, %llu flash bytes written, %llu serial bytes\n",
+           (unsigned long long)simStats.interrupts, (unsigned long long)simStats.contextSwitches, (unsigned long long)simStats.flashErases,
+           (unsigned long long)simStats.flashBytesWritten, (unsigned long long)simStats.serialBytes);
+
+    return failedTrials == 0 ? 0 : 1;
+}
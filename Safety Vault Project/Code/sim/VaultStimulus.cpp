@@ -0,0 +1,108 @@
+#include "Arduino.h"
+#include "Sim.h"
+#include "VaultStimulus.h"
+#include "../main/DisplayDrivers.h"
+#include "../main/DoorDrivers.h"
+#include "../main/PasswordManager.h"
+#include "../main/RotaryDrivers.h"
+#include "../main/StorageManager.h"
+#include "../main/CredentialManager.h"
+#include "../main/BluetoothHandler.h"
+
+static uint32_t randomState = 12345;
+
+void PreloadInitializedVault(const int code[])
+{
+    PreloadLockedVault(code, 0);
+}
+
+void PreloadLockedVault(const int code[], int lockdownSeconds)
+{
+    //Save what the firmware saves once its password is set, as if a previous boot had done it.
+    int incorrectTries = lockdownSeconds > 0 ? MAX_INCORRECT_TRIES : 0;
+    int vaultState = lockdownSeconds > 0 ? 1 : 0; //InputLocked : AcceptingInput
+
+    SetupStorage();
+    SetupCredentials();
+    AddCredential(code, CredentialAdmin, ADMIN_USER, 0);
+    WriteStorage(StoredIncorrectTries, &incorrectTries, sizeof(incorrectTries));
+    WriteStorage(StoredVaultState, &vaultState, sizeof(vaultState));
+    if(lockdownSeconds > 0) WriteStorage(StoredLockdownSeconds, &lockdownSeconds, sizeof(lockdownSeconds));
+    CommitStorage();
+
+    SimSetPin(PIN_DOORSTATE, HIGH);
+    SimSetPin(PIN_CLOCKWISE, HIGH);
+    SimSetPin(PIN_COUNTERCLOCKWISE, HIGH);
+}
+
+void SendBluetooth(const char *message)
+{
+    byte checksum = 0;
+    for(const char *c = message; *c; c++) checksum ^= *c;
+
+    char frame[BLUETOOTH_FRAME_SIZE + 8];
+    snprintf(frame, sizeof(frame), "%s*%02X\n", message, checksum);
+    SimBluetoothReceive(frame);
+}
+
+uint32_t NextRandom()
+{
+    randomState = randomState * 1103515245 + 12345;
+    return randomState >> 8;
+}
+
+void Wait(uint64_t ns)
+{
+    SimSleepUntil(SimNow() + ns);
+}
+
+//Contacts bounce as they open again. The decoder in RotaryDrivers.cpp has to see through the extra edges.
+static void ReleaseContact(uint8_t pin)
+{
+    SimSetPin(pin, HIGH);
+    Wait(100);
+    SimSetPin(pin, LOW);
+    Wait(200);
+    SimSetPin(pin, HIGH);
+}
+
+//One detent that increments the counter. Both contacts rest high.
+void RotateOneDetent()
+{
+    SimSetPin(PIN_CLOCKWISE, LOW);
+    Wait(1500 * US);
+    SimSetPin(PIN_COUNTERCLOCKWISE, LOW);
+    Wait(1500 * US);
+    ReleaseContact(PIN_CLOCKWISE);
+    Wait(1500 * US);
+    ReleaseContact(PIN_COUNTERCLOCKWISE);
+    Wait(1500 * US);
+}
+
+void PressButton()
+{
+    SimSetPin(PIN_BUTTON_PRESS, HIGH);
+    Wait(100 * MS);
+    SimSetPin(PIN_BUTTON_PRESS, LOW);
+    Wait(150 * MS);
+}
+
+uint64_t EnterCode(const int code[])
+{
+    uint64_t pressTime = 0;
+    for(int digit = 0; digit < DIGIT_AMOUNT; digit++)
+    {
+        //Click by click, slow enough that the encoder's acceleration doesnt kick in.
+        for(int i = 0; i < code[digit]; i++)
+        {
+            RotateOneDetent();
+            Wait(40 * MS);
+        }
+
+        //Wait for HandleInput to pick up the digit, then press at a random point in the loop/display cycle.
+        Wait(120 * MS + NextRandom() % (1 * MS));
+        pressTime = SimNow();
+        PressButton();
+    }
+    return pressTime;
+}
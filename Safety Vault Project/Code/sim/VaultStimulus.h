@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+//The outside world of the vault for the benchmarks: a user turning the rotary encoder, pressing its button and opening the door.
+//Everything here has to be called from an external task (SimCreateExternalTask).
+
+#define MS 1000000ULL
+#define US 1000ULL
+
+void PreloadInitializedVault(const int code[]); //An already initialized vault with the given code stored and the door closed.
+void PreloadLockedVault(const int code[], int lockdownSeconds); //The same, but the power went with that much of a lockdown left.
+void Wait(uint64_t ns);
+void RotateOneDetent();
+void PressButton();
+uint64_t EnterCode(const int code[]); //Returns the time the button was pressed on the last digit.
+uint32_t NextRandom();
+void SendBluetooth(const char *message); //Adds the checksum and line ending. Messages sent without waiting in between arrive as one batch.
+
+extern bool vaultBluetoothEnabled; //Set before SimStartArduino() to run the firmware with Bluetooth on.
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+//Host stand-in for the ESP32 Arduino core. Every call ends up in the simulator (Sim.h) which charges its cost in simulated time.
+#include "freertos/FreeRTOS.h"
+#include "WString.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+#define IRAM_ATTR
+#define digitalPinToInterrupt(pin) (pin)
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void detachInterrupt(uint8_t pin);
+
+//Hardware timers (esp32-hal-timer). The counter runs off the 80MHz APB clock through the divider.
+typedef struct SimHardwareTimer hw_timer_t;
+hw_timer_t *timerBegin(uint8_t number, uint16_t divider, bool countUp);
+void timerEnd(hw_timer_t *timer);
+void timerAttachInterrupt(hw_timer_t *timer, void (*handler)(), bool edge);
+void timerDetachInterrupt(hw_timer_t *timer);
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarmValue, bool autoreload);
+void timerAlarmEnable(hw_timer_t *timer);
+void timerAlarmDisable(hw_timer_t *timer);
+uint64_t timerRead(hw_timer_t *timer);
+
+//LEDC PWM (esp32-hal-ledc). 16 channels, each one can drive any number of pins.
+double ledcSetup(uint8_t channel, double frequency, uint8_t resolutionBits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+void ledcWrite(uint8_t channel, uint32_t duty);
+double ledcWriteTone(uint8_t channel, double frequency); //50% duty at the given frequency, 0 stops the output.
+
+//The part of EspClass (Esp.h) the sketches use.
+class EspClass
+{
+public:
+    uint32_t getCycleCount(); //CCOUNT of the running core. It stands still while the chip light sleeps, like on the chip.
+};
+extern EspClass ESP;
+
+uint32_t esp_random(); //Always the same sequence, so runs repeat. On the chip it is the hardware RNG.
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
@@ -0,0 +1,38 @@
+#pragma once
+#include "Arduino.h"
+#include "esp_err.h"
+
+//SPP events (esp_spp_api.h). Only the data one is ever raised here.
+typedef enum
+{
+    ESP_SPP_INIT_EVT = 0,
+    ESP_SPP_DATA_IND_EVT = 30
+} esp_spp_cb_event_t;
+
+typedef union
+{
+    struct
+    {
+        uint32_t handle;
+        uint16_t len;
+        uint8_t *data;
+    } data_ind;
+} esp_spp_cb_param_t;
+
+typedef void (esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+//Classic Bluetooth SPP link. SimBluetoothReceive() feeds the receive side, everything written is kept for the benchmark to inspect.
+//A registered callback gets ESP_SPP_DATA_IND_EVT from the Bluetooth stack's task once the data is readable, modelled as an interrupt.
+class BluetoothSerial : public Stream
+{
+public:
+    bool begin(String localName = String(), bool isMaster = false);
+    void end() {}
+    esp_err_t register_callback(esp_spp_cb_t *callback);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+};
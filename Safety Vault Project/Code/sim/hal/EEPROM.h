@@ -0,0 +1,25 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE 4096
+
+//ESP32 EEPROM emulation, only used by StorageManager to take over the values of the firmware before it and clear them. Holds
+//what SimEepromPreload() put in, a fresh chip reads back 0xFF. Writes go to a copy made by begin() and only reach the chip with
+//commit(), end() throws away what wasnt committed.
+class EEPROMClass
+{
+public:
+    bool begin(size_t size);
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    bool commit();
+    void end() { size = 0; }
+    uint16_t length() { return size; }
+
+private:
+    size_t size = 0;
+    uint8_t copy[SIM_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
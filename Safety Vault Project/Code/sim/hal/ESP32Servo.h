@@ -0,0 +1,18 @@
+#pragma once
+#include "Arduino.h"
+
+class Servo
+{
+public:
+    int attach(int pin);
+    int attach(int pin, int minimum, int maximum);
+    void detach();
+    void setPeriodHertz(int hertz) {}
+    void write(int value);
+    int read() { return angle; }
+    bool attached() { return pin >= 0; }
+
+private:
+    int pin = -1;
+    int angle = 0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include "Stream.h"
+#include "freertos/FreeRTOS.h"
+
+//UART0. Bytes leave at the configured baud rate through a 128 byte FIFO, writes busy-wait while it is full like the real driver.
+//Every write holds the UART lock from begin() on, so writes from different tasks dont get mixed up.
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    void flush();
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    operator bool() const { return true; }
+
+private:
+    void WriteByte(uint8_t c);
+
+    unsigned long baudRate = 115200;
+    uint64_t transmitDoneTime = 0;
+    SemaphoreHandle_t lock = NULL;
+};
+
+extern HardwareSerial Serial;
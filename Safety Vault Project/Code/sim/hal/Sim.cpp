@@ -0,0 +1,477 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "SimInternal.h"
+
+#define SIM_TASK_STACK_SIZE (256 * 1024)
+
+SimCosts simCosts;
+SimStats simStats;
+
+struct PendingInterrupt
+{
+    uint64_t time;
+    uint64_t sequence;
+    void (*handler)(void *argument);
+    void *argument;
+};
+
+static uint64_t now = 0;
+static std::vector<SimTask *> tasks;
+static SimTask *currentTask = NULL;
+static SimTask *lastFirmwareTask = NULL;
+static ucontext_t schedulerContext;
+static uint64_t preemptCheckTime = UINT64_MAX; //Earliest time something may want to take the CPU away from the running task
+static uint32_t nextTaskOrder = 0;
+static int interruptDepth = 0;
+static bool stopRequested = false;
+static bool tasksFinished = false;
+
+static std::vector<PendingInterrupt> pendingInterrupts; //Sorted on time, then on the order they were raised
+static uint64_t nextInterruptSequence = 0;
+
+static uint8_t pinLevels[SIM_PIN_COUNT];
+static void (*pinInterrupts[SIM_PIN_COUNT])();
+static int pinInterruptModes[SIM_PIN_COUNT];
+static void (*pinHook)(uint8_t pin, int level) = NULL;
+
+static bool pinWakes[SIM_PIN_COUNT];
+static int pinWakeLevels[SIM_PIN_COUNT];
+static SimTask *sleepingTask = NULL; //The task that put the chip in light sleep, NULL while it is awake
+static bool sleepPinsWake = false;
+static bool wokenByPin = false;
+
+static uint64_t TickTime()
+{
+    return 1000000000ULL / configTICK_RATE_HZ;
+}
+
+//Work out when the running task has to check again if an interrupt or another task should run instead.
+//Higher priorities preempt as soon as they are due, equal priorities share the CPU on tick boundaries (time slicing).
+static void RecalculatePreemptCheck()
+{
+    preemptCheckTime = pendingInterrupts.empty() ? UINT64_MAX : pendingInterrupts.front().time;
+    if(currentTask == NULL) return;
+
+    uint64_t nextTick = (now / TickTime() + 1) * TickTime();
+    for(SimTask *task : tasks)
+    {
+        if(task == currentTask || task->finished) continue;
+
+        if(task->priority > currentTask->priority) preemptCheckTime = std::min(preemptCheckTime, task->wakeTime);
+        else if(task->priority == currentTask->priority) preemptCheckTime = std::min(preemptCheckTime, std::max(task->wakeTime, nextTick));
+    }
+}
+
+//The outside world does not wait for the CPU. Interrupts that became due while another one ran must not get ahead of a pin change
+//the outside world was going to make before them, so we stop at the first external task due earlier and let it run first.
+static uint64_t ExternalWakeTime()
+{
+    uint64_t earliest = UINT64_MAX;
+    for(SimTask *task : tasks)
+    {
+        if(task->external && !task->finished) earliest = std::min(earliest, task->wakeTime);
+    }
+    return earliest;
+}
+
+static void RunDueInterrupts()
+{
+    if(sleepingTask != NULL) return;
+
+    while(!pendingInterrupts.empty() && pendingInterrupts.front().time <= now && pendingInterrupts.front().time <= ExternalWakeTime())
+    {
+        PendingInterrupt interrupt = pendingInterrupts.front();
+        pendingInterrupts.erase(pendingInterrupts.begin());
+
+        interruptDepth++;
+        interrupt.handler(interrupt.argument);
+        now += simCosts.interruptExit;
+        interruptDepth--;
+        simStats.interrupts++;
+    }
+}
+
+//Hand the CPU back to the scheduler. Returns once the scheduler picks this task again.
+static void SwitchOut(uint64_t wakeTime)
+{
+    SimTask *task = currentTask;
+    task->wakeTime = wakeTime;
+    swapcontext(&task->context, &schedulerContext);
+}
+
+static void Reschedule()
+{
+    RunDueInterrupts();
+    RecalculatePreemptCheck();
+
+    if(currentTask != NULL && now >= preemptCheckTime) SwitchOut(now);
+}
+
+uint64_t SimNow()
+{
+    return now;
+}
+
+void SimCharge(uint64_t ns)
+{
+    now += ns;
+    if(interruptDepth == 0 && now >= preemptCheckTime) Reschedule();
+}
+
+void SimStall(uint64_t ns)
+{
+    now += ns;
+}
+
+void SimSleepUntil(uint64_t time)
+{
+    if(currentTask == NULL)
+    {
+        now = std::max(now, time);
+        return;
+    }
+
+    SwitchOut(time);
+}
+
+static void TaskEntry()
+{
+    SimTask *task = currentTask;
+    task->function(task->parameter);
+    task->finished = true;
+    tasksFinished = true;
+    //Returning resumes the scheduler through uc_link.
+}
+
+SimTask *SimCreateTask(void (*function)(void *), void *parameter, const char *name, int priority, bool external)
+{
+    SimTask *task = new SimTask();
+    task->name = name;
+    task->function = function;
+    task->parameter = parameter;
+    task->priority = priority;
+    task->core = 0;
+    task->external = external;
+    task->finished = false;
+    task->wakeTime = now;
+    task->order = nextTaskOrder++;
+    task->stack = (char *)malloc(SIM_TASK_STACK_SIZE);
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = SIM_TASK_STACK_SIZE;
+    task->context.uc_link = &schedulerContext;
+    makecontext(&task->context, TaskEntry, 0);
+
+    tasks.push_back(task);
+    RecalculatePreemptCheck();
+    return task;
+}
+
+SimTask *SimCurrentTask()
+{
+    return currentTask;
+}
+
+bool SimInInterrupt()
+{
+    return interruptDepth > 0;
+}
+
+//Make a task ready to run now. A task of higher priority than the running one takes over straight away, like FreeRTOS does.
+void SimWakeTask(SimTask *task)
+{
+    task->wakeTime = now;
+    RecalculatePreemptCheck();
+
+    if(currentTask != NULL && interruptDepth == 0 && task->priority > currentTask->priority) SwitchOut(now);
+}
+
+void SimFinishTask(SimTask *task)
+{
+    task->finished = true;
+    tasksFinished = true;
+    if(task == currentTask) SwitchOut(UINT64_MAX);
+}
+
+void SimCreateExternalTask(void (*function)(void *), void *parameter, const char *name)
+{
+    SimCreateTask(function, parameter, name, 1000, true);
+}
+
+extern void setup();
+extern void loop();
+
+//Mirrors the loopTask the ESP32 Arduino core creates around the sketch.
+static void LoopTask(void *parameter)
+{
+    setup();
+    simStats.setupFinishedTime = now;
+
+    for(;;)
+    {
+        uint64_t start = now;
+        uint64_t blockedBefore = currentTask->blockedTime;
+        loop();
+        SimCharge(simCosts.loopOverhead);
+
+        simStats.loopIterations++;
+        simStats.loopDuration.Record(now - start - (currentTask->blockedTime - blockedBefore));
+    }
+}
+
+void SimStartArduino()
+{
+    SimHeapAllocate(8192 + SIM_TCB_SIZE); //The core gives loopTask an 8KB stack
+    SimCreateTask(LoopTask, NULL, "loopTask", 1, false)->core = 1; //ARDUINO_RUNNING_CORE
+}
+
+static SimTask *PickReadyTask()
+{
+    SimTask *best = NULL;
+    for(SimTask *task : tasks)
+    {
+        if(task->finished || task->wakeTime > now) continue;
+        if(sleepingTask != NULL && !task->external && task != sleepingTask) continue; //Frozen until the chip wakes up
+
+        if(best == NULL || task->priority > best->priority ||
+           (task->priority == best->priority && (task->wakeTime < best->wakeTime || (task->wakeTime == best->wakeTime && task->order < best->order))))
+        {
+            best = task;
+        }
+    }
+    return best;
+}
+
+static uint64_t EarliestEvent()
+{
+    uint64_t earliest = pendingInterrupts.empty() || sleepingTask != NULL ? UINT64_MAX : pendingInterrupts.front().time;
+    for(SimTask *task : tasks)
+    {
+        if(sleepingTask != NULL && !task->external && task != sleepingTask) continue;
+        if(!task->finished) earliest = std::min(earliest, task->wakeTime);
+    }
+    return earliest;
+}
+
+static void ReleaseFinishedTasks()
+{
+    tasksFinished = false;
+    for(size_t i = 0; i < tasks.size();)
+    {
+        if(tasks[i]->finished)
+        {
+            if(lastFirmwareTask == tasks[i]) lastFirmwareTask = NULL;
+            free(tasks[i]->stack);
+            delete tasks[i];
+            tasks.erase(tasks.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void SimRun(uint64_t duration)
+{
+    uint64_t endTime = duration > UINT64_MAX - now ? UINT64_MAX : now + duration;
+    stopRequested = false;
+
+    while(!stopRequested && now < endTime)
+    {
+        RunDueInterrupts();
+
+        SimTask *next = PickReadyTask();
+        if(next == NULL)
+        {
+            //Nothing can run right now, skip ahead to the next thing that happens.
+            uint64_t nextEvent = EarliestEvent();
+            if(nextEvent == UINT64_MAX) break;
+
+            uint64_t until = std::max(now, std::min(nextEvent, endTime));
+            if(sleepingTask == NULL) simStats.idleTime += until - now;
+            else simStats.lightSleepTime += until - now;
+            now = until;
+            continue;
+        }
+
+        if(!next->external)
+        {
+            if(next != lastFirmwareTask && lastFirmwareTask != NULL)
+            {
+                now += simCosts.contextSwitch;
+                simStats.contextSwitches++;
+            }
+            lastFirmwareTask = next;
+        }
+
+        currentTask = next;
+        RecalculatePreemptCheck();
+        swapcontext(&schedulerContext, &next->context);
+        currentTask = NULL;
+
+        if(tasksFinished) ReleaseFinishedTasks();
+    }
+}
+
+void SimStop()
+{
+    stopRequested = true;
+}
+
+void SimScheduleInterrupt(uint64_t time, void (*handler)(void *argument), void *argument)
+{
+    PendingInterrupt interrupt = { time, nextInterruptSequence++, handler, argument };
+    auto position = std::upper_bound(pendingInterrupts.begin(), pendingInterrupts.end(), interrupt, [](const PendingInterrupt &a, const PendingInterrupt &b)
+    {
+        return a.time < b.time || (a.time == b.time && a.sequence < b.sequence);
+    });
+    pendingInterrupts.insert(position, interrupt);
+    RecalculatePreemptCheck();
+}
+
+void SimCancelInterrupts(void *argument)
+{
+    pendingInterrupts.erase(std::remove_if(pendingInterrupts.begin(), pendingInterrupts.end(), [argument](const PendingInterrupt &interrupt)
+    {
+        return interrupt.argument == argument;
+    }), pendingInterrupts.end());
+    RecalculatePreemptCheck();
+}
+
+static void GpioInterrupt(void *argument)
+{
+    uint8_t pin = (uint8_t)(uintptr_t)argument;
+    if(pinInterrupts[pin] != NULL) pinInterrupts[pin]();
+}
+
+void SimWritePin(uint8_t pin, int level)
+{
+    level = level ? HIGH : LOW;
+    if(pin >= SIM_PIN_COUNT || pinLevels[pin] == level) return;
+    pinLevels[pin] = level;
+
+    if(pinHook != NULL) pinHook(pin, level);
+
+    if(sleepingTask != NULL && sleepPinsWake && pinWakes[pin] && pinWakeLevels[pin] == level && !wokenByPin)
+    {
+        wokenByPin = true;
+        sleepingTask->wakeTime = now;
+    }
+
+    if(pinInterrupts[pin] == NULL) return;
+
+    //Each pin has a single interrupt status bit, so edges that come in before the ISR got to run only raise one interrupt.
+    int mode = pinInterruptModes[pin];
+    if(mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW))
+    {
+        void *argument = (void *)(uintptr_t)pin;
+        bool pending = std::any_of(pendingInterrupts.begin(), pendingInterrupts.end(), [argument](const PendingInterrupt &interrupt)
+        {
+            return interrupt.handler == GpioInterrupt && interrupt.argument == argument;
+        });
+        if(!pending) SimScheduleInterrupt(now + simCosts.interruptLatency, GpioInterrupt, argument);
+    }
+}
+
+//Light sleep stops the clocks of both cores and the peripherals. Interrupts that come due meanwhile run once it wakes up.
+bool SimLightSleep(uint64_t wakeTime, bool pinsWake)
+{
+    SimCharge(simCosts.lightSleepEnter);
+    if(currentTask == NULL) return false;
+
+    //A wake pin that is already at its level wakes the chip straight away.
+    for(int pin = 0; pin < SIM_PIN_COUNT; pin++)
+    {
+        if(pinsWake && pinWakes[pin] && pinLevels[pin] == pinWakeLevels[pin]) return true;
+    }
+
+    sleepingTask = currentTask;
+    sleepPinsWake = pinsWake;
+    wokenByPin = false;
+    SwitchOut(wakeTime);
+    sleepingTask = NULL;
+
+    simStats.lightSleeps++;
+    SimStall(simCosts.lightSleepWake);
+    return wokenByPin;
+}
+
+void SimSetWakePin(uint8_t pin, bool enabled, int level)
+{
+    if(pin >= SIM_PIN_COUNT) return;
+    pinWakes[pin] = enabled;
+    pinWakeLevels[pin] = level ? HIGH : LOW;
+}
+
+int SimReadPin(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+void SimAttachInterrupt(uint8_t pin, void (*handler)(), int mode)
+{
+    if(pin >= SIM_PIN_COUNT) return;
+    pinInterrupts[pin] = handler;
+    pinInterruptModes[pin] = mode;
+}
+
+void SimSetPin(uint8_t pin, int level)
+{
+    SimWritePin(pin, level);
+}
+
+int SimGetPin(uint8_t pin)
+{
+    return SimReadPin(pin);
+}
+
+void SimSetPinHook(void (*hook)(uint8_t pin, int level))
+{
+    pinHook = hook;
+}
+
+static int BucketIndex(uint64_t value)
+{
+    if(value < 64) return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (int)((value >> (msb - 5)) & 31);
+    return 64 + (msb - 6) * 32 + sub;
+}
+
+static uint64_t BucketValue(int index)
+{
+    if(index < 64) return index;
+
+    int msb = (index - 64) / 32 + 6;
+    uint64_t sub = (index - 64) % 32;
+    return (1ULL << msb) | (sub << (msb - 5));
+}
+
+void SimHistogram::Record(uint64_t value)
+{
+    buckets[BucketIndex(value)]++;
+    count++;
+    if(value > maximum) maximum = value;
+}
+
+uint64_t SimHistogram::Percentile(double percent) const
+{
+    if(count == 0) return 0;
+
+    uint64_t target = (uint64_t)(percent / 100.0 * count + 0.5);
+    if(target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if(seen >= target) return std::min(BucketValue(i), maximum);
+    }
+    return maximum;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+
+//Host simulator sitting underneath the Arduino/ESP32 stand-in headers in this folder.
+//Time is simulated in nanoseconds. Firmware only moves it forward through the cost of the HAL calls it makes (SimCosts),
+//through delays and through blocking RTOS calls, so every figure a benchmark prints is simulated ESP32 time, not host time.
+//The model is a single core running FreeRTOS style fixed priority preemptive scheduling. Interrupts preempt everything.
+
+#define SIM_CPU_MHZ 240
+
+//Cost of each HAL call in nanoseconds. Rough figures for an ESP32 at 240MHz running the Arduino core.
+struct SimCosts
+{
+    uint32_t digitalRead = 120;
+    uint32_t digitalWrite = 150;
+    uint32_t gpioRegister = 30;           //A single store to a GPIO peripheral register
+    uint32_t pinMode = 1000;
+    uint32_t timeRead = 150;              //millis() & micros() (esp_timer_get_time)
+    uint32_t cycleCount = 10;             //ESP.getCycleCount(), an esync and a special register read
+    uint32_t interruptLatency = 2000;     //From the pin edge to the first line of the attached ISR
+    uint32_t interruptExit = 500;
+    uint32_t contextSwitch = 800;
+    uint32_t semaphore = 400;             //Taking or giving a semaphore, sending to or receiving from a queue
+    uint32_t taskCreate = 30000;          //xTaskCreate: allocating the stack and TCB and setting them up
+    uint32_t taskDelete = 5000;
+    uint32_t loopOverhead = 300;          //The Arduino loopTask around each loop() call
+    uint32_t servoWrite = 1500;
+    uint32_t analogWrite = 2000;          //Any LEDC call, analogWrite goes through LEDC too
+    uint32_t serialByte = 400;            //CPU time to put one byte into the UART FIFO
+    uint32_t bluetoothByte = 1000;
+    uint64_t flashSectorErase = 45000000; //Erasing a 4KB flash sector. Both cores stall while it happens.
+    uint32_t flashWriteByte = 2700;       //Programming flash. Stalls the chip like an erase.
+    uint32_t flashReadByte = 25;
+    uint32_t lightSleepEnter = 150000;    //esp_light_sleep_start() getting the chip ready before it sleeps
+    uint32_t lightSleepWake = 500000;     //From the wakeup source to esp_light_sleep_start() returning
+};
+extern SimCosts simCosts;
+
+#define SIM_HEAP_SIZE (300 * 1024) //Free heap an ESP32 Arduino sketch starts out with
+#define SIM_TCB_SIZE 360            //Heap used by a task on top of its stack
+#define SIM_QUEUE_OVERHEAD 88       //Heap used by a queue or semaphore on top of its storage
+
+//Log-linear histogram (32 sub buckets per power of two, ~3% resolution) so hot paths can be recorded without allocating.
+class SimHistogram
+{
+public:
+    void Record(uint64_t value);
+    uint64_t Percentile(double percent) const;
+    uint64_t Max() const { return maximum; }
+    uint64_t Count() const { return count; }
+
+private:
+    static const int BUCKET_COUNT = 64 + 58 * 32;
+    uint64_t buckets[BUCKET_COUNT] = {};
+    uint64_t count = 0;
+    uint64_t maximum = 0;
+};
+
+struct SimStats
+{
+    uint64_t setupFinishedTime = 0;
+    uint64_t loopIterations = 0;
+    SimHistogram loopDuration;      //Each loop() call, not counting time it spent blocked on a queue or semaphore waiting for something to happen
+    uint64_t interrupts = 0;
+    uint64_t contextSwitches = 0;
+    uint64_t flashErases = 0;
+    uint64_t flashBytesWritten = 0;
+    uint64_t serialBytes = 0;
+    uint64_t idleTime = 0;          //Nothing to run, the CPU waits for an interrupt
+    uint64_t lightSleepTime = 0;    //The whole chip light sleeping. Counts neither as idle nor as busy.
+    uint64_t lightSleeps = 0;
+};
+extern SimStats simStats;
+
+//Time
+uint64_t SimNow();
+void SimCharge(uint64_t ns);        //CPU time used by the running code. Lets due interrupts and higher priority tasks run.
+void SimStall(uint64_t ns);         //Time in which the whole chip stands still (flash erase). Nothing else gets to run.
+void SimSleepUntil(uint64_t time);  //Block the running task until the given simulated time.
+
+//Tasks
+void SimStartArduino();             //Create the Arduino loopTask: setup() once and then loop() forever.
+void SimCreateExternalTask(void (*function)(void *), void *parameter, const char *name); //The outside world. Highest priority and uses no CPU time.
+void SimRun(uint64_t duration);     //Run the simulation until SimStop() is called, the duration has passed or nothing is left to run.
+void SimStop();
+
+//The outside world
+void SimSetPin(uint8_t pin, int level); //Drive an input pin. Fires any interrupt attached to the pin.
+int SimGetPin(uint8_t pin);
+void SimSetPinHook(void (*hook)(uint8_t pin, int level)); //Called for every level change, whoever drives the pin.
+void SimSetServoHook(void (*hook)(int pin, int angle));
+void SimSetToneHook(void (*hook)(uint8_t pin, double frequency)); //Called when an LEDC channel changes, with 0 when the pin goes quiet.
+void SimBluetoothReceive(const char *text);
+const char *SimBluetoothSent(); //Everything the firmware wrote to Bluetooth since the last SimBluetoothClearSent().
+void SimBluetoothClearSent();
+void SimSetSerialEcho(bool echo);
+void SimSetSerialHook(void (*hook)(uint8_t c)); //Called for every byte written to Serial.
+
+//Emulated flash
+void SimFlashCutPowerAfter(uint32_t operations, uint32_t seed); //Power goes during the given byte write or sector erase from now, leaving it half done.
+bool SimFlashPowerLost();           //Every flash write and erase fails from the power cut until SimFlashRestorePower().
+void SimFlashRestorePower();
+uint32_t SimFlashEraseCount(int sector); //Erases of the given 4KB sector so far, counted from the start of the vault partition.
+void SimEepromPreload(int address, uint8_t value); //What the firmware before StorageManager left in EEPROM.
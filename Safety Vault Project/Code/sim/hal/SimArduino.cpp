@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <algorithm>
+#include "Arduino.h"
+#include "soc/gpio_struct.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include "Sim.h"
+#include "SimInternal.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+SimGpio GPIO;
+static bool serialEcho = false;
+static void (*serialHook)(uint8_t c) = NULL;
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    SimCharge(simCosts.pinMode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    SimCharge(simCosts.digitalWrite);
+    SimWritePin(pin, value);
+}
+
+int digitalRead(uint8_t pin)
+{
+    SimCharge(simCosts.digitalRead);
+    return SimReadPin(pin);
+}
+
+void SimGpioSetRegister::operator=(uint32_t mask)
+{
+    SimCharge(simCosts.gpioRegister);
+    for(; mask != 0; mask &= mask - 1) SimWritePin(firstPin + __builtin_ctz(mask), HIGH);
+}
+
+void SimGpioClearRegister::operator=(uint32_t mask)
+{
+    SimCharge(simCosts.gpioRegister);
+    for(; mask != 0; mask &= mask - 1) SimWritePin(firstPin + __builtin_ctz(mask), LOW);
+}
+
+SimGpioInputRegister::operator uint32_t() const
+{
+    SimCharge(simCosts.gpioRegister);
+
+    uint32_t levels = 0;
+    int pins = firstPin == 0 ? 32 : 8;
+    for(int i = 0; i < pins; i++)
+    {
+        if(SimReadPin(firstPin + i)) levels |= 1UL << i;
+    }
+    return levels;
+}
+
+//Same bit-banging loop as the ESP32 core's shiftOut, so it costs 24 digitalWrite calls.
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        if(bitOrder == LSBFIRST) digitalWrite(dataPin, !!(value & (1 << i)));
+        else digitalWrite(dataPin, !!(value & (1 << (7 - i))));
+
+        digitalWrite(clockPin, HIGH);
+        digitalWrite(clockPin, LOW);
+    }
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode)
+{
+    SimAttachInterrupt(pin, handler, mode);
+}
+
+void detachInterrupt(uint8_t pin)
+{
+    SimAttachInterrupt(pin, NULL, 0);
+}
+
+struct SimHardwareTimer
+{
+    uint64_t tickTime;    //Picoseconds per counter tick
+    uint64_t zeroTime;    //Simulated time the counter was (or would have been) 0
+    uint64_t alarmValue;
+    bool autoreload;
+    bool alarmEnabled;
+    void (*handler)();
+};
+
+static SimHardwareTimer hardwareTimers[4];
+
+static uint64_t TimerCount(SimHardwareTimer *timer)
+{
+    return (SimNow() - timer->zeroTime) * 1000 / timer->tickTime;
+}
+
+static void TimerAlarm(void *argument);
+
+//(Re)schedule the alarm interrupt for when the counter reaches the alarm value. An alarm already passed never fires, like the hardware.
+static void ArmTimer(SimHardwareTimer *timer)
+{
+    SimCancelInterrupts(timer);
+    if(!timer->alarmEnabled || timer->handler == NULL || timer->alarmValue < TimerCount(timer)) return;
+
+    uint64_t alarmTime = timer->zeroTime + (timer->alarmValue * timer->tickTime + 999) / 1000;
+    SimScheduleInterrupt(alarmTime + simCosts.interruptLatency, TimerAlarm, timer);
+}
+
+static void TimerAlarm(void *argument)
+{
+    SimHardwareTimer *timer = (SimHardwareTimer *)argument;
+
+    if(timer->autoreload) timer->zeroTime = SimNow() - simCosts.interruptLatency;
+    else timer->alarmEnabled = false;
+    ArmTimer(timer);
+
+    timer->handler();
+}
+
+hw_timer_t *timerBegin(uint8_t number, uint16_t divider, bool countUp)
+{
+    SimHardwareTimer *timer = &hardwareTimers[number % 4];
+    timer->tickTime = 1000000ULL * divider / 80; //APB clock is 80MHz
+    timer->zeroTime = SimNow();
+    timer->alarmEnabled = false;
+    timer->handler = NULL;
+    return timer;
+}
+
+void timerEnd(hw_timer_t *timer)
+{
+    timer->alarmEnabled = false;
+    ArmTimer(timer);
+}
+
+void timerAttachInterrupt(hw_timer_t *timer, void (*handler)(), bool edge)
+{
+    timer->handler = handler;
+    ArmTimer(timer);
+}
+
+void timerDetachInterrupt(hw_timer_t *timer)
+{
+    timer->handler = NULL;
+    ArmTimer(timer);
+}
+
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarmValue, bool autoreload)
+{
+    SimCharge(simCosts.gpioRegister * 3);
+    timer->alarmValue = alarmValue;
+    timer->autoreload = autoreload;
+    ArmTimer(timer);
+}
+
+void timerAlarmEnable(hw_timer_t *timer)
+{
+    SimCharge(simCosts.gpioRegister);
+    timer->alarmEnabled = true;
+    ArmTimer(timer);
+}
+
+void timerAlarmDisable(hw_timer_t *timer)
+{
+    SimCharge(simCosts.gpioRegister);
+    timer->alarmEnabled = false;
+    ArmTimer(timer);
+}
+
+uint64_t timerRead(hw_timer_t *timer)
+{
+    SimCharge(simCosts.timeRead);
+    return TimerCount(timer);
+}
+
+#define LEDC_CHANNEL_AMOUNT 16
+
+struct SimLedcChannel
+{
+    double frequency = 0;
+    uint8_t resolutionBits = 8;
+    uint32_t duty = 0;
+};
+
+static SimLedcChannel ledcChannels[LEDC_CHANNEL_AMOUNT];
+static int ledcPinChannels[SIM_PIN_COUNT]; //Channel + 1 the pin is attached to, 0 for none
+static void (*toneHook)(uint8_t pin, double frequency) = NULL;
+
+void SimSetToneHook(void (*hook)(uint8_t pin, double frequency))
+{
+    toneHook = hook;
+}
+
+//Tell the outside world what each pin on the channel now sounds like: its frequency, or 0 while it outputs nothing.
+static void LedcChanged(uint8_t channel)
+{
+    SimLedcChannel *ledc = &ledcChannels[channel];
+    double frequency = ledc->duty > 0 ? ledc->frequency : 0;
+    for(int pin = 0; pin < SIM_PIN_COUNT; pin++)
+    {
+        if(ledcPinChannels[pin] == channel + 1 && toneHook != NULL) toneHook(pin, frequency);
+    }
+}
+
+double ledcSetup(uint8_t channel, double frequency, uint8_t resolutionBits)
+{
+    SimCharge(simCosts.analogWrite);
+    if(channel >= LEDC_CHANNEL_AMOUNT) return 0;
+
+    ledcChannels[channel].frequency = frequency;
+    ledcChannels[channel].resolutionBits = resolutionBits;
+    LedcChanged(channel);
+    return frequency;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel)
+{
+    SimCharge(simCosts.analogWrite);
+    if(pin < SIM_PIN_COUNT && channel < LEDC_CHANNEL_AMOUNT) ledcPinChannels[pin] = channel + 1;
+}
+
+void ledcDetachPin(uint8_t pin)
+{
+    SimCharge(simCosts.analogWrite);
+    if(pin < SIM_PIN_COUNT) ledcPinChannels[pin] = 0;
+}
+
+void ledcWrite(uint8_t channel, uint32_t duty)
+{
+    SimCharge(simCosts.analogWrite);
+    if(channel >= LEDC_CHANNEL_AMOUNT) return;
+
+    ledcChannels[channel].duty = duty;
+    LedcChanged(channel);
+}
+
+double ledcWriteTone(uint8_t channel, double frequency)
+{
+    SimCharge(simCosts.analogWrite);
+    if(channel >= LEDC_CHANNEL_AMOUNT) return 0;
+
+    SimLedcChannel *ledc = &ledcChannels[channel];
+    ledc->frequency = frequency;
+    ledc->duty = frequency > 0 ? 1U << (ledc->resolutionBits - 1) : 0;
+    LedcChanged(channel);
+    return frequency;
+}
+
+static bool timerWakeupEnabled = false;
+static uint64_t timerWakeupUs = 0;
+static bool gpioWakeupEnabled = false;
+static esp_sleep_wakeup_cause_t wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intrType)
+{
+    if(intrType != GPIO_INTR_LOW_LEVEL && intrType != GPIO_INTR_HIGH_LEVEL) return ESP_ERR_INVALID_ARG;
+
+    SimCharge(simCosts.gpioRegister);
+    SimSetWakePin(gpio, true, intrType == GPIO_INTR_HIGH_LEVEL ? HIGH : LOW);
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio)
+{
+    SimCharge(simCosts.gpioRegister);
+    SimSetWakePin(gpio, false, LOW);
+    return ESP_OK;
+}
+
+//Edge interrupts that came in while the chip slept are still pending in the simulator, so there is nothing to restore here.
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t intrType)
+{
+    SimCharge(simCosts.gpioRegister);
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeInUs)
+{
+    timerWakeupEnabled = true;
+    timerWakeupUs = timeInUs;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup()
+{
+    gpioWakeupEnabled = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source)
+{
+    if(source == ESP_SLEEP_WAKEUP_TIMER || source == ESP_SLEEP_WAKEUP_ALL) timerWakeupEnabled = false;
+    if(source == ESP_SLEEP_WAKEUP_GPIO || source == ESP_SLEEP_WAKEUP_ALL) gpioWakeupEnabled = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start()
+{
+    uint64_t wakeTime = timerWakeupEnabled ? SimNow() + timerWakeupUs * 1000ULL : UINT64_MAX;
+    wakeupCause = SimLightSleep(wakeTime, gpioWakeupEnabled) ? ESP_SLEEP_WAKEUP_GPIO : ESP_SLEEP_WAKEUP_TIMER;
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return wakeupCause;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+    SimCharge(simCosts.cycleCount);
+    return (uint32_t)((SimNow() - simStats.lightSleepTime) * SIM_CPU_MHZ / 1000);
+}
+
+unsigned long millis()
+{
+    SimCharge(simCosts.timeRead);
+    return (unsigned long)(SimNow() / 1000000ULL);
+}
+
+unsigned long micros()
+{
+    SimCharge(simCosts.timeRead);
+    return (unsigned long)(SimNow() / 1000ULL);
+}
+
+uint32_t esp_random()
+{
+    static uint64_t state = 0x853C49E6748FEA9BULL;
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(state >> 32);
+}
+
+//The ESP32 core hands delay() to the scheduler, so it has tick resolution.
+void delay(uint32_t ms)
+{
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    SimCharge((uint64_t)us * 1000ULL);
+}
+
+void yield()
+{
+    vTaskDelay(0);
+}
+
+void SimSetSerialEcho(bool echo)
+{
+    serialEcho = echo;
+}
+
+void SimSetSerialHook(void (*hook)(uint8_t c))
+{
+    serialHook = hook;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    baudRate = baud;
+    if(lock == NULL) lock = xSemaphoreCreateMutex();
+}
+
+void HardwareSerial::flush()
+{
+    if(transmitDoneTime > SimNow()) SimCharge(transmitDoneTime - SimNow());
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if(lock != NULL) xSemaphoreTake(lock, portMAX_DELAY);
+    for(size_t i = 0; i < size; i++) WriteByte(buffer[i]);
+    if(lock != NULL) xSemaphoreGive(lock);
+    return size;
+}
+
+void HardwareSerial::WriteByte(uint8_t c)
+{
+    const uint64_t byteTime = 10000000000ULL / baudRate; //8N1 framing, 10 bits per byte
+    const uint64_t fifoTime = 128 * byteTime;
+
+    //Busy-wait until the FIFO has room for one more byte.
+    if(transmitDoneTime > SimNow() + fifoTime) SimCharge(transmitDoneTime - fifoTime - SimNow());
+
+    SimCharge(simCosts.serialByte);
+    transmitDoneTime = std::max(transmitDoneTime, SimNow()) + byteTime;
+    simStats.serialBytes++;
+
+    if(serialEcho) putchar(c);
+    if(serialHook != NULL) serialHook(c);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while(size--) written += write(*buffer++);
+    return written;
+}
+
+size_t Print::write(const char *text)
+{
+    return write((const uint8_t *)text, strlen(text));
+}
+
+static size_t PrintNumber(Print *out, unsigned long number, int base)
+{
+    char buffer[8 * sizeof(long) + 1];
+    char *text = &buffer[sizeof(buffer) - 1];
+    *text = '\0';
+    if(base < 2) base = 10;
+
+    do
+    {
+        int digit = number % base;
+        number /= base;
+        *--text = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while(number);
+
+    return out->write(text);
+}
+
+size_t Print::print(const char text[])
+{
+    return write(text);
+}
+
+size_t Print::print(const String &text)
+{
+    return write(text.c_str());
+}
+
+size_t Print::print(char c)
+{
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char number, int base)
+{
+    return PrintNumber(this, number, base);
+}
+
+size_t Print::print(int number, int base)
+{
+    return print((long)number, base);
+}
+
+size_t Print::print(unsigned int number, int base)
+{
+    return PrintNumber(this, number, base);
+}
+
+size_t Print::print(long number, int base)
+{
+    if(base == 10 && number < 0) return print('-') + PrintNumber(this, -(unsigned long)number, 10);
+    return PrintNumber(this, number, base);
+}
+
+size_t Print::print(unsigned long number, int base)
+{
+    return PrintNumber(this, number, base);
+}
+
+size_t Print::print(double number, int digits)
+{
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, number);
+    return write(buffer);
+}
+
+size_t Print::println()
+{
+    return write("\r\n");
+}
+
+size_t Print::println(const char text[]) { return print(text) + println(); }
+size_t Print::println(const String &text) { return print(text) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char number, int base) { return print(number, base) + println(); }
+size_t Print::println(int number, int base) { return print(number, base) + println(); }
+size_t Print::println(unsigned int number, int base) { return print(number, base) + println(); }
+size_t Print::println(long number, int base) { return print(number, base) + println(); }
+size_t Print::println(unsigned long number, int base) { return print(number, base) + println(); }
+size_t Print::println(double number, int digits) { return print(number, digits) + println(); }
+
+//Same as the Arduino core: poll until a byte shows up or the stream timeout passes.
+int Stream::TimedRead()
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = read();
+        if(c >= 0) return c;
+    } while(millis() - start < timeout);
+
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length)
+    {
+        int c = TimedRead();
+        if(c < 0) break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readString()
+{
+    String text;
+    int c = TimedRead();
+    while(c >= 0)
+    {
+        text += (char)c;
+        c = TimedRead();
+    }
+    return text;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <ucontext.h>
+
+//Shared between the simulator's translation units only. Firmware never sees this.
+
+#define SIM_PIN_COUNT 64
+
+struct SimTask
+{
+    const char *name;
+    void (*function)(void *);
+    void *parameter;
+    int priority;
+    int core;               //Only for xPortGetCoreID(), everything runs on the one simulated core
+    bool external;
+    bool finished;
+    uint64_t wakeTime;
+    uint32_t order;
+    bool semaphoreTaken;
+    uint64_t blockedTime;   //Spent blocked on a queue or semaphore
+    uint32_t heapBytes;
+    char *stack;
+    ucontext_t context;
+};
+
+SimTask *SimCreateTask(void (*function)(void *), void *parameter, const char *name, int priority, bool external); //Ready, but only preempts once woken
+SimTask *SimCurrentTask();
+void SimWakeTask(SimTask *task);
+void SimFinishTask(SimTask *task);
+bool SimInInterrupt();
+
+bool SimHeapAllocate(uint32_t bytes); //False when the simulated heap can't fit it
+void SimHeapFree(uint32_t bytes);
+
+void SimScheduleInterrupt(uint64_t time, void (*handler)(void *argument), void *argument);
+void SimCancelInterrupts(void *argument);
+
+bool SimLightSleep(uint64_t wakeTime, bool pinsWake); //Freezes every firmware task and interrupt until the wake time or a wake pin. True if a pin woke it.
+void SimSetWakePin(uint8_t pin, bool enabled, int level);
+
+void SimWritePin(uint8_t pin, int level);
+int SimReadPin(uint8_t pin);
+void SimAttachInterrupt(uint8_t pin, void (*handler)(), int mode);
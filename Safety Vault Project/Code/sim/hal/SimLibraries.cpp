@@ -0,0 +1,318 @@
+#include <string.h>
+#include <deque>
+#include <string>
+#include "Arduino.h"
+#include "esp_partition.h"
+#include "EEPROM.h"
+#include "rom/crc.h"
+#include "ESP32Servo.h"
+#include "BluetoothSerial.h"
+#include "analogWrite.h"
+#include "Sim.h"
+#include "SimInternal.h"
+
+#define FLASH_PARTITION_AMOUNT 3
+#define FLASH_BASE 0x290000
+#define FLASH_SIZE 0x1C000
+
+//Same as the vault, creds and audit partitions in ../main/partitions.csv. The emulated flash only holds the data partitions, from
+//FLASH_BASE on.
+static const esp_partition_t flashPartitions[FLASH_PARTITION_AMOUNT] =
+{
+    {ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40, 0x290000, 0x4000, "vault", false},
+    {ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x41, 0x294000, 0x8000, "creds", false},
+    {ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x42, 0x29C000, 0x10000, "audit", false}
+};
+static uint8_t flash[FLASH_SIZE];
+static uint32_t flashSectorErases[FLASH_SIZE / SPI_FLASH_SEC_SIZE];
+static bool flashErased = false;
+static int64_t flashOperationsLeft = -1;
+static bool flashPowerLost = false;
+static uint32_t flashRandomState = 1;
+
+EEPROMClass EEPROM;
+static uint8_t eepromData[SIM_EEPROM_SIZE];
+static bool eepromErased = false;
+
+static void (*servoHook)(int pin, int angle) = NULL;
+static std::deque<uint8_t> bluetoothReceived;
+static std::string bluetoothSent;
+static esp_spp_cb_t *bluetoothCallback = NULL;
+
+//A fresh chip reads back 0xFF everywhere.
+static void EraseFlashOnce()
+{
+    if(flashErased) return;
+    memset(flash, 0xFF, sizeof(flash));
+    flashErased = true;
+}
+
+static uint8_t FlashRandomByte()
+{
+    flashRandomState = flashRandomState * 1103515245 + 12345;
+    return flashRandomState >> 16;
+}
+
+//Counts down the byte writes and sector erases left before the power cut. Returns false for the one the power goes during.
+static bool FlashOperation()
+{
+    if(flashOperationsLeft < 0) return true;
+    if(flashOperationsLeft-- > 0) return true;
+
+    flashPowerLost = true;
+    flashOperationsLeft = -1;
+    return false;
+}
+
+static bool FlashRange(const esp_partition_t *partition, size_t offset, size_t size, uint8_t **data)
+{
+    if(partition < flashPartitions || partition >= flashPartitions + FLASH_PARTITION_AMOUNT || offset + size > partition->size) return false;
+
+    EraseFlashOnce();
+    *data = flash + partition->address - FLASH_BASE + offset;
+    return true;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for(int i = 0; i < FLASH_PARTITION_AMOUNT; i++)
+    {
+        const esp_partition_t *partition = &flashPartitions[i];
+        if(partition->type != type) continue;
+        if(subtype != ESP_PARTITION_SUBTYPE_ANY && partition->subtype != subtype) continue;
+        if(label != NULL && strcmp(partition->label, label) != 0) continue;
+        return partition;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    uint8_t *data;
+    if(!FlashRange(partition, src_offset, size, &data)) return ESP_ERR_INVALID_ARG;
+
+    SimCharge((uint64_t)simCosts.flashReadByte * size);
+    memcpy(dst, data, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    uint8_t *data;
+    if(!FlashRange(partition, dst_offset, size, &data)) return ESP_ERR_INVALID_ARG;
+    if(flashPowerLost) return ESP_FAIL;
+
+    //Flash cache is off while programming, so nothing else on the chip runs.
+    SimStall((uint64_t)simCosts.flashWriteByte * size);
+    for(size_t i = 0; i < size; i++)
+    {
+        uint8_t value = ((const uint8_t *)src)[i];
+        if(!FlashOperation())
+        {
+            data[i] &= value | FlashRandomByte(); //The byte being programmed when the power went only got some of its bits.
+            return ESP_FAIL;
+        }
+
+        data[i] &= value; //Programming can only clear bits.
+        simStats.flashBytesWritten++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    uint8_t *data;
+    if(offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) return ESP_ERR_INVALID_SIZE;
+    if(!FlashRange(partition, offset, size, &data)) return ESP_ERR_INVALID_ARG;
+    if(flashPowerLost) return ESP_FAIL;
+
+    for(size_t sector = 0; sector < size / SPI_FLASH_SEC_SIZE; sector++)
+    {
+        uint8_t *sectorData = data + sector * SPI_FLASH_SEC_SIZE;
+        if(!FlashOperation())
+        {
+            //Cut off halfway through the erase: any bit could have been set already.
+            for(int i = 0; i < SPI_FLASH_SEC_SIZE; i++) sectorData[i] |= FlashRandomByte();
+            return ESP_FAIL;
+        }
+
+        //Both cores stall while a sector is erased.
+        SimStall(simCosts.flashSectorErase);
+        memset(sectorData, 0xFF, SPI_FLASH_SEC_SIZE);
+        flashSectorErases[(sectorData - flash) / SPI_FLASH_SEC_SIZE]++;
+        simStats.flashErases++;
+    }
+    return ESP_OK;
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *buf++;
+        for(int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+void SimFlashCutPowerAfter(uint32_t operations, uint32_t seed)
+{
+    flashOperationsLeft = operations;
+    flashRandomState = seed;
+}
+
+bool SimFlashPowerLost()
+{
+    return flashPowerLost;
+}
+
+void SimFlashRestorePower()
+{
+    flashPowerLost = false;
+    flashOperationsLeft = -1;
+}
+
+uint32_t SimFlashEraseCount(int sector)
+{
+    return flashSectorErases[sector];
+}
+
+static void EraseEepromOnce()
+{
+    if(eepromErased) return;
+    memset(eepromData, 0xFF, sizeof(eepromData));
+    eepromErased = true;
+}
+
+void SimEepromPreload(int address, uint8_t value)
+{
+    EraseEepromOnce();
+    if(address >= 0 && address < (int)sizeof(eepromData)) eepromData[address] = value;
+}
+
+bool EEPROMClass::begin(size_t size)
+{
+    if(size == 0 || size > sizeof(eepromData)) return false;
+
+    EraseEepromOnce();
+    SimCharge(simCosts.flashReadByte * size);
+    memcpy(copy, eepromData, size);
+    this->size = size;
+    return true;
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+    if(address < 0 || (size_t)address >= size) return 0;
+    return copy[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    if(address < 0 || (size_t)address >= size) return;
+    copy[address] = value;
+}
+
+bool EEPROMClass::commit()
+{
+    if(size == 0) return false;
+    memcpy(eepromData, copy, size);
+    return true;
+}
+
+void SimSetServoHook(void (*hook)(int pin, int angle))
+{
+    servoHook = hook;
+}
+
+int Servo::attach(int pin)
+{
+    return attach(pin, 500, 2500);
+}
+
+int Servo::attach(int pin, int minimum, int maximum)
+{
+    this->pin = pin;
+    return 0;
+}
+
+void Servo::detach()
+{
+    pin = -1;
+}
+
+void Servo::write(int value)
+{
+    SimCharge(simCosts.servoWrite);
+    angle = value;
+    if(servoHook != NULL) servoHook(pin, value);
+}
+
+void analogWrite(uint8_t pin, int value, int valueMax)
+{
+    SimCharge(simCosts.analogWrite);
+}
+
+static void BluetoothDataEvent(void *argument)
+{
+    esp_spp_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.data_ind.len = (uint16_t)bluetoothReceived.size();
+    if(bluetoothCallback != NULL) bluetoothCallback(ESP_SPP_DATA_IND_EVT, &param);
+}
+
+void SimBluetoothReceive(const char *text)
+{
+    while(*text) bluetoothReceived.push_back((uint8_t)*text++);
+    if(bluetoothCallback != NULL) SimScheduleInterrupt(SimNow() + simCosts.interruptLatency, BluetoothDataEvent, &bluetoothCallback);
+}
+
+const char *SimBluetoothSent()
+{
+    return bluetoothSent.c_str();
+}
+
+void SimBluetoothClearSent()
+{
+    bluetoothSent.clear();
+}
+
+bool BluetoothSerial::begin(String localName, bool isMaster)
+{
+    return true;
+}
+
+esp_err_t BluetoothSerial::register_callback(esp_spp_cb_t *callback)
+{
+    bluetoothCallback = callback;
+    return ESP_OK;
+}
+
+int BluetoothSerial::available()
+{
+    SimCharge(simCosts.digitalRead);
+    return (int)bluetoothReceived.size();
+}
+
+int BluetoothSerial::read()
+{
+    SimCharge(simCosts.digitalRead);
+    if(bluetoothReceived.empty()) return -1;
+
+    int c = bluetoothReceived.front();
+    bluetoothReceived.pop_front();
+    return c;
+}
+
+int BluetoothSerial::peek()
+{
+    return bluetoothReceived.empty() ? -1 : bluetoothReceived.front();
+}
+
+size_t BluetoothSerial::write(uint8_t c)
+{
+    SimCharge(simCosts.bluetoothByte);
+    bluetoothSent += (char)c;
+    return 1;
+}
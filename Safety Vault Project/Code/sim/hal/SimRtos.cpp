@@ -0,0 +1,277 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "SimInternal.h"
+
+struct SimSemaphore
+{
+    UBaseType_t count;
+    UBaseType_t maxCount;
+    std::vector<SimTask *> waiters;
+};
+
+struct SimQueue
+{
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t waiting;
+    uint8_t *storage;
+    std::vector<SimTask *> receivers;
+    std::vector<SimTask *> senders;
+};
+
+static uint32_t heapUsed = 0;
+static uint32_t heapPeak = 0;
+
+bool SimHeapAllocate(uint32_t bytes)
+{
+    if(heapUsed + bytes > SIM_HEAP_SIZE) return false;
+    heapUsed += bytes;
+    heapPeak = std::max(heapPeak, heapUsed);
+    return true;
+}
+
+void SimHeapFree(uint32_t bytes)
+{
+    heapUsed -= std::min(heapUsed, bytes);
+}
+
+uint32_t xPortGetFreeHeapSize()
+{
+    return SIM_HEAP_SIZE - heapUsed;
+}
+
+uint32_t xPortGetMinimumEverFreeHeapSize()
+{
+    return SIM_HEAP_SIZE - heapPeak;
+}
+
+static uint64_t TickTime()
+{
+    return 1000000000ULL / configTICK_RATE_HZ;
+}
+
+//FreeRTOS counts block times from the current tick, not from the current instant.
+static uint64_t TickDeadline(TickType_t ticks)
+{
+    if(ticks == portMAX_DELAY) return UINT64_MAX;
+    return (SimNow() / TickTime() + ticks) * TickTime();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask)
+{
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, createdTask, tskNO_AFFINITY);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t core)
+{
+    SimCharge(simCosts.taskCreate);
+    if(!SimHeapAllocate(stackDepth + SIM_TCB_SIZE)) return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+
+    //The simulator models a single core, so the affinity only shows in xPortGetCoreID().
+    SimTask *task = SimCreateTask(function, parameter, name, priority, false);
+    task->core = core == tskNO_AFFINITY ? 0 : core;
+    task->heapBytes = stackDepth + SIM_TCB_SIZE;
+    if(createdTask != NULL) *createdTask = task;
+
+    SimWakeTask(task); //A higher priority task starts running right here, like in FreeRTOS.
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    SimSleepUntil(ticks == 0 ? SimNow() : TickDeadline(ticks));
+}
+
+//Tasks that delete themselves only get their memory back once the idle task runs. That is close enough to straight away here.
+void vTaskDelete(TaskHandle_t task)
+{
+    if(task == NULL) task = SimCurrentTask();
+
+    SimCharge(simCosts.taskDelete);
+    SimHeapFree(task->heapBytes);
+    task->heapBytes = 0;
+    SimFinishTask(task);
+}
+
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t ticks)
+{
+    *previousWakeTime += ticks;
+    SimSleepUntil(std::max(SimNow(), (uint64_t)*previousWakeTime * TickTime()));
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)(SimNow() / TickTime());
+}
+
+BaseType_t xPortGetCoreID()
+{
+    if(SimInInterrupt() || SimCurrentTask() == NULL) return 1;
+    return SimCurrentTask()->core;
+}
+
+static SemaphoreHandle_t CreateSemaphore(UBaseType_t count, UBaseType_t maxCount)
+{
+    SimHeapAllocate(SIM_QUEUE_OVERHEAD);
+    SimSemaphore *semaphore = new SimSemaphore();
+    semaphore->count = count;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return CreateSemaphore(0, 1); //Created empty, like FreeRTOS does. Someone has to give it first.
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return CreateSemaphore(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    SimCharge(simCosts.semaphore);
+
+    if(semaphore->count > 0)
+    {
+        semaphore->count--;
+        return pdTRUE;
+    }
+    if(ticks == 0) return pdFALSE;
+
+    //Block until a give hands the semaphore to us or the block time runs out.
+    SimTask *task = SimCurrentTask();
+    task->semaphoreTaken = false;
+    semaphore->waiters.push_back(task);
+
+    uint64_t start = SimNow();
+    SimSleepUntil(TickDeadline(ticks));
+    task->blockedTime += SimNow() - start;
+
+    semaphore->waiters.erase(std::remove(semaphore->waiters.begin(), semaphore->waiters.end(), task), semaphore->waiters.end());
+    return task->semaphoreTaken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    SimCharge(simCosts.semaphore);
+
+    if(!semaphore->waiters.empty())
+    {
+        //Hand it straight to the highest priority waiter, the one waiting longest if there is a tie.
+        auto waiter = semaphore->waiters.begin();
+        for(auto it = semaphore->waiters.begin(); it != semaphore->waiters.end(); it++)
+        {
+            if((*it)->priority > (*waiter)->priority) waiter = it;
+        }
+
+        SimTask *task = *waiter;
+        semaphore->waiters.erase(waiter);
+        task->semaphoreTaken = true;
+        SimWakeTask(task);
+        return pdTRUE;
+    }
+
+    if(semaphore->count >= semaphore->maxCount) return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken)
+{
+    if(higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+    return xSemaphoreGive(semaphore);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    if(!SimHeapAllocate(SIM_QUEUE_OVERHEAD + length * itemSize)) return NULL;
+
+    SimQueue *queue = new SimQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->storage = new uint8_t[length * itemSize];
+    return queue;
+}
+
+//Block the running task on a queue's wait list until it is woken or the block time runs out. Returns false on a timeout.
+static bool WaitOnQueue(std::vector<SimTask *> *waiters, uint64_t deadline)
+{
+    if(SimNow() >= deadline) return false;
+
+    SimTask *task = SimCurrentTask();
+    waiters->push_back(task);
+    uint64_t start = SimNow();
+    SimSleepUntil(deadline);
+    task->blockedTime += SimNow() - start;
+    waiters->erase(std::remove(waiters->begin(), waiters->end(), task), waiters->end());
+    return true;
+}
+
+//Wake the highest priority task waiting on the queue, the one waiting longest if there is a tie. It checks the queue again itself.
+static void WakeQueueWaiter(std::vector<SimTask *> *waiters)
+{
+    if(waiters->empty()) return;
+
+    auto waiter = waiters->begin();
+    for(auto it = waiters->begin(); it != waiters->end(); it++)
+    {
+        if((*it)->priority > (*waiter)->priority) waiter = it;
+    }
+
+    SimTask *task = *waiter;
+    waiters->erase(waiter);
+    SimWakeTask(task);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    SimCharge(simCosts.semaphore);
+
+    uint64_t deadline = ticks == 0 ? 0 : TickDeadline(ticks);
+    while(queue->waiting == queue->length)
+    {
+        if(SimInInterrupt() || !WaitOnQueue(&queue->senders, deadline)) return errQUEUE_FULL;
+    }
+
+    UBaseType_t tail = (queue->head + queue->waiting) % queue->length;
+    memcpy(queue->storage + tail * queue->itemSize, item, queue->itemSize);
+    queue->waiting++;
+
+    WakeQueueWaiter(&queue->receivers);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken)
+{
+    if(higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks)
+{
+    SimCharge(simCosts.semaphore);
+
+    uint64_t deadline = ticks == 0 ? 0 : TickDeadline(ticks);
+    while(queue->waiting == 0)
+    {
+        if(SimInInterrupt() || !WaitOnQueue(&queue->receivers, deadline)) return pdFALSE;
+    }
+
+    memcpy(buffer, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->waiting--;
+
+    WakeQueueWaiter(&queue->senders);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->waiting;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *text);
+
+    size_t print(const char text[]);
+    size_t print(const String &text);
+    size_t print(char c);
+    size_t print(unsigned char number, int base = DEC);
+    size_t print(int number, int base = DEC);
+    size_t print(unsigned int number, int base = DEC);
+    size_t print(long number, int base = DEC);
+    size_t print(unsigned long number, int base = DEC);
+    size_t print(double number, int digits = 2);
+
+    size_t println();
+    size_t println(const char text[]);
+    size_t println(const String &text);
+    size_t println(char c);
+    size_t println(unsigned char number, int base = DEC);
+    size_t println(int number, int base = DEC);
+    size_t println(unsigned int number, int base = DEC);
+    size_t println(long number, int base = DEC);
+    size_t println(unsigned long number, int base = DEC);
+    size_t println(double number, int digits = 2);
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+    size_t readBytes(char *buffer, size_t length);
+    String readString();
+
+protected:
+    int TimedRead();
+
+    unsigned long timeout = 1000;
+};
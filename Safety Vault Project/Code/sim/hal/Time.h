@@ -0,0 +1,4 @@
+#pragma once
+#include <time.h>
+
+//TimeLib. Included by the sketch but nothing from it is used yet.
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdlib.h>
+#include <string>
+#include <utility>
+
+//Arduino String on top of std::string. Only what the sketches use is here.
+class String
+{
+public:
+    String(const char *text = "") : value(text != NULL ? text : "") {}
+    String(const std::string &text) : value(text) {}
+    explicit String(char c) : value(1, c) {}
+    explicit String(int number) : value(std::to_string(number)) {}
+    explicit String(long number) : value(std::to_string(number)) {}
+    explicit String(unsigned long number) : value(std::to_string(number)) {}
+
+    unsigned int length() const { return value.length(); }
+    bool reserve(unsigned int size) { value.reserve(size); return true; }
+    const char *c_str() const { return value.c_str(); }
+
+    char charAt(unsigned int index) const { return index < value.length() ? value[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    String substring(unsigned int from) const { return substring(from, value.length()); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if(from > to) std::swap(from, to);
+        if(from >= value.length()) return String();
+        if(to > value.length()) to = value.length();
+        return String(value.substr(from, to - from));
+    }
+
+    long toInt() const { return atol(value.c_str()); }
+    float toFloat() const { return (float)atof(value.c_str()); }
+
+    String &operator+=(const String &other) { value += other.value; return *this; }
+    String &operator+=(const char *text) { value += text; return *this; }
+    String &operator+=(char c) { value += c; return *this; }
+
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator==(const char *text) const { return value == text; }
+    bool operator!=(const String &other) const { return value != other.value; }
+
+private:
+    std::string value;
+};
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+//ESP32 AnalogWrite library: LEDC PWM behind the AVR style analogWrite call.
+void analogWrite(uint8_t pin, int value, int valueMax = 255);
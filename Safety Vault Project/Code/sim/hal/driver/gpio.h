@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+//The ESP-IDF GPIO calls the sketches use next to the Arduino ones, for light sleep wakeup.
+typedef enum
+{
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_INTR_DISABLE = 0,
+    GPIO_INTR_POSEDGE = 1,
+    GPIO_INTR_NEGEDGE = 2,
+    GPIO_INTR_ANYEDGE = 3,
+    GPIO_INTR_LOW_LEVEL = 4,
+    GPIO_INTR_HIGH_LEVEL = 5
+} gpio_int_type_t;
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t intrType); //Only the level types can wake the chip
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio);
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t intrType);
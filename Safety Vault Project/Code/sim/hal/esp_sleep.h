@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+//Light sleep (esp_sleep.h). The simulator freezes every task and interrupt until a timer or GPIO wakeup, see SimLightSleep.
+typedef enum
+{
+    ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+    ESP_SLEEP_WAKEUP_ALL = 1,
+    ESP_SLEEP_WAKEUP_EXT0 = 2,
+    ESP_SLEEP_WAKEUP_EXT1 = 3,
+    ESP_SLEEP_WAKEUP_TIMER = 4,
+    ESP_SLEEP_WAKEUP_TOUCHPAD = 5,
+    ESP_SLEEP_WAKEUP_ULP = 6,
+    ESP_SLEEP_WAKEUP_GPIO = 7,
+    ESP_SLEEP_WAKEUP_UART = 8
+} esp_sleep_wakeup_cause_t;
+
+typedef esp_sleep_wakeup_cause_t esp_sleep_source_t;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeInUs);
+esp_err_t esp_sleep_enable_gpio_wakeup();
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source);
+esp_err_t esp_light_sleep_start();
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+//The part of the FreeRTOS API the sketches use, scheduled by the simulator (see Sim.h).
+//Task and semaphore calls are plain functions here instead of the macros ESP-IDF uses.
+
+#ifndef configTICK_RATE_HZ
+#define configTICK_RATE_HZ 1000 //Same as the ESP32 Arduino core. Build with -DconfigTICK_RATE_HZ=100 to try the ESP-IDF default.
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct SimTask *TaskHandle_t;
+typedef struct SimSemaphore *SemaphoreHandle_t;
+typedef struct SimQueue *QueueHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define errQUEUE_FULL 0
+#define errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY (-1)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define taskYIELD() vTaskDelay(0)
+#define portYIELD_FROM_ISR() //The simulator switches to a woken higher priority task as soon as the interrupt returns
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t ticks);
+TickType_t xTaskGetTickCount();
+BaseType_t xPortGetCoreID(); //The core the running task is pinned to. Interrupts count as core 1, where the sketch attaches them.
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+//Heap figures, from ESP-IDF's port layer. Task stacks, TCBs, queues and semaphores come out of the simulated heap (Sim.h).
+uint32_t xPortGetFreeHeapSize();
+uint32_t xPortGetMinimumEverFreeHeapSize();
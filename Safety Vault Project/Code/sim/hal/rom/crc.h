@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+//CRC32 (IEEE 802.3) from the ESP32 ROM.
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
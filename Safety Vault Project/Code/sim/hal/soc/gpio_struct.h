@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+
+//The ESP32 GPIO peripheral's output set/clear registers, out_w1ts/out_w1tc for pins 0-31 and out1_w1ts.val/out1_w1tc.val for
+//pins 32-33. Writing a mask changes every pin in it at once. Reading in or out (pins 0-31), in1.data or out1.data (pins 32-39)
+//gives the level of every pin in one go.
+struct SimGpioSetRegister
+{
+    uint8_t firstPin;
+    void operator=(uint32_t mask);
+};
+
+struct SimGpioClearRegister
+{
+    uint8_t firstPin;
+    void operator=(uint32_t mask);
+};
+
+struct SimGpioInputRegister
+{
+    uint8_t firstPin;
+    operator uint32_t() const;
+};
+
+struct SimGpioBank1
+{
+    SimGpioInputRegister data {32};
+};
+
+struct SimGpioSet1
+{
+    SimGpioSetRegister val {32};
+};
+
+struct SimGpioClear1
+{
+    SimGpioClearRegister val {32};
+};
+
+struct SimGpio
+{
+    SimGpioInputRegister out {0};
+    SimGpioSetRegister out_w1ts {0};
+    SimGpioClearRegister out_w1tc {0};
+    SimGpioBank1 out1;
+    SimGpioSet1 out1_w1ts;
+    SimGpioClear1 out1_w1tc;
+    SimGpioInputRegister in {0};
+    SimGpioBank1 in1;
+};
+
+extern SimGpio GPIO;
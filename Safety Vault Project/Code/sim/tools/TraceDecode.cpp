@@ -0,0 +1,272 @@
+//Decodes the vault's serial output, captured with tracing on (see TraceManager.h), into a latency histogram for every kind of
+//span and a Chrome trace that chrome://tracing or ui.perfetto.dev can open. Anything between the frames, println() output for
+//one, is skipped, and so is a frame that fails its checksum.
+//Usage: TraceDecode capture [trace.json] [cpuMHz]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "../../main/TraceManager.h"
+
+#define HISTOGRAM_WIDTH 40
+
+struct Event
+{
+    int64_t cycles; //Unwrapped
+    int core;
+    TraceRecord record;
+};
+
+struct Span
+{
+    int64_t start;
+    int64_t duration;
+    int core;
+    TraceRecord record; //The end record
+};
+
+struct Capture
+{
+    std::vector<Event> events;
+    unsigned long frames = 0;
+    unsigned long dropped = 0;
+    unsigned long skippedBytes = 0;
+};
+
+static uint32_t GetLittleEndian(const uint8_t *data, int bytes)
+{
+    uint32_t value = 0;
+    for(int i = bytes - 1; i >= 0; i--) value = value << 8 | data[i];
+    return value;
+}
+
+static bool ReadFile(const char *path, std::vector<uint8_t> *data)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+
+    uint8_t buffer[4096];
+    size_t length;
+    while((length = fread(buffer, 1, sizeof(buffer), file)) > 0) data->insert(data->end(), buffer, buffer + length);
+    fclose(file);
+    return true;
+}
+
+//Length of the valid frame at the given position, 0 if there is none.
+static size_t FrameLength(const std::vector<uint8_t> &data, size_t position)
+{
+    if(position + TRACE_FRAME_HEADER_SIZE > data.size()) return 0;
+    if(data[position] != TRACE_FRAME_MAGIC_1 || data[position + 1] != TRACE_FRAME_MAGIC_2) return 0;
+    if(data[position + 2] >= TRACE_CORE_AMOUNT || data[position + 3] > TRACE_FRAME_RECORDS) return 0;
+
+    size_t length = TRACE_FRAME_SIZE(data[position + 3]);
+    if(position + length > data.size()) return 0;
+
+    uint8_t checksum = 0;
+    for(size_t i = position + 2; i < position + length; i++) checksum ^= data[i];
+    return checksum == 0 ? length : 0;
+}
+
+//Each core has a cycle counter of its own. Its records come in the order they were written, which can be a few cycles off the
+//order of their timestamps when one preempted another, so the counter is unwrapped by the signed difference to the last record.
+static Capture Decode(const std::vector<uint8_t> &data)
+{
+    Capture capture;
+    bool started[TRACE_CORE_AMOUNT] = {};
+    int64_t lastCycles[TRACE_CORE_AMOUNT] = {};
+
+    size_t position = 0;
+    while(position < data.size())
+    {
+        size_t length = FrameLength(data, position);
+        if(length == 0)
+        {
+            capture.skippedBytes++;
+            position++;
+            continue;
+        }
+
+        int core = data[position + 2];
+        int amount = data[position + 3];
+        capture.dropped += GetLittleEndian(&data[position + 4], 2);
+        capture.frames++;
+
+        const uint8_t *in = &data[position + TRACE_FRAME_HEADER_SIZE];
+        for(int i = 0; i < amount; i++, in += TRACE_RECORD_SIZE)
+        {
+            Event event;
+            event.core = core;
+            event.record.cycles = GetLittleEndian(in, 4);
+            event.record.type = in[4];
+            event.record.phase = in[5];
+            event.record.argument = GetLittleEndian(in + 6, 2);
+            if(event.record.type >= TRACE_EVENT_TYPE_AMOUNT || event.record.phase > TraceInstant) continue;
+
+            if(!started[core]) lastCycles[core] = event.record.cycles;
+            started[core] = true;
+            lastCycles[core] += (int32_t)(event.record.cycles - (uint32_t)lastCycles[core]);
+            event.cycles = lastCycles[core];
+            capture.events.push_back(event);
+        }
+        position += length;
+    }
+    return capture;
+}
+
+//Pair every end with the last begin of the same kind on the same core.
+static std::vector<Span> PairSpans(const Capture &capture, unsigned long *unmatched)
+{
+    std::vector<Span> spans;
+    std::vector<int64_t> open[TRACE_CORE_AMOUNT][TRACE_EVENT_TYPE_AMOUNT];
+    *unmatched = 0;
+
+    for(const Event &event : capture.events)
+    {
+        std::vector<int64_t> &begins = open[event.core][event.record.type];
+        if(event.record.phase == TraceBegin) begins.push_back(event.cycles);
+        if(event.record.phase != TraceEnd) continue;
+
+        if(begins.empty())
+        {
+            (*unmatched)++; //Its begin was dropped or came before the capture started
+            continue;
+        }
+        spans.push_back({begins.back(), event.cycles - begins.back(), event.core, event.record});
+        begins.pop_back();
+    }
+    return spans;
+}
+
+static double Percentile(const std::vector<double> &sorted, double percent)
+{
+    size_t index = (size_t)(percent / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+//Power of two buckets from 1us up, anything shorter goes in the first one.
+static void PrintHistogram(const std::vector<double> &sorted)
+{
+    std::vector<unsigned long> buckets;
+    for(double duration : sorted)
+    {
+        size_t bucket = 0;
+        while(duration >= (double)(2ULL << bucket)) bucket++;
+        if(bucket >= buckets.size()) buckets.resize(bucket + 1);
+        buckets[bucket]++;
+    }
+
+    unsigned long most = *std::max_element(buckets.begin(), buckets.end());
+    for(size_t bucket = 0; bucket < buckets.size(); bucket++)
+    {
+        if(buckets[bucket] == 0) continue;
+        char range[32];
+        if(bucket == 0) snprintf(range, sizeof(range), "< 2 us");
+        else snprintf(range, sizeof(range), "%llu-%llu us", 1ULL << bucket, 2ULL << bucket);
+
+        int width = (int)((buckets[bucket] * HISTOGRAM_WIDTH + most - 1) / most);
+        printf("    %18s %8lu %.*s\n", range, buckets[bucket], width, "########################################");
+    }
+}
+
+static void PrintSpans(const std::vector<Span> &spans, double cyclesPerUs)
+{
+    printf("%-18s %8s %10s %10s %10s %10s %10s\n", "span", "count", "min", "p50", "p90", "p99", "max");
+    for(int type = 0; type < TRACE_EVENT_TYPE_AMOUNT; type++)
+    {
+        std::vector<double> durations;
+        for(const Span &span : spans)
+        {
+            if(span.record.type == type) durations.push_back(span.duration / cyclesPerUs);
+        }
+        if(durations.empty()) continue;
+
+        std::sort(durations.begin(), durations.end());
+        printf("%-18s %8zu %7.2f us %7.2f us %7.2f us %7.2f us %7.2f us\n", TRACE_EVENT_NAMES[type], durations.size(), durations.front(),
+               Percentile(durations, 50), Percentile(durations, 90), Percentile(durations, 99), durations.back());
+        PrintHistogram(durations);
+    }
+}
+
+static void PrintInstants(const Capture &capture)
+{
+    unsigned long counts[TRACE_EVENT_TYPE_AMOUNT] = {};
+    for(const Event &event : capture.events)
+    {
+        if(event.record.phase == TraceInstant) counts[event.record.type]++;
+    }
+
+    for(int type = 0; type < TRACE_EVENT_TYPE_AMOUNT; type++)
+    {
+        if(counts[type] > 0) printf("%-18s %8lu instants\n", TRACE_EVENT_NAMES[type], counts[type]);
+    }
+}
+
+//Chrome trace event format: spans are complete ("X") events, instants are thread scoped "i" events, every core is a thread.
+static bool WriteChromeTrace(const char *path, const Capture &capture, const std::vector<Span> &spans, double cyclesPerUs)
+{
+    FILE *file = fopen(path, "w");
+    if(file == NULL) return false;
+
+    int64_t origin = INT64_MAX;
+    for(const Event &event : capture.events) origin = std::min(origin, event.cycles);
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for(int core = 0; core < TRACE_CORE_AMOUNT; core++)
+    {
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"core %d\"}},\n", core, core);
+    }
+    for(const Span &span : spans)
+    {
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"argument\":%u}},\n",
+                TRACE_EVENT_NAMES[span.record.type], span.core, (span.start - origin) / cyclesPerUs, span.duration / cyclesPerUs,
+                span.record.argument);
+    }
+    for(const Event &event : capture.events)
+    {
+        if(event.record.phase != TraceInstant) continue;
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"argument\":%u}},\n",
+                TRACE_EVENT_NAMES[event.record.type], event.core, (event.cycles - origin) / cyclesPerUs, event.record.argument);
+    }
+    fprintf(file, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":0}\n]}\n");
+
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: TraceDecode capture [trace.json] [cpuMHz]\n");
+        return 2;
+    }
+    double cyclesPerUs = argc > 3 ? atof(argv[3]) : 240;
+
+    std::vector<uint8_t> data;
+    if(!ReadFile(argv[1], &data))
+    {
+        fprintf(stderr, "Cant read %s\n", argv[1]);
+        return 1;
+    }
+
+    Capture capture = Decode(data);
+    unsigned long unmatched;
+    std::vector<Span> spans = PairSpans(capture, &unmatched);
+
+    printf("%zu bytes: %lu frames, %zu records, %lu dropped by the firmware, %lu bytes skipped, %lu unmatched span ends\n", data.size(),
+           capture.frames, capture.events.size(), capture.dropped, capture.skippedBytes, unmatched);
+    PrintSpans(spans, cyclesPerUs);
+    PrintInstants(capture);
+
+    if(argc > 2)
+    {
+        if(!WriteChromeTrace(argv[2], capture, spans, cyclesPerUs))
+        {
+            fprintf(stderr, "Cant write %s\n", argv[2]);
+            return 1;
+        }
+        printf("Chrome trace written to %s\n", argv[2]);
+    }
+    return capture.frames > 0 ? 0 : 1;
+}
@@ -1,370 +1,665 @@
-/*
- *  Date: 29.05.2021
- *  Name: Racing Car by Turbo Inc.
- *  Author: Artem Tikhonov
-*/
-
-/******************************   Including All Libraries   *****************************/
-#include <Servo.h>
-
-/*******************************   Enums and Structures   ******************************/
-enum CarStateName {
- Stop,
- Forward,
- SlightRT,
- SlightLT,
- SharpRT,
- SharpLT
-};
-
-struct CarState {
- CarStateName stateName;
- unsigned short motorRotationDirection;
- short motorSpeed;
- int servoPosition;
- int sharpCycleCount;
-};
-
-enum ObstaclePosition {
- NoObstacle,
- ObstacleFar,
- ObstacleNear
-};
-
-struct SensorsState {
- bool leftLineSensorOnLine;
- bool rightLineSensorOnLine;
- ObstaclePosition obstacleDetectorResult;
-};
-
-/*******************************   Variables and Constants Declaration   ******************************/
-#define echoPin 3               // Echo pin in the Ultrasonic sensor
-#define trigPin 10              // Trig pin in the Ultrasonic sensor
-
-#define BRAKE 0
-#define CW    1
-#define CCW   2
-#define CS_THRESHOLD 15
-
-//MOTOR 1
-#define MOTOR_A1_PIN 7
-#define MOTOR_B1_PIN 8
-
-#define PWM_MOTOR_1 5
-
-#define CURRENT_SEN_1 A2
-
-#define EN_PIN_1 A0
-
-/* Ultrasonic Sensor */
-const int ObstacleFarDistance  = 45;
-const int ObstacleNearDistance = 15;
-
-
-/* TCRT5000 Sensors */
-const int tcrtLeftPin  = 11;     // The variable for pin of the TCRT5000 left sensor
-const int tcrtRightPin = 12;     // The variable for pin of the TCRT5000 right sensor
-
-/* Servo */
-Servo servo;                     // The variable for servo
-const int servoPin = 13;         // The variable for pin of the servo
-
-const int servoNeutral   = 130;
-const int servoLowRight  = servoNeutral - 15;
-const int servoHighRight = servoNeutral - 55;
-const int servoLowLeft   = servoNeutral + 15;
-const int servoHighLeft  = servoNeutral + 55;
-
-/* DC Motor */
-const short lowSpeed             = 20; // 20 ok
-const short maxSpeed             = 25; // 20-25 ok
-const short maxSpeedWithObstacle = 20;
-
-const short ObstacleAroundSpeed  = 25;
-
-short highSpeed = maxSpeed;
-
-/* The condition to determine that the line was lost */
-const int maxSharpT = 70; //possible to have 30 here, it was 35, it was was 50 :)
-
-const int movementCountForFindLine = 2;
-const int movementTimeForFindLine = 300;
-
-/* Global objects */
-SensorsState sensorsState = {true, true, NoObstacle};
-CarState     carState     = {Forward, CCW, 0, servoNeutral, 0};
-
-/**********************************   Setup Function   **********************************/
-void setup() {
-  /* Arduino setup */
-  Serial.begin(9600);           // Start the serial connection with Arduino
-
-  /* Ultrasonic sensor setup */
-  pinMode(trigPin, OUTPUT);     // The Trig pin for the Ultrasonic sensor
-  pinMode(echoPin, INPUT);      // The Echo pin for the Ultrasonic sensor
-
-  /* TCRT5000 setup */
-  pinMode(tcrtLeftPin,  INPUT);  // The input pin fro the TCRT5000 left sensor
-  pinMode(tcrtRightPin, INPUT); // The input pin fro the TCRT5000 right sensor
-
-  /* Servo */
-  servo.attach(servoPin);       // The output of the servo
-
-  /* DC Motor */
-  pinMode(MOTOR_A1_PIN, OUTPUT);
-  pinMode(MOTOR_B1_PIN, OUTPUT);
-
-  pinMode(PWM_MOTOR_1, OUTPUT);
-
-  pinMode(CURRENT_SEN_1, OUTPUT);
-
-  pinMode(EN_PIN_1, OUTPUT);
-}
-
-/**********************************   Main Loop Function   ***********************************/
-void loop() {
-    Serial.print(carState.stateName);
-    Serial.print("-");
-    Serial.println(carState.sharpCycleCount);
-
- GetSensorData();
- CalculateNextState();
- ChangeCarState();
-}
-
-/*******************************   GetSensorData Function   *******************************/
-void GetSensorData(){
- sensorsState.leftLineSensorOnLine  = IsSensorOnWhiteLine(tcrtLeftPin);  // left  TCRT5000 sensor
- sensorsState.rightLineSensorOnLine = IsSensorOnWhiteLine(tcrtRightPin); // right TCRT5000 sensor
- 
- long distance = GetDistanceToObstacle();
- 
- if(distance > ObstacleFarDistance){ // Check the distance to find the obstacle
-  sensorsState.obstacleDetectorResult = NoObstacle;
- } else {
-  if(distance > ObstacleNearDistance && distance <= ObstacleFarDistance){
-   sensorsState.obstacleDetectorResult = ObstacleFar;
-  } else {
-   sensorsState.obstacleDetectorResult = ObstacleNear;
-  }
- }
-};
-
-/*******************************   CalculateNextState Function   *******************************/
-void CalculateNextState(){
-
- if(carState.stateName == Stop){
-  return;
- };
-
- if(sensorsState.obstacleDetectorResult != NoObstacle){
-  highSpeed = maxSpeedWithObstacle;
-  
-  if(sensorsState.obstacleDetectorResult == ObstacleNear){
-   GoAroundObstacle();
-  }
- } else {
-  highSpeed = maxSpeed;
- }
- 
- if(sensorsState.leftLineSensorOnLine && sensorsState.rightLineSensorOnLine){
-  PrepareCarState(Forward, CCW, highSpeed, servoNeutral, true);
- };
-
- if(!sensorsState.leftLineSensorOnLine && sensorsState.rightLineSensorOnLine){
-  PrepareCarState(SlightRT, CCW, highSpeed, servoLowRight, true);
- };
-
- if(sensorsState.leftLineSensorOnLine && !sensorsState.rightLineSensorOnLine){
-  PrepareCarState(SlightLT, CCW, highSpeed, servoLowLeft, true);
- };
- 
- if(!sensorsState.leftLineSensorOnLine && !sensorsState.rightLineSensorOnLine){
-  if((carState.stateName == SlightRT)||(carState.stateName == SharpRT)){
-   PrepareCarState(SharpRT, CCW, lowSpeed, servoHighRight, false);
-  };
-
-  if((carState.stateName == SlightLT)||(carState.stateName == SharpLT)){
-   PrepareCarState(SharpLT, CCW, lowSpeed, servoHighLeft, false);
-  };
-
-  if(carState.sharpCycleCount > maxSharpT){
-   FindLine();
-  };
- };
-};
-
-/*******************************   PrepareCarState Function   *******************************/
-void PrepareCarState(CarStateName stateName, unsigned short motorRotationDirection, short motorSpeed, int servoPosition, bool resetCycleCount){
- carState.stateName = stateName;
- carState.motorRotationDirection = motorRotationDirection;
- carState.motorSpeed = motorSpeed;
- carState.servoPosition = servoPosition;
- if(resetCycleCount){
-  carState.sharpCycleCount = 0;
- } else {
-  carState.sharpCycleCount++;
- };
-};
-
-/*******************************   ChangeCarState Function   *******************************/
-void ChangeCarState(){
-  servo.write(carState.servoPosition); // Turn the servo
-//  delay(10);                           // Delay for turning the servo
-
-  motorGo(carState.motorRotationDirection, carState.motorSpeed);
-}
-
-/*******************************   GoAroundObstacle Function   *******************************/
-void GoAroundObstacle(){
-  motorGo(BRAKE, 0);
-
-  CarMovement(servoHighLeft, CW, 700); // L B
-  CarMovement(servoHighRight, CCW, 700); // R F
-  CarMovement(servoHighLeft, CW, 700); // L B
-  CarMovement(servoHighRight, CCW, 700); // R F
-  CarMovement(servoNeutral, CCW, 1000); // Forward
-  
-  CarMovement(servoHighRight, CW, 700); // R B
-  CarMovement(servoHighLeft, CCW, 700); // L F
-  CarMovement(servoHighRight, CW, 700); // R B
-  CarMovement(servoHighLeft, CCW, 700); // L F
-  CarMovement(servoHighRight, CW, 700); // R B
-  CarMovement(servoHighLeft, CCW, 700); // L F
-  CarMovement(servoHighRight, CW, 700); // R B
-  CarMovement(servoHighLeft, CCW, 700); // L F
-  CarMovement(servoNeutral, CCW, 1000); // Forward
-}
-
-/****************************   CarMovement Function   ********************************/
-void CarMovement(int ServoPosition, uint8_t Direction, int Delay){
-  servo.write(ServoPosition);
-  delay(10);
-  motorGo(Direction, ObstacleAroundSpeed);
-  delay(Delay);
-  motorGo(BRAKE, 0);
-}
-
-/*******************************   FindLine Function   *******************************/
-void FindLine(){
-
- motorGo(BRAKE, 0);
- int movementCount = 0;
- int patternNumber = 0;
- bool restartMovementPattern = false;
-
- while(!sensorsState.leftLineSensorOnLine && !sensorsState.rightLineSensorOnLine && (movementCount < movementCountForFindLine)){
- 
-  switch (patternNumber) {
-  case 0: // R
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine);
-    break;
-  case 1: // R
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  case 2: // L
-    CarMovement(servoHighRight, CW, movementTimeForFindLine);
-    CarMovement(servoHighLeft, CCW, movementTimeForFindLine);
-    break;
-  case 3: // L
-    CarMovement(servoHighRight, CW, movementTimeForFindLine);
-    CarMovement(servoHighLeft, CCW, movementTimeForFindLine);
-    break;
-  case 4: // to the start point
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  case 5: // R
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  case 6: // R
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  case 7: // R
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  case 8: // R
-    CarMovement(servoHighLeft, CW, movementTimeForFindLine); // L B
-    CarMovement(servoHighRight, CCW, movementTimeForFindLine); // R F
-    break;
-  default:
-    restartMovementPattern = true;
-    break;
-  }
-  
-  if(restartMovementPattern){
-   patternNumber = 0;
-  } else {
-   patternNumber++;
-  }
- 
-  movementCount++;
-  GetSensorData();
- };
-
- if(movementCount >= movementCountForFindLine){
-   //finish
-  //
-  PrepareCarState(Stop, BRAKE, 0, servoNeutral, true);
- }; 
-
- CalculateNextState();
- ChangeCarState();
-}
-
-/****************************   Ultrasonic Sensor Function   ****************************/
-long GetDistanceToObstacle(){
- digitalWrite(trigPin, LOW);               // Clears the trigPin condition
-   delayMicroseconds(2);
-
- digitalWrite(trigPin, HIGH);              // Sets the trigPin HIGH (ACTIVE) for 10 microseconds
- delayMicroseconds(10);
- digitalWrite(trigPin, LOW);
-
- long duration = pulseIn(echoPin, HIGH);        // Reads the echoPin, returns the sound wave travel time in microseconds
-
- long distance = duration * 0.034 / 2;          // Calculating the distance
- 
- return(distance);
-}
-
-
-/******************************   TCRT5000 sensor Function   ******************************/
-bool IsSensorOnWhiteLine(int TCRT5000Pin){
-  boolean val = digitalRead(TCRT5000Pin);   // Read the value of TCRT5000 sensor on Pin TCRT5000Pin
-  
-  if(val == HIGH){                          // If it is HiGH
-    return(false);                           // Return false if on the Black area
-  }
-  else{                                     // If it is LOW
-    return(true);                           // Return true if on the White line
-  }
-}
-
-/**********************************   Motor Go Function   *******************************/
-void motorGo(uint8_t direct, uint8_t pwm){
-    if(direct == CW)
-    {
-      digitalWrite(EN_PIN_1, HIGH);
-      digitalWrite(MOTOR_A1_PIN, LOW); 
-      digitalWrite(MOTOR_B1_PIN, HIGH);
-    }
-    else if(direct == CCW)
-    {
-      digitalWrite(EN_PIN_1, HIGH);
-      digitalWrite(MOTOR_A1_PIN, HIGH);
-      digitalWrite(MOTOR_B1_PIN, LOW);      
-    }
-    else
-    {
-//      digitalWrite(EN_PIN_1, LOW);
-      digitalWrite(MOTOR_A1_PIN, LOW);
-      digitalWrite(MOTOR_B1_PIN, LOW);            
-    }
-    
-    analogWrite(PWM_MOTOR_1, pwm); 
-} 
+/*
+ *  Date: 29.05.2021
+ *  Name: Racing Car by Turbo Inc.
+ *  Author: Artem Tikhonov
+*/
+
+/******************************   Including All Libraries   *****************************/
+#include <Servo.h>
+#include <FastPin.h>        // Pins as types, set and read straight through their port registers
+
+/*******************************   Enums and Structures   ******************************/
+enum CarStateName {
+ Stop,
+ Forward,
+ SlightRT,
+ SlightLT,
+ SharpRT,
+ SharpLT
+};
+
+struct CarState {
+ CarStateName stateName;
+ unsigned short motorRotationDirection;
+ short motorSpeed;
+ int servoPosition;
+ unsigned long lineSeenTime;   // millis() when a sensor last saw the line
+};
+
+enum ObstaclePosition {
+ NoObstacle,
+ ObstacleFar,
+ ObstacleNear
+};
+
+struct SensorsState {
+ bool leftLineSensorOnLine;
+ bool rightLineSensorOnLine;
+ ObstaclePosition obstacleDetectorResult;
+};
+
+enum AbortCondition {
+ NeverAbort,
+ AbortOnLine                 // Either TCRT5000 sensor sees the line
+};
+
+struct ManeuverStep {
+ int servoPosition;
+ uint8_t motorRotationDirection;
+ short motorSpeed;
+ unsigned int duration;      // ms of driving, after the servo had servoSettleTime to turn
+ AbortCondition abortCondition;
+};
+
+struct Maneuver {
+ const ManeuverStep *steps;
+ int stepAmount;
+ bool stopIfNotAborted;      // Stop the car when the last step ends without its abort condition having been met
+};
+
+enum SteeringMode {
+ StateTableSteering,         // CalculateNextState() picks one of the CarStateName states from the two sensors
+ PidSteering                 // A PID controller steers from where the line is estimated to be, the state table takes over when it is lost
+};
+
+struct LineEstimate {
+ int band;                   // Where the sensors say the line is: 0 both see it, 1 only the left, 2 neither and it went left, negative to the right
+ float edge;                 // mm, where the line was when the band last changed, positive to the left of the middle of the sensors
+ unsigned long edgeTime;     // millis() of that change
+ float rate;                 // mm/s the line moves to the left at, from the time between the last two changes
+};
+
+struct PidState {
+ bool active;                // false while the state table steers
+ unsigned long lastTime;     // millis() of the last step
+ float integral;             // Servo degrees
+ float curvature;            // Servo degrees off neutral the car held lately, how much the line bends
+};
+
+struct ManeuverState {
+ const Maneuver *maneuver;   // NULL when no maneuver is running
+ int step;
+ unsigned long stepStartTime;
+ bool motorStarted;
+};
+
+/*******************************   Variables and Constants Declaration   ******************************/
+#define echoPin 3               // Echo pin in the Ultrasonic sensor
+#define trigPin 10              // Trig pin in the Ultrasonic sensor
+
+typedef OutputPin<trigPin> TrigPin;
+typedef InputPin<echoPin>  EchoPin;
+
+#define BRAKE 0
+#define CW    1
+#define CCW   2
+#define CS_THRESHOLD 15
+
+//MOTOR 1
+#define MOTOR_A1_PIN 7
+#define MOTOR_B1_PIN 8
+
+#define PWM_MOTOR_1 5
+
+#define CURRENT_SEN_1 A2
+
+#define EN_PIN_1 A0
+
+typedef OutputPin<MOTOR_A1_PIN> MotorA1Pin;
+typedef OutputPin<MOTOR_B1_PIN> MotorB1Pin;
+typedef OutputPin<EN_PIN_1>     MotorEnablePin;
+
+/* Ultrasonic Sensor */
+const int ObstacleFarDistance  = 45;
+const int ObstacleNearDistance = 15;
+
+const int ultrasonicPingInterval = 30;   // ms between pings, the HC-SR04 needs about 25 ms for the old echoes to die out
+const int ultrasonicMaxDistance  = 200;  // cm, echoes from further away count as no obstacle
+
+volatile long obstacleDistance = ultrasonicMaxDistance + 1; // The latest distance, published by the echo interrupt
+volatile unsigned long echoStartTime = 0;                   // micros() of the rising edge of the echo
+volatile bool echoPending = false;                          // A ping was sent and its echo didnt end yet
+volatile int pingTimer = 0;                                 // ms since the last ping
+
+
+/* TCRT5000 Sensors */
+const int tcrtLeftPin  = 11;     // The variable for pin of the TCRT5000 left sensor
+const int tcrtRightPin = 12;     // The variable for pin of the TCRT5000 right sensor
+
+typedef InputPins<tcrtLeftPin, tcrtRightPin> LineSensorPins; // Both on PORTB, read in one go
+
+/* Servo */
+Servo servo;                     // The variable for servo
+const int servoPin = 13;         // The variable for pin of the servo
+
+const int servoNeutral   = 130;
+const int servoLowRight  = servoNeutral - 15;
+const int servoHighRight = servoNeutral - 55;
+const int servoLowLeft   = servoNeutral + 15;
+const int servoHighLeft  = servoNeutral + 55;
+
+/* DC Motor */
+const short lowSpeed             = 20; // 20 ok
+const short maxSpeed             = 25; // 20-25 ok
+const short maxSpeedWithObstacle = 20;
+
+const short ObstacleAroundSpeed  = 25;
+
+short highSpeed = maxSpeed;
+
+/* The condition to determine that the line was lost */
+const unsigned long maxSharpTime = 3000; // ms without the line, it was 70 loops of about 43 ms
+
+const int movementTimeForFindLine = 300;
+
+/* PID steering */
+const SteeringMode steeringMode = PidSteering;
+
+const float lineInnerEdge = 10;  // mm off the middle where one sensor stops seeing the line, half the line width less half the sensor spacing
+const float lineOuterEdge = 40;  // mm off the middle where neither sees it, half the line width plus half the sensor spacing
+const float lineLostEdge  = 60;  // mm off the middle the line is assumed to be at most once neither sensor sees it
+const float maxLineRate   = 400; // mm/s
+
+const unsigned long pidInterval = 2;  // ms between steps, a step is about 100 us of float math on the Uno
+const float steerP = 0.6;             // Servo degrees per mm
+const float steerI = 0.0;             // Servo degrees per mm and second
+const float steerD = 0.2;             // Servo degrees per mm/s
+const float steerIntegralLimit = 20;  // Servo degrees
+const float feedForwardGain = 0.6;    // Part of the steering held lately that is steered anyway
+const float curvatureTime = 400;      // ms the curvature is averaged over
+
+const short pidStraightSpeed = 40;    // On a straight line
+const short pidCurveSpeed    = 25;    // In a bend that needs pidCurveSteer or more
+const float pidCurveSteer    = 35;    // Servo degrees
+const unsigned long pidLostTime = 300; // ms neither sensor sees the line before the state table takes over
+
+/* Maneuvers, run step by step from loop() while the sensors keep being read */
+const int servoSettleTime = 10;  // ms with the motor braked for the servo to turn at the start of a step
+
+const ManeuverStep goAroundObstacleSteps[] = {
+ {servoHighLeft,  CW,  ObstacleAroundSpeed, 700,  NeverAbort},  // L B
+ {servoHighRight, CCW, ObstacleAroundSpeed, 700,  NeverAbort},  // R F
+ {servoHighLeft,  CW,  ObstacleAroundSpeed, 700,  NeverAbort},  // L B
+ {servoHighRight, CCW, ObstacleAroundSpeed, 700,  NeverAbort},  // R F
+ {servoNeutral,   CCW, ObstacleAroundSpeed, 1000, NeverAbort},  // Forward, past the obstacle
+
+ {servoHighRight, CW,  ObstacleAroundSpeed, 700,  AbortOnLine}, // R B, back to the line
+ {servoHighLeft,  CCW, ObstacleAroundSpeed, 700,  AbortOnLine}, // L F
+ {servoHighRight, CW,  ObstacleAroundSpeed, 700,  AbortOnLine}, // R B
+ {servoHighLeft,  CCW, ObstacleAroundSpeed, 700,  AbortOnLine}, // L F
+ {servoHighRight, CW,  ObstacleAroundSpeed, 700,  AbortOnLine}, // R B
+ {servoHighLeft,  CCW, ObstacleAroundSpeed, 700,  AbortOnLine}, // L F
+ {servoHighRight, CW,  ObstacleAroundSpeed, 700,  AbortOnLine}, // R B
+ {servoHighLeft,  CCW, ObstacleAroundSpeed, 700,  AbortOnLine}, // L F
+ {servoNeutral,   CCW, ObstacleAroundSpeed, 1000, AbortOnLine}  // Forward
+};
+
+const ManeuverStep findLineSteps[] = {
+ {servoHighRight, CCW, ObstacleAroundSpeed, movementTimeForFindLine, AbortOnLine}, // R F
+ {servoHighLeft,  CW,  ObstacleAroundSpeed, movementTimeForFindLine, AbortOnLine}, // L B
+ {servoHighRight, CCW, ObstacleAroundSpeed, movementTimeForFindLine, AbortOnLine}  // R F
+};
+
+const Maneuver goAroundObstacle = {goAroundObstacleSteps, sizeof(goAroundObstacleSteps) / sizeof(ManeuverStep), false};
+const Maneuver findLine         = {findLineSteps, sizeof(findLineSteps) / sizeof(ManeuverStep), true};
+
+/* Telemetry: fixed size records, see tools/TelemetryDecode.py */
+#define TELEMETRY_SYNC        0xA5
+#define TELEMETRY_RECORD_SIZE 12
+
+const unsigned long telemetryInterval = 20; // ms, at most one record this often
+const int telemetryDecimation = 1;          // Only every Nth loop() iteration can send a record
+
+unsigned long lastTelemetryTime = 0;
+int telemetryLoopCount = 0;
+uint8_t telemetrySequence = 0;   // Counts the records dropped because the TX buffer was full too
+uint8_t motorDirection = BRAKE;  // What motorGo() last set
+uint8_t motorPwm = 0;
+
+/* Global objects */
+SensorsState  sensorsState  = {true, true, NoObstacle};
+CarState      carState      = {Forward, CCW, 0, servoNeutral, 0};
+ManeuverState maneuverState = {NULL, 0, 0, false};
+LineEstimate  lineEstimate  = {0, 0, 0, 0};
+PidState      pidState      = {false, 0, 0, 0};
+
+/**********************************   Setup Function   **********************************/
+void setup() {
+  /* Arduino setup */
+  Serial.begin(115200);         // Start the serial connection with Arduino, telemetry only
+
+  /* Ultrasonic sensor setup */
+  pinMode(trigPin, OUTPUT);     // The Trig pin for the Ultrasonic sensor
+  pinMode(echoPin, INPUT);      // The Echo pin for the Ultrasonic sensor
+  attachInterrupt(digitalPinToInterrupt(echoPin), EchoChanged, CHANGE); // Both edges of the echo
+
+  /* Timer2 interrupt every 1 ms to send the pings (Timer0 is millis(), Timer1 the servo) */
+  noInterrupts();
+  TCCR2A = _BV(WGM21);          // CTC mode
+  TCCR2B = _BV(CS22);           // Prescaler 64: 250 kHz
+  OCR2A  = 249;                 // 250 counts = 1 ms
+  TIMSK2 = _BV(OCIE2A);
+  interrupts();
+
+  /* TCRT5000 setup */
+  pinMode(tcrtLeftPin,  INPUT);  // The input pin fro the TCRT5000 left sensor
+  pinMode(tcrtRightPin, INPUT); // The input pin fro the TCRT5000 right sensor
+
+  /* Servo */
+  servo.attach(servoPin);       // The output of the servo
+
+  /* DC Motor */
+  pinMode(MOTOR_A1_PIN, OUTPUT);
+  pinMode(MOTOR_B1_PIN, OUTPUT);
+
+  pinMode(PWM_MOTOR_1, OUTPUT);
+
+  pinMode(CURRENT_SEN_1, OUTPUT);
+
+  pinMode(EN_PIN_1, OUTPUT);
+}
+
+/**********************************   Main Loop Function   ***********************************/
+void loop() {
+ GetSensorData();
+
+ if(maneuverState.maneuver == NULL){
+  CalculateNextState();           // Can start a maneuver
+ }
+
+ if(maneuverState.maneuver != NULL){
+  RunManeuver();
+ } else {
+  ChangeCarState();
+ }
+
+ SendTelemetry();
+}
+
+/*******************************   GetSensorData Function   *******************************/
+void GetSensorData(){
+ PortWord lineSensors = LineSensorPins::Read();                                          // Both TCRT5000 sensors at the same instant
+ sensorsState.leftLineSensorOnLine  = IsSensorOnWhiteLine(lineSensors & PinBit<tcrtLeftPin>());  // left  TCRT5000 sensor
+ sensorsState.rightLineSensorOnLine = IsSensorOnWhiteLine(lineSensors & PinBit<tcrtRightPin>()); // right TCRT5000 sensor
+ 
+ long distance = GetDistanceToObstacle();
+ 
+ if(distance > ObstacleFarDistance){ // Check the distance to find the obstacle
+  sensorsState.obstacleDetectorResult = NoObstacle;
+ } else {
+  if(distance > ObstacleNearDistance && distance <= ObstacleFarDistance){
+   sensorsState.obstacleDetectorResult = ObstacleFar;
+  } else {
+   sensorsState.obstacleDetectorResult = ObstacleNear;
+  }
+ }
+};
+
+/*******************************   CalculateNextState Function   *******************************/
+void CalculateNextState(){
+
+ if(carState.stateName == Stop){
+  return;
+ };
+
+ if(sensorsState.obstacleDetectorResult != NoObstacle){
+  highSpeed = maxSpeedWithObstacle;
+  
+  if(sensorsState.obstacleDetectorResult == ObstacleNear){
+   GoAroundObstacle();
+   return;
+  }
+ } else {
+  highSpeed = maxSpeed;
+ }
+
+ if(steeringMode == PidSteering){
+  UpdateLineEstimate();
+  if(PidSteer()){
+   return;
+  }
+ }
+ 
+ if(sensorsState.leftLineSensorOnLine && sensorsState.rightLineSensorOnLine){
+  PrepareCarState(Forward, CCW, highSpeed, servoNeutral, true);
+ };
+
+ if(!sensorsState.leftLineSensorOnLine && sensorsState.rightLineSensorOnLine){
+  PrepareCarState(SlightRT, CCW, highSpeed, servoLowRight, true);
+ };
+
+ if(sensorsState.leftLineSensorOnLine && !sensorsState.rightLineSensorOnLine){
+  PrepareCarState(SlightLT, CCW, highSpeed, servoLowLeft, true);
+ };
+ 
+ if(!sensorsState.leftLineSensorOnLine && !sensorsState.rightLineSensorOnLine){
+  if((carState.stateName == SlightRT)||(carState.stateName == SharpRT)){
+   PrepareCarState(SharpRT, CCW, lowSpeed, servoHighRight, false);
+  };
+
+  if((carState.stateName == SlightLT)||(carState.stateName == SharpLT)){
+   PrepareCarState(SharpLT, CCW, lowSpeed, servoHighLeft, false);
+  };
+
+  if(millis() - carState.lineSeenTime > maxSharpTime){
+   FindLine();
+   return;
+  };
+ };
+};
+
+/*******************************   UpdateLineEstimate Function   *******************************/
+// The sensors only tell which band the line is in. When it changes band it is on the edge between them, and the time it
+// took from the edge before gives how fast it moves across.
+void UpdateLineEstimate(){
+ bool left  = sensorsState.leftLineSensorOnLine;
+ bool right = sensorsState.rightLineSensorOnLine;
+ int band;
+
+ if(left && right){
+  band = 0;
+ } else if(left){
+  band = 1;
+ } else if(right){
+  band = -1;
+ } else {
+  band = (lineEstimate.band > 0 || (lineEstimate.band == 0 && lineEstimate.edge > 0)) ? 2 : -2;
+ };
+
+ if(band == lineEstimate.band){
+  return;
+ };
+
+ float edge;
+ if(abs(band) > abs(lineEstimate.band) || (band > 0) != (lineEstimate.band > 0)){  // Further out, on the edge of the new band
+  edge = abs(band) == 2 ? lineOuterEdge : lineInnerEdge;
+  edge = band > 0 ? edge : -edge;
+ } else {                                                                          // Back in, on the edge of the old one
+  edge = abs(lineEstimate.band) == 2 ? lineOuterEdge : lineInnerEdge;
+  edge = lineEstimate.band > 0 ? edge : -edge;
+ };
+
+ unsigned long now = millis();
+ if(edge != lineEstimate.edge && now != lineEstimate.edgeTime){
+  lineEstimate.rate = constrain((edge - lineEstimate.edge) * 1000 / (now - lineEstimate.edgeTime), -maxLineRate, maxLineRate);
+ } else {
+  lineEstimate.rate = 0;                                                           // Turned back on the same edge
+ };
+
+ lineEstimate.band = band;
+ lineEstimate.edge = edge;
+ lineEstimate.edgeTime = now;
+};
+
+/*******************************   LineOffset Function   *******************************/
+// mm the line is to the left of the middle of the sensors now, carried on from the last edge at its rate but kept in its band.
+float LineOffset(unsigned long now){
+ float low, high;
+ switch(abs(lineEstimate.band)){
+  case 0:  low = -lineInnerEdge; high = lineInnerEdge; break;
+  case 1:  low = lineInnerEdge;  high = lineOuterEdge; break;
+  default: low = lineOuterEdge;  high = lineLostEdge;  break;
+ };
+ if(lineEstimate.band < 0){
+  float swap = low;
+  low = -high;
+  high = -swap;
+ };
+
+ float offset = lineEstimate.edge + lineEstimate.rate * (now - lineEstimate.edgeTime) / 1000;
+ return constrain(offset, low, high);
+};
+
+/*******************************   PidSteer Function   *******************************/
+// Steers towards the estimated line with feed-forward of the curvature and slows down as much as the curvature asks for.
+// Returns false when neither sensor saw the line for pidLostTime, the state table steers then.
+
+bool PidSteer(){
+ unsigned long now = millis();
+
+ if(abs(lineEstimate.band) == 2 && now - lineEstimate.edgeTime > pidLostTime){
+  pidState.active = false;
+  return false;
+ };
+
+ if(!pidState.active){
+  pidState.active = true;
+  pidState.lastTime = now;
+  pidState.integral = 0;
+ };
+
+ if(now - pidState.lastTime < pidInterval){ // carState still holds the last step
+  return true;
+ };
+ float dt = (now - pidState.lastTime) / 1000.0;
+ pidState.lastTime = now;
+
+ float offset = LineOffset(now);
+ pidState.integral = constrain(pidState.integral + steerI * offset * dt, -steerIntegralLimit, steerIntegralLimit);
+
+ float steer = feedForwardGain * pidState.curvature + steerP * offset + steerD * lineEstimate.rate + pidState.integral;
+ steer = constrain(steer, (float)(servoHighRight - servoNeutral), (float)(servoHighLeft - servoNeutral));
+ pidState.curvature += (steer - pidState.curvature) * min(1.0, dt * 1000 / curvatureTime);
+
+ float bend = min(1.0, fabs(pidState.curvature) / pidCurveSteer);
+ short speed = pidStraightSpeed - (pidStraightSpeed - pidCurveSpeed) * bend;
+ if(sensorsState.obstacleDetectorResult == ObstacleFar){
+  speed = min(speed, maxSpeedWithObstacle);
+ };
+
+ CarStateName stateName = lineEstimate.band == 0 ? Forward : (lineEstimate.band > 0 ? SlightLT : SlightRT); // The state table turns on from here
+ PrepareCarState(stateName, CCW, speed, servoNeutral + (int)round(steer), abs(lineEstimate.band) != 2);
+ return true;
+};
+
+/*******************************   PrepareCarState Function   *******************************/
+void PrepareCarState(CarStateName stateName, unsigned short motorRotationDirection, short motorSpeed, int servoPosition, bool lineSeen){
+ carState.stateName = stateName;
+ carState.motorRotationDirection = motorRotationDirection;
+ carState.motorSpeed = motorSpeed;
+ carState.servoPosition = servoPosition;
+ if(lineSeen){
+  carState.lineSeenTime = millis();
+ };
+};
+
+/*******************************   ChangeCarState Function   *******************************/
+void ChangeCarState(){
+  servo.write(carState.servoPosition); // Turn the servo
+//  delay(10);                           // Delay for turning the servo
+
+  motorGo(carState.motorRotationDirection, carState.motorSpeed);
+}
+
+/*******************************   GoAroundObstacle Function   *******************************/
+void GoAroundObstacle(){
+ StartManeuver(&goAroundObstacle);
+}
+
+/*******************************   FindLine Function   *******************************/
+void FindLine(){
+ StartManeuver(&findLine);
+}
+
+/*******************************   StartManeuver Function   *******************************/
+void StartManeuver(const Maneuver *maneuver){
+ maneuverState.maneuver = maneuver;
+ StartManeuverStep(0);
+}
+
+/*******************************   StartManeuverStep Function   *******************************/
+void StartManeuverStep(int step){
+ const ManeuverStep *maneuverStep = &maneuverState.maneuver->steps[step];
+
+ maneuverState.step = step;
+ maneuverState.stepStartTime = millis();
+ maneuverState.motorStarted = false;
+
+ motorGo(BRAKE, 0);
+ servo.write(maneuverStep->servoPosition); // The motor starts once the servo had time to turn
+}
+
+/*******************************   RunManeuver Function   *******************************/
+void RunManeuver(){
+ const Maneuver *maneuver = maneuverState.maneuver;
+ const ManeuverStep *maneuverStep = &maneuver->steps[maneuverState.step];
+ unsigned long stepTime = millis() - maneuverState.stepStartTime;
+
+ if(maneuverStep->abortCondition == AbortOnLine && (sensorsState.leftLineSensorOnLine || sensorsState.rightLineSensorOnLine)){
+  EndManeuver(true);
+  return;
+ }
+
+ if(!maneuverState.motorStarted && stepTime >= (unsigned long)servoSettleTime){
+  motorGo(maneuverStep->motorRotationDirection, maneuverStep->motorSpeed);
+  maneuverState.motorStarted = true;
+ }
+
+ if(stepTime >= (unsigned long)servoSettleTime + maneuverStep->duration){
+  if(maneuverState.step + 1 < maneuver->stepAmount){
+   StartManeuverStep(maneuverState.step + 1);
+  } else {
+   EndManeuver(false);
+  }
+ }
+}
+
+/*******************************   EndManeuver Function   *******************************/
+void EndManeuver(bool aborted){
+ motorGo(BRAKE, 0);
+
+ if(!aborted && maneuverState.maneuver->stopIfNotAborted){
+  PrepareCarState(Stop, BRAKE, 0, servoNeutral, true);
+ } else {
+  carState.lineSeenTime = millis(); // The line is looked for from where the maneuver left the car
+ }
+
+ pidState.active = false;         // What the PID knew about the line is from before the maneuver
+ pidState.curvature = 0;
+ lineEstimate.rate = 0;
+ lineEstimate.edgeTime = millis();
+
+ maneuverState.maneuver = NULL;   // loop() goes on with CalculateNextState() from the next iteration
+}
+
+/****************************   Ultrasonic Sensor Function   ****************************/
+long GetDistanceToObstacle(){
+ noInterrupts();                           // The echo interrupt could change the distance halfway through reading its 4 bytes
+ long distance = obstacleDistance;
+ interrupts();
+
+ return(distance);                         // Never waits for the echo, the distance is at most one ping interval old
+}
+
+/*************************   Ultrasonic Ping Timer Interrupt   *************************/
+ISR(TIMER2_COMPA_vect){
+ if(++pingTimer < ultrasonicPingInterval){
+  return;
+ }
+ pingTimer = 0;
+
+ if(echoPending){                          // The last echo didnt end in a whole interval, nothing is in range
+  obstacleDistance = ultrasonicMaxDistance + 1;
+ }
+
+ echoPending = true;
+ TrigPin::High();                          // Sets the trigPin HIGH (ACTIVE) for 10 microseconds
+ delayMicroseconds(10);
+ TrigPin::Low();
+}
+
+/*************************   Ultrasonic Echo Pin Interrupt   *************************/
+void EchoChanged(){
+ unsigned long now = micros();
+
+ if(EchoPin::Read()){                      // The sound wave left
+  echoStartTime = now;
+  return;
+ }
+
+ if(!echoPending){                         // Falling edge of an echo we already gave up on
+  return;
+ }
+ echoPending = false;
+
+ long distance = (now - echoStartTime) / 58; // 0.034 cm/us there and back
+ if(distance > ultrasonicMaxDistance){
+  distance = ultrasonicMaxDistance + 1;
+ }
+ obstacleDistance = distance;
+}
+
+
+/******************************   TCRT5000 sensor Function   ******************************/
+bool IsSensorOnWhiteLine(boolean val){      // val is the level read from the TCRT5000 sensor
+  if(val){                                  // If it is HiGH
+    return(false);                           // Return false if on the Black area
+  }
+  else{                                     // If it is LOW
+    return(true);                           // Return true if on the White line
+  }
+}
+
+/**********************************   Motor Go Function   *******************************/
+void motorGo(uint8_t direct, uint8_t pwm){
+    if(direct == CW)
+    {
+      MotorEnablePin::High();
+      MotorA1Pin::Low();
+      MotorB1Pin::High();
+    }
+    else if(direct == CCW)
+    {
+      MotorEnablePin::High();
+      MotorA1Pin::High();
+      MotorB1Pin::Low();
+    }
+    else
+    {
+//      digitalWrite(EN_PIN_1, LOW);
+      MotorA1Pin::Low();
+      MotorB1Pin::Low();
+    }
+    
+    analogWrite(PWM_MOTOR_1, pwm); 
+
+    motorDirection = direct;
+    motorPwm = pwm;
+}
+
+/*******************************   SendTelemetry Function   *******************************/
+// One record: sync, sequence, millis() (4 bytes little endian), sensors and state, distance in cm, servo position,
+// motor direction, motor PWM and the sum of the bytes before. Serial.write() only fills the TX buffer the UART interrupt
+// empties, and a record that doesnt fit in it is dropped instead of waiting, the gap shows in the sequence.
+void SendTelemetry(){
+ unsigned long now = millis();
+ if(++telemetryLoopCount < telemetryDecimation || now - lastTelemetryTime < telemetryInterval){
+  return;
+ }
+ telemetryLoopCount = 0;
+ lastTelemetryTime = now;
+
+ long distance = GetDistanceToObstacle();
+ uint8_t record[TELEMETRY_RECORD_SIZE];
+ record[0]  = TELEMETRY_SYNC;
+ record[1]  = telemetrySequence++;
+ record[2]  = now;
+ record[3]  = now >> 8;
+ record[4]  = now >> 16;
+ record[5]  = now >> 24;
+ record[6]  = sensorsState.leftLineSensorOnLine | sensorsState.rightLineSensorOnLine << 1 | (maneuverState.maneuver != NULL) << 2 | carState.stateName << 4;
+ record[7]  = distance > 255 ? 255 : distance;
+ record[8]  = servo.read();
+ record[9]  = motorDirection;
+ record[10] = motorPwm;
+
+ uint8_t checksum = 0;
+ for(int i = 0; i < TELEMETRY_RECORD_SIZE - 1; i++){
+  checksum += record[i];
+ }
+ record[TELEMETRY_RECORD_SIZE - 1] = checksum;
+
+ if(Serial.availableForWrite() >= TELEMETRY_RECORD_SIZE){
+  Serial.write(record, TELEMETRY_RECORD_SIZE);
+ }
+} 
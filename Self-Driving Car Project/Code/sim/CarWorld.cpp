@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "Firmware.h"
+#include "CarWorld.h"
+
+#define ARC_STEP 0.02             //m between the points of a turn
+#define TRACK_CLOSE_TOLERANCE 0.02
+#define SPEED_OF_SOUND 343.0
+#define ECHO_DELAY 460000         //ns from the end of the trigger pulse to the echo going high, the burst going out
+#define ECHO_TIMEOUT 38000000     //ns the echo stays high when nothing answers
+#define TRIGGER_MIN_TIME 8000     //ns the trigger has to be high for
+#define ULTRASONIC_RAYS 7
+#define OBSTACLE_CLEARANCE 0.3    //m between an obstacle and where a car stuck at it is put back on the line
+
+static const Track *track = NULL;
+static CarConfig config;
+static CarPins pins;
+static CarPose pose;
+static CarWorldStats stats;
+static std::vector<Obstacle> obstacles;
+
+static double targetServoAngle;
+static int motorDirection = 0;    //1 forward, -1 backward, 0 braking
+static int motorPwm = 0;
+static uint64_t triggerRiseTime = 0;
+static bool echoBusy = false;
+
+static double progress = 0;       //Unwrapped, meters
+static double lastLinePosition = 0;
+static uint64_t lapStartTime = 0;
+static bool lapRestarted = false;
+static bool lineLost = false;
+
+static double Radians(double degrees)
+{
+    return degrees * M_PI / 180;
+}
+
+void FinishTrack(Track *track)
+{
+    track->distance.clear();
+    double distance = 0;
+    for(size_t i = 0; i < track->line.size(); i++)
+    {
+        track->distance.push_back(distance);
+        const TrackPoint &a = track->line[i];
+        const TrackPoint &b = track->line[(i + 1) % track->line.size()];
+        distance += hypot(b.x - a.x, b.y - a.y);
+    }
+    track->length = distance;
+}
+
+//Nearest point of the line: how far along it and how far from it.
+static void NearestOnLine(const Track *track, double x, double y, double *along, double *away)
+{
+    double best = INFINITY;
+    size_t amount = track->line.size();
+    for(size_t i = 0; i < amount; i++)
+    {
+        const TrackPoint &a = track->line[i];
+        const TrackPoint &b = track->line[i + 1 < amount ? i + 1 : 0];
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        double length2 = dx * dx + dy * dy;
+        double t = length2 > 0 ? ((x - a.x) * dx + (y - a.y) * dy) / length2 : 0;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        double ex = a.x + t * dx - x;
+        double ey = a.y + t * dy - y;
+        double distance2 = ex * ex + ey * ey;
+        if(distance2 < best)
+        {
+            best = distance2;
+            *along = track->distance[i] + t * sqrt(length2);
+        }
+    }
+    *away = sqrt(best);
+}
+
+static TrackPoint PointOnLine(const Track *track, double along, double *heading)
+{
+    along = fmod(along, track->length);
+    if(along < 0) along += track->length;
+
+    size_t amount = track->line.size();
+    size_t i = 0;
+    while(i + 1 < amount && track->distance[i + 1] <= along) i++;
+    const TrackPoint &a = track->line[i];
+    const TrackPoint &b = track->line[(i + 1) % amount];
+    double length = (i + 1 < amount ? track->distance[i + 1] : track->length) - track->distance[i];
+    double t = length > 0 ? (along - track->distance[i]) / length : 0;
+    *heading = atan2(b.y - a.y, b.x - a.x);
+    return {a.x + t * (b.x - a.x), a.y + t * (b.y - a.y)};
+}
+
+bool LoadTrack(const char *path, Track *track)
+{
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+    {
+        fprintf(stderr, "%s: cant open it\n", path);
+        return false;
+    }
+
+    double x = 0, y = 0, heading = 0;
+    struct PlacedObstacle { double along, radius, offset; };
+    std::vector<PlacedObstacle> placed;
+    char line[256];
+    int lineNumber = 0;
+    bool good = true;
+    *track = Track();
+    track->line.push_back({x, y});
+
+    while(good && fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if(comment) *comment = '\0';
+
+        char command[32];
+        double a = 0, b = 0, c = 0;
+        int fields = sscanf(line, "%31s %lf %lf %lf", command, &a, &b, &c);
+        if(fields <= 0) continue;
+
+        if(strcmp(command, "width") == 0 && fields == 2) track->lineWidth = a;
+        else if(strcmp(command, "start") == 0 && fields == 4)
+        {
+            x = a;
+            y = b;
+            heading = Radians(c);
+            track->startHeading = heading;
+            track->line = {{x, y}};
+        }
+        else if(strcmp(command, "straight") == 0 && fields == 2)
+        {
+            x += a * cos(heading);
+            y += a * sin(heading);
+            track->line.push_back({x, y});
+        }
+        else if(strcmp(command, "turn") == 0 && fields == 3 && a > 0)
+        {
+            double angle = Radians(b);
+            int steps = (int)ceil(fabs(angle) * a / ARC_STEP);
+            double side = angle > 0 ? 1 : -1;
+            double centerX = x - side * a * sin(heading);
+            double centerY = y + side * a * cos(heading);
+            double start = heading;
+            for(int i = 1; i <= steps; i++)
+            {
+                heading = start + angle * i / steps;
+                x = centerX + side * a * sin(heading);
+                y = centerY - side * a * cos(heading);
+                track->line.push_back({x, y});
+            }
+        }
+        else if(strcmp(command, "obstacle") == 0 && fields >= 3) placed.push_back({a, b, fields == 4 ? c : 0});
+        else
+        {
+            fprintf(stderr, "%s:%d: cant make sense of it\n", path, lineNumber);
+            good = false;
+        }
+    }
+    fclose(file);
+    if(!good) return false;
+
+    //The last point should be back at the start.
+    const TrackPoint &first = track->line.front();
+    if(track->line.size() < 3 || hypot(x - first.x, y - first.y) > TRACK_CLOSE_TOLERANCE)
+    {
+        fprintf(stderr, "%s: the line ends at %.3f %.3f, not back at the start\n", path, x, y);
+        return false;
+    }
+    track->line.pop_back();
+    FinishTrack(track);
+
+    for(const PlacedObstacle &obstacle : placed)
+    {
+        double lineHeading;
+        TrackPoint point = PointOnLine(track, obstacle.along, &lineHeading);
+        track->obstacles.push_back({point.x - obstacle.offset * sin(lineHeading), point.y + obstacle.offset * cos(lineHeading), obstacle.radius});
+    }
+    return true;
+}
+
+//Part of a disc the TCRT5000 sees that is over a line of the given width, its middle at the given distance from the line's.
+static double FootprintOverLine(double away)
+{
+    auto below = [](double t) //Part of a unit disc left of x = t
+    {
+        if(t <= -1) return 0.0;
+        if(t >= 1) return 1.0;
+        return (acos(-t) + t * sqrt(1 - t * t)) / M_PI;
+    };
+    double half = track->lineWidth / 2;
+    return below((half - away) / config.footprintRadius) - below((-half - away) / config.footprintRadius);
+}
+
+static void SensorPosition(double side, double *x, double *y)
+{
+    double forward = config.sensorForward;
+    double left = side * config.sensorSpacing / 2;
+    *x = pose.x + forward * cos(pose.heading) - left * sin(pose.heading);
+    *y = pose.y + forward * sin(pose.heading) + left * cos(pose.heading);
+}
+
+static void UpdateLineSensors()
+{
+    double x, y, along, away;
+    SensorPosition(1, &x, &y);
+    NearestOnLine(track, x, y, &along, &away);
+    SimSetPin(pins.leftLineSensor, FootprintOverLine(away) >= config.footprintThreshold ? LOW : HIGH);
+
+    SensorPosition(-1, &x, &y);
+    NearestOnLine(track, x, y, &along, &away);
+    SimSetPin(pins.rightLineSensor, FootprintOverLine(away) >= config.footprintThreshold ? LOW : HIGH);
+}
+
+//Laps and line losses, from where the middle between the sensors is along the line.
+static void UpdateProgress()
+{
+    double x, y, along, away;
+    SensorPosition(0, &x, &y);
+    NearestOnLine(track, x, y, &along, &away);
+
+    double step = along - lastLinePosition;
+    if(step > track->length / 2) step -= track->length;
+    if(step < -track->length / 2) step += track->length;
+    progress += step;
+    lastLinePosition = along;
+
+    if(progress >= (stats.laps + 1) * track->length)
+    {
+        stats.laps++;
+        if(lapRestarted) stats.restartedLaps++;
+        else stats.lapTimes.push_back((SimNow() - lapStartTime) / 1e9);
+        lapStartTime = SimNow();
+        lapRestarted = false;
+    }
+
+    if(!lineLost && away > config.lostLineDistance)
+    {
+        lineLost = true;
+        stats.lineLosses++;
+    }
+    else if(lineLost && away < track->lineWidth / 2)
+    {
+        lineLost = false;
+    }
+}
+
+static void Step(void *argument)
+{
+    double dt = CAR_WORLD_STEP / 1e9;
+
+    double servoStep = config.servoSpeed * dt;
+    double servoError = targetServoAngle - pose.servoAngle;
+    pose.servoAngle += servoError > servoStep ? servoStep : (servoError < -servoStep ? -servoStep : servoError);
+
+    int pwm = motorPwm > config.pwmDeadband ? motorPwm - config.pwmDeadband : 0;
+    double targetSpeed = motorDirection * pwm * config.speedPerPwm;
+    pose.speed += (targetSpeed - pose.speed) * (1 - exp(-dt / config.motorTimeConstant));
+
+    double steering = Radians((pose.servoAngle - config.servoCenter) * config.steeringRatio);
+    pose.x += pose.speed * cos(pose.heading) * dt;
+    pose.y += pose.speed * sin(pose.heading) * dt;
+    pose.heading += pose.speed / config.wheelbase * tan(steering) * dt;
+    stats.distanceDriven += fabs(pose.speed) * dt;
+
+    UpdateLineSensors();
+    UpdateProgress();
+    SimSchedule(SimNow() + CAR_WORLD_STEP, Step, NULL);
+}
+
+//Distance from the HC-SR04 to the nearest obstacle across its beam, infinite if none.
+static double CastUltrasonic()
+{
+    double originX = pose.x + config.ultrasonicForward * cos(pose.heading);
+    double originY = pose.y + config.ultrasonicForward * sin(pose.heading);
+    double nearest = INFINITY;
+
+    for(int ray = 0; ray < ULTRASONIC_RAYS; ray++)
+    {
+        double angle = pose.heading + Radians(config.ultrasonicHalfAngle) * (2.0 * ray / (ULTRASONIC_RAYS - 1) - 1);
+        double dx = cos(angle);
+        double dy = sin(angle);
+        for(const Obstacle &obstacle : obstacles)
+        {
+            double ox = obstacle.x - originX;
+            double oy = obstacle.y - originY;
+            double along = ox * dx + oy * dy;
+            double across2 = ox * ox + oy * oy - along * along;
+            double radius2 = obstacle.radius * obstacle.radius;
+            if(along <= 0 || across2 > radius2) continue;
+            double hit = along - sqrt(radius2 - across2);
+            if(hit > 0 && hit < nearest) nearest = hit;
+        }
+    }
+    return nearest;
+}
+
+static void EchoEdge(void *argument)
+{
+    bool rising = argument != NULL;
+    SimSetPin(pins.echo, rising ? HIGH : LOW);
+    if(!rising) echoBusy = false;
+}
+
+static void Ping()
+{
+    if(echoBusy) return; //The HC-SR04 ignores the trigger while it listens for the last echo
+    echoBusy = true;
+    stats.pings++;
+
+    double distance = CastUltrasonic();
+    uint64_t echoTime = distance <= config.ultrasonicMaxRange ? (uint64_t)(2 * distance / SPEED_OF_SOUND * 1e9) : ECHO_TIMEOUT;
+    SimSchedule(SimNow() + ECHO_DELAY, EchoEdge, (void *)1);
+    SimSchedule(SimNow() + ECHO_DELAY + echoTime, EchoEdge, NULL);
+}
+
+static void PinWritten(uint8_t pin, int level)
+{
+    if(pin == pins.trigger)
+    {
+        if(level == HIGH) triggerRiseTime = SimNow();
+        else if(triggerRiseTime != 0 && SimNow() - triggerRiseTime >= TRIGGER_MIN_TIME) Ping();
+        if(level == LOW) triggerRiseTime = 0;
+    }
+    else if(pin == pins.motorA || pin == pins.motorB)
+    {
+        int a = SimGetPin(pins.motorA);
+        int b = SimGetPin(pins.motorB);
+        motorDirection = a == HIGH && b == LOW ? 1 : (a == LOW && b == HIGH ? -1 : 0);
+    }
+}
+
+static void AnalogWritten(uint8_t pin, int value)
+{
+    if(pin == pins.motorPwm) motorPwm = value;
+}
+
+static void ServoWritten(uint8_t pin, int angle)
+{
+    if(pin == pins.servo) targetServoAngle = angle;
+}
+
+void StartCarWorld(const Track *startTrack, const CarConfig &startConfig)
+{
+    track = startTrack;
+    config = startConfig;
+    pins = GetCarPins();
+    obstacles = track->obstacles;
+
+    //The sensors start over the start of the line.
+    pose = {};
+    pose.heading = track->startHeading;
+    pose.x = track->line[0].x - config.sensorForward * cos(pose.heading);
+    pose.y = track->line[0].y - config.sensorForward * sin(pose.heading);
+    pose.servoAngle = config.servoCenter;
+    targetServoAngle = config.servoCenter;
+    lapStartTime = SimNow();
+
+    SimSetPinHook(PinWritten);
+    SimSetAnalogWriteHook(AnalogWritten);
+    SimSetServoHook(ServoWritten);
+    UpdateLineSensors();
+    SimSchedule(SimNow() + CAR_WORLD_STEP, Step, NULL);
+}
+
+void SetObstacles(const std::vector<Obstacle> &newObstacles)
+{
+    obstacles = newObstacles;
+}
+
+void PutCarBackOnLine()
+{
+    double x, y, along, away, heading;
+    SensorPosition(0, &x, &y);
+    NearestOnLine(track, x, y, &along, &away);
+    TrackPoint point = PointOnLine(track, along, &heading);
+
+    //Past any obstacle it is stuck at.
+    for(bool clear = false; !clear; )
+    {
+        clear = true;
+        for(const Obstacle &obstacle : obstacles)
+        {
+            if(hypot(obstacle.x - point.x, obstacle.y - point.y) < obstacle.radius + OBSTACLE_CLEARANCE) clear = false;
+        }
+        if(!clear)
+        {
+            along += OBSTACLE_CLEARANCE / 4;
+            point = PointOnLine(track, along, &heading);
+        }
+    }
+
+    pose.heading = heading;
+    pose.x = point.x - config.sensorForward * cos(heading);
+    pose.y = point.y - config.sensorForward * sin(heading);
+    pose.speed = 0;
+    lapRestarted = true;
+    lineLost = false;
+    stats.restarts++;
+    UpdateLineSensors();
+}
+
+double CarProgress()
+{
+    return progress;
+}
+
+CarPose GetCarPose()
+{
+    return pose;
+}
+
+const CarWorldStats &GetCarWorldStats()
+{
+    return stats;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Sim.h"
+
+//The track and the car the sketch drives around it. The car is a kinematic bicycle model: the servo turns the front wheels through
+//the steering linkage and the motor PWM sets a speed the car gets to with a lag. The TCRT5000s see the line when enough of
+//their footprint is over it and the HC-SR04 casts a few rays across its beam at the obstacles.
+
+struct TrackPoint
+{
+    double x;
+    double y;
+};
+
+struct Obstacle
+{
+    double x;
+    double y;
+    double radius;
+};
+
+struct Track
+{
+    std::vector<TrackPoint> line;   //Middle of the line, closed: the last point joins the first
+    std::vector<double> distance;   //Along the line up to each point
+    double length = 0;
+    double lineWidth = 0.05;
+    double startHeading = 0;        //Radians
+    std::vector<Obstacle> obstacles;
+};
+
+//A track file has one command a line, distances in meters and angles in degrees, # starts a comment:
+//  width 0.05                   line width
+//  start x y heading            where the line and the car start
+//  straight length
+//  turn radius degrees          positive turns left
+//  obstacle distance radius [offset]  on the line that far from the start, offset to the left of it
+bool LoadTrack(const char *path, Track *track); //Complains on stderr and returns false if the file is bad or the line doesnt close.
+void FinishTrack(Track *track); //Works out the distances of a track built in code.
+
+struct CarConfig
+{
+    double wheelbase = 0.16;
+    double servoCenter = 130;         //Servo angle the front wheels are straight at
+    double steeringRatio = 0.5;       //Degrees of front wheel per degree of servo, 27.5 at servoHighLeft
+    double servoSpeed = 600;          //Degrees a second
+    double speedPerPwm = 0.0075;      //m/s per PWM step above the deadband, 0.15 at maxSpeed
+    int pwmDeadband = 5;
+    double motorTimeConstant = 0.2;   //Seconds
+    double sensorForward = 0.14;      //TCRT5000s ahead of the rear axle
+    double sensorSpacing = 0.03;      //Between the two TCRT5000s
+    double footprintRadius = 0.005;
+    double footprintThreshold = 0.5;  //Part of the footprint over the line for the TCRT5000 to see it
+    double ultrasonicForward = 0.18;  //HC-SR04 ahead of the rear axle
+    double ultrasonicHalfAngle = 15;  //Degrees
+    double ultrasonicMaxRange = 4.0;
+    double lostLineDistance = 0.1;    //Sensors further than this from the middle of the line count as a line loss
+};
+
+struct CarPose
+{
+    double x;                         //Middle of the rear axle
+    double y;
+    double heading;                   //Radians
+    double speed;
+    double servoAngle;
+};
+
+struct CarWorldStats
+{
+    std::vector<double> lapTimes;     //Seconds, laps the car wasnt put back on the line in only
+    int laps = 0;
+    int restartedLaps = 0;
+    int lineLosses = 0;
+    int restarts = 0;
+    double distanceDriven = 0;
+    uint64_t pings = 0;
+};
+
+#define CAR_WORLD_STEP 500000 //ns
+
+void StartCarWorld(const Track *track, const CarConfig &config); //Puts the car at the start and hooks into the simulator.
+void SetObstacles(const std::vector<Obstacle> &obstacles);
+void PutCarBackOnLine();        //Where the line is nearest to the sensors, or past the obstacle there, heading along it and standing still
+double CarProgress();           //Meters along the line since the start, laps included
+CarPose GetCarPose();
+const CarWorldStats &GetCarWorldStats();
@@ -0,0 +1,30 @@
+//Compiles the sketch for the host. The Makefile turns TurboInc.ino into CAR_SKETCH first the way the Arduino IDE does, with the
+//constants of TUNING overridden.
+#include CAR_SKETCH
+#include "Firmware.h"
+
+CarPins GetCarPins()
+{
+    return {tcrtLeftPin, tcrtRightPin, trigPin, echoPin, servoPin, MOTOR_A1_PIN, MOTOR_B1_PIN, PWM_MOTOR_1};
+}
+
+bool CarFindingLine()
+{
+    return maneuverState.maneuver == &findLine;
+}
+
+bool CarGoingAroundObstacle()
+{
+    return maneuverState.maneuver == &goAroundObstacle;
+}
+
+bool CarStopped()
+{
+    return carState.stateName == Stop;
+}
+
+void RestartCar()
+{
+    maneuverState.maneuver = NULL;
+    PrepareCarState(Forward, CCW, 0, servoNeutral, true);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+//What the benchmarks get to see of the sketch compiled in Firmware.cpp.
+struct CarPins
+{
+    uint8_t leftLineSensor;
+    uint8_t rightLineSensor;
+    uint8_t trigger;
+    uint8_t echo;
+    uint8_t servo;
+    uint8_t motorA;         //HIGH with motorB LOW drives forward (CCW)
+    uint8_t motorB;
+    uint8_t motorPwm;
+};
+
+CarPins GetCarPins();
+bool CarFindingLine();
+bool CarGoingAroundObstacle();
+bool CarStopped();          //FindLine() gave up
+void RestartCar();          //Back to following the line, like after someone put the car back on it and reset it
+long GetDistanceToObstacle();
@@ -0,0 +1,169 @@
+//Drives the car round each track for the given number of laps and reports the lap times, how often the car lost the line and how
+//fast loop() goes. Every track runs in a process of its own, so they all run at once on as many cores as there are. A car
+//FindLine() gave up on, or that got nowhere for STUCK_TIME, is put back on the line and that lap doesnt count.
+//The telemetry the car sent goes to <track>.telemetry next to the benchmark, for ../tools/TelemetryDecode.py.
+//Usage: LapBench [laps] [track ...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Sim.h"
+#include "Firmware.h"
+#include "CarWorld.h"
+
+#define MS 1000000ULL
+#define CHECK_INTERVAL (10 * MS)
+#define STUCK_TIME (10000 * MS)
+#define MAX_LAP_TIME (300000 * MS)
+
+static const char *defaultTracks[] = {"tracks/Oval.txt", "tracks/Chicanes.txt", "tracks/Obstacle.txt"};
+static FILE *telemetry = NULL;
+
+static void TelemetryByte(uint8_t c)
+{
+    fputc(c, telemetry);
+}
+
+static double HostSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static std::string TrackName(const char *path)
+{
+    std::string name = path;
+    name = name.substr(name.find_last_of('/') + 1);
+    return name.substr(0, name.find('.'));
+}
+
+//Runs in a child process, the simulator has one car and one sketch per process.
+static std::string RunTrack(const char *path, int laps, const std::string &telemetryPath)
+{
+    Track track;
+    if(!LoadTrack(path, &track)) exit(1);
+
+    telemetry = fopen(telemetryPath.c_str(), "wb");
+    if(telemetry) SimSetSerialHook(TelemetryByte);
+
+    CarConfig config;
+    StartCarWorld(&track, config);
+
+    double hostStart = HostSeconds();
+    int findLineRuns = 0;
+    int obstacleRuns = 0;
+    int stops = 0;
+    int stuck = 0;
+    bool findingLine = false;
+    bool goingAround = false;
+    double bestProgress = 0;
+    uint64_t progressTime = 0;
+
+    while(GetCarWorldStats().laps < laps && SimNow() < laps * MAX_LAP_TIME)
+    {
+        SimRunSketch(CHECK_INTERVAL);
+
+        findLineRuns += CarFindingLine() && !findingLine;
+        findingLine = CarFindingLine();
+        obstacleRuns += CarGoingAroundObstacle() && !goingAround;
+        goingAround = CarGoingAroundObstacle();
+
+        if(CarProgress() > bestProgress)
+        {
+            bestProgress = CarProgress();
+            progressTime = SimNow();
+        }
+
+        bool stopped = CarStopped();
+        if(stopped || SimNow() - progressTime > STUCK_TIME)
+        {
+            stops += stopped;
+            stuck += !stopped;
+            PutCarBackOnLine();
+            RestartCar();
+            bestProgress = CarProgress();
+            progressTime = SimNow();
+        }
+    }
+    if(telemetry) fclose(telemetry);
+
+    const CarWorldStats &stats = GetCarWorldStats();
+    std::vector<double> times = stats.lapTimes;
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for(double time : times) total += time;
+    double simulated = SimNow() / 1e9;
+    double host = HostSeconds() - hostStart;
+
+    char report[2048];
+    int length = snprintf(report, sizeof(report), "%s: %.2f m, %d laps, %d put back on the line\n", path, track.length, stats.laps, stats.restartedLaps);
+    if(!times.empty())
+    {
+        length += snprintf(report + length, sizeof(report) - length, "  lap time              p50 %.2f s, best %.2f s, worst %.2f s, %.2f m/s on average\n",
+                           times[times.size() / 2], times.front(), times.back(), track.length * times.size() / total);
+    }
+    length += snprintf(report + length, sizeof(report) - length,
+                       "  line losses           %d (%.2f a lap), FindLine %d times, around an obstacle %d times, %d stops, %d stuck\n",
+                       stats.lineLosses, stats.laps ? (double)stats.lineLosses / stats.laps : 0.0, findLineRuns, obstacleRuns, stops, stuck);
+    length += snprintf(report + length, sizeof(report) - length, "  loop()                %.0f a second, p50 %.0f us, p99 %.0f us, max %.2f ms\n",
+                       simStats.loopIterations / simulated, simStats.loopDuration.Percentile(50) / 1e3,
+                       simStats.loopDuration.Percentile(99) / 1e3, simStats.loopDuration.Max() / 1e6);
+    length += snprintf(report + length, sizeof(report) - length, "  line sensor -> servo  p50 %.0f us, p99 %.0f us, max %.2f ms\n",
+                       simStats.inputToServo.Percentile(50) / 1e3, simStats.inputToServo.Percentile(99) / 1e3, simStats.inputToServo.Max() / 1e6);
+    length += snprintf(report + length, sizeof(report) - length, "  %.0f s simulated in %.1f s, %.0fx real time\n", simulated, host, simulated / host);
+
+    //One line for Sweep.sh to pick up.
+    snprintf(report + length, sizeof(report) - length, "summary %s laps %d lapP50 %.2f best %.2f losses %d restarts %d loopP99 %.0f\n",
+             TrackName(path).c_str(), stats.laps, times.empty() ? 0.0 : times[times.size() / 2], times.empty() ? 0.0 : times.front(),
+             stats.lineLosses, stats.restarts, simStats.loopDuration.Percentile(99) / 1e3);
+    return report;
+}
+
+int main(int argc, char **argv)
+{
+    int laps = argc > 1 ? atoi(argv[1]) : 20;
+    std::vector<const char *> tracks(argv + std::min(argc, 2), argv + argc);
+    if(tracks.empty()) tracks.assign(std::begin(defaultTracks), std::end(defaultTracks));
+
+    std::string directory = argv[0];
+    directory = directory.substr(0, directory.find_last_of('/') + 1);
+
+    std::vector<std::pair<pid_t, int>> children;
+    for(const char *track : tracks)
+    {
+        int pipeEnds[2];
+        if(pipe(pipeEnds) != 0) return 1;
+        fflush(stdout);
+        pid_t child = fork();
+        if(child == 0)
+        {
+            close(pipeEnds[0]);
+            std::string report = RunTrack(track, laps, directory + TrackName(track) + ".telemetry");
+            if(write(pipeEnds[1], report.data(), report.size()) < 0) _exit(1);
+            _exit(0);
+        }
+        close(pipeEnds[1]);
+        children.push_back({child, pipeEnds[0]});
+    }
+
+    bool passed = true;
+    for(auto &child : children)
+    {
+        char buffer[4096];
+        ssize_t length;
+        while((length = read(child.second, buffer, sizeof(buffer))) > 0) fwrite(buffer, 1, length, stdout);
+        close(child.second);
+
+        int status;
+        waitpid(child.first, &status, 0);
+        passed &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return passed ? 0 : 1;
+}
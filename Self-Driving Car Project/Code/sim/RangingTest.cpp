@@ -0,0 +1,83 @@
+//Holds the car still in front of an obstacle at a few distances and checks that the sketch ranges it from the echo interrupt
+//within the HC-SR04s centimeter and the speed of sound, that anything past ultrasonicMaxDistance or nothing at all reads as
+//ultrasonicMaxDistance + 1, and that loop() never waits for an echo while it does.
+//Usage: RangingTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "Firmware.h"
+#include "CarWorld.h"
+
+#define MS 1000000ULL
+#define SETTLE_TIME (200 * MS)    //A few pings for the new distance to come in
+#define READINGS 20
+#define MAX_LOOP_TIME (1 * MS)
+#define OUT_OF_RANGE 201          //ultrasonicMaxDistance + 1
+
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+//An obstacle straight ahead of the HC-SR04 with its near side the given distance away, or none for a negative distance.
+static void PlaceObstacle(const CarConfig &config, double distance)
+{
+    const double radius = 0.05;
+    std::vector<Obstacle> obstacles;
+    CarPose pose = GetCarPose();
+    if(distance >= 0)
+    {
+        double away = config.ultrasonicForward + distance + radius;
+        obstacles.push_back({pose.x + away * cos(pose.heading), pose.y + away * sin(pose.heading), radius});
+    }
+    SetObstacles(obstacles);
+}
+
+//Every reading over a while, checked against what the HC-SR04 should give.
+static void Range(const CarConfig &config, int centimeters)
+{
+    PlaceObstacle(config, centimeters / 100.0);
+    SimRunSketch(SETTLE_TIME);
+
+    long expected = centimeters < 0 || centimeters > 200 ? OUT_OF_RANGE : centimeters;
+    long tolerance = expected == OUT_OF_RANGE ? 0 : 1 + expected / 50;
+    long worst = 0;
+    for(int i = 0; i < READINGS; i++)
+    {
+        SimRunSketch(17 * MS);
+        long error = labs(GetDistanceToObstacle() - expected);
+        if(error > worst) worst = error;
+    }
+
+    char description[80];
+    if(centimeters < 0) snprintf(description, sizeof(description), "no obstacle reads %d cm", OUT_OF_RANGE);
+    else snprintf(description, sizeof(description), "obstacle at %d cm reads %ld cm, off by %ld at most", centimeters, expected, worst);
+    Check(worst <= tolerance, description);
+}
+
+int main(int argc, char **argv)
+{
+    Track track;
+    if(!LoadTrack("tracks/Oval.txt", &track)) return 1;
+
+    //The motor doesnt move the car, so the obstacle stays where it is put whatever the sketch does about it.
+    CarConfig config;
+    config.speedPerPwm = 0;
+    StartCarWorld(&track, config);
+    SimRunSketch(SETTLE_TIME);
+
+    printf("ranging\n");
+    const int distances[] = {10, 30, 100, 190, 300, -1};
+    for(int centimeters : distances) Range(config, centimeters);
+
+    printf("  %llu pings, loop() max %.2f ms\n", (unsigned long long)GetCarWorldStats().pings, simStats.loopDuration.Max() / 1e6);
+    Check(simStats.loopDuration.Max() < MAX_LOOP_TIME, "loop() never waits for an echo");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
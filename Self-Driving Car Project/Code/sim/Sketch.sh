@@ -0,0 +1,25 @@
+#!/bin/bash
+#Turns the sketch into C++ the way the Arduino IDE does: Arduino.h first and every function declared before the first one. The
+#constants given as NAME=VALUE are overridden on the way, for parameter sweeps (see Sweep.sh).
+#Usage: Sketch.sh sketch.ino ["NAME=VALUE ..."] > sketch.cpp
+sketch="$1"
+text=$(tr -d '\r' < "$sketch") || exit 1
+
+for setting in $2; do
+    name=${setting%%=*}
+    value=${setting#*=}
+    if ! grep -qE "^const [A-Za-z ]* $name *=" <<< "$text"; then
+        echo "Sketch.sh: no constant $name in $sketch" >&2
+        exit 1
+    fi
+    text=$(sed -E "s/^(const [A-Za-z ]* $name *= *)[^;]*;/\1$value;/" <<< "$text")
+done
+
+function='^[A-Za-z_][A-Za-z0-9_ ]* \**[A-Za-z_][A-Za-z0-9_]*\([^;]*\) *\{'
+prototypes=$(grep -E "$function" <<< "$text" | sed -E 's/ *\{.*$/;/')
+
+echo '#include "Arduino.h"'
+echo "#line 1 \"$sketch\""
+awk -v pattern="$function" -v prototypes="$prototypes" -v sketch="$sketch" '
+    !declared && $0 ~ pattern { print prototypes; print "#line " NR " \"" sketch "\""; declared = 1 }
+    { print }' <<< "$text"
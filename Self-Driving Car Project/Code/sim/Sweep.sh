@@ -0,0 +1,22 @@
+#!/bin/bash
+#Builds the sketch once for every tuning given, each into a build directory of its own, and drives them all round the tracks at
+#once on every core. Prints the LapBench summary line of every track after the tuning it came from.
+#Usage: Sweep.sh laps "NAME=VALUE ..." ["NAME=VALUE ..." ...]
+#  Sweep.sh 10 "maxSpeed=25" "maxSpeed=30" "maxSpeed=35 lowSpeed=25"
+laps="$1"
+shift
+if [ -z "$laps" ] || [ $# -eq 0 ]; then
+    echo "Usage: Sweep.sh laps \"NAME=VALUE ...\" [\"NAME=VALUE ...\" ...]" >&2
+    exit 1
+fi
+
+jobs=$(nproc)
+number=0
+for tuning in "$@"; do
+    echo "$number $tuning"
+    number=$((number + 1))
+done | xargs -P "$jobs" -L 1 bash -c '
+    build=build/sweep/$0
+    tuning="$*"
+    make -s BUILD=$build TUNING="$tuning" $build/LapBench >&2 || exit 255
+    ./$build/LapBench '"$laps"' | sed -n "s/^summary /$tuning: /p"'
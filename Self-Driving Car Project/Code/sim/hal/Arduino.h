@@ -0,0 +1,94 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//Host stand-in for the Arduino AVR core on an Uno. Every call ends up in the simulator (Sim.h) which charges its cost in
+//simulated time.
+#include "HardwareSerial.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(pin) ((pin) == 2 ? 0 : ((pin) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+//The core has these as macros that take any two types, templates do the same without breaking std::min and std::max.
+template<typename A, typename B> inline auto min(A a, B b) { return a < b ? a : b; }
+template<typename A, typename B> inline auto max(A a, B b) { return a < b ? b : a; }
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void attachInterrupt(uint8_t interruptNumber, void (*handler)(), int mode);
+void detachInterrupt(uint8_t interruptNumber);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void noInterrupts();
+void interrupts();
+
+//Timer2, the only timer a sketch can have to itself: Timer0 is millis() and Timer1 the Servo library. Only CTC mode with the
+//compare A interrupt is simulated.
+extern volatile uint8_t TCCR2A;
+extern volatile uint8_t TCCR2B;
+extern volatile uint8_t OCR2A;
+extern volatile uint8_t TIMSK2;
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define OCIE2A 1
+#define _BV(bit) (1 << (bit))
+
+//The I/O port registers, for code that skips digitalWrite() and digitalRead(). Port B is pins 8-13, C is A0-A5 and D is 0-7.
+//Writing PORTx sets what the output pins of the port drive, reading it gives that back. Reading PINx gives the level of every
+//pin of the port and writing it toggles the output pins whose bits are 1. DDRx is only stored, pinMode() sets the direction.
+class SimPortRegister
+{
+public:
+    SimPortRegister(uint8_t firstPin, uint8_t pinAmount, bool input) : firstPin(firstPin), pinAmount(pinAmount), input(input) {}
+    SimPortRegister &operator=(uint8_t value);
+    SimPortRegister &operator|=(uint8_t bits) { return *this = *this | bits; }
+    SimPortRegister &operator&=(uint8_t bits) { return *this = *this & bits; }
+    operator uint8_t() const;
+
+private:
+    uint8_t firstPin;
+    uint8_t pinAmount;
+    bool input;
+};
+
+extern SimPortRegister PORTB, PORTC, PORTD;
+extern SimPortRegister PINB, PINC, PIND;
+extern volatile uint8_t DDRB, DDRC, DDRD;
+
+#define ISR(vector, ...) extern "C" void vector()
+extern "C" void TIMER2_COMPA_vect();
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+//The Servo library. Writes go to the hook set with SimSetServoHook().
+class Servo
+{
+public:
+    uint8_t attach(int pin);
+    uint8_t attach(int pin, int minimum, int maximum);
+    void detach();
+    void write(int value);
+    int read();
+    bool attached();
+
+private:
+    int pin = -1;
+    int angle = 90;
+};
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <queue>
+#include <vector>
+#include "Arduino.h"
+#include "Servo.h"
+#include "Sim.h"
+
+#define TIMER0_OVERFLOW_TIME 1024000 //ns, 256 counts of 4us
+
+SimCosts simCosts;
+SimStats simStats;
+HardwareSerial Serial;
+
+volatile uint8_t TCCR2A = 0;
+volatile uint8_t TCCR2B = 0;
+volatile uint8_t OCR2A = 0;
+volatile uint8_t TIMSK2 = 0;
+
+SimPortRegister PORTB(8, 6, false);
+SimPortRegister PORTC(A0, 6, false);
+SimPortRegister PORTD(0, 8, false);
+SimPortRegister PINB(8, 6, true);
+SimPortRegister PINC(A0, 6, true);
+SimPortRegister PIND(0, 8, true);
+volatile uint8_t DDRB = 0;
+volatile uint8_t DDRC = 0;
+volatile uint8_t DDRD = 0;
+
+void setup();
+void loop();
+
+struct HardwareEvent
+{
+    uint64_t time;
+    uint64_t sequence;
+    void (*handler)(void *argument);
+    void *argument;
+
+    bool operator>(const HardwareEvent &other) const
+    {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+static uint64_t now = 0;
+static std::priority_queue<HardwareEvent, std::vector<HardwareEvent>, std::greater<HardwareEvent>> events;
+static uint64_t nextEventSequence = 0;
+static std::vector<void (*)()> pendingInterrupts; //In the order they were raised
+static bool interruptsEnabled = true;
+static bool inInterrupt = false;
+static bool stopRequested = false;
+static bool sketchStarted = false;
+
+static uint8_t pinLevels[SIM_PIN_COUNT];
+static bool pinOutputs[SIM_PIN_COUNT];
+static uint8_t pinLatches[SIM_PIN_COUNT];   //What PORTx holds for the pin
+static void (*pinInterrupts[SIM_PIN_COUNT])();
+static int pinInterruptModes[SIM_PIN_COUNT];
+static uint64_t pinChangeTimes[SIM_PIN_COUNT]; //First change of a polled input the sketch didnt read yet, 0 if none
+static std::vector<uint64_t> readChangeTimes;  //Changes the sketch read but no servo write followed yet
+static void (*pinHook)(uint8_t pin, int level) = NULL;
+static void (*analogWriteHook)(uint8_t pin, int value) = NULL;
+static void (*servoHook)(uint8_t pin, int angle) = NULL;
+static void (*serialHook)(uint8_t c) = NULL;
+
+static bool timer2Running = false;
+static uint64_t timer2Time = 0;
+
+static uint8_t serialRing[SIM_SERIAL_BUFFER_SIZE];
+static int serialHead = 0;
+static int serialCount = 0;
+static bool serialSending = false;
+static uint64_t serialByteTime = 10000000000ULL / 9600; //10 bits a byte
+
+static void RunInterrupts()
+{
+    while(interruptsEnabled && !inInterrupt && !pendingInterrupts.empty())
+    {
+        void (*handler)() = pendingInterrupts.front();
+        pendingInterrupts.erase(pendingInterrupts.begin());
+
+        uint64_t start = now;
+        inInterrupt = true;
+        SimCharge(simCosts.interruptEntry);
+        handler();
+        SimCharge(simCosts.interruptExit);
+        inInterrupt = false;
+        simStats.interrupts++;
+        simStats.interruptTime += now - start;
+    }
+}
+
+uint64_t SimNow()
+{
+    return now;
+}
+
+//Hardware events that become due inside the charged time run at their own time, and the interrupts they raise push the rest of
+//the charged work back.
+void SimCharge(uint64_t ns)
+{
+    uint64_t left = ns;
+    while(!events.empty() && events.top().time <= now + left)
+    {
+        HardwareEvent event = events.top();
+        events.pop();
+        if(event.time > now)
+        {
+            left -= event.time - now;
+            now = event.time;
+        }
+        event.handler(event.argument);
+        RunInterrupts();
+    }
+    now += left;
+}
+
+void SimSchedule(uint64_t time, void (*handler)(void *argument), void *argument)
+{
+    events.push({time, nextEventSequence++, handler, argument});
+}
+
+void SimRaiseInterrupt(void (*handler)())
+{
+    pendingInterrupts.push_back(handler);
+}
+
+//Timer0 keeps millis() going, which costs the sketch a little every 1.024ms.
+static void Timer0Interrupt()
+{
+    SimCharge(simCosts.timer0Interrupt);
+}
+
+static void Timer0Overflow(void *argument)
+{
+    SimRaiseInterrupt(Timer0Interrupt);
+    SimSchedule(SimNow() + TIMER0_OVERFLOW_TIME, Timer0Overflow, NULL);
+}
+
+extern "C" __attribute__((weak)) void TIMER2_COMPA_vect()
+{
+}
+
+static uint64_t Timer2Period()
+{
+    static const uint32_t prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+    uint32_t prescaler = prescalers[TCCR2B & 0x07];
+    bool enabled = (TCCR2A & _BV(WGM21)) && (TIMSK2 & _BV(OCIE2A)) && prescaler != 0;
+    return enabled ? (uint64_t)(OCR2A + 1) * prescaler * 1000 / SIM_CPU_MHZ : 0;
+}
+
+static void Timer2Compare(void *argument)
+{
+    uint64_t period = Timer2Period();
+    if(period == 0)
+    {
+        timer2Running = false;
+        return;
+    }
+    SimRaiseInterrupt(TIMER2_COMPA_vect);
+    timer2Time += period;
+    SimSchedule(timer2Time, Timer2Compare, NULL);
+}
+
+//Called whenever the sketch could have set the timer up.
+static void CheckTimer2()
+{
+    uint64_t period = Timer2Period();
+    if(timer2Running || period == 0) return;
+    timer2Running = true;
+    timer2Time = now + period;
+    SimSchedule(timer2Time, Timer2Compare, NULL);
+}
+
+void SimRunSketch(uint64_t duration)
+{
+    uint64_t end = now + duration;
+    stopRequested = false;
+
+    if(!sketchStarted)
+    {
+        sketchStarted = true;
+        SimSchedule(now + TIMER0_OVERFLOW_TIME, Timer0Overflow, NULL);
+        setup();
+        CheckTimer2();
+    }
+
+    while(!stopRequested && now < end)
+    {
+        uint64_t start = now;
+        SimCharge(simCosts.loopOverhead);
+        loop();
+        simStats.loopDuration.Record(now - start);
+        simStats.loopIterations++;
+    }
+}
+
+void SimStop()
+{
+    stopRequested = true;
+}
+
+static void WritePin(uint8_t pin, uint8_t level)
+{
+    pinLatches[pin] = level;
+    pinLevels[pin] = level;
+    if(pinHook != NULL) pinHook(pin, level);
+}
+
+static int ReadPin(uint8_t pin)
+{
+    if(pinChangeTimes[pin] != 0)
+    {
+        readChangeTimes.push_back(pinChangeTimes[pin]);
+        pinChangeTimes[pin] = 0;
+    }
+    return pinLevels[pin];
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    SimCharge(simCosts.pinMode);
+    if(pin < SIM_PIN_COUNT) pinOutputs[pin] = mode == OUTPUT;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    SimCharge(simCosts.digitalWrite);
+    if(pin >= SIM_PIN_COUNT) return;
+    WritePin(pin, value ? HIGH : LOW);
+}
+
+int digitalRead(uint8_t pin)
+{
+    SimCharge(simCosts.digitalRead);
+    if(pin >= SIM_PIN_COUNT) return LOW;
+    return ReadPin(pin);
+}
+
+SimPortRegister &SimPortRegister::operator=(uint8_t value)
+{
+    SimCharge(simCosts.portRegister);
+    for(int bit = 0; bit < pinAmount; bit++)
+    {
+        uint8_t pin = firstPin + bit;
+        uint8_t level = input ? pinLatches[pin] ^ ((value >> bit) & 1) : (value >> bit) & 1;
+        if(level == pinLatches[pin]) continue;
+        if(pinOutputs[pin]) WritePin(pin, level);
+        else pinLatches[pin] = level; //The pull-up, which isnt simulated
+    }
+    return *this;
+}
+
+SimPortRegister::operator uint8_t() const
+{
+    SimCharge(simCosts.portRegister);
+    uint8_t value = 0;
+    for(int bit = 0; bit < pinAmount; bit++)
+    {
+        uint8_t pin = firstPin + bit;
+        if(input ? ReadPin(pin) : pinLatches[pin]) value |= 1 << bit;
+    }
+    return value;
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+    SimCharge(simCosts.analogWrite);
+    if(analogWriteHook != NULL) analogWriteHook(pin, constrain(value, 0, 255));
+}
+
+static int InterruptPin(uint8_t interruptNumber)
+{
+    return interruptNumber == 0 ? 2 : (interruptNumber == 1 ? 3 : -1);
+}
+
+void attachInterrupt(uint8_t interruptNumber, void (*handler)(), int mode)
+{
+    int pin = InterruptPin(interruptNumber);
+    if(pin < 0) return;
+    pinInterrupts[pin] = handler;
+    pinInterruptModes[pin] = mode;
+}
+
+void detachInterrupt(uint8_t interruptNumber)
+{
+    int pin = InterruptPin(interruptNumber);
+    if(pin >= 0) pinInterrupts[pin] = NULL;
+}
+
+unsigned long millis()
+{
+    SimCharge(simCosts.timeRead);
+    return now / 1000000;
+}
+
+unsigned long micros()
+{
+    SimCharge(simCosts.timeRead);
+    return now / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    SimCharge((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    SimCharge((uint64_t)us * 1000);
+}
+
+void noInterrupts()
+{
+    interruptsEnabled = false;
+}
+
+void interrupts()
+{
+    interruptsEnabled = true;
+    CheckTimer2();
+    RunInterrupts();
+}
+
+void SimSetPin(uint8_t pin, int level)
+{
+    if(pin >= SIM_PIN_COUNT || pinLevels[pin] == level) return;
+    pinLevels[pin] = level;
+
+    if(pinInterrupts[pin] != NULL)
+    {
+        int mode = pinInterruptModes[pin];
+        if(mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) SimRaiseInterrupt(pinInterrupts[pin]);
+    }
+    else if(pinChangeTimes[pin] == 0)
+    {
+        pinChangeTimes[pin] = now;
+    }
+}
+
+int SimGetPin(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+void SimSetPinHook(void (*hook)(uint8_t pin, int level))
+{
+    pinHook = hook;
+}
+
+void SimSetAnalogWriteHook(void (*hook)(uint8_t pin, int value))
+{
+    analogWriteHook = hook;
+}
+
+void SimSetServoHook(void (*hook)(uint8_t pin, int angle))
+{
+    servoHook = hook;
+}
+
+void SimSetSerialHook(void (*hook)(uint8_t c))
+{
+    serialHook = hook;
+}
+
+uint8_t Servo::attach(int pin)
+{
+    return attach(pin, 544, 2400);
+}
+
+uint8_t Servo::attach(int pin, int minimum, int maximum)
+{
+    this->pin = pin;
+    return 0;
+}
+
+void Servo::detach()
+{
+    pin = -1;
+}
+
+//Everything the sketch read from a polled input since the last servo write has now been acted on.
+void Servo::write(int value)
+{
+    SimCharge(simCosts.servoWrite);
+    angle = constrain(value, 0, 180);
+
+    for(uint64_t changeTime : readChangeTimes) simStats.inputToServo.Record(now - changeTime);
+    readChangeTimes.clear();
+
+    if(servoHook != NULL && pin >= 0) servoHook(pin, angle);
+}
+
+int Servo::read()
+{
+    return angle;
+}
+
+bool Servo::attached()
+{
+    return pin >= 0;
+}
+
+//The data register empty interrupt moving the next byte out.
+static void SerialInterrupt()
+{
+    SimCharge(simCosts.serialInterrupt);
+}
+
+static void SerialByteSent(void *argument)
+{
+    uint8_t c = serialRing[serialHead];
+    serialHead = (serialHead + 1) % SIM_SERIAL_BUFFER_SIZE;
+    serialCount--;
+    simStats.serialBytes++;
+    if(serialHook != NULL) serialHook(c);
+
+    SimRaiseInterrupt(SerialInterrupt);
+    serialSending = serialCount > 0;
+    if(serialSending) SimSchedule(SimNow() + serialByteTime, SerialByteSent, NULL);
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    serialByteTime = 10000000000ULL / baud;
+}
+
+void HardwareSerial::flush()
+{
+    while(serialCount > 0) SimCharge(1000);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    SimCharge(simCosts.serialByte);
+
+    uint64_t start = now;
+    while(serialCount >= SIM_SERIAL_BUFFER_SIZE - 1) SimCharge(1000);
+    simStats.serialWaitTime += now - start;
+
+    serialRing[(serialHead + serialCount) % SIM_SERIAL_BUFFER_SIZE] = c;
+    serialCount++;
+    if(!serialSending)
+    {
+        serialSending = true;
+        SimSchedule(now + serialByteTime, SerialByteSent, NULL);
+    }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    for(size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return SIM_SERIAL_BUFFER_SIZE - 1 - serialCount;
+}
+
+size_t HardwareSerial::print(const char text[])
+{
+    return write((const uint8_t *)text, strlen(text));
+}
+
+size_t HardwareSerial::print(long number)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", number);
+    return print(text);
+}
+
+size_t HardwareSerial::println(const char text[])
+{
+    return print(text) + println();
+}
+
+size_t HardwareSerial::println(long number)
+{
+    return print(number) + println();
+}
+
+size_t HardwareSerial::println()
+{
+    return print("\r\n");
+}
+
+static int BucketIndex(uint64_t value)
+{
+    if(value < 64) return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (int)((value >> (msb - 5)) & 31);
+    return 64 + (msb - 6) * 32 + sub;
+}
+
+static uint64_t BucketValue(int index)
+{
+    if(index < 64) return index;
+
+    int msb = (index - 64) / 32 + 6;
+    uint64_t sub = (index - 64) % 32;
+    return (1ULL << msb) | (sub << (msb - 5));
+}
+
+void SimHistogram::Record(uint64_t value)
+{
+    buckets[BucketIndex(value)]++;
+    count++;
+    if(value > maximum) maximum = value;
+}
+
+uint64_t SimHistogram::Percentile(double percent) const
+{
+    if(count == 0) return 0;
+
+    uint64_t target = (uint64_t)(percent / 100.0 * count + 0.5);
+    if(target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if(seen >= target) return std::min(BucketValue(i), maximum);
+    }
+    return maximum;
+}
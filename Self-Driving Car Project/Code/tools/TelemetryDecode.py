@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Decodes the car's telemetry (see SendTelemetry() in TurboInc.ino) into CSV, one line per record. Reads a capture file, or the
+# serial port itself if pyserial is installed. Bytes that dont make up a record with a good checksum are skipped, and records the
+# car dropped because its TX buffer was full show up in the dropped column.
+# Usage: TelemetryDecode.py capture|/dev/ttyUSB0 [out.csv]
+import sys
+
+SYNC = 0xA5
+RECORD_SIZE = 12
+BAUD_RATE = 115200
+
+STATES = ["Stop", "Forward", "SlightRT", "SlightLT", "SharpRT", "SharpLT"]
+DIRECTIONS = ["BRAKE", "CW", "CCW"]
+
+
+def Records(data):
+    position = 0
+    while position + RECORD_SIZE <= len(data):
+        record = data[position:position + RECORD_SIZE]
+        if record[0] != SYNC or sum(record[:-1]) & 0xFF != record[-1]:
+            position += 1
+            continue
+        position += RECORD_SIZE
+        yield record, position
+
+
+def Decode(record):
+    flags = record[6]
+    state = flags >> 4
+    direction = record[9]
+    return {
+        "sequence": record[1],
+        "time_ms": int.from_bytes(record[2:6], "little"),
+        "left_on_line": flags & 1,
+        "right_on_line": flags >> 1 & 1,
+        "maneuver": flags >> 2 & 1,
+        "state": STATES[state] if state < len(STATES) else state,
+        "distance_cm": record[7],
+        "servo": record[8],
+        "motor_direction": DIRECTIONS[direction] if direction < len(DIRECTIONS) else direction,
+        "motor_pwm": record[10],
+    }
+
+
+def Read(source):
+    if source.startswith("/dev/") or source.upper().startswith("COM"):
+        import serial
+        port = serial.Serial(source, BAUD_RATE)
+        data = bytearray()
+        try:
+            while True:
+                data += port.read(max(1, port.in_waiting))
+                yield data
+        except KeyboardInterrupt:
+            return
+    with open(source, "rb") as capture:
+        yield bytearray(capture.read())
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: TelemetryDecode.py capture|/dev/ttyUSB0 [out.csv]", file=sys.stderr)
+        return 1
+    out = open(sys.argv[2], "w") if len(sys.argv) > 2 else sys.stdout
+
+    columns = ["time_ms", "dropped", "left_on_line", "right_on_line", "maneuver", "state", "distance_cm", "servo",
+               "motor_direction", "motor_pwm"]
+    print(",".join(columns), file=out)
+
+    lastSequence = None
+    for data in Read(sys.argv[1]):
+        used = 0
+        for record, end in Records(data):
+            values = Decode(record)
+            values["dropped"] = 0 if lastSequence is None else (values["sequence"] - lastSequence - 1) & 0xFF
+            lastSequence = values["sequence"]
+            print(",".join(str(values[column]) for column in columns), file=out)
+            used = end
+        del data[:used]  # Keep what may be the start of a record for the next read
+        out.flush()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,189 +1,922 @@
-/*
-  Project Name:              The Smart House
-  Sub-project Name:          Password Management
-  Developer Name:            Artem Tikhonov
-  Development Date:          11.04.2021
-  Development Time:          2:32am CEST
-  Description of the Code:   This code related to The Smart House project,
-                             contains the keypad code, the LCD, and system
-                             approvals interactions.
-*/
-
-//***********************************************   Headers and Libraries   ***********************************************//
-#include <Keypad.h>                  // For the Arduino Keypad
-#include <SoftwareSerial.h>          // For combinating the LCD's transmitter and receiver into one thing in the code
-                                     // The Serial LCD display from Parallax has 3 pins: GND, 5V and RX(transmitter and receiver)
-SoftwareSerial ParLCD(12, 11);       // Combining the LCD's transmitter and receiver into almost one thing
-                                     // in the code => ParLCD(RX,TX)
-
-//**************************************************   Global Variables   *************************************************//
-#define SensorPin A0                 // For the Soil Moisture Sensor
-
-//*********************************************   Machine States Explonation   ********************************************//
-/* The System has 4 states:
-
-    State 1: Entering the password. State cycling until the confirmation that
-             the password was entered.
-
-    Inside the function:
-    State 2: The password was entered and confirmed. The algorythm will compare
-             the entered password with the setted correct password.
-
-    State 3: The algorythm checked the entered password. Correct password - grant
-             access; Incorrect - the notification is going to be send to the LCD
-             display.
-
-    State 4: The access was granted. Now, it is going to be possible to change the
-             setted correct password.
-*/
-
-//**************************************************   Variables   ********************************************************//
-// Privacy management:
-int incorrect_password_attempts = 0; // Numnber of the incorrect password attempts
-
-float sensorValue = 0;               // For the Soil Moisture Sensor
-
-const String password = "1234";      // change your password here
-String input_password;
-
-// Arduino keypad's matrix (4x4):
-const byte ROWS = 4;                 // Number of the rows
-const byte COLS = 4;                 // Number of the columns
-
-char hexaKeys[ROWS][COLS] = {
-    {'1', '2', '3', 'A'},
-    {'4', '5', '6', 'B'},
-    {'7', '8', '9', 'C'},
-    {'*', '0', '#', 'D'}};
-
-// Keypad pins for the rows and columns of the keypad:
-byte rowPins[ROWS] = {10, 9, 8, 7};  // For rows
-byte colPins[COLS] = {6, 5, 4, 3};   // For columns
-
-Keypad keypad = Keypad(makeKeymap(hexaKeys), rowPins, colPins, ROWS, COLS);
-
-// LCD's commands (Dec => Action):
-int Move = 128;                      // Position 0 line 0 character
-int Empty = 12;                      // Empty buffer
-int LightOn = 17;                    // Light on the LCD
-int LightOff = 18;                   // Light off the LCD
-
-//**************************************************   Functions   ********************************************************//
-// State Handling
-EnterCheckPassword();
-
-//***********************************************    Arduino Setup   ******************************************************//
-void setup()
-{
-  ParLCD.begin(9600);                // Provide serial connection with the Arduino
-
-  input_password.reserve(32);        // Creating the maximum input characters (it is 33 here)
-
-  ParLCD.write(Empty);               // Clear buffer from the past actions
-
-  ParLCD.write(Move);
-  ParLCD.write(LightOn);             // Turn on the display light
-  ParLCD.print("      Hey!      Password please)"); // Print the greating text
-
-  delay(6000);
-
-  ParLCD.write(LightOff);            // Turn off the display light
-  ParLCD.write(Empty);               // Cleare the buffer after the past actions
-}
-
-//************************************************   Main Function   ******************************************************//
-void loop()
-{
-
-  //*************************************************   Variables   *******************************************************//
-  int machine_state = 1;             // State of the machine
-
-  bool run_program = true;           // Falg to run the program
-  bool grant_access = false;         // Flag when the access should be granted
-
-  //*********************************************   Start of the Loop   ***************************************************//
-  if (incorrect_password_attempts == 3)
-  {
-    ParLCD.write(Move);
-    ParLCD.write(LightOn);
-    ParLCD.print("  3rd Attempt!  Wait 30 seconds");
-
-    incorrect_password_attempts = 0;
-
-    delay(30000);
-
-    ParLCD.write(Move);
-    ParLCD.print("30 Seconds have      passed     ");
-    delay(3000);
-
-    ParLCD.write(LightOff);
-    ParLCD.write(Empty);
-  }
-
-  //*************************************************   1st State   *******************************************************//
-  while (run_program == true)
-  {
-    while (machine_state == 1)
-    {
-      EnterCheckPassword();
-    }
-  }
-}
-
-//*********************************************   State One Handling   ****************************************************//
-void EnterCheckPassword()
-{
-
-  char key = keypad.getKey();
-
-  if (key)
-  {
-    ParLCD.print('*');
-
-    if (key == 'D')
-    {
-      input_password = "";           // clear input password
-      ParLCD.write(Empty);
-    }
-    else if (key == 'A')
-    {
-      if (password == input_password)
-      {
-        ParLCD.write(Move);
-        ParLCD.write(LightOn);
-        ParLCD.print("Welcome, Artem!   :)   :)   :)  ");
-        ParLCD.print(sensorValue);
-        delay(10000);
-
-
-        for(int i = 0; i <= 100; i++){
-          sensorValue = sensorValue + analogRead(SensorPin);
-          delay(1);
-        }
-        
-        sensorValue = sensorValue/100.0;
-        ParLCD.print(sensorValue);
-        delay(30);
-        
-        
-        ParLCD.write(LightOff);
-        ParLCD.write(Empty);
-      }
-      else
-      {
-        ParLCD.write(Move);
-        ParLCD.write(LightOn);
-        ParLCD.print("Incorrect");
-        delay(10000);
-        ParLCD.write(LightOff);
-        ParLCD.write(Empty);
-      }
-
-      input_password = "";           // clear input password
-    }
-    else
-    {
-      input_password += key;         // append new character to input password string
-    }
-  }
-}
+/*
+  Project Name:              The Smart House
+  Sub-project Name:          Password Management
+  Developer Name:            Artem Tikhonov
+  Development Date:          11.04.2021
+  Development Time:          2:32am CEST
+  Description of the Code:   This code related to The Smart House project,
+                             contains the keypad code, the LCD, and system
+                             approvals interactions.
+*/
+
+//***********************************************   Headers and Libraries   ***********************************************//
+#include <avr/sleep.h>               // For idling the CPU between the interrupts
+#include <FastPin.h>                 // Pins as types, set and read straight through their port registers (Libraries/FastPin)
+                                     // The Serial LCD display from Parallax has 3 pins: GND, 5V and RX(transmitter and receiver)
+                                     // It only listens, so the Arduino only needs a transmitter for it. SoftwareSerial would
+                                     // take every pin change interrupt, the keypad needs the one of pins 0-7.
+const byte LcdTxPinNumber = 11;      // To the LCD's RX
+typedef OutputPin<LcdTxPinNumber> LcdTxPin;
+
+//**************************************************   Global Variables   *************************************************//
+#define SensorPin A0                 // For the Soil Moisture Sensor
+#define TemperaturePin A1            // For the Temperature Switch board
+#define SoundPin A2                  // For the Sound Switch board
+
+//*********************************************   Machine States Explonation   ********************************************//
+/* The System has 4 states:
+
+    State 1: Entering the password. State cycling until the confirmation that
+             the password was entered.
+
+    Inside the function:
+    State 2: The password was entered and confirmed. The algorythm will compare
+             the entered password with the setted correct password.
+
+    State 3: The algorythm checked the entered password. Correct password - grant
+             access; Incorrect - the notification is going to be send to the LCD
+             display.
+
+    State 4: The access was granted. Now, it is going to be possible to change the
+             setted correct password.
+
+   Every state is a row of the machine_states table: what to do when it is entered,
+   on every loop() pass and for every key, and after how long the machine moves on by
+   itself. loop() never waits, so the keypad is scanned the whole time a message is
+   shown or the system is locked out.
+
+   Keys: A confirms the password, D clears it. A key pressed while a message is shown
+   closes the message, and unless it is A or D it starts a new password. B while "Welcome" is shown changes
+   the password (State 4): type the new one, A saves it, D clears it, C cancels.
+   3 incorrect passwords in a row lock the keypad for 30 seconds.
+*/
+enum MachineState
+{
+  Greeting,                          // "Hey! Password please)" after the power on
+  EnterPassword,                     // State 1
+  CheckPassword,                     // State 2
+  AccessGranted,                     // State 3, the password is correct, shows the soil moisture
+  AccessDenied,                      // State 3, the password is incorrect
+  Lockout,                           //          3rd incorrect password in a row
+  LockoutEnded,
+  ChangePassword,                    // State 4
+  PasswordChanged
+};
+
+struct MachineStateInfo
+{
+  void (*enter)();                   // Once when the state is entered
+  void (*update)();                  // Every loop() pass
+  void (*key_pressed)(char key);     // For every key, NULL ignores the keys
+  unsigned long duration;            // ms until the machine goes to next by itself, 0 to stay
+  MachineState next;
+};
+
+//**************************************************   Variables   ********************************************************//
+// Privacy management:
+int incorrect_password_attempts = 0; // Numnber of the incorrect password attempts in a row
+
+
+const byte PASSWORD_MAX_LENGTH = 16; // As many stars as fit on a line of the LCD
+char password[PASSWORD_MAX_LENGTH + 1] = "1234"; // change your password here, or with State 4
+char input_password[PASSWORD_MAX_LENGTH + 1];
+byte input_length = 0;
+
+MachineState machine_state = Greeting; // State of the machine
+unsigned long state_entered_time = 0;  // millis() when the machine entered it
+
+// Arduino keypad's matrix (4x4):
+const byte ROWS = 4;                 // Number of the rows
+const byte COLS = 4;                 // Number of the columns
+
+char hexaKeys[ROWS][COLS] = {
+    {'1', '2', '3', 'A'},
+    {'4', '5', '6', 'B'},
+    {'7', '8', '9', 'C'},
+    {'*', '0', '#', 'D'}};
+
+// Keypad pins for the rows and columns of the keypad:
+const byte rowPins[ROWS] = {10, 9, 8, 7};  // For rows
+constexpr byte colPins[COLS] = {6, 5, 4, 3};   // For columns, all on PORTD: PCINT22-19
+
+// The keypad is scanned only when a key changes. The rows are driven LOW all the time and the columns pulled up, so pressing
+// a key pulls its column LOW and the pin change interrupt of the columns goes off, and releasing it does the same again.
+// KeypadDebounceTime ms after the last change the rows are driven one at a time to find the keys of the columns that are LOW.
+// A key pressed or released in a column another key already holds LOW changes no pin, so while any key is down the keypad is
+// also scanned every KeypadDebounceTime ms, and what such a scan finds only counts once the next one finds the same.
+// What changed goes into key_events with the time of the first change, KeyHold when a key stays down KeypadHoldTime ms.
+typedef InputPins<colPins[0], colPins[1], colPins[2], colPins[3]> KeypadColumnPins;
+const PortWord colBits[COLS] = {PinBit<colPins[0]>(), PinBit<colPins[1]>(), PinBit<colPins[2]>(), PinBit<colPins[3]>()};
+
+const unsigned long KeypadDebounceTime = 10; // ms the columns have to stay the same
+const unsigned long KeypadHoldTime = 500;
+
+enum KeyEventType
+{
+  KeyDown,
+  KeyUp,
+  KeyHold
+};
+
+struct KeyEvent
+{
+  char key;
+  KeyEventType type;
+  unsigned long time;                // millis()
+};
+
+const byte KEY_EVENT_AMOUNT = 16;    // Fast typing is 10 keys a second, loop() takes them out every ms
+KeyEvent key_events[KEY_EVENT_AMOUNT];
+byte key_event_first = 0;
+byte key_event_count = 0;
+
+volatile bool keypad_changed = false;     // A column changed since the last scan
+volatile unsigned long keypad_first_change = 0; // millis() of the first change since the last scan
+volatile unsigned long keypad_last_change = 0;
+unsigned int keys_down = 0;          // Bit row * COLS + col for every key that is down
+unsigned int keys_polled = 0;        // What the last scan found
+unsigned long keypad_scan_time = 0;  // millis() of the last scan
+unsigned int keys_held = 0;          // The ones KeyHold was sent for
+unsigned long keys_down_time[ROWS * COLS];
+
+// LCD's commands (Dec => Action):
+int Move = 128;                      // Position 0 line 0 character, line 1 starts at 148
+int Empty = 12;                      // Empty buffer
+int LightOn = 17;                    // Light on the LCD
+int LightOff = 18;                   // Light off the LCD
+
+// LCD's shadow framebuffer. The states draw into lcd_wanted and HandleLcd() sends the LCD only the moves and characters
+// that make lcd_glass, what it shows, the same, one byte each loop() pass. LcdWrite() keeps the interrupts off for the
+// whole byte, 1.04 ms at 9600 baud, so a full 32 character redraw in one go used to stop everything for ~35 ms.
+#define LCD_STATS 0                  // 1 prints the bytes and the blocked time of every screen update on Serial
+
+const byte LCD_ROWS = 2;
+const byte LCD_COLS = 16;
+const byte LCD_CELLS = LCD_ROWS * LCD_COLS;
+const int LcdLineStep = 20;          // Move + LcdLineStep is line 1
+const int LcdClearTime = 5;          // ms the LCD needs after Empty before it takes the next byte
+const int LcdClearBytes = 1 + LcdClearTime; // What Empty costs, counted in 1.04 ms bytes
+
+char lcd_wanted[LCD_CELLS];          // What the states want on the LCD, row by row
+char lcd_glass[LCD_CELLS];           // What is on it
+bool lcd_light_wanted = false;
+bool lcd_light_on = false;
+byte lcd_cursor = 0;                 // Cell the next character lands in
+unsigned long lcd_wait_start = 0;    // millis() of the last Empty
+
+struct LcdStats
+{
+  bool updating;                     // lcd_glass and lcd_wanted differ since the last byte sent
+  unsigned int bytes;                // Sent for the current update
+  unsigned long blocked;             // us spent in LcdWrite() for it
+};
+LcdStats lcd_stats = {false, 0, 0};
+
+// Analog sensors, sampled in the background. The ADC starts a conversion by itself at every Timer0 overflow, the one of
+// millis(), so 976 times a second, and its interrupt takes the channels in turn. oversampling conversions of a channel are
+// summed into one sample, and HandleSensors() keeps the last SENSOR_HISTORY samples of every channel with their mean and
+// median and an exponential filter of them. Reading any of those is a lookup. A sample is in ADC counts * oversampling,
+// SensorMean() and the others give counts (0-1023) again, with the extra bits oversampling brings after the point.
+enum SensorChannelName
+{
+  SoilMoistureChannel,
+  TemperatureChannel,
+  SoundChannel,
+  SENSOR_CHANNEL_AMOUNT
+};
+
+struct SensorChannel
+{
+  byte pin;                          // A0-A5
+  byte oversampling;                 // Conversions in a sample, at most 64
+  float smoothing;                   // Weight of a new sample in the exponential filter, 0-1
+};
+
+// The rows are in the order of enum SensorChannelName:
+const SensorChannel sensor_channels[SENSOR_CHANNEL_AMOUNT] = {
+//  pin             oversampling  smoothing
+  { SensorPin,      16,           0.1 },   // ~20 samples a second, soil moisture changes slowly
+  { TemperaturePin, 16,           0.1 },
+  { SoundPin,       4,            0.5 }    // ~80 samples a second
+};
+
+const byte SENSOR_HISTORY = 9;       // Samples kept, odd for the median
+
+struct SensorHistory
+{
+  unsigned int samples[SENSOR_HISTORY];
+  byte next;                         // Where the next sample goes
+  byte count;
+  unsigned long sum;                 // Of the samples kept
+  unsigned int median;
+  float filtered;
+};
+
+SensorHistory sensor_histories[SENSOR_CHANNEL_AMOUNT];
+
+volatile byte adc_channel = 0;       // Of the conversion running
+volatile byte adc_conversions[SENSOR_CHANNEL_AMOUNT]; // In the sample being summed
+volatile unsigned int adc_sums[SENSOR_CHANNEL_AMOUNT];
+volatile unsigned int adc_samples[SENSOR_CHANNEL_AMOUNT]; // The last whole one
+volatile byte adc_samples_ready = 0; // Bit per channel with a sample HandleSensors() didnt take yet
+
+//**************************************************   Functions   ********************************************************//
+// State Handling
+void EnterState(MachineState state);
+void ShowGreeting();
+void StartPasswordEntry();
+void HandlePasswordKey(char key);
+void CheckEnteredPassword();
+void ShowWelcome();
+void HandleWelcomeKey(char key);
+void ShowIncorrect();
+void ShowLockout();
+void ShowLockoutEnded();
+void StartPasswordChange();
+void HandleNewPasswordKey(char key);
+void ShowPasswordChanged();
+void DismissMessage(char key);
+
+// Keypad Handling
+void KeypadBegin();
+void HandleKeypad();
+unsigned int ScanKeypad();
+void AddKeyEvent(byte key_index, KeyEventType type, unsigned long time);
+bool GetKeyEvent(KeyEvent *event);
+void ClearInputPassword();
+void AddInputKey(char key);
+
+// Sensor Handling
+void SensorsBegin();
+void HandleSensors();
+float SensorMean(SensorChannelName channel);
+float SensorMedian(SensorChannelName channel);
+float SensorFiltered(SensorChannelName channel);
+
+// LCD Handling
+void ShowMessage(const char *text);
+void ClearDisplay();
+void ShowMoistureLine();
+void LcdBegin();
+void LcdClear();
+void LcdPrint(byte row, byte col, const char *text);
+void LcdSetLight(bool on);
+bool HandleLcd();
+byte LcdUpdateBytes(bool from_empty);
+void LcdSend(byte value);
+void LcdWrite(byte value);
+
+// The rows are in the order of enum MachineState:
+const MachineStateInfo machine_states[] = {
+//  enter                     update                 key_pressed         duration  next
+  { ShowGreeting,             NULL,                  DismissMessage,     6000,     EnterPassword   }, // Greeting
+  { StartPasswordEntry,       NULL,                  HandlePasswordKey,  0,        EnterPassword   }, // EnterPassword
+  { CheckEnteredPassword,     NULL,                  NULL,               0,        CheckPassword   }, // CheckPassword
+  { ShowWelcome,              ShowMoistureLine,      HandleWelcomeKey,   10000,    EnterPassword   }, // AccessGranted
+  { ShowIncorrect,            NULL,                  DismissMessage,     10000,    EnterPassword   }, // AccessDenied
+  { ShowLockout,              NULL,                  NULL,               30000,    LockoutEnded    }, // Lockout
+  { ShowLockoutEnded,         NULL,                  DismissMessage,     3000,     EnterPassword   }, // LockoutEnded
+  { StartPasswordChange,      NULL,                  HandleNewPasswordKey, 0,      ChangePassword  }, // ChangePassword
+  { ShowPasswordChanged,      NULL,                  DismissMessage,     3000,     EnterPassword   }  // PasswordChanged
+};
+
+//***********************************************    Arduino Setup   ******************************************************//
+void setup()
+{
+#if LCD_STATS
+  Serial.begin(115200);
+#endif
+
+  LcdBegin();                        // Provide serial connection with the Arduino and clear the LCD
+  KeypadBegin();
+  SensorsBegin();
+
+  EnterState(Greeting);              // Print the greating text
+}
+
+//************************************************   Main Function   ******************************************************//
+// One pass of the machine, returns right away: give the keys pressed to the state, run the state and move on if its time is
+// over. When the LCD is up to date too the CPU idles until the next interrupt, the millis() one comes every ms.
+void loop()
+{
+  HandleKeypad();
+  HandleSensors();
+
+  KeyEvent event;
+  while (GetKeyEvent(&event))
+  {
+    if (event.type == KeyDown && machine_states[machine_state].key_pressed != NULL)
+    {
+      machine_states[machine_state].key_pressed(event.key);
+    }
+  }
+
+  if (machine_states[machine_state].update != NULL)
+  {
+    machine_states[machine_state].update();
+  }
+
+  const MachineStateInfo &state = machine_states[machine_state];
+  if (state.duration != 0 && millis() - state_entered_time >= state.duration)
+  {
+    EnterState(state.next);
+  }
+
+  if (!HandleLcd())
+  {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+  }
+}
+
+//***********************************************   State Machine Handling   **********************************************//
+void EnterState(MachineState state)
+{
+  machine_state = state;
+  state_entered_time = millis();
+
+  if (machine_states[state].enter != NULL)
+  {
+    machine_states[state].enter();
+  }
+}
+
+// A key closes the message shown. A password key is the first key of a new password, A and D only close it.
+void DismissMessage(char key)
+{
+  EnterState(EnterPassword);
+  if (key != 'A' && key != 'D')
+  {
+    HandlePasswordKey(key);
+  }
+}
+
+void ShowGreeting()
+{
+  ShowMessage("      Hey!      Password please)");
+}
+
+//*********************************************   State One Handling   ****************************************************//
+void StartPasswordEntry()
+{
+  ClearInputPassword();
+  ClearDisplay();
+}
+
+void HandlePasswordKey(char key)
+{
+  if (key == 'D')
+  {
+    ClearInputPassword();
+    LcdClear();
+  }
+  else if (key == 'A')
+  {
+    // An empty password isnt an attempt.
+    if (input_length > 0)
+    {
+      EnterState(CheckPassword);
+    }
+  }
+  else
+  {
+    AddInputKey(key);
+    LcdPrint(0, input_length - 1, "*");
+  }
+}
+
+//*********************************************   State Two Handling   ****************************************************//
+void CheckEnteredPassword()
+{
+  if (strcmp(password, input_password) == 0)
+  {
+    incorrect_password_attempts = 0;
+    EnterState(AccessGranted);
+  }
+  else if (++incorrect_password_attempts == 3)
+  {
+    incorrect_password_attempts = 0;
+    EnterState(Lockout);
+  }
+  else
+  {
+    EnterState(AccessDenied);
+  }
+}
+
+//********************************************   State Three Handling   ***************************************************//
+void ShowWelcome()
+{
+  ShowMessage("Welcome, Artem!");
+  ShowMoistureLine();
+}
+
+void HandleWelcomeKey(char key)
+{
+  if (key == 'B')
+  {
+    EnterState(ChangePassword);
+  }
+  else
+  {
+    DismissMessage(key);
+  }
+}
+
+void ShowIncorrect()
+{
+  ShowMessage("Incorrect");
+}
+
+// The keys pressed during the lockout are scanned and thrown away.
+void ShowLockout()
+{
+  ShowMessage("  3rd Attempt!  Wait 30 seconds");
+}
+
+void ShowLockoutEnded()
+{
+  ShowMessage("30 Seconds have      passed     ");
+}
+
+//*********************************************   State Four Handling   ***************************************************//
+void StartPasswordChange()
+{
+  ClearInputPassword();
+  ShowMessage("  New password  ");
+}
+
+void HandleNewPasswordKey(char key)
+{
+  if (key == 'A')
+  {
+    if (input_length > 0)
+    {
+      strcpy(password, input_password);
+      EnterState(PasswordChanged);
+    }
+  }
+  else if (key == 'C')
+  {
+    EnterState(EnterPassword);
+  }
+  else if (key == 'D')
+  {
+    EnterState(ChangePassword);
+  }
+  else
+  {
+    AddInputKey(key);
+    LcdPrint(1, input_length - 1, "*");
+  }
+}
+
+void ShowPasswordChanged()
+{
+  ShowMessage("Password changed");
+}
+
+//**********************************************   Password Input Handling   **********************************************//
+void ClearInputPassword()
+{
+  input_length = 0;
+  input_password[0] = '\0';
+}
+
+// Keys past PASSWORD_MAX_LENGTH are ignored.
+void AddInputKey(char key)
+{
+  if (input_length < PASSWORD_MAX_LENGTH)
+  {
+    input_password[input_length++] = key;
+    input_password[input_length] = '\0';
+  }
+}
+
+//***********************************************   Keypad Handling   *****************************************************//
+void KeypadBegin()
+{
+  for (byte row = 0; row < ROWS; row++)
+  {
+    pinMode(rowPins[row], OUTPUT);
+    digitalWrite(rowPins[row], LOW);
+  }
+  KeypadColumnPins::Begin(INPUT_PULLUP);
+
+  for (byte col = 0; col < COLS; col++)
+  {
+    PCMSK2 |= colBits[col];          // PORTD bit n is PCINT16 + n
+  }
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+}
+
+ISR(PCINT2_vect)
+{
+  unsigned long now = millis();
+  if (!keypad_changed)
+  {
+    keypad_first_change = now;
+    keypad_changed = true;
+  }
+  keypad_last_change = now;
+}
+
+// Scans the keypad once it stopped bouncing and sends KeyHold for the keys down long enough.
+void HandleKeypad()
+{
+  unsigned long now = millis();
+
+  noInterrupts();
+  bool changed = keypad_changed;
+  bool scan = changed ? now - keypad_last_change >= KeypadDebounceTime
+                      : keys_down != 0 && now - keypad_scan_time >= KeypadDebounceTime;
+  unsigned long first_change = changed ? keypad_first_change : keypad_scan_time;
+  if (scan)
+  {
+    keypad_changed = false;          // A change during the scan sets it again and is scanned next time
+  }
+  interrupts();
+
+  if (scan)
+  {
+    unsigned int down = ScanKeypad();
+    keypad_scan_time = now;
+
+    // Without a pin change a key may still be bouncing, wait for the next scan to find the same.
+    bool settled = changed || down == keys_polled;
+    keys_polled = down;
+    if (!settled)
+    {
+      down = keys_down;
+    }
+
+    for (byte key_index = 0; key_index < ROWS * COLS; key_index++)
+    {
+      unsigned int bit = 1 << key_index;
+      if ((down & bit) && !(keys_down & bit))
+      {
+        AddKeyEvent(key_index, KeyDown, first_change);
+        keys_down_time[key_index] = first_change;
+      }
+      else if (!(down & bit) && (keys_down & bit))
+      {
+        AddKeyEvent(key_index, KeyUp, first_change);
+        keys_held &= ~bit;
+      }
+    }
+    keys_down = down;
+  }
+
+  for (unsigned int left = keys_down & ~keys_held; left != 0; left &= left - 1)
+  {
+    byte key_index = __builtin_ctz(left);
+    if (now - keys_down_time[key_index] >= KeypadHoldTime)
+    {
+      AddKeyEvent(key_index, KeyHold, now);
+      keys_held |= 1 << key_index;
+    }
+  }
+}
+
+// Bit row * COLS + col for every key down. Only the columns that are LOW with all rows driven have a key down, so only they
+// are looked at, and not at all when every key is up.
+unsigned int ScanKeypad()
+{
+  PortWord columns = ~KeypadColumnPins::Read() & KeypadColumnPins::List::Mask();
+  if (columns == 0)
+  {
+    return 0;
+  }
+
+  byte pcint_mask = PCMSK2;
+  PCMSK2 = 0;                        // The scan changes the columns itself
+
+  unsigned int down = 0;
+  for (byte row = 0; row < ROWS; row++)
+  {
+    for (byte other = 0; other < ROWS; other++)
+    {
+      pinMode(rowPins[other], other == row ? OUTPUT : INPUT);
+    }
+    delayMicroseconds(5);            // For the pull-ups to bring the columns of the other rows back up
+
+    PortWord low = ~KeypadColumnPins::Read() & columns;
+    for (byte col = 0; col < COLS; col++)
+    {
+      if (low & colBits[col])
+      {
+        down |= 1 << (row * COLS + col);
+      }
+    }
+  }
+
+  for (byte row = 0; row < ROWS; row++)
+  {
+    pinMode(rowPins[row], OUTPUT);   // Their PORT bit stayed 0, so LOW
+  }
+  delayMicroseconds(5);
+  PCIFR = _BV(PCIF2);
+  PCMSK2 = pcint_mask;
+  return down;
+}
+
+// A full ring drops the new event, loop() takes them out far quicker than keys can be pressed.
+void AddKeyEvent(byte key_index, KeyEventType type, unsigned long time)
+{
+  if (key_event_count == KEY_EVENT_AMOUNT)
+  {
+    return;
+  }
+
+  KeyEvent &event = key_events[(key_event_first + key_event_count) % KEY_EVENT_AMOUNT];
+  event.key = hexaKeys[key_index / COLS][key_index % COLS];
+  event.type = type;
+  event.time = time;
+  key_event_count++;
+}
+
+bool GetKeyEvent(KeyEvent *event)
+{
+  if (key_event_count == 0)
+  {
+    return false;
+  }
+
+  *event = key_events[key_event_first];
+  key_event_first = (key_event_first + 1) % KEY_EVENT_AMOUNT;
+  key_event_count--;
+  return true;
+}
+
+//***********************************************   Sensor Handling   *****************************************************//
+void SensorsBegin()
+{
+  for (byte channel = 0; channel < SENSOR_CHANNEL_AMOUNT; channel++)
+  {
+    DIDR0 |= _BV(sensor_channels[channel].pin - A0); // No digital input buffer on an analog pin
+  }
+
+  adc_channel = 0;
+  ADMUX = _BV(REFS0) | (sensor_channels[0].pin - A0); // AVcc as the reference
+  ADCSRB = _BV(ADTS2);               // Start on Timer0 overflow, its millis() interrupt clears the flag for the next one
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0); // 125 kHz ADC clock
+}
+
+// The next conversion starts at the next overflow, ~1 ms away, so the channel is switched long before it.
+ISR(ADC_vect)
+{
+  byte channel = adc_channel;
+  adc_sums[channel] += ADC;
+  if (++adc_conversions[channel] == sensor_channels[channel].oversampling)
+  {
+    adc_samples[channel] = adc_sums[channel];
+    adc_samples_ready |= 1 << channel;
+    adc_sums[channel] = 0;
+    adc_conversions[channel] = 0;
+  }
+
+  channel = (channel + 1) % SENSOR_CHANNEL_AMOUNT;
+  adc_channel = channel;
+  ADMUX = _BV(REFS0) | (sensor_channels[channel].pin - A0);
+}
+
+// Takes the new samples into the histories.
+void HandleSensors()
+{
+  for (byte channel = 0; channel < SENSOR_CHANNEL_AMOUNT; channel++)
+  {
+    noInterrupts();
+    bool ready = adc_samples_ready & (1 << channel);
+    unsigned int sample = adc_samples[channel];
+    adc_samples_ready &= ~(1 << channel);
+    interrupts();
+
+    if (!ready)
+    {
+      continue;
+    }
+
+    SensorHistory &history = sensor_histories[channel];
+    if (history.count == SENSOR_HISTORY)
+    {
+      history.sum -= history.samples[history.next];
+    }
+    else
+    {
+      history.count++;
+    }
+    history.samples[history.next] = sample;
+    history.next = (history.next + 1) % SENSOR_HISTORY;
+    history.sum += sample;
+
+    // Insertion sort of a copy, a few hundred cycles for 9 samples.
+    unsigned int sorted[SENSOR_HISTORY] = {0};
+    for (byte i = 0; i < history.count; i++)
+    {
+      byte j = i;
+      for (; j > 0 && sorted[j - 1] > history.samples[i]; j--)
+      {
+        sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = history.samples[i];
+    }
+    history.median = sorted[history.count / 2];
+
+    float smoothing = history.count == 1 ? 1 : sensor_channels[channel].smoothing;
+    history.filtered += smoothing * (sample - history.filtered);
+  }
+}
+
+// 0 before the first sample, ~50 ms after the start.
+float SensorMean(SensorChannelName channel)
+{
+  const SensorHistory &history = sensor_histories[channel];
+  if (history.count == 0)
+  {
+    return 0;
+  }
+  return (float)history.sum / history.count / sensor_channels[channel].oversampling;
+}
+
+float SensorMedian(SensorChannelName channel)
+{
+  return (float)sensor_histories[channel].median / sensor_channels[channel].oversampling;
+}
+
+float SensorFiltered(SensorChannelName channel)
+{
+  return sensor_histories[channel].filtered / sensor_channels[channel].oversampling;
+}
+
+//************************************************   LCD Handling   *******************************************************//
+void ShowMessage(const char *text)
+{
+  LcdClear();
+  LcdSetLight(true);
+  LcdPrint(0, 0, text);
+}
+
+void ClearDisplay()
+{
+  LcdClear();
+  LcdSetLight(false);
+}
+
+// Redrawn every pass while shown, the framebuffer only sends it when it changed. Whole counts, the decimals would change
+// all the time.
+void ShowMoistureLine()
+{
+  char value[8];
+  dtostrf(SensorFiltered(SoilMoistureChannel), 7, 0, value);
+  LcdPrint(1, 0, "Moisture:");
+  LcdPrint(1, 9, value);
+}
+
+void LcdBegin()
+{
+  LcdTxPin::Begin();
+  LcdTxPin::High();                  // Idle
+  LcdSend(LightOff);
+  LcdSend(Empty);                    // Clear buffer from the past actions
+  lcd_wait_start = millis();
+  memset(lcd_glass, ' ', LCD_CELLS);
+  memset(lcd_wanted, ' ', LCD_CELLS);
+  lcd_stats.updating = false;
+}
+
+void LcdClear()
+{
+  memset(lcd_wanted, ' ', LCD_CELLS);
+}
+
+// Like on the LCD, text going past the end of a line goes on at the start of the other one.
+void LcdPrint(byte row, byte col, const char *text)
+{
+  byte cell = (row * LCD_COLS + col) % LCD_CELLS;
+  for (byte i = 0; text[i] != '\0' && i < LCD_CELLS; i++)
+  {
+    lcd_wanted[cell] = text[i];
+    cell = (cell + 1) % LCD_CELLS;
+  }
+}
+
+void LcdSetLight(bool on)
+{
+  lcd_light_wanted = on;
+}
+
+// Sends one byte that brings the LCD closer to lcd_wanted. The cells are sent in order from the cursor, so a run of
+// changed cells costs one move and a byte each. Empty is sent instead when clearing and drawing the rest is shorter.
+// Returns false if the LCD is up to date or still clearing itself, as nothing was sent.
+bool HandleLcd()
+{
+  if (millis() - lcd_wait_start <= (unsigned long)LcdClearTime)
+  {
+    return false;                    // Still clearing
+  }
+
+  if (lcd_light_on != lcd_light_wanted)
+  {
+    LcdSend(lcd_light_wanted ? LightOn : LightOff);
+    lcd_light_on = lcd_light_wanted;
+    return true;
+  }
+
+  byte cell = lcd_cursor;
+  byte checked = 0;
+  while (checked < LCD_CELLS && lcd_glass[cell] == lcd_wanted[cell])
+  {
+    cell = (cell + 1) % LCD_CELLS;
+    checked++;
+  }
+
+  if (checked == LCD_CELLS)
+  {
+    if (lcd_stats.updating)
+    {
+#if LCD_STATS
+      Serial.print("LCD update: ");
+      Serial.print(lcd_stats.bytes);
+      Serial.print(" bytes, ");
+      Serial.print(lcd_stats.blocked);
+      Serial.println(" us blocked");
+#endif
+      lcd_stats.updating = false;
+    }
+    return false;
+  }
+
+  if (LcdUpdateBytes(false) > LcdClearBytes + LcdUpdateBytes(true))
+  {
+    LcdSend(Empty);
+    lcd_wait_start = millis();
+    memset(lcd_glass, ' ', LCD_CELLS);
+    lcd_cursor = 0;
+  }
+  else if (cell != lcd_cursor)
+  {
+    LcdSend(Move + (cell / LCD_COLS) * LcdLineStep + cell % LCD_COLS);
+    lcd_cursor = cell;
+  }
+  else
+  {
+    LcdSend(lcd_wanted[cell]);
+    lcd_glass[cell] = lcd_wanted[cell];
+    lcd_cursor = (cell + 1) % LCD_CELLS;
+  }
+  return true;
+}
+
+// Bytes HandleLcd() will send to get from lcd_glass, or from an empty LCD with the cursor at the start, to lcd_wanted.
+byte LcdUpdateBytes(bool from_empty)
+{
+  byte cursor = from_empty ? 0 : lcd_cursor;
+  byte bytes = 0;
+  for (byte i = 0; i < LCD_CELLS; i++)
+  {
+    byte cell = ((from_empty ? 0 : lcd_cursor) + i) % LCD_CELLS;
+    char shown = from_empty ? ' ' : lcd_glass[cell];
+    if (shown != lcd_wanted[cell])
+    {
+      bytes += cell == cursor ? 1 : 2;
+      cursor = (cell + 1) % LCD_CELLS;
+    }
+  }
+  return bytes;
+}
+
+void LcdSend(byte value)
+{
+  unsigned long start = micros();
+  LcdWrite(value);
+
+  if (!lcd_stats.updating)
+  {
+    lcd_stats.updating = true;
+    lcd_stats.bytes = 0;
+    lcd_stats.blocked = 0;
+  }
+  lcd_stats.bytes++;
+  lcd_stats.blocked += micros() - start;
+}
+
+// 9600 baud 8N1, bit-banged with the interrupts off so no bit gets longer. They are back on for the stop bit, it only has to
+// last at least a bit.
+void LcdWrite(byte value)
+{
+  const unsigned int bit_time = 104; // us, 1000000 / 9600
+
+  noInterrupts();
+  LcdTxPin::Low();                   // Start bit
+  delayMicroseconds(bit_time);
+  for (byte bit = 0; bit < 8; bit++)
+  {
+    LcdTxPin::Write(value & 1);
+    value >>= 1;
+    delayMicroseconds(bit_time);
+  }
+  LcdTxPin::High();                  // Stop bit
+  interrupts();
+  delayMicroseconds(bit_time);
+}
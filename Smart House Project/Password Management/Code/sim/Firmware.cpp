@@ -0,0 +1,45 @@
+//Compiles the sketch for the host. The Makefile turns PasswordManagement.ino into HOUSE_SKETCH first the way the Arduino IDE
+//does.
+#include HOUSE_SKETCH
+#include "Firmware.h"
+
+HousePins GetHousePins()
+{
+    return {{rowPins[0], rowPins[1], rowPins[2], rowPins[3]}, {colPins[0], colPins[1], colPins[2], colPins[3]}, LcdTxPinNumber,
+            SensorPin, TemperaturePin, SoundPin};
+}
+
+char KeyAt(int row, int column)
+{
+    return hexaKeys[row][column];
+}
+
+const char *TypedPassword()
+{
+    return input_password;
+}
+
+int IncorrectAttempts()
+{
+    return incorrect_password_attempts;
+}
+
+bool LockedOut()
+{
+    return machine_state == Lockout;
+}
+
+float SensorReadingMean(HouseSensor sensor)
+{
+    return SensorMean((SensorChannelName)sensor);
+}
+
+float SensorReadingMedian(HouseSensor sensor)
+{
+    return SensorMedian((SensorChannelName)sensor);
+}
+
+float SensorReadingFiltered(HouseSensor sensor)
+{
+    return SensorFiltered((SensorChannelName)sensor);
+}
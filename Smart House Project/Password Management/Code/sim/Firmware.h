@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+
+//What the benchmarks and tests get to see of the sketch compiled in Firmware.cpp.
+struct HousePins
+{
+    uint8_t rows[4];
+    uint8_t columns[4];
+    uint8_t lcdTx;
+    uint8_t soilMoisture;
+    uint8_t temperature;
+    uint8_t sound;
+};
+
+enum HouseSensor
+{
+    SoilMoistureSensor,
+    TemperatureSensor,
+    SoundSensor
+};
+
+HousePins GetHousePins();
+char KeyAt(int row, int column);
+const char *TypedPassword();        //What was typed of the password being entered
+int IncorrectAttempts();
+bool LockedOut();
+float SensorReadingMean(HouseSensor sensor);
+float SensorReadingMedian(HouseSensor sensor);
+float SensorReadingFiltered(HouseSensor sensor);
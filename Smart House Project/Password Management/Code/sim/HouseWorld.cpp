@@ -0,0 +1,248 @@
+#include <string.h>
+#include "Arduino.h"
+#include "HouseWorld.h"
+#include "Firmware.h"
+
+#define KEYPAD_SIZE 4
+#define LCD_COLUMNS 16
+#define LCD_CELLS 32
+#define LCD_CLEAR_TIME (5 * MS)
+#define LCD_BIT_TIME (1000000000ULL / 9600)
+#define BOUNCE_CHANGES 4
+
+//A closing or opening contact makes and breaks these many ns after it starts, then stays.
+static const uint64_t bounceTimes[BOUNCE_CHANGES] = {300 * US, 700 * US, 1500 * US, 2000 * US};
+
+struct AnalogSensor
+{
+    int level = 0;
+    int noise = 0;
+    int spikeEvery = 0;
+    int spikeSize = 0;
+};
+
+static HousePins pins;
+static bool keysDown[KEYPAD_SIZE][KEYPAD_SIZE];
+static uint32_t randomState = 12345;
+
+static char lcdGlass[LCD_CELLS];
+static int lcdCursor = 0;
+static bool lcdLight = false;
+static uint64_t lcdBusyUntil = 0;
+static bool lcdReceiving = false;
+static uint8_t lcdByte = 0;
+static LcdStats lcdStats;
+
+static AnalogSensor sensors[6];
+
+static uint32_t NextRandom()
+{
+    randomState = randomState * 1103515245 + 12345;
+    return randomState >> 8;
+}
+
+//A column is LOW when a key of it is down on a row that is an output driving LOW, the pull-up keeps it HIGH otherwise.
+static void UpdateColumns()
+{
+    for(int column = 0; column < KEYPAD_SIZE; column++)
+    {
+        int level = HIGH;
+        for(int row = 0; row < KEYPAD_SIZE; row++)
+        {
+            uint8_t rowPin = pins.rows[row];
+            if(keysDown[row][column] && SimPinIsOutput(rowPin) && SimPinLatch(rowPin) == LOW) level = LOW;
+        }
+        SimSetPin(pins.columns[column], level);
+    }
+}
+
+static bool FindKey(char key, int *row, int *column)
+{
+    for(*row = 0; *row < KEYPAD_SIZE; (*row)++)
+    {
+        for(*column = 0; *column < KEYPAD_SIZE; (*column)++)
+        {
+            if(KeyAt(*row, *column) == key) return true;
+        }
+    }
+    return false;
+}
+
+//The argument is the key index with the contact state it goes to in bit 8.
+static void ContactChanged(void *argument)
+{
+    intptr_t change = (intptr_t)argument;
+    int index = change & 0xFF;
+    keysDown[index / KEYPAD_SIZE][index % KEYPAD_SIZE] = change >> 8;
+    UpdateColumns();
+}
+
+static void SetKey(char key, bool down, bool bounce)
+{
+    int row, column;
+    if(!FindKey(key, &row, &column)) return;
+
+    intptr_t index = row * KEYPAD_SIZE + column;
+    keysDown[row][column] = down;
+    UpdateColumns();
+    if(!bounce) return;
+
+    bool level = down;
+    for(int i = 0; i < BOUNCE_CHANGES; i++)
+    {
+        level = !level;
+        if(i == BOUNCE_CHANGES - 1) level = down;
+        SimSchedule(SimNow() + bounceTimes[i], ContactChanged, (void *)(index | (intptr_t)level << 8));
+    }
+}
+
+void PressKey(char key, bool bounce)
+{
+    SetKey(key, true, bounce);
+}
+
+void ReleaseKey(char key, bool bounce)
+{
+    SetKey(key, false, bounce);
+}
+
+void TypeKeys(const char *keys, uint64_t hold, uint64_t gap)
+{
+    for(const char *key = keys; *key; key++)
+    {
+        PressKey(*key);
+        SimRunSketch(hold);
+        ReleaseKey(*key);
+        SimRunSketch(gap);
+    }
+}
+
+static void LcdReceived(uint8_t c)
+{
+    lcdStats.bytes++;
+    lcdStats.lastByteTime = SimNow();
+    if(SimNow() < lcdBusyUntil)
+    {
+        lcdStats.lostBytes++;
+        return;
+    }
+
+    if(c == 12)
+    {
+        memset(lcdGlass, ' ', LCD_CELLS);
+        lcdCursor = 0;
+        lcdBusyUntil = SimNow() + LCD_CLEAR_TIME;
+    }
+    else if(c == 17 || c == 18)
+    {
+        lcdLight = c == 17;
+    }
+    else if(c >= 128 && c < 128 + LCD_COLUMNS)
+    {
+        lcdCursor = c - 128;
+    }
+    else if(c >= 148 && c < 148 + LCD_COLUMNS)
+    {
+        lcdCursor = LCD_COLUMNS + c - 148;
+    }
+    else if(c >= 32 && c < 128)
+    {
+        lcdGlass[lcdCursor] = c;
+        lcdCursor = (lcdCursor + 1) % LCD_CELLS;
+    }
+}
+
+//Bit n of the frame is sampled in its middle: 0 the start bit, 1-8 the data, 9 the stop bit.
+static void LcdSampleBit(void *argument)
+{
+    intptr_t bit = (intptr_t)argument;
+    int level = SimGetPin(pins.lcdTx);
+
+    if(bit == 0 && level != LOW)
+    {
+        lcdReceiving = false; //A glitch, not a start bit
+        return;
+    }
+    if(bit >= 1 && bit <= 8) lcdByte |= level << (bit - 1);
+    if(bit == 9)
+    {
+        lcdReceiving = false;
+        if(level == HIGH) LcdReceived(lcdByte);
+        else lcdStats.framingErrors++;
+        return;
+    }
+    SimSchedule(SimNow() + LCD_BIT_TIME, LcdSampleBit, (void *)(bit + 1));
+}
+
+static void PinChanged(uint8_t pin, int level)
+{
+    if(pin == pins.lcdTx)
+    {
+        if(level == LOW && !lcdReceiving)
+        {
+            lcdReceiving = true;
+            lcdByte = 0;
+            SimSchedule(SimNow() + LCD_BIT_TIME / 2, LcdSampleBit, (void *)0);
+        }
+        return;
+    }
+    for(int row = 0; row < KEYPAD_SIZE; row++)
+    {
+        if(pin == pins.rows[row]) UpdateColumns();
+    }
+}
+
+static void PinModeChanged(uint8_t pin, uint8_t mode)
+{
+    UpdateColumns();
+}
+
+static int AnalogLevel(uint8_t pin)
+{
+    AnalogSensor &sensor = sensors[pin - A0];
+    int level = sensor.level;
+    if(sensor.noise > 0) level += (int)(NextRandom() % (2 * sensor.noise + 1)) - sensor.noise;
+    if(sensor.spikeEvery > 0 && NextRandom() % sensor.spikeEvery == 0) level += sensor.spikeSize;
+    return level;
+}
+
+void StartHouse()
+{
+    pins = GetHousePins();
+    memset(lcdGlass, ' ', LCD_CELLS);
+    SimSetPin(pins.lcdTx, HIGH);
+    SimSetPinHook(PinChanged);
+    SimSetPinModeHook(PinModeChanged);
+    SimSetAnalogInput(AnalogLevel);
+    UpdateColumns();
+}
+
+const char *LcdLine(int row)
+{
+    static char lines[2][LCD_COLUMNS + 1];
+    memcpy(lines[row], lcdGlass + row * LCD_COLUMNS, LCD_COLUMNS);
+    lines[row][LCD_COLUMNS] = '\0';
+    return lines[row];
+}
+
+bool LcdLight()
+{
+    return lcdLight;
+}
+
+LcdStats GetLcdStats()
+{
+    return lcdStats;
+}
+
+void SetSensor(uint8_t pin, int level, int noise)
+{
+    sensors[pin - A0].level = level;
+    sensors[pin - A0].noise = noise;
+}
+
+void SetSensorSpikes(uint8_t pin, int everyConversions, int size)
+{
+    sensors[pin - A0].spikeEvery = everyConversions;
+    sensors[pin - A0].spikeSize = size;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include "Sim.h"
+
+#define MS 1000000ULL
+#define US 1000ULL
+
+//What the sketch is wired to. The keypad is a 4x4 matrix: a key that is down connects its row to its column, so a column pin
+//with its pull-up reads LOW while a key of it is down on a row driven LOW. Contacts bounce for a few ms when they close and
+//open. The Parallax serial LCD takes 9600 baud 8N1 on its RX pin, samples each bit in its middle like a UART, ignores a start
+//bit that doesnt last half a bit and drops the bytes that come in while it is clearing itself. The sensors are voltages on the
+//analog pins, with noise and the odd spike.
+
+void StartHouse(); //Hooks the world up to the simulator, before the first SimRunSketch().
+
+//Keypad
+void PressKey(char key, bool bounce = true);
+void ReleaseKey(char key, bool bounce = true);
+void TypeKeys(const char *keys, uint64_t hold = 80 * MS, uint64_t gap = 150 * MS); //Presses and releases every key in turn, runs the sketch meanwhile.
+
+//LCD
+struct LcdStats
+{
+    uint64_t bytes = 0;             //Received
+    uint64_t lostBytes = 0;         //Came in while it was clearing
+    uint64_t framingErrors = 0;
+    uint64_t lastByteTime = 0;
+};
+const char *LcdLine(int row);       //What the line shows, 16 characters
+bool LcdLight();
+LcdStats GetLcdStats();
+
+//Sensors
+void SetSensor(uint8_t pin, int level, int noise = 0); //ADC counts, noise is the most a reading is off either way
+void SetSensorSpikes(uint8_t pin, int everyConversions, int size); //Every so many conversions on average a reading is size counts off
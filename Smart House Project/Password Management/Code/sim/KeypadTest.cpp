@@ -0,0 +1,85 @@
+//Types on the keypad with bouncing contacts and checks that every key counts once, also while the greeting is still being drawn,
+//and that keys held down together in the same column, which pull no pin by themselves, all count too. Then checks that A and D
+//only close a message and that A without a password is no attempt, so closing messages never locks the keypad out, while three
+//wrong passwords do.
+//Usage: KeypadTest
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "HouseWorld.h"
+#include "Firmware.h"
+
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+static bool Shows(int row, const char *text)
+{
+    return strncmp(LcdLine(row), text, strlen(text)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    StartHouse();
+    SimRunSketch(10 * MS);
+
+    printf("typing 1234 while the greeting is drawn\n");
+    TypeKeys("1234");
+    Check(strcmp(TypedPassword(), "1234") == 0, "every key counted once");
+    SimRunSketch(50 * MS);
+    Check(Shows(0, "****"), "a star for every key");
+    TypeKeys("A");
+    SimRunSketch(100 * MS);
+    Check(Shows(0, "Welcome, Artem!"), "password accepted");
+
+    printf("holding 1, 4 and 7 together, all in the first column\n");
+    TypeKeys("D");
+    PressKey('1');
+    SimRunSketch(100 * MS);
+    PressKey('4');
+    SimRunSketch(100 * MS);
+    PressKey('7');
+    SimRunSketch(100 * MS);
+    ReleaseKey('1');
+    SimRunSketch(100 * MS);
+    ReleaseKey('4');
+    SimRunSketch(100 * MS);
+    ReleaseKey('7');
+    SimRunSketch(100 * MS);
+    printf("  typed %s\n", TypedPassword());
+    Check(strcmp(TypedPassword(), "147") == 0, "every key of the column counted");
+
+    printf("closing messages with A and D\n");
+    TypeKeys("A");
+    SimRunSketch(100 * MS);
+    Check(Shows(0, "Incorrect") && IncorrectAttempts() == 1, "wrong password counted");
+    TypeKeys("A");
+    Check(!Shows(0, "Incorrect") && strcmp(TypedPassword(), "") == 0, "A closed the message and typed nothing");
+    TypeKeys("AAA");
+    SimRunSketch(100 * MS);
+    Check(IncorrectAttempts() == 1 && !Shows(0, "Incorrect"), "A without a password is no attempt");
+    TypeKeys("9A");
+    SimRunSketch(100 * MS);
+    TypeKeys("D");
+    Check(IncorrectAttempts() == 2 && strcmp(TypedPassword(), "") == 0, "D closed the message and typed nothing");
+
+    printf("third wrong password\n");
+    TypeKeys("5A");
+    SimRunSketch(100 * MS);
+    Check(LockedOut() && Shows(0, "  3rd Attempt!"), "keypad locked out");
+    char typed[20];
+    strcpy(typed, TypedPassword());
+    TypeKeys("1234A");
+    Check(LockedOut() && strcmp(TypedPassword(), typed) == 0 && Shows(0, "  3rd Attempt!"), "keys ignored during the lockout");
+
+    LcdStats lcd = GetLcdStats();
+    Check(lcd.lostBytes == 0 && lcd.framingErrors == 0, "LCD got every byte");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
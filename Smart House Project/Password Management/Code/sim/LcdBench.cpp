@@ -0,0 +1,70 @@
+//Goes through the screens of the sketch the way a user would and prints, for every screen update, the bytes sent to the LCD, the
+//longest loop() pass and the longest time the interrupts were off meanwhile. Every byte takes 1.04 ms at 9600 baud and keeps the
+//interrupts off for 9 of its 10 bits, so the longest pass is what the keypad and the sensors wait for at most.
+//Usage: LcdBench
+#include <stdio.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "HouseWorld.h"
+#include "Firmware.h"
+
+#define QUIET_TIME (100 * MS)       //The LCD is up to date once nothing was sent for this long
+#define KEY_HOLD (80 * MS)
+
+static HousePins pins;
+
+//Runs the action, then the sketch until the LCD is up to date, and prints what the update took.
+static void Measure(const char *name, void (*action)())
+{
+    LcdStats before = GetLcdStats();
+    simStats.loopDuration = SimHistogram();
+    simStats.interruptsOff = SimHistogram();
+    action();
+
+    uint64_t done = SimNow();
+    while(true)
+    {
+        LcdStats now = GetLcdStats();
+        uint64_t last = now.bytes != before.bytes && now.lastByteTime > done ? now.lastByteTime : done;
+        if(SimNow() - last >= QUIET_TIME) break;
+        SimRunSketch(1 * MS);
+    }
+
+    LcdStats after = GetLcdStats();
+    printf("%-28s %4llu bytes, longest loop() %.2f ms, interrupts off %.2f ms\n", name,
+           (unsigned long long)(after.bytes - before.bytes), simStats.loopDuration.Max() / 1e6, simStats.interruptsOff.Max() / 1e6);
+    printf("%28s |%s|%s|\n", "", LcdLine(0), LcdLine(1));
+}
+
+static void Press(char key)
+{
+    PressKey(key);
+    SimRunSketch(KEY_HOLD);
+    ReleaseKey(key);
+}
+
+int main(int argc, char **argv)
+{
+    pins = GetHousePins();
+    SetSensor(pins.soilMoisture, 500, 3);
+    StartHouse();
+
+    Measure("greeting after power on", [] { SimRunSketch(1 * MS); });
+    Measure("key closing the greeting", [] { Press('1'); });
+    Measure("star of the next key", [] { Press('2'); });
+    Measure("star of the next key", [] { Press('3'); });
+    Measure("star of the next key", [] { Press('4'); });
+    Measure("D clearing the password", [] { Press('D'); });
+    Measure("wrong password", [] { Press('9'); SimRunSketch(QUIET_TIME); Press('A'); });
+    Measure("A closing the message", [] { Press('A'); });
+    Measure("right password", [] { Press('1'); Press('2'); Press('3'); Press('4'); SimRunSketch(QUIET_TIME); Press('A'); });
+    Measure("moisture 500 to 600", [] { SetSensor(pins.soilMoisture, 600, 3); SimRunSketch(3000 * MS); });
+    Measure("welcome timing out", [] { SimRunSketch(10000 * MS); });
+    Measure("B on welcome, new password", [] { Press('1'); Press('2'); Press('3'); Press('4'); Press('A'); SimRunSketch(QUIET_TIME); Press('B'); });
+    Measure("new password saved", [] { Press('5'); Press('6'); Press('7'); Press('8'); Press('A'); });
+
+    LcdStats lcd = GetLcdStats();
+    printf("%llu bytes in all, %llu lost while the LCD was clearing, %llu framing errors\n", (unsigned long long)lcd.bytes,
+           (unsigned long long)lcd.lostBytes, (unsigned long long)lcd.framingErrors);
+    return lcd.lostBytes == 0 && lcd.framingErrors == 0 ? 0 : 1;
+}
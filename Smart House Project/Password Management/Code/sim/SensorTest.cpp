@@ -0,0 +1,70 @@
+//Feeds the sensors a noisy soil moisture reading with the odd spike, a steady temperature and loud random sound, and checks that
+//the ADC converts at every Timer0 overflow by itself, that the median leaves the spikes out and the filter follows a change, and
+//that the welcome screen shows the filtered moisture. loop() must never wait for a conversion.
+//Usage: SensorTest
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Arduino.h"
+#include "Sim.h"
+#include "HouseWorld.h"
+#include "Firmware.h"
+
+#define SOIL 500
+#define SOIL_NOISE 10
+#define SOIL_AFTER 700
+#define TEMPERATURE 300
+#define OVERFLOWS_PER_SECOND 976.5625
+#define TYPICAL_LOOP_TIME (100 * US) //Reading the 3 channels with analogRead() would take 336 us
+
+static bool passed = true;
+
+static void Check(bool condition, const char *description)
+{
+    printf("  %-60s %s\n", description, condition ? "ok" : "FAILED");
+    passed &= condition;
+}
+
+int main(int argc, char **argv)
+{
+    HousePins pins = GetHousePins();
+    SetSensor(pins.soilMoisture, SOIL, SOIL_NOISE);
+    SetSensorSpikes(pins.soilMoisture, 100, 400);
+    SetSensor(pins.temperature, TEMPERATURE);
+    SetSensor(pins.sound, 512, 511);
+    StartHouse();
+
+    printf("2 seconds of sensor readings\n");
+    SimRunSketch(2000 * MS);
+    double conversionsPerSecond = simStats.adcConversions / (SimNow() / 1e9);
+    float mean = SensorReadingMean(SoilMoistureSensor);
+    float median = SensorReadingMedian(SoilMoistureSensor);
+    float filtered = SensorReadingFiltered(SoilMoistureSensor);
+    printf("  %.1f conversions a second, soil mean %.2f median %.2f filtered %.2f, temperature %.2f\n", conversionsPerSecond, mean,
+           median, filtered, SensorReadingMedian(TemperatureSensor));
+    Check(fabs(conversionsPerSecond - OVERFLOWS_PER_SECOND) < 5, "a conversion every Timer0 overflow");
+    Check(fabs(median - SOIL) < 3, "median leaves the spikes out");
+    Check(fabs(mean - SOIL) < 10 && fabs(filtered - SOIL) < 10, "mean and filter near the reading");
+    Check(SensorReadingMedian(TemperatureSensor) == TEMPERATURE, "steady temperature read exactly");
+    Check(SensorReadingMean(SoundSensor) > 200 && SensorReadingMean(SoundSensor) < 800, "sound channel read too");
+
+    printf("soil moisture going to %d\n", SOIL_AFTER);
+    SetSensor(pins.soilMoisture, SOIL_AFTER, SOIL_NOISE);
+    SimRunSketch(2000 * MS);
+    filtered = SensorReadingFiltered(SoilMoistureSensor);
+    printf("  filtered %.2f 2 s later\n", filtered);
+    Check(fabs(filtered - SOIL_AFTER) < 10, "filter followed the change");
+
+    TypeKeys("1234A");
+    SimRunSketch(200 * MS);
+    printf("  LCD: |%s|\n", LcdLine(1));
+    int shown = 0;
+    Check(sscanf(LcdLine(1), "Moisture: %d", &shown) == 1 && abs(shown - SOIL_AFTER) < 10, "welcome screen shows the moisture");
+
+    printf("  loop() pass median %.0f us, longest %.2f ms\n", simStats.loopDuration.Percentile(50) / 1e3, simStats.loopDuration.Max() / 1e6);
+    Check(simStats.loopDuration.Percentile(50) < TYPICAL_LOOP_TIME, "loop() never waited for a conversion");
+
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#!/bin/bash
+#Turns the sketch into C++ the way the Arduino IDE does: Arduino.h first and every function declared before the first one.
+#Usage: Sketch.sh sketch.ino > sketch.cpp
+sketch="$1"
+text=$(tr -d '\r' < "$sketch") || exit 1
+
+function='^[A-Za-z_][A-Za-z0-9_ ]* \**[A-Za-z_][A-Za-z0-9_]*\([^;]*\) *\{?$'
+prototypes=$(grep -E "$function" <<< "$text" | sed -E 's/ *\{?$/;/')
+
+echo '#include "Arduino.h"'
+echo "#line 1 \"$sketch\""
+awk -v pattern="$function" -v prototypes="$prototypes" -v sketch="$sketch" '
+    !declared && $0 ~ pattern { print prototypes; print "#line " NR " \"" sketch "\""; declared = 1 }
+    { print }' <<< "$text"
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//Host stand-in for the Arduino AVR core on an Uno. Every call ends up in the simulator (Sim.h) which charges its cost in
+//simulated time.
+#include "HardwareSerial.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+//The core has these as macros that take any two types, templates do the same without breaking std::min and std::max.
+template<typename A, typename B> inline auto min(A a, B b) { return a < b ? a : b; }
+template<typename A, typename B> inline auto max(A a, B b) { return a < b ? b : a; }
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void noInterrupts();
+void interrupts();
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *text);
+
+#define _BV(bit) (1 << (bit))
+
+//The I/O port registers, for code that skips digitalWrite() and digitalRead(). Port B is pins 8-13, C is A0-A5 and D is 0-7.
+//Writing PORTx sets what the output pins of the port drive, reading it gives that back. Reading PINx gives the level of every
+//pin of the port and writing it toggles the output pins whose bits are 1. DDRx is only stored, pinMode() sets the direction.
+class SimPortRegister
+{
+public:
+    SimPortRegister(uint8_t firstPin, uint8_t pinAmount, bool input) : firstPin(firstPin), pinAmount(pinAmount), input(input) {}
+    SimPortRegister &operator=(uint8_t value);
+    SimPortRegister &operator|=(uint8_t bits) { return *this = *this | bits; }
+    SimPortRegister &operator&=(uint8_t bits) { return *this = *this & bits; }
+    operator uint8_t() const;
+
+private:
+    uint8_t firstPin;
+    uint8_t pinAmount;
+    bool input;
+};
+
+extern SimPortRegister PORTB, PORTC, PORTD;
+extern SimPortRegister PINB, PINC, PIND;
+extern volatile uint8_t DDRB, DDRC, DDRD;
+
+//An interrupt flag register: writing a 1 to a bit clears it, like on the AVR.
+class SimFlagRegister
+{
+public:
+    SimFlagRegister &operator=(uint8_t bits) { flags &= ~bits; return *this; }
+    operator uint8_t() const { return flags; }
+    void Raise(uint8_t bits) { flags |= bits; }
+
+private:
+    uint8_t flags = 0;
+};
+
+//Pin change interrupt 2, pins 0-7 (PCINT16-23). Bit n of PCMSK2 is pin n.
+extern volatile uint8_t PCICR;
+extern SimFlagRegister PCIFR;
+extern volatile uint8_t PCMSK2;
+#define PCIE2 2
+#define PCIF2 2
+
+//The ADC. Only free running off a trigger source with the conversion complete interrupt is simulated, and of the trigger
+//sources only Timer0 overflow. ADMUX selects the channel when the conversion starts.
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint8_t DIDR0;
+extern volatile uint16_t ADC;
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+
+#define ISR(vector, ...) extern "C" void vector()
+extern "C" void PCINT2_vect();
+extern "C" void ADC_vect();
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//UART0. write() puts bytes in a 64 byte ring the data register empty interrupt takes them out of at the baud rate, and waits
+//while the ring is full, like the AVR core.
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    void flush();
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    int availableForWrite();
+
+    size_t print(const char text[]);
+    size_t print(long number);
+    size_t println(const char text[]);
+    size_t println(long number);
+    size_t println();
+
+    int available() { return 0; }
+    int read() { return -1; }
+
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
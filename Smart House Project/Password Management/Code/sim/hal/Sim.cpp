@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <queue>
+#include <vector>
+#include "Arduino.h"
+#include "avr/sleep.h"
+#include "Sim.h"
+
+#define TIMER0_OVERFLOW_TIME 1024000 //ns, 256 counts of 4us
+#define ADC_CONVERSION_CLOCKS 13
+#define ADC_TRIGGER_TIMER0_OVERFLOW 4 //ADTS2:0 in ADCSRB
+
+SimCosts simCosts;
+SimStats simStats;
+HardwareSerial Serial;
+
+SimPortRegister PORTB(8, 6, false);
+SimPortRegister PORTC(A0, 6, false);
+SimPortRegister PORTD(0, 8, false);
+SimPortRegister PINB(8, 6, true);
+SimPortRegister PINC(A0, 6, true);
+SimPortRegister PIND(0, 8, true);
+volatile uint8_t DDRB = 0;
+volatile uint8_t DDRC = 0;
+volatile uint8_t DDRD = 0;
+
+volatile uint8_t PCICR = 0;
+SimFlagRegister PCIFR;
+volatile uint8_t PCMSK2 = 0;
+
+volatile uint8_t ADMUX = 0;
+volatile uint8_t ADCSRA = 0;
+volatile uint8_t ADCSRB = 0;
+volatile uint8_t DIDR0 = 0;
+volatile uint16_t ADC = 0;
+
+void setup();
+void loop();
+
+struct HardwareEvent
+{
+    uint64_t time;
+    uint64_t sequence;
+    void (*handler)(void *argument);
+    void *argument;
+
+    bool operator>(const HardwareEvent &other) const
+    {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+static uint64_t now = 0;
+static std::priority_queue<HardwareEvent, std::vector<HardwareEvent>, std::greater<HardwareEvent>> events;
+static uint64_t nextEventSequence = 0;
+static std::vector<void (*)()> pendingInterrupts; //In the order they were raised
+static bool interruptsEnabled = true;
+static bool inInterrupt = false;
+static uint64_t interruptsOffSince = 0;
+static bool stopRequested = false;
+static bool sketchStarted = false;
+
+static uint8_t pinLevels[SIM_PIN_COUNT];
+static bool pinOutputs[SIM_PIN_COUNT];
+static uint8_t pinLatches[SIM_PIN_COUNT];   //What PORTx holds for the pin
+static bool pinChange2Pending = false;
+static void (*pinHook)(uint8_t pin, int level) = NULL;
+static void (*pinModeHook)(uint8_t pin, uint8_t mode) = NULL;
+static int (*analogInput)(uint8_t pin) = NULL;
+static void (*serialHook)(uint8_t c) = NULL;
+
+static bool adcConverting = false;
+static uint16_t adcResult = 0;
+
+static uint8_t serialRing[SIM_SERIAL_BUFFER_SIZE];
+static int serialHead = 0;
+static int serialCount = 0;
+static bool serialSending = false;
+static uint64_t serialByteTime = 10000000000ULL / 9600; //10 bits a byte
+
+static void RunInterrupts()
+{
+    while(interruptsEnabled && !inInterrupt && !pendingInterrupts.empty())
+    {
+        void (*handler)() = pendingInterrupts.front();
+        pendingInterrupts.erase(pendingInterrupts.begin());
+
+        uint64_t start = now;
+        inInterrupt = true;
+        SimCharge(simCosts.interruptEntry);
+        handler();
+        SimCharge(simCosts.interruptExit);
+        inInterrupt = false;
+        simStats.interrupts++;
+        simStats.interruptTime += now - start;
+    }
+}
+
+uint64_t SimNow()
+{
+    return now;
+}
+
+//Hardware events that become due inside the charged time run at their own time, and the interrupts they raise push the rest of
+//the charged work back.
+void SimCharge(uint64_t ns)
+{
+    uint64_t left = ns;
+    while(!events.empty() && events.top().time <= now + left)
+    {
+        HardwareEvent event = events.top();
+        events.pop();
+        if(event.time > now)
+        {
+            left -= event.time - now;
+            now = event.time;
+        }
+        event.handler(event.argument);
+        RunInterrupts();
+    }
+    now += left;
+}
+
+void SimSchedule(uint64_t time, void (*handler)(void *argument), void *argument)
+{
+    events.push({time, nextEventSequence++, handler, argument});
+}
+
+void SimRaiseInterrupt(void (*handler)())
+{
+    pendingInterrupts.push_back(handler);
+}
+
+extern "C" __attribute__((weak)) void PCINT2_vect()
+{
+}
+
+extern "C" __attribute__((weak)) void ADC_vect()
+{
+}
+
+//The ADC conversion complete interrupt. The flag is cleared as the interrupt starts.
+static void AdcInterrupt()
+{
+    ADCSRA &= ~_BV(ADIF);
+    ADC_vect();
+}
+
+static void AdcConversionDone(void *argument)
+{
+    adcConverting = false;
+    ADC = adcResult;
+    ADCSRA |= _BV(ADIF);
+    simStats.adcConversions++;
+    if(ADCSRA & _BV(ADIE)) SimRaiseInterrupt(AdcInterrupt);
+}
+
+//The input is sampled as the conversion starts, the result comes ADC_CONVERSION_CLOCKS ADC clocks later.
+static void StartAdcConversion()
+{
+    if(adcConverting) return;
+
+    int prescaler = 1 << (ADCSRA & 0x07);
+    if(prescaler == 1) prescaler = 2;
+    uint8_t pin = A0 + (ADMUX & 0x0F);
+    int level = analogInput != NULL && pin < A0 + 6 ? analogInput(pin) : 0;
+
+    adcConverting = true;
+    adcResult = constrain(level, 0, 1023);
+    SimSchedule(now + (uint64_t)ADC_CONVERSION_CLOCKS * prescaler * 1000 / SIM_CPU_MHZ, AdcConversionDone, NULL);
+}
+
+//Timer0 keeps millis() going, which costs the sketch a little every 1.024ms.
+static void Timer0Interrupt()
+{
+    SimCharge(simCosts.timer0Interrupt);
+}
+
+static void Timer0Overflow(void *argument)
+{
+    SimRaiseInterrupt(Timer0Interrupt);
+
+    bool autoTrigger = (ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE));
+    if(autoTrigger && (ADCSRB & 0x07) == ADC_TRIGGER_TIMER0_OVERFLOW) StartAdcConversion();
+
+    SimSchedule(SimNow() + TIMER0_OVERFLOW_TIME, Timer0Overflow, NULL);
+}
+
+//Pin change interrupt 2. The sketch clearing PCIF2 before it runs takes it back, like on the AVR.
+static void PinChange2Interrupt()
+{
+    pinChange2Pending = false;
+    if(!(PCIFR & _BV(PCIF2))) return;
+    PCIFR = _BV(PCIF2);
+    PCINT2_vect();
+}
+
+static void PinChanged(uint8_t pin)
+{
+    if(pin >= 8 || !(PCMSK2 & _BV(pin))) return;
+
+    PCIFR.Raise(_BV(PCIF2));
+    if((PCICR & _BV(PCIE2)) && !pinChange2Pending)
+    {
+        pinChange2Pending = true;
+        SimRaiseInterrupt(PinChange2Interrupt);
+    }
+}
+
+void SimRunSketch(uint64_t duration)
+{
+    uint64_t end = now + duration;
+    stopRequested = false;
+
+    if(!sketchStarted)
+    {
+        sketchStarted = true;
+        SimSchedule(now + TIMER0_OVERFLOW_TIME, Timer0Overflow, NULL);
+        setup();
+    }
+
+    while(!stopRequested && now < end)
+    {
+        uint64_t start = now;
+        uint64_t slept = simStats.sleepTime;
+        SimCharge(simCosts.loopOverhead);
+        loop();
+        simStats.loopDuration.Record(now - start - (simStats.sleepTime - slept));
+        simStats.loopIterations++;
+    }
+}
+
+void SimStop()
+{
+    stopRequested = true;
+}
+
+static void DrivePin(uint8_t pin, uint8_t level)
+{
+    if(pinLevels[pin] == level) return;
+    pinLevels[pin] = level;
+    PinChanged(pin);
+    if(pinHook != NULL) pinHook(pin, level);
+}
+
+static void WritePin(uint8_t pin, uint8_t level)
+{
+    pinLatches[pin] = level;
+    if(pinOutputs[pin]) DrivePin(pin, level);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    SimCharge(simCosts.pinMode);
+    if(pin >= SIM_PIN_COUNT) return;
+
+    pinOutputs[pin] = mode == OUTPUT;
+    if(mode != OUTPUT) pinLatches[pin] = mode == INPUT_PULLUP ? HIGH : LOW; //The PORTx bit turns the pull-up on
+    else DrivePin(pin, pinLatches[pin]);
+    if(pinModeHook != NULL) pinModeHook(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    SimCharge(simCosts.digitalWrite);
+    if(pin >= SIM_PIN_COUNT) return;
+    WritePin(pin, value ? HIGH : LOW);
+}
+
+int digitalRead(uint8_t pin)
+{
+    SimCharge(simCosts.digitalRead);
+    if(pin >= SIM_PIN_COUNT) return LOW;
+    return pinLevels[pin];
+}
+
+SimPortRegister &SimPortRegister::operator=(uint8_t value)
+{
+    SimCharge(simCosts.portRegister);
+    for(int bit = 0; bit < pinAmount; bit++)
+    {
+        uint8_t pin = firstPin + bit;
+        uint8_t level = input ? pinLatches[pin] ^ ((value >> bit) & 1) : (value >> bit) & 1;
+        if(level != pinLatches[pin]) WritePin(pin, level);
+    }
+    return *this;
+}
+
+SimPortRegister::operator uint8_t() const
+{
+    SimCharge(simCosts.portRegister);
+    uint8_t value = 0;
+    for(int bit = 0; bit < pinAmount; bit++)
+    {
+        uint8_t pin = firstPin + bit;
+        if(input ? pinLevels[pin] : pinLatches[pin]) value |= 1 << bit;
+    }
+    return value;
+}
+
+unsigned long millis()
+{
+    SimCharge(simCosts.timeRead);
+    return now / 1000000;
+}
+
+unsigned long micros()
+{
+    SimCharge(simCosts.timeRead);
+    return now / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    SimCharge((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    SimCharge((uint64_t)us * 1000);
+}
+
+void noInterrupts()
+{
+    if(interruptsEnabled && !inInterrupt) interruptsOffSince = now;
+    interruptsEnabled = false;
+}
+
+void interrupts()
+{
+    if(!interruptsEnabled && !inInterrupt) simStats.interruptsOff.Record(now - interruptsOffSince);
+    interruptsEnabled = true;
+    RunInterrupts();
+}
+
+void set_sleep_mode(int mode)
+{
+}
+
+//Nothing runs until the next hardware event raises an interrupt. With the interrupts off the AVR would sleep for good, here
+//it returns.
+void sleep_mode()
+{
+    if(!interruptsEnabled || inInterrupt) return;
+
+    uint64_t start = now;
+    while(pendingInterrupts.empty() && !events.empty())
+    {
+        HardwareEvent event = events.top();
+        events.pop();
+        if(event.time > now) now = event.time;
+        event.handler(event.argument);
+    }
+    simStats.sleepTime += now - start;
+    SimCharge(simCosts.sleepWake);
+    RunInterrupts();
+}
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *text)
+{
+    SimCharge(simCosts.formatNumber);
+    sprintf(text, "%*.*f", width, precision, value);
+    return text;
+}
+
+void SimSetPin(uint8_t pin, int level)
+{
+    if(pin >= SIM_PIN_COUNT || pinOutputs[pin]) return;
+    DrivePin(pin, level ? HIGH : LOW);
+}
+
+int SimGetPin(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+bool SimPinIsOutput(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT && pinOutputs[pin];
+}
+
+int SimPinLatch(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLatches[pin] : LOW;
+}
+
+void SimSetPinHook(void (*hook)(uint8_t pin, int level))
+{
+    pinHook = hook;
+}
+
+void SimSetPinModeHook(void (*hook)(uint8_t pin, uint8_t mode))
+{
+    pinModeHook = hook;
+}
+
+void SimSetAnalogInput(int (*input)(uint8_t pin))
+{
+    analogInput = input;
+}
+
+void SimSetSerialHook(void (*hook)(uint8_t c))
+{
+    serialHook = hook;
+}
+
+//The data register empty interrupt moving the next byte out.
+static void SerialInterrupt()
+{
+    SimCharge(simCosts.serialInterrupt);
+}
+
+static void SerialByteSent(void *argument)
+{
+    uint8_t c = serialRing[serialHead];
+    serialHead = (serialHead + 1) % SIM_SERIAL_BUFFER_SIZE;
+    serialCount--;
+    simStats.serialBytes++;
+    if(serialHook != NULL) serialHook(c);
+
+    SimRaiseInterrupt(SerialInterrupt);
+    serialSending = serialCount > 0;
+    if(serialSending) SimSchedule(SimNow() + serialByteTime, SerialByteSent, NULL);
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    serialByteTime = 10000000000ULL / baud;
+}
+
+void HardwareSerial::flush()
+{
+    while(serialCount > 0) SimCharge(1000);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    SimCharge(simCosts.serialByte);
+    while(serialCount >= SIM_SERIAL_BUFFER_SIZE - 1) SimCharge(1000);
+
+    serialRing[(serialHead + serialCount) % SIM_SERIAL_BUFFER_SIZE] = c;
+    serialCount++;
+    if(!serialSending)
+    {
+        serialSending = true;
+        SimSchedule(now + serialByteTime, SerialByteSent, NULL);
+    }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    for(size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return SIM_SERIAL_BUFFER_SIZE - 1 - serialCount;
+}
+
+size_t HardwareSerial::print(const char text[])
+{
+    return write((const uint8_t *)text, strlen(text));
+}
+
+size_t HardwareSerial::print(long number)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", number);
+    return print(text);
+}
+
+size_t HardwareSerial::println(const char text[])
+{
+    return print(text) + println();
+}
+
+size_t HardwareSerial::println(long number)
+{
+    return print(number) + println();
+}
+
+size_t HardwareSerial::println()
+{
+    return print("\r\n");
+}
+
+static int BucketIndex(uint64_t value)
+{
+    if(value < 64) return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (int)((value >> (msb - 5)) & 31);
+    return 64 + (msb - 6) * 32 + sub;
+}
+
+static uint64_t BucketValue(int index)
+{
+    if(index < 64) return index;
+
+    int msb = (index - 64) / 32 + 6;
+    uint64_t sub = (index - 64) % 32;
+    return (1ULL << msb) | (sub << (msb - 5));
+}
+
+void SimHistogram::Record(uint64_t value)
+{
+    buckets[BucketIndex(value)]++;
+    count++;
+    if(value > maximum) maximum = value;
+}
+
+uint64_t SimHistogram::Percentile(double percent) const
+{
+    if(count == 0) return 0;
+
+    uint64_t target = (uint64_t)(percent / 100.0 * count + 0.5);
+    if(target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if(seen >= target) return std::min(BucketValue(i), maximum);
+    }
+    return maximum;
+}
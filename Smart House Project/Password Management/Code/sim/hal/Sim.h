@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+
+//Host simulator sitting underneath the Arduino Uno stand-in headers in this folder.
+//Time is simulated in nanoseconds. The sketch only moves it forward through the cost of the Arduino calls it makes (SimCosts),
+//through delays and by sleeping until the next interrupt, so every figure a benchmark prints is simulated ATmega328P time, not
+//host time.
+//Hardware (timers, the ADC, the UART, the outside world) runs as events at their exact time. An event can raise an interrupt,
+//which runs as soon as interrupts are enabled and no other one is running, like on the AVR.
+
+#define SIM_CPU_MHZ 16
+#define SIM_PIN_COUNT 20
+#define SIM_SERIAL_BUFFER_SIZE 64 //HardwareSerial's TX ring, one slot is always left empty
+
+//Cost of each Arduino call in nanoseconds. Rough figures for the Arduino AVR core at 16MHz.
+struct SimCosts
+{
+    uint32_t digitalRead = 3500;
+    uint32_t digitalWrite = 4000;
+    uint32_t pinMode = 4000;
+    uint32_t portRegister = 62;           //Reading or writing PORTx or PINx is one cycle, an sbi/cbi both
+    uint32_t timeRead = 1500;             //millis() & micros(), interrupts off while the counters are copied
+    uint32_t serialByte = 5000;           //HardwareSerial::write() putting one byte in the TX ring
+    uint32_t interruptEntry = 2500;       //Pushing the registers and dispatching
+    uint32_t interruptExit = 1500;
+    uint32_t timer0Interrupt = 5000;      //The millis() overflow interrupt every 1.024ms
+    uint32_t serialInterrupt = 5000;      //The UART data register empty interrupt moving the next byte out
+    uint32_t loopOverhead = 1000;         //main() around each loop() call, serialEventRun()
+    uint32_t sleepWake = 375;             //Waking up from idle, 6 cycles
+    uint32_t formatNumber = 60000;        //dtostrf(), soft float on the AVR
+};
+extern SimCosts simCosts;
+
+//Log-linear histogram (32 sub buckets per power of two, ~3% resolution) so hot paths can be recorded without allocating.
+class SimHistogram
+{
+public:
+    void Record(uint64_t value);
+    uint64_t Percentile(double percent) const;
+    uint64_t Max() const { return maximum; }
+    uint64_t Count() const { return count; }
+
+private:
+    static const int BUCKET_COUNT = 64 + 58 * 32;
+    uint64_t buckets[BUCKET_COUNT] = {};
+    uint64_t count = 0;
+    uint64_t maximum = 0;
+};
+
+struct SimStats
+{
+    uint64_t loopIterations = 0;
+    SimHistogram loopDuration;      //Each loop() call, interrupts in it included, sleeping not
+    SimHistogram interruptsOff;     //Each stretch the sketch kept the interrupts off
+    uint64_t interrupts = 0;
+    uint64_t interruptTime = 0;
+    uint64_t sleepTime = 0;         //In sleep_mode()
+    uint64_t adcConversions = 0;
+    uint64_t serialBytes = 0;
+};
+extern SimStats simStats;
+
+//Time
+uint64_t SimNow();
+void SimCharge(uint64_t ns);        //CPU time used by the running code. Runs the hardware events and interrupts that become due.
+void SimSchedule(uint64_t time, void (*handler)(void *argument), void *argument); //A hardware event, runs even with interrupts off.
+void SimRaiseInterrupt(void (*handler)()); //From a hardware event. Runs once interrupts are on.
+
+//The sketch
+void SimRunSketch(uint64_t duration); //setup() the first time, then loop() until the duration passed or SimStop() was called.
+void SimStop();
+
+//The outside world
+void SimSetPin(uint8_t pin, int level); //Drive an input pin. Raises the pin change interrupt of the pin, if it is enabled.
+int SimGetPin(uint8_t pin);
+bool SimPinIsOutput(uint8_t pin);
+int SimPinLatch(uint8_t pin);       //What PORTx holds for the pin: the level it drives as an output
+void SimSetPinHook(void (*hook)(uint8_t pin, int level)); //Called for every level an output pin changes to.
+void SimSetPinModeHook(void (*hook)(uint8_t pin, uint8_t mode)); //Called for every pinMode().
+void SimSetAnalogInput(int (*input)(uint8_t pin)); //Gives the ADC the voltage of an analog pin, 0-1023, when a conversion starts.
+void SimSetSerialHook(void (*hook)(uint8_t c)); //Called for every byte as it leaves the UART.
@@ -0,0 +1,7 @@
+#pragma once
+
+//Only idle is simulated: the CPU stops until the next interrupt, the timers and the ADC go on.
+#define SLEEP_MODE_IDLE 0
+
+void set_sleep_mode(int mode);
+void sleep_mode();